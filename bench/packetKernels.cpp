@@ -0,0 +1,114 @@
+// Microbenchmark for the packet kernels in src/atmosphere/packetKernels.hpp.
+// Reports rays per second for the ray-sphere intersection and values per
+// second for exp on every instruction set the CPU supports, together with
+// how far each one is from the reference results.
+
+#include <algorithm>
+#include <atmosphere/packetKernels.hpp>
+#include <chrono>
+#include <cmath>
+#include <fmt/format.h>
+#include <random>
+#include <vector>
+
+// Large enough to not fit in L2, like a row batch of a big frame
+const size_t COUNT = 1 << 20;
+const double MIN_BENCHMARK_SECONDS = 0.5;
+
+// Runs `body` until MIN_BENCHMARK_SECONDS have passed and returns the number
+// of calls per second
+template <typename Body> static double callsPerSecond(Body body) {
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point start = Clock::now();
+  int calls = 0;
+  double elapsed = 0.0;
+  do {
+    body();
+    calls++;
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  } while (elapsed < MIN_BENCHMARK_SECONDS);
+  return calls / elapsed;
+}
+
+int main() {
+  // Rays from around the atmosphere shell of the default scene towards
+  // random points near the planet, so that most of them hit
+  std::mt19937 random(1234);
+  std::uniform_real_distribution<float> position(-20.0f, 20.0f);
+  std::uniform_real_distribution<float> target(-12.0f, 12.0f);
+
+  std::vector<float> origin[3], direction[3];
+  for (int axis = 0; axis < 3; axis++) {
+    origin[axis].resize(COUNT);
+    direction[axis].resize(COUNT);
+  }
+  for (size_t i = 0; i < COUNT; i++) {
+    for (int axis = 0; axis < 3; axis++) {
+      origin[axis][i] = position(random);
+      direction[axis][i] = target(random) - origin[axis][i];
+    }
+  }
+  RayPackets rays = {origin[0].data(),    origin[1].data(),
+                     origin[2].data(),    direction[0].data(),
+                     direction[1].data(), direction[2].data(),
+                     COUNT};
+  PacketSphere sphere = {0.0f, 0.0f, 0.0f, 10.25f};
+
+  // Exponents covering what the scattering code feeds to exp, and beyond
+  std::uniform_real_distribution<float> exponent(-87.0f, 88.0f);
+  std::vector<float> exponents(COUNT);
+  for (float &x : exponents) {
+    x = exponent(random);
+  }
+
+  std::vector<float> referenceNear(COUNT), referenceFar(COUNT);
+  intersectSphereScalar(rays, sphere, referenceNear.data(),
+                        referenceFar.data());
+
+  std::vector<float> near(COUNT), far(COUNT), values(COUNT);
+
+  fmt::print("{:<8} {:>5} {:>14} {:>14} {:>16} {:>14}\n", "ISA", "width",
+             "Mrays/s", "Mexp/s", "intersect error", "exp error");
+
+  for (PacketISA isa : {PacketISA::Scalar, PacketISA::SSE, PacketISA::AVX2,
+                        PacketISA::AVX512}) {
+    const PacketKernels *kernels = packetKernelsFor(isa);
+    if (!kernels) {
+      continue;
+    }
+
+    double raysPerSecond = COUNT * callsPerSecond([&] {
+                             kernels->intersectSphere(rays, sphere, near.data(),
+                                                      far.data());
+                           });
+    double expsPerSecond = COUNT * callsPerSecond([&] {
+                             kernels->exp(exponents.data(), values.data(),
+                                          COUNT);
+                           });
+
+    // Largest difference to the scalar kernel, relative to the distance
+    float intersectError = 0.0f;
+    for (size_t i = 0; i < COUNT; i++) {
+      float scale = std::max(std::abs(referenceFar[i]), 1.0f);
+      intersectError =
+          std::max({intersectError,
+                    std::abs(near[i] - referenceNear[i]) / scale,
+                    std::abs(far[i] - referenceFar[i]) / scale});
+    }
+
+    // Largest error relative to the standard library, in double precision
+    double expError = 0.0;
+    for (size_t i = 0; i < COUNT; i++) {
+      double reference = std::exp((double)exponents[i]);
+      expError =
+          std::max(expError, std::abs(values[i] - reference) / reference);
+    }
+
+    fmt::print("{:<8} {:>5} {:>14.1f} {:>14.1f} {:>16.2e} {:>14.2e}\n",
+               kernels->name, kernels->width, raysPerSecond / 1e6,
+               expsPerSecond / 1e6, intersectError, expError);
+  }
+
+  fmt::print("\nSelected at runtime: {}\n", packetKernels().name);
+  return 0;
+}
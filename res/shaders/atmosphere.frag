@@ -1,25 +1,85 @@
 #version 430 core
 
 in layout(location = 0) vec4 position;
+flat in layout(location = 3) int body;
 
 out vec4 color;
 
-uniform float planetRadius;
-uniform float atmosphereRadius;
-uniform vec3 planetPosition;
 uniform vec3 cameraPosition;
 uniform vec3 sunDirection;
-uniform vec3 waveLengths;
 uniform int nSamples;
 uniform float fSamples;
-uniform float Kr;
-uniform float Km;
-uniform float ESun;
-uniform float g;
-uniform float scaleDepth;
 uniform bool enabledAtmosphere;
+uniform bool useOpticalDepthTable;
+uniform bool adaptiveSampling;
+// Samples per shell depth of path length when sampling adaptively
+uniform float sampleDensity;
+// Optical depth from the Chapman function, which needs fewer samples
+uniform bool useChapmanFunction;
+uniform int chapmanSamples;
+uniform bool usePrecomputedScattering;
+// Size of the scattering tables as (nu, muS, mu, r)
+uniform ivec4 scatteringTableSize;
 
 const float PI = 3.14159;
+const float SCATTERING_MU_S_MIN = -0.2;
+const int MAX_SPECTRAL_GROUPS = 4;
+
+uniform bool spectralScattering;
+uniform int spectralGroups;
+// Per wavelength bin constants, four bins per element. See
+// atmosphere/spectrum.hpp.
+uniform vec4 spectralRayleigh[MAX_SPECTRAL_GROUPS];
+uniform vec4 spectralExtinction[MAX_SPECTRAL_GROUPS];
+uniform mat4x3 spectralToRGB[MAX_SPECTRAL_GROUPS];
+
+layout(binding = 1) uniform sampler2D opticalDepthTable;
+layout(binding = 2) uniform sampler2D transmittanceTable;
+layout(binding = 3) uniform sampler3D singleScatteringTable;
+layout(binding = 4) uniform sampler3D multipleScatteringTable;
+
+// Every planet and moon, see bodies.hpp. The constants of the body being
+// drawn are copied into the globals below by loadBody().
+struct Body {
+  mat4 model;
+  float planetRadius;
+  float atmosphereRadius;
+  float Kr;
+  float Km;
+  float ESun;
+  float g;
+  float scaleDepth;
+  uint flags;
+  vec3 invWaveLength;
+};
+layout(std430, binding = 0) readonly buffer Bodies { Body bodies[]; };
+// The scattering tables and wavelength bins were made for the body
+const uint BODY_USES_TABLES = 1u;
+
+float planetRadius;
+float atmosphereRadius;
+vec3 planetPosition;
+vec3 invWaveLength;
+float Kr;
+float Km;
+float ESun;
+float g;
+float scaleDepth;
+bool bodyUsesTables;
+
+void loadBody() {
+  Body b = bodies[body];
+  planetRadius = b.planetRadius;
+  atmosphereRadius = b.atmosphereRadius;
+  planetPosition = b.model[3].xyz;
+  invWaveLength = b.invWaveLength;
+  Kr = b.Kr;
+  Km = b.Km;
+  ESun = b.ESun;
+  g = b.g;
+  scaleDepth = b.scaleDepth;
+  bodyUsesTables = (b.flags & BODY_USES_TABLES) != 0u;
+}
 
 float raySphereIntersect(vec3 r0, vec3 rd, vec3 s0, float sr) {
     float a = dot(rd, rd);
@@ -39,18 +99,301 @@ float raySphereIntersect(vec3 r0, vec3 rd, vec3 s0, float sr) {
     return (c < 0.0) ? t2 : t1;
 }
 
+// Looks up (density, distance to the edge of the atmosphere) for a point at
+// the normalised height h, looking in a direction whose angle to the up vector
+// has the given cosine. The table is baked by atmosphere/opticalDepth.cpp.
+vec2 opticalDepth(float h, float cosAngle) {
+  vec2 size = vec2(textureSize(opticalDepthTable, 0));
+  vec2 uv = (vec2(h, cosAngle * 0.5 + 0.5) * (size - 1.0) + 0.5) / size;
+  vec2 texel = texture(opticalDepthTable, uv).xy;
+  return vec2(texel.x, texel.y * (atmosphereRadius - planetRadius));
+}
+
+// Precomputed scattering, see atmosphere/precomputedScattering.hpp for the
+// layout of the tables. Lengths are in world units, and directions are
+// described by their cosine to the up vector (mu), to the sun (nu), and the
+// cosine between the sun and the up vector (muS).
+float distanceToTopBoundary(float r, float mu) {
+  float discriminant = r*r * (mu*mu - 1.0) + atmosphereRadius*atmosphereRadius;
+  return max(-r*mu + sqrt(max(discriminant, 0.0)), 0.0);
+}
+
+bool rayIntersectsGround(float r, float mu) {
+  return mu < 0.0 && r*r * (mu*mu - 1.0) + planetRadius*planetRadius >= 0.0;
+}
+
+float textureCoordFromUnitRange(float x, int size) {
+  return 0.5 / float(size) + x * (1.0 - 1.0 / float(size));
+}
+
+float miePhase(float nu) {
+  float theta = -nu;
+  return 1.5 * ((1.0 - g*g) / (2.0 + g*g)) * (1.0 + theta*theta) / pow(1.0 + g*g - 2.0*g*theta, 1.5);
+}
+
+// Transmittance to the top of the atmosphere in rgb, optical depth in a
+vec4 transmittanceLookup(float r, float mu) {
+  float horizon = sqrt(atmosphereRadius*atmosphereRadius - planetRadius*planetRadius);
+  float rho = sqrt(max(r*r - planetRadius*planetRadius, 0.0));
+  float d = distanceToTopBoundary(r, mu);
+  float dMin = atmosphereRadius - r;
+  float dMax = rho + horizon;
+  ivec2 size = textureSize(transmittanceTable, 0);
+  vec2 uv = vec2(textureCoordFromUnitRange((d - dMin) / (dMax - dMin), size.x),
+                 textureCoordFromUnitRange(rho / horizon, size.y));
+  return texture(transmittanceTable, uv);
+}
+
+// Transmittance over the distance d along a ray
+vec3 transmittanceBetween(float r, float mu, float d, bool groundHit, vec3 extinction) {
+  float rD = clamp(sqrt(d*d + 2.0*r*mu*d + r*r), planetRadius, atmosphereRadius);
+  float muD = clamp((r*mu + d) / rD, -1.0, 1.0);
+  float depth = groundHit
+      ? transmittanceLookup(rD, -muD).a - transmittanceLookup(r, -mu).a
+      : transmittanceLookup(r, mu).a - transmittanceLookup(rD, muD).a;
+  return exp(-max(depth, 0.0) * extinction);
+}
+
+vec3 transmittanceToSun(float r, float muS) {
+  return rayIntersectsGround(r, muS) ? vec3(0.0) : transmittanceLookup(r, muS).rgb;
+}
+
+vec3 scatteringLookup(sampler3D table, float r, float mu, float muS, float nu, bool groundHit) {
+  float horizon = sqrt(atmosphereRadius*atmosphereRadius - planetRadius*planetRadius);
+  float rho = sqrt(max(r*r - planetRadius*planetRadius, 0.0));
+  float uR = textureCoordFromUnitRange(rho / horizon, scatteringTableSize.w);
+
+  float rMu = r * mu;
+  float discriminant = rMu*rMu - r*r + planetRadius*planetRadius;
+  float uMu;
+  if (groundHit) {
+    float d = -rMu - sqrt(max(discriminant, 0.0));
+    float dMin = r - planetRadius;
+    float dMax = rho;
+    uMu = 0.5 - 0.5 * textureCoordFromUnitRange(dMax == dMin ? 0.0 : (d - dMin) / (dMax - dMin), scatteringTableSize.z / 2);
+  } else {
+    float d = -rMu + sqrt(max(discriminant + horizon*horizon, 0.0));
+    float dMin = atmosphereRadius - r;
+    float dMax = rho + horizon;
+    uMu = 0.5 + 0.5 * textureCoordFromUnitRange((d - dMin) / (dMax - dMin), scatteringTableSize.z / 2);
+  }
+
+  float dMin = atmosphereRadius - planetRadius;
+  float dMax = horizon;
+  float alpha = (distanceToTopBoundary(planetRadius, muS) - dMin) / (dMax - dMin);
+  float A = (distanceToTopBoundary(planetRadius, SCATTERING_MU_S_MIN) - dMin) / (dMax - dMin);
+  float uMuS = textureCoordFromUnitRange(max(1.0 - alpha / A, 0.0) / (1.0 + alpha), scatteringTableSize.y);
+
+  // The nu slices are packed side by side and blended by hand
+  float texCoordX = (nu + 1.0) / 2.0 * float(scatteringTableSize.x - 1);
+  float texX = floor(texCoordX);
+  float lerp = texCoordX - texX;
+  vec3 uvw0 = vec3((texX + uMuS) / float(scatteringTableSize.x), uMu, uR);
+  vec3 uvw1 = vec3((texX + 1.0 + uMuS) / float(scatteringTableSize.x), uMu, uR);
+  return mix(texture(table, uvw0).rgb, texture(table, uvw1).rgb, lerp);
+}
+
+// Light scattered towards the camera along the view ray, before ESun
+vec3 scatteringRadiance(float r, float mu, float muS, float nu, bool groundHit, vec3 invWaveLength) {
+  vec3 single = scatteringLookup(singleScatteringTable, r, mu, muS, nu, groundHit);
+  vec3 multiple = scatteringLookup(multipleScatteringTable, r, mu, muS, nu, groundHit);
+  return single * (invWaveLength * Kr + Km * miePhase(nu)) + multiple;
+}
+
+// Camera position relative to the planet, moved to where the view ray enters
+// the atmosphere if it is outside
+vec3 atmosphereEntry(vec3 ray) {
+  vec3 x = cameraPosition - planetPosition;
+  if (length(x) > atmosphereRadius) {
+    x += ray * max(raySphereIntersect(cameraPosition, ray, planetPosition, atmosphereRadius), 0.0);
+  }
+  return x;
+}
+
+// Part of the ray in the planet's shadow, which is the cylinder the planet
+// casts away from the sun, as distances along the ray clamped to [0, far].
+// Rays that stay lit get (far, far).
+vec2 shadowInterval(vec3 start, vec3 ray, float far) {
+  vec3 fromCenter = start - planetPosition;
+  float k = dot(fromCenter, sunDirection);
+  float m = dot(ray, sunDirection);
+  vec3 fromAxis = fromCenter - k * sunDirection;
+  vec3 rayAcross = ray - m * sunDirection;
+
+  float a = dot(rayAcross, rayAcross);
+  float b = dot(fromAxis, rayAcross);
+  float c = dot(fromAxis, fromAxis) - planetRadius * planetRadius;
+  float enter = -1e30;
+  float exit = 1e30;
+  if (a > 1e-8) {
+    float discriminant = b*b - a*c;
+    if (discriminant <= 0.0) {
+      return vec2(far);
+    }
+    enter = (-b - sqrt(discriminant)) / a;
+    exit = (-b + sqrt(discriminant)) / a;
+  } else if (c >= 0.0) {
+    return vec2(far);
+  }
+
+  // Only the half of the cylinder behind the planet
+  if (m > 1e-8) {
+    exit = min(exit, -k / m);
+  } else if (m < -1e-8) {
+    enter = max(enter, -k / m);
+  } else if (k >= 0.0) {
+    return vec2(far);
+  }
+
+  enter = clamp(enter, 0.0, far);
+  exit = clamp(exit, 0.0, far);
+  return enter < exit ? vec2(enter, exit) : vec2(far);
+}
+
+// Distance along the ray of the point `d` into its lit part
+float litDistance(vec2 shadow, float d) {
+  return d < shadow.x ? d : d + (shadow.y - shadow.x);
+}
+
+// Optical depth, in world units at ground density, from a point `height`
+// above the ground to the edge of an unbounded exponential atmosphere, looking
+// in a direction with the given cosine to the up vector. Schüler's
+// approximation of the Chapman function, from "An Approximation to the
+// Chapman Grazing-Incidence Function for Atmospheric Scattering" (GPU Pro 3).
+float chapman(float height, float cosZenith) {
+  float scaleHeight = scaleDepth * (atmosphereRadius - planetRadius);
+  float X = planetRadius / scaleHeight;
+  float h = max(height, 0.0) / scaleHeight;
+  float c = sqrt(X + h);
+  if (cosZenith >= 0.0) {
+    return scaleHeight * c / (c * cosZenith + 1.0) * exp(-h);
+  }
+  float x0 = sqrt(1.0 - cosZenith * cosZenith) * (X + h);
+  float c0 = sqrt(x0);
+  return scaleHeight * (2.0 * c0 * exp(X - x0) - c / (1.0 - c * cosZenith) * exp(-h));
+}
+
+// Optical depth between two points on a ray. Rays that hit the ground are
+// measured in the opposite direction, which does not.
+float chapmanSegment(vec3 from, vec3 to, vec3 ray, bool groundHit) {
+  vec3 a = from - planetPosition;
+  vec3 b = to - planetPosition;
+  float ra = length(a);
+  float rb = length(b);
+  if (groundHit) {
+    return max(chapman(rb - planetRadius, -dot(b, ray) / rb) - chapman(ra - planetRadius, -dot(a, ray) / ra), 0.0);
+  }
+  return max(chapman(ra - planetRadius, dot(a, ray) / ra) - chapman(rb - planetRadius, dot(b, ray) / rb), 0.0);
+}
+
+// Adaptive marching. The lit part of the ray is split where it passes closest
+// to the planet, so the height changes monotonically along every segment, and
+// the samples of each segment are spread by an exponential fitted to the
+// density at its ends. The number of samples follows the lit length of the
+// ray through the shell.
+struct MarchSegment {
+  float start;
+  float length;
+  float rate;
+  float mass;
+  int samples;
+};
+
+float marchHeight(vec3 point) {
+  return max(length(point - planetPosition) - planetRadius, 0.0) / (atmosphereRadius - planetRadius);
+}
+
+MarchSegment marchSegment(vec3 start, vec3 ray, float from, float to) {
+  MarchSegment s;
+  s.start = from;
+  s.length = to - from;
+  s.rate = 0.0;
+  s.mass = 0.0;
+  s.samples = 0;
+  if (s.length > 0.0) {
+    float h0 = marchHeight(start + ray * from);
+    float h1 = marchHeight(start + ray * to);
+    s.rate = clamp((h0 - h1) / (scaleDepth * s.length), -80.0 / s.length, 80.0 / s.length);
+
+    // Integral of the fitted density along the segment
+    float x = s.rate * s.length;
+    s.mass = exp(-h0 / scaleDepth) * (abs(x) < 1e-3 ? s.length : (exp(x) - 1.0) / s.rate);
+  }
+  return s;
+}
+
+int planMarch(vec3 start, vec3 ray, float far, vec2 shadow, out MarchSegment segments[4]) {
+  float closest = clamp(-dot(start - planetPosition, ray), 0.0, far);
+  float beforeShadow = min(closest, shadow.x);
+  float afterShadow = max(closest, shadow.y);
+  segments[0] = marchSegment(start, ray, 0.0, beforeShadow);
+  segments[1] = marchSegment(start, ray, beforeShadow, shadow.x);
+  segments[2] = marchSegment(start, ray, shadow.y, afterShadow);
+  segments[3] = marchSegment(start, ray, afterShadow, far);
+
+  float totalMass = 0.0;
+  for (int k = 0; k < 4; k++) {
+    totalMass += segments[k].mass;
+  }
+
+  float litLength = far - (shadow.y - shadow.x);
+  int total = min(int(ceil(sampleDensity * litLength / (atmosphereRadius - planetRadius))), nSamples);
+  int sampleCount = 0;
+  for (int k = 0; k < 4; k++) {
+    if (segments[k].length > 0.0) {
+      segments[k].samples = max(int(round(float(total) * segments[k].mass / max(totalMass, 1e-20))), 1);
+      sampleCount += segments[k].samples;
+    }
+  }
+  return sampleCount;
+}
+
+// Inverse of the cumulative density along a segment, for u in [0, 1]
+float marchDistance(MarchSegment s, float u) {
+  float x = s.rate * s.length;
+  return abs(x) < 1e-3 ? u * s.length : log(1.0 + u * (exp(x) - 1.0)) / s.rate;
+}
+
+// Distance along the ray and length of sample i. Every sample covers an equal
+// share of the segment's density, and sits in the middle of it.
+vec2 marchSample(MarchSegment segments[4], int i) {
+  int k = 0;
+  while (k < 3 && i >= segments[k].samples) {
+    i -= segments[k].samples;
+    k++;
+  }
+  MarchSegment s = segments[k];
+  float j = float(i);
+  float n = float(s.samples);
+
+  float t0 = marchDistance(s, j / n);
+  float t1 = marchDistance(s, (j + 1.0) / n);
+  return vec2(s.start + marchDistance(s, (j + 0.5) / n), t1 - t0);
+}
+
 void main() {
+  loadBody();
+
   if (!enabledAtmosphere) {
     color = vec4(0.0f);
     return;
   }
 
-  vec3 invWaveLength = vec3(1.0 / pow(waveLengths.x, 4), 1.0 / pow(waveLengths.y, 4), 1.0 / pow(waveLengths.z, 4));
 
   vec3 ray = position.xyz - cameraPosition;
   float far = length(ray);
   ray /= far;
 
+  if (usePrecomputedScattering && bodyUsesTables) {
+    vec3 x = atmosphereEntry(ray);
+    float r = clamp(length(x), planetRadius, atmosphereRadius);
+    float mu = dot(x, ray) / r;
+    color.rgb = ESun * scatteringRadiance(r, mu, dot(x, sunDirection) / r, dot(ray, sunDirection),
+                                          rayIntersectsGround(r, mu), invWaveLength);
+    color.a = length(color.rgb);
+    return;
+  }
+
   float near = raySphereIntersect(cameraPosition, ray, planetPosition, atmosphereRadius);
   vec3 start = cameraPosition + ray * near;
   far -= near;
@@ -59,30 +402,83 @@ void main() {
   float sunRayLength = raySphereIntersect(start, sunDirection, planetPosition, atmosphereRadius);
 	float startOffset = -startDepth*sunRayLength;
 
-  float sampleLength = far / fSamples;
-  vec3 sampleRay = ray * sampleLength;
-  vec3 samplePoint = start + sampleRay * 0.5;
+  // Only the lit part of the ray is marched, with the same spacing as if the
+  // whole ray was
+  vec2 shadow = shadowInterval(start, ray, far);
+  float litLength = far - (shadow.y - shadow.x);
+  float raySamples = useChapmanFunction ? float(chapmanSamples) : fSamples;
+  int sampleCount = int(ceil(raySamples * litLength / far));
+  float sampleLength = litLength / float(max(sampleCount, 1));
+
+  // Rays through the planet are hidden behind it, but still need a finite
+  // optical depth
+  bool groundHit = raySphereIntersect(start, ray, planetPosition, planetRadius) > 0.0;
+
+  MarchSegment segments[4];
+  if (adaptiveSampling) {
+    sampleCount = planMarch(start, ray, far, shadow, segments);
+  }
 
   vec3 scatteringColor = vec3(0.0, 0.0, 0.0);
-  for (int i = 0; i < nSamples; i++) {
-    float height = length(samplePoint - planetPosition);
+  vec4 scatteringSpectrum[MAX_SPECTRAL_GROUPS] = vec4[](vec4(0.0), vec4(0.0), vec4(0.0), vec4(0.0));
+  for (int i = 0; i < sampleCount; i++) {
+    float sampleDistance;
+    if (adaptiveSampling) {
+      vec2 marchStep = marchSample(segments, i);
+      sampleDistance = marchStep.x;
+      sampleLength = marchStep.y;
+    } else {
+      sampleDistance = litDistance(shadow, (float(i) + 0.5) * sampleLength);
+    }
+    vec3 samplePoint = start + ray * sampleDistance;
+    vec3 fromCenter = samplePoint - planetPosition;
+    float height = length(fromCenter);
 
     float h = (height - planetRadius) / (atmosphereRadius - planetRadius);
-    float depth = exp(-h/scaleDepth);
+    float depth, scatter;
+    if (useChapmanFunction) {
+      depth = exp(-h/scaleDepth);
+      scatter = chapman(height - planetRadius, dot(fromCenter, sunDirection) / height)
+          + chapmanSegment(start, samplePoint, ray, groundHit);
+    } else {
+      float sunRayLength, cameraRayLength;
+      if (useOpticalDepthTable && bodyUsesTables) {
+        vec2 sunLookup = opticalDepth(h, dot(fromCenter, sunDirection) / height);
+        depth = sunLookup.x;
+        sunRayLength = sunLookup.y;
+        cameraRayLength = opticalDepth(h, dot(fromCenter, -ray) / height).y;
+      } else {
+        depth = exp(-h/scaleDepth);
+        sunRayLength = raySphereIntersect(samplePoint, sunDirection, planetPosition, atmosphereRadius);
+        cameraRayLength = raySphereIntersect(samplePoint, -ray, planetPosition, atmosphereRadius);
+      }
+      scatter = (startOffset + depth*(sunRayLength - cameraRayLength));
+    }
 
-    float sunRayLength = raySphereIntersect(samplePoint, sunDirection, planetPosition, atmosphereRadius);
-    float cameraRayLength = raySphereIntersect(samplePoint, -ray, planetPosition, atmosphereRadius);
-    float scatter = (startOffset + depth*(sunRayLength - cameraRayLength));
+    if (spectralScattering && bodyUsesTables) {
+      for (int k = 0; k < spectralGroups; k++) {
+        scatteringSpectrum[k] += exp(-scatter * spectralExtinction[k]) * (depth * sampleLength / (atmosphereRadius - planetRadius));
+      }
+      continue;
+    }
 
     vec3 attenuate = exp(-scatter * (invWaveLength * Kr * 4 * PI + Km * 4 * PI));
     scatteringColor += attenuate * (depth * sampleLength / (atmosphereRadius - planetRadius));
-    samplePoint += sampleRay;
   }
 
   vec3 toCamera = cameraPosition - position.xyz;
 	float theta = dot(sunDirection, toCamera) / length(toCamera);
 	float phase = 1.5 * ((1.0 - g*g) / (2.0 + g*g)) * (1.0 + theta*theta) / pow(1.0 + g*g - 2.0*g*theta, 1.5);
 
+  if (spectralScattering && bodyUsesTables) {
+    color.rgb = vec3(0.0);
+    for (int k = 0; k < spectralGroups; k++) {
+      color.rgb += spectralToRGB[k] * (scatteringSpectrum[k] * (spectralRayleigh[k] + phase * Km) * ESun);
+    }
+    color.a = length(color.rgb);
+    return;
+  }
+
   vec3 rayleighColor = (scatteringColor * invWaveLength * Kr * ESun);
   vec3 mieColor = (scatteringColor * Km * ESun);
   color.rgb = rayleighColor + phase * mieColor;
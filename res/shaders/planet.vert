@@ -1,17 +1,47 @@
 #version 430 core
 
 in layout(location = 0) vec3 position;
+// Octahedral encoded in xy for packed meshes
 in layout(location = 1) vec3 normal_in;
 in layout(location = 2) vec2 textureCoordinates_in;
 
 out layout(location = 0) vec4 position_out;
 out layout(location = 1) vec2 textureCoordinates_out;
+out layout(location = 2) vec3 direction_out;
+flat out layout(location = 3) int body_out;
 
-uniform mat4 M;
 uniform mat4 VP;
 
+// Every planet and moon, see bodies.hpp
+struct Body {
+  mat4 model;
+  float planetRadius;
+  float atmosphereRadius;
+  float Kr;
+  float Km;
+  float ESun;
+  float g;
+  float scaleDepth;
+  uint flags;
+  vec3 invWaveLength;
+};
+layout(std430, binding = 0) readonly buffer Bodies { Body bodies[]; };
+// The body of each instance drawn, from firstInstance on
+layout(std430, binding = 1) readonly buffer Instances { uint instanceBodies[]; };
+uniform int firstInstance;
+
+// Maps quantized attributes back to their range, see VertexQuantization
+uniform vec3 positionOffset = vec3(0.0f);
+uniform vec3 positionScale = vec3(1.0f);
+uniform vec2 textureOffset = vec2(0.0f);
+uniform vec2 textureScale = vec2(1.0f);
+
 void main() {
-  position_out = M * vec4(position, 1.0f);
-  textureCoordinates_out = textureCoordinates_in;
+  int body = int(instanceBodies[firstInstance + gl_InstanceID]);
+  body_out = body;
+  direction_out = positionOffset + position * positionScale;
+  position_out = bodies[body].model * vec4(direction_out, 1.0f);
+  textureCoordinates_out =
+      textureOffset + textureCoordinates_in * textureScale;
   gl_Position = VP * position_out;
 }
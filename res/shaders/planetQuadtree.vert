@@ -0,0 +1,76 @@
+#version 430 core
+
+// Integer grid coordinates, see generateChunkGrid()
+in layout(location = 0) vec3 gridPosition;
+
+out layout(location = 0) vec4 position_out;
+out layout(location = 1) vec2 textureCoordinates_out;
+out layout(location = 2) vec3 direction_out;
+flat out layout(location = 3) int body_out;
+
+uniform mat4 VP;
+uniform float planetRadius;
+
+// Every planet and moon, see bodies.hpp
+struct Body {
+  mat4 model;
+  float planetRadius;
+  float atmosphereRadius;
+  float Kr;
+  float Km;
+  float ESun;
+  float g;
+  float scaleDepth;
+  uint flags;
+  vec3 invWaveLength;
+};
+layout(std430, binding = 0) readonly buffer Bodies { Body bodies[]; };
+// The body of each instance drawn, from firstInstance on
+layout(std430, binding = 1) readonly buffer Instances { uint instanceBodies[]; };
+uniform int firstInstance;
+
+// The chunk, see planet/quadtree.hpp
+uniform vec3 faceNormal;
+uniform vec3 faceU;
+uniform vec3 faceV;
+uniform vec2 chunkOrigin;
+uniform float chunkSize;
+uniform float gridResolution;
+uniform vec2 morphRange;
+// In the planet's model space, like the vertices
+uniform vec3 localCameraPosition;
+
+const float QUARTER_PI = 0.78539816;
+
+vec3 spherePoint(vec2 grid) {
+  vec2 face = chunkOrigin + grid / gridResolution * chunkSize;
+  vec2 stretched = tan(face * QUARTER_PI);
+  return planetRadius *
+         normalize(faceNormal + stretched.x * faceU + stretched.y * faceV);
+}
+
+void main() {
+  int body = int(instanceBodies[firstInstance + gl_InstanceID]);
+  body_out = body;
+  vec2 grid = gridPosition.xy;
+  vec3 position = spherePoint(grid);
+
+  // Vertices that are not in the parent's grid slide onto the parent's edge
+  // or diagonal through them. Only distances decide how far, so chunks of
+  // different levels or faces agree on the vertices they share.
+  float morph = clamp((distance(position, localCameraPosition) - morphRange.x) /
+                          (morphRange.y - morphRange.x),
+                      0.0, 1.0);
+  vec2 odd = mod(grid, 2.0);
+  if (morph > 0.0 && odd != vec2(0.0)) {
+    vec3 parentEdge = 0.5 * (spherePoint(grid - odd) + spherePoint(grid + odd));
+    position = mix(position, parentEdge, morph);
+  }
+
+  position_out = bodies[body].model * vec4(position, 1.0f);
+  // The fragment shader looks the texture up from the direction, which has no
+  // seam to interpolate across
+  textureCoordinates_out = vec2(0.0);
+  direction_out = position;
+  gl_Position = VP * position_out;
+}
@@ -0,0 +1,264 @@
+#include "cpuRenderer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <utilities/parallel.hpp>
+#include <utilities/shapes.h>
+#include <vector>
+
+// Finds both intersections of a ray with a sphere. Returns false on a miss.
+static bool intersectSphere(glm::vec3 origin, glm::vec3 direction,
+                            glm::vec3 center, float radius, float &near,
+                            float &far) {
+  glm::vec3 toOrigin = origin - center;
+  float b = glm::dot(direction, toOrigin);
+  float c = glm::dot(toOrigin, toOrigin) - radius * radius;
+  float discriminant = b * b - c;
+  if (discriminant < 0.0f) {
+    return false;
+  }
+  float sqrtDiscriminant = std::sqrt(discriminant);
+  near = -b - sqrtDiscriminant;
+  far = -b + sqrtDiscriminant;
+  return far > 0.0f;
+}
+
+static glm::vec4 texel(const PNGImage &image, int x, int y) {
+  // GL_REPEAT wrapping
+  x = ((x % (int)image.width) + image.width) % image.width;
+  y = ((y % (int)image.height) + image.height) % image.height;
+  const unsigned char *p = &image.pixels[4 * (y * image.width + x)];
+  return glm::vec4(p[0], p[1], p[2], p[3]) / 255.0f;
+}
+
+// Bilinear lookup matching GL_LINEAR on the base level
+static glm::vec4 sampleTexture(const PNGImage &image, glm::vec2 uv) {
+  float x = uv.x * image.width - 0.5f;
+  float y = uv.y * image.height - 0.5f;
+  int x0 = (int)std::floor(x);
+  int y0 = (int)std::floor(y);
+  float fx = x - x0;
+  float fy = y - y0;
+
+  glm::vec4 bottom =
+      glm::mix(texel(image, x0, y0), texel(image, x0 + 1, y0), fx);
+  glm::vec4 top =
+      glm::mix(texel(image, x0, y0 + 1), texel(image, x0 + 1, y0 + 1), fx);
+  return glm::mix(bottom, top, fy);
+}
+
+static unsigned char toByte(float value) {
+  return (unsigned char)(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+static void writePixel(glm::vec3 color, unsigned char *out) {
+  out[0] = toByte(color.r);
+  out[1] = toByte(color.g);
+  out[2] = toByte(color.b);
+  out[3] = 255;
+}
+
+static glm::vec3 shadeTexel(const GBufferTexel &texel,
+                            const AtmosphereParameters &atmosphere,
+                            glm::vec3 cameraPosition, glm::vec3 sunDirection,
+                            const SpectralBins *spectrum) {
+  if (texel.surface == GBufferTexel::Planet) {
+    return glm::clamp(glm::vec3(planetColor(atmosphere, cameraPosition,
+                                            sunDirection, texel.position,
+                                            texel.textureColor, spectrum)),
+                      0.0f, 1.0f);
+  }
+  if (texel.surface == GBufferTexel::Atmosphere) {
+    // Alpha blended onto the black clear colour
+    glm::vec4 fragment = atmosphereColor(atmosphere, cameraPosition,
+                                         sunDirection, texel.position,
+                                         spectrum);
+    return glm::clamp(glm::vec3(fragment), 0.0f, 1.0f) *
+           glm::clamp(fragment.a, 0.0f, 1.0f);
+  }
+  return glm::vec3(0.0f);
+}
+
+// Edge length of the square tiles a frame is split into. Small enough to
+// balance the load across many threads, even though tiles on the planet cost
+// far more than empty ones.
+const unsigned int TILE_SIZE = 32;
+
+// Everything the tiles of one frame share
+struct FrameSetup {
+  const CPUScene *scene;
+  unsigned int width, height;
+  glm::vec3 cameraPosition;
+  glm::mat4 inverseVP;
+  glm::mat4 inversePlanetModel;
+  // Empty unless the scene is spectral
+  SpectralBins bins;
+};
+
+static GBufferTexel primaryHit(const FrameSetup &frame, glm::vec3 direction) {
+  const AtmosphereParameters &atmosphere = frame.scene->atmosphere;
+  GBufferTexel texel;
+  float planetNear, planetFar, atmosphereNear, atmosphereFar;
+  if (intersectSphere(frame.cameraPosition, direction,
+                      atmosphere.planetPosition, atmosphere.planetRadius,
+                      planetNear, planetFar) &&
+      planetNear > 0.0f) {
+    // Planet pass, drawn with back face culling: front side of the sphere
+    texel.surface = GBufferTexel::Planet;
+    texel.position = frame.cameraPosition + direction * planetNear;
+
+    if (frame.scene->earthTexture) {
+      glm::vec3 local =
+          glm::vec3(frame.inversePlanetModel * glm::vec4(texel.position, 1.0f));
+      texel.textureColor =
+          sampleTexture(*frame.scene->earthTexture,
+                        sphereTextureCoordinates(glm::normalize(local)));
+    }
+  } else if (intersectSphere(frame.cameraPosition, direction,
+                             atmosphere.planetPosition,
+                             atmosphere.atmosphereRadius, atmosphereNear,
+                             atmosphereFar)) {
+    // Atmosphere pass, drawn with front face culling: back side of the shell
+    texel.surface = GBufferTexel::Atmosphere;
+    texel.position = frame.cameraPosition + direction * atmosphereFar;
+  }
+  return texel;
+}
+
+static void setupFrame(const CPUScene &scene, Gloom::Camera &camera,
+                       const glm::mat4 &projection, unsigned int width,
+                       unsigned int height, FrameSetup &frame) {
+  frame.scene = &scene;
+  frame.width = width;
+  frame.height = height;
+  frame.cameraPosition = camera.getPosition();
+  frame.inverseVP = glm::inverse(projection * camera.getViewMatrix());
+  frame.inversePlanetModel = glm::inverse(scene.planetModel);
+
+  if (scene.atmosphere.spectralBins > 0) {
+    frame.bins = makeSpectralBins(scene.atmosphere.spectralBins,
+                                  scene.atmosphere.Kr, scene.atmosphere.Km);
+  }
+}
+
+static unsigned int tileCount(const FrameSetup &frame) {
+  return ((frame.width + TILE_SIZE - 1) / TILE_SIZE) *
+         ((frame.height + TILE_SIZE - 1) / TILE_SIZE);
+}
+
+// Casts the primary rays of one tile and calls write(pixel index, texel) for
+// each of them
+template <typename Write>
+static void castTile(const FrameSetup &frame, unsigned int tile, Write write) {
+  unsigned int tilesPerRow = (frame.width + TILE_SIZE - 1) / TILE_SIZE;
+  unsigned int x0 = (tile % tilesPerRow) * TILE_SIZE;
+  unsigned int y0 = (tile / tilesPerRow) * TILE_SIZE;
+  unsigned int x1 = std::min(x0 + TILE_SIZE, frame.width);
+  unsigned int y1 = std::min(y0 + TILE_SIZE, frame.height);
+
+  for (unsigned int row = y0; row < y1; row++) {
+    float ndcY = ((float)row + 0.5f) / (float)frame.height * 2.0f - 1.0f;
+    for (unsigned int column = x0; column < x1; column++) {
+      float ndcX = ((float)column + 0.5f) / (float)frame.width * 2.0f - 1.0f;
+
+      glm::vec4 farPoint = frame.inverseVP * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+      glm::vec3 direction = glm::normalize(glm::vec3(farPoint) / farPoint.w -
+                                           frame.cameraPosition);
+      write(row * frame.width + column, primaryHit(frame, direction));
+    }
+  }
+}
+
+static void renderTile(const FrameSetup &frame, unsigned int tile,
+                       PNGImage &image) {
+  const AtmosphereParameters &atmosphere = frame.scene->atmosphere;
+  const SpectralBins *spectrum = frame.bins.count > 0 ? &frame.bins : nullptr;
+  castTile(frame, tile, [&](unsigned int pixel, const GBufferTexel &texel) {
+    writePixel(shadeTexel(texel, atmosphere, frame.cameraPosition,
+                          frame.scene->sunDirection, spectrum),
+               &image.pixels[4 * pixel]);
+  });
+}
+
+static PNGImage emptyImage(unsigned int width, unsigned int height) {
+  PNGImage image;
+  image.width = width;
+  image.height = height;
+  image.pixels.resize(4 * width * height);
+  return image;
+}
+
+PNGImage renderFrameCPU(const CPUScene &scene, Gloom::Camera &camera,
+                        const glm::mat4 &projection, unsigned int width,
+                        unsigned int height, ThreadPool &pool) {
+  PNGImage image = emptyImage(width, height);
+  FrameSetup frame;
+  setupFrame(scene, camera, projection, width, height, frame);
+
+  parallelFor(pool, tileCount(frame),
+              [&](unsigned int tile) { renderTile(frame, tile, image); });
+
+  return image;
+}
+
+GBuffer renderGBufferCPU(const CPUScene &scene, Gloom::Camera &camera,
+                         const glm::mat4 &projection, unsigned int width,
+                         unsigned int height, unsigned int threadCount) {
+  FrameSetup frame;
+  setupFrame(scene, camera, projection, width, height, frame);
+
+  GBuffer gBuffer;
+  gBuffer.width = width;
+  gBuffer.height = height;
+  gBuffer.cameraPosition = frame.cameraPosition;
+  gBuffer.sunDirection = scene.sunDirection;
+  gBuffer.texels.resize(width * height);
+
+  parallelFor(
+      tileCount(frame),
+      [&](unsigned int tile) {
+        castTile(frame, tile,
+                 [&](unsigned int pixel, const GBufferTexel &texel) {
+                   gBuffer.texels[pixel] = texel;
+                 });
+      },
+      threadCount);
+
+  return gBuffer;
+}
+
+PNGImage shadeGBufferCPU(const GBuffer &gBuffer,
+                         const AtmosphereParameters &atmosphere) {
+  PNGImage image = emptyImage(gBuffer.width, gBuffer.height);
+
+  SpectralBins bins;
+  const SpectralBins *spectrum = nullptr;
+  if (atmosphere.spectralBins > 0) {
+    bins = makeSpectralBins(atmosphere.spectralBins, atmosphere.Kr,
+                            atmosphere.Km);
+    spectrum = &bins;
+  }
+
+  for (size_t pixel = 0; pixel < gBuffer.texels.size(); pixel++) {
+    writePixel(shadeTexel(gBuffer.texels[pixel], atmosphere,
+                          gBuffer.cameraPosition, gBuffer.sunDirection,
+                          spectrum),
+               &image.pixels[4 * pixel]);
+  }
+  return image;
+}
+
+float relativeImageDifference(const PNGImage &reference,
+                              const PNGImage &image) {
+  double difference = 0.0;
+  double total = 0.0;
+  size_t count = std::min(reference.pixels.size(), image.pixels.size());
+  for (size_t i = 0; i < count; i++) {
+    // Skip alpha
+    if (i % 4 == 3) {
+      continue;
+    }
+    difference += std::abs(int(reference.pixels[i]) - int(image.pixels[i]));
+    total += reference.pixels[i];
+  }
+  return total > 0.0 ? float(difference / total) : 0.0f;
+}
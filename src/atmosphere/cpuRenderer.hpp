@@ -0,0 +1,66 @@
+#pragma once
+
+#include "scattering.hpp"
+#include <glm/mat4x4.hpp>
+#include <utilities/camera.hpp>
+#include <utilities/imageLoader.hpp>
+#include <utilities/threadPool.hpp>
+#include <vector>
+
+// Everything besides the camera that is needed to render a frame on the CPU
+struct CPUScene {
+  AtmosphereParameters atmosphere;
+  glm::vec3 sunDirection;
+
+  // Model matrix of the planet, used to find the texture coordinates of a
+  // surface point. The atmosphere shell shares the planet's transformation.
+  glm::mat4 planetModel = glm::mat4(1.0f);
+
+  // Earth texture as returned by loadPNGFile. May be null, in which case the
+  // planet is rendered white.
+  const PNGImage *earthTexture = nullptr;
+};
+
+// Renders the planet and its atmosphere the same way the GL pipeline does, by
+// ray casting the planet and atmosphere spheres and evaluating the shader
+// code for each pixel. The frame is split into tiles, which are distributed
+// across the threads of `pool`; tasks submitted earlier, like encoding the
+// previous frame, run alongside them. Like loadPNGFile, the first row of the
+// returned image is the bottom of the frame.
+PNGImage renderFrameCPU(const CPUScene &scene, Gloom::Camera &camera,
+                        const glm::mat4 &projection, unsigned int width,
+                        unsigned int height, ThreadPool &pool);
+
+// What the primary ray of a pixel hits. None of it depends on the scattering
+// constants, so one G-buffer can be shaded for many sets of them.
+struct GBufferTexel {
+  enum Surface { Empty, Planet, Atmosphere };
+  Surface surface = Empty;
+  // World space fragment position
+  glm::vec3 position = glm::vec3(0.0f);
+  // Earth texture at the fragment, planet only
+  glm::vec4 textureColor = glm::vec4(1.0f);
+};
+
+struct GBuffer {
+  unsigned int width = 0;
+  unsigned int height = 0;
+  glm::vec3 cameraPosition;
+  glm::vec3 sunDirection;
+  // Bottom row first, like PNGImage
+  std::vector<GBufferTexel> texels;
+};
+
+// Casts the primary rays of a frame, split into tiles like renderFrameCPU
+GBuffer renderGBufferCPU(const CPUScene &scene, Gloom::Camera &camera,
+                         const glm::mat4 &projection, unsigned int width,
+                         unsigned int height, unsigned int threadCount = 0);
+
+// Shades a G-buffer on the calling thread. `atmosphere` must have the radii
+// and planet position the G-buffer was cast with; everything else may vary.
+PNGImage shadeGBufferCPU(const GBuffer &gBuffer,
+                         const AtmosphereParameters &atmosphere);
+
+// Mean absolute difference of the colour channels of two images of the same
+// size, relative to the mean brightness of `reference`
+float relativeImageDifference(const PNGImage &reference, const PNGImage &image);
@@ -0,0 +1,47 @@
+#include "opticalDepth.hpp"
+#include <algorithm>
+#include <cmath>
+
+OpticalDepthTable bakeOpticalDepthTable(const AtmosphereParameters &params,
+                                        int heightResolution,
+                                        int angleResolution) {
+  OpticalDepthTable table;
+  table.heightResolution = heightResolution;
+  table.angleResolution = angleResolution;
+  table.scaleDepth = params.scaleDepth;
+  table.planetRadius = params.planetRadius;
+  table.atmosphereRadius = params.atmosphereRadius;
+  table.texels.resize(heightResolution * angleResolution);
+
+  float shellDepth = params.atmosphereRadius - params.planetRadius;
+  float outerRadiusSquared = params.atmosphereRadius * params.atmosphereRadius;
+
+  for (int y = 0; y < angleResolution; y++) {
+    float cosAngle = (float)y / (float)(angleResolution - 1) * 2.0f - 1.0f;
+
+    for (int x = 0; x < heightResolution; x++) {
+      float h = (float)x / (float)(heightResolution - 1);
+      float density = std::exp(-h / params.scaleDepth);
+
+      // The far root of raySphereIntersect() for a point inside the
+      // atmosphere, written out so that the top row (a point exactly on the
+      // sphere) takes the inside branch as well
+      float radius = params.planetRadius + h * shellDepth;
+      float b = radius * cosAngle;
+      float discriminant = b * b - radius * radius + outerRadiusSquared;
+      float distance = -b + std::sqrt(std::max(discriminant, 0.0f));
+
+      table.texels[y * heightResolution + x] =
+          glm::vec2(density, distance / shellDepth);
+    }
+  }
+
+  return table;
+}
+
+bool opticalDepthTableMatches(const OpticalDepthTable &table,
+                              const AtmosphereParameters &params) {
+  return !table.texels.empty() && table.scaleDepth == params.scaleDepth &&
+         table.planetRadius == params.planetRadius &&
+         table.atmosphereRadius == params.atmosphereRadius;
+}
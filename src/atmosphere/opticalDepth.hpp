@@ -0,0 +1,33 @@
+#pragma once
+
+#include "scattering.hpp"
+#include <glm/vec2.hpp>
+#include <vector>
+
+// O'Neil style lookup table of the two values the scattering loops evaluate
+// for every sample: the atmospheric density at a height, and the distance
+// from that height to the edge of the atmosphere along a direction.
+//
+// The x axis is the height above the planet, normalised to [0, 1] across the
+// atmosphere shell. The y axis is the cosine of the angle between the
+// direction and the up vector, mapped from [-1, 1] to [0, 1]. Every texel
+// holds (density, distance), with the distance measured in units of the
+// shell depth so that the table only depends on the ratio of the radii.
+struct OpticalDepthTable {
+  int heightResolution = 0;
+  int angleResolution = 0;
+  std::vector<glm::vec2> texels;
+
+  // The parameters the table was baked from
+  float scaleDepth = 0.0f;
+  float planetRadius = 0.0f;
+  float atmosphereRadius = 0.0f;
+};
+
+OpticalDepthTable bakeOpticalDepthTable(const AtmosphereParameters &params,
+                                        int heightResolution = 128,
+                                        int angleResolution = 256);
+
+// Whether the table is up to date with the given parameters
+bool opticalDepthTableMatches(const OpticalDepthTable &table,
+                              const AtmosphereParameters &params);
@@ -0,0 +1,185 @@
+#include "packetKernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||            \
+    defined(_M_IX86)
+#define PACKET_KERNELS_X86
+#if defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+#endif
+
+// Defined in packetKernels{SSE,AVX2,AVX512}.cpp. They return null when the
+// file was compiled without the flags for its instruction set.
+const PacketKernels *packetKernelsSSE();
+const PacketKernels *packetKernelsAVX2();
+const PacketKernels *packetKernelsAVX512();
+
+// Range reduction and polynomial of Cephes' expf. The vector kernels use the
+// same constants.
+static const float EXP_MIN = -87.3365448f;
+static const float EXP_MAX = 88.0f;
+static const float LOG2E = 1.44269504088896341f;
+static const float LN2_HIGH = 0.693359375f;
+static const float LN2_LOW = -2.12194440e-4f;
+static const float EXP_P0 = 1.9875691500e-4f;
+static const float EXP_P1 = 1.3981999507e-3f;
+static const float EXP_P2 = 8.3334519073e-3f;
+static const float EXP_P3 = 4.1665795894e-2f;
+static const float EXP_P4 = 1.6666665459e-1f;
+static const float EXP_P5 = 5.0000001201e-1f;
+
+static float fastExp(float x) {
+  if (x < EXP_MIN) {
+    return 0.0f;
+  }
+  x = std::min(x, EXP_MAX);
+
+  // x = n ln(2) + r, with |r| <= ln(2) / 2
+  float n = std::nearbyint(x * LOG2E);
+  float r = x - n * LN2_HIGH - n * LN2_LOW;
+
+  float p = EXP_P0;
+  p = p * r + EXP_P1;
+  p = p * r + EXP_P2;
+  p = p * r + EXP_P3;
+  p = p * r + EXP_P4;
+  p = p * r + EXP_P5;
+  float y = p * r * r + r + 1.0f;
+
+  // 2^n, built directly from the exponent bits
+  int32_t bits = ((int32_t)n + 127) << 23;
+  float scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return y * scale;
+}
+
+void intersectSphereScalar(const RayPackets &rays, const PacketSphere &sphere,
+                           float *near, float *far) {
+  for (size_t i = 0; i < rays.count; i++) {
+    float ox = rays.originX[i] - sphere.x;
+    float oy = rays.originY[i] - sphere.y;
+    float oz = rays.originZ[i] - sphere.z;
+    float dx = rays.directionX[i];
+    float dy = rays.directionY[i];
+    float dz = rays.directionZ[i];
+
+    // Same formulation as raySphereIntersect() in the shaders
+    float a = dx * dx + dy * dy + dz * dz;
+    float b = 2.0f * (dx * ox + dy * oy + dz * oz);
+    float c = ox * ox + oy * oy + oz * oz - sphere.radius * sphere.radius;
+    float discriminant = b * b - 4.0f * a * c;
+
+    if (discriminant < 0.0f) {
+      near[i] = -1.0f;
+      far[i] = -1.0f;
+      continue;
+    }
+
+    float sqrtDiscriminant = std::sqrt(discriminant);
+    near[i] = (-b - sqrtDiscriminant) / (2.0f * a);
+    far[i] = (-b + sqrtDiscriminant) / (2.0f * a);
+  }
+}
+
+void expScalar(const float *in, float *out, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = fastExp(in[i]);
+  }
+}
+
+RayPackets rayPacketsFrom(const RayPackets &rays, size_t first) {
+  RayPackets rest = rays;
+  rest.originX += first;
+  rest.originY += first;
+  rest.originZ += first;
+  rest.directionX += first;
+  rest.directionY += first;
+  rest.directionZ += first;
+  rest.count = first < rays.count ? rays.count - first : 0;
+  return rest;
+}
+
+static bool cpuSupports(PacketISA isa) {
+#if defined(PACKET_KERNELS_X86) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  bool sse2 = (info[3] & (1 << 26)) != 0;
+  bool fma = (info[2] & (1 << 12)) != 0;
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+
+  // The OS has to save the wider registers on context switches
+  unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+  bool avxState = (xcr0 & 0x06) == 0x06;
+  bool avx512State = (xcr0 & 0xe6) == 0xe6;
+
+  __cpuidex(info, 7, 0);
+  bool avx2 = (info[1] & (1 << 5)) != 0;
+  bool avx512f = (info[1] & (1 << 16)) != 0;
+
+  switch (isa) {
+  case PacketISA::Scalar:
+    return true;
+  case PacketISA::SSE:
+    return sse2;
+  case PacketISA::AVX2:
+    return avx2 && fma && avxState;
+  case PacketISA::AVX512:
+    return avx512f && avx512State;
+  }
+  return false;
+#elif defined(PACKET_KERNELS_X86)
+  // Also checks that the OS saves the wider registers
+  __builtin_cpu_init();
+  switch (isa) {
+  case PacketISA::Scalar:
+    return true;
+  case PacketISA::SSE:
+    return __builtin_cpu_supports("sse2");
+  case PacketISA::AVX2:
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  case PacketISA::AVX512:
+    return __builtin_cpu_supports("avx512f");
+  }
+  return false;
+#else
+  return isa == PacketISA::Scalar;
+#endif
+}
+
+static const PacketKernels scalarKernels = {
+    PacketISA::Scalar, "Scalar", 1, intersectSphereScalar, expScalar};
+
+const PacketKernels *packetKernelsFor(PacketISA isa) {
+  if (!cpuSupports(isa)) {
+    return nullptr;
+  }
+  switch (isa) {
+  case PacketISA::Scalar:
+    return &scalarKernels;
+  case PacketISA::SSE:
+    return packetKernelsSSE();
+  case PacketISA::AVX2:
+    return packetKernelsAVX2();
+  case PacketISA::AVX512:
+    return packetKernelsAVX512();
+  }
+  return nullptr;
+}
+
+const PacketKernels &packetKernels() {
+  static const PacketKernels *best = [] {
+    for (PacketISA isa :
+         {PacketISA::AVX512, PacketISA::AVX2, PacketISA::SSE}) {
+      if (const PacketKernels *kernels = packetKernelsFor(isa)) {
+        return kernels;
+      }
+    }
+    return &scalarKernels;
+  }();
+  return *best;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+
+// Vectorised versions of the two operations that dominate every CPU side
+// evaluation of the scattering model: ray-sphere intersection and exp. Each
+// instruction set gets its own translation unit, compiled with the matching
+// compiler flags, and the best one supported by the running CPU is picked at
+// runtime.
+//
+// The kernels work on arrays and process them a packet of 4 (SSE), 8 (AVX2)
+// or 16 (AVX-512) elements at a time. This header is kept free of glm and
+// inline functions, so that no code compiled for a wider instruction set can
+// end up being shared with the rest of the program.
+
+enum class PacketISA { Scalar, SSE, AVX2, AVX512 };
+
+// Rays in structure of arrays form. Directions do not need to be normalised.
+struct RayPackets {
+  const float *originX;
+  const float *originY;
+  const float *originZ;
+  const float *directionX;
+  const float *directionY;
+  const float *directionZ;
+  size_t count;
+};
+
+struct PacketSphere {
+  float x, y, z;
+  float radius;
+};
+
+// Writes both roots of every ray's intersection with the sphere, in units of
+// the ray direction, or -1 for both on a miss. raySphereIntersect() in the
+// shaders returns `far` for origins inside the sphere and `near` otherwise.
+typedef void (*IntersectSphereKernel)(const RayPackets &rays,
+                                      const PacketSphere &sphere, float *near,
+                                      float *far);
+
+// out[i] = exp(in[i]), with a relative error below 2e-7 for inputs in
+// [-87.3, 88]. Smaller inputs give 0 and larger ones are clamped to 88.
+// `in` and `out` may be the same array.
+typedef void (*ExpKernel)(const float *in, float *out, size_t count);
+
+struct PacketKernels {
+  PacketISA isa;
+  const char *name;
+  // Elements per packet
+  int width;
+  IntersectSphereKernel intersectSphere;
+  ExpKernel exp;
+};
+
+// Kernels for the widest instruction set the CPU supports
+const PacketKernels &packetKernels();
+
+// Kernels for the given instruction set, or null when it is not supported by
+// the CPU or was not compiled in
+const PacketKernels *packetKernelsFor(PacketISA isa);
+
+// Scalar versions, also used by the vector kernels for the tail of an array
+void intersectSphereScalar(const RayPackets &rays, const PacketSphere &sphere,
+                           float *near, float *far);
+void expScalar(const float *in, float *out, size_t count);
+
+// The rays from index `first` onwards
+RayPackets rayPacketsFrom(const RayPackets &rays, size_t first);
@@ -0,0 +1,99 @@
+#include "packetKernels.hpp"
+
+// Compiled with -mavx2 -mfma (/arch:AVX2 on MSVC), see CMakeLists.txt
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#include <immintrin.h>
+
+static void intersectSphereAVX2(const RayPackets &rays,
+                                const PacketSphere &sphere, float *near,
+                                float *far) {
+  const __m256 centerX = _mm256_set1_ps(sphere.x);
+  const __m256 centerY = _mm256_set1_ps(sphere.y);
+  const __m256 centerZ = _mm256_set1_ps(sphere.z);
+  const __m256 radiusSquared = _mm256_set1_ps(sphere.radius * sphere.radius);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 miss = _mm256_set1_ps(-1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 four = _mm256_set1_ps(4.0f);
+
+  size_t i = 0;
+  for (; i + 8 <= rays.count; i += 8) {
+    __m256 ox = _mm256_sub_ps(_mm256_loadu_ps(rays.originX + i), centerX);
+    __m256 oy = _mm256_sub_ps(_mm256_loadu_ps(rays.originY + i), centerY);
+    __m256 oz = _mm256_sub_ps(_mm256_loadu_ps(rays.originZ + i), centerZ);
+    __m256 dx = _mm256_loadu_ps(rays.directionX + i);
+    __m256 dy = _mm256_loadu_ps(rays.directionY + i);
+    __m256 dz = _mm256_loadu_ps(rays.directionZ + i);
+
+    __m256 a = _mm256_fmadd_ps(dz, dz,
+                               _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+    __m256 b = _mm256_mul_ps(
+        two, _mm256_fmadd_ps(dz, oz,
+                             _mm256_fmadd_ps(dy, oy, _mm256_mul_ps(dx, ox))));
+    __m256 c = _mm256_sub_ps(
+        _mm256_fmadd_ps(oz, oz, _mm256_fmadd_ps(oy, oy, _mm256_mul_ps(ox, ox))),
+        radiusSquared);
+    __m256 discriminant =
+        _mm256_fnmadd_ps(four, _mm256_mul_ps(a, c), _mm256_mul_ps(b, b));
+
+    __m256 hit = _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ);
+    __m256 sqrtDiscriminant = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+    __m256 twoA = _mm256_mul_ps(two, a);
+    __m256 minusB = _mm256_sub_ps(zero, b);
+    __m256 t1 = _mm256_div_ps(_mm256_sub_ps(minusB, sqrtDiscriminant), twoA);
+    __m256 t2 = _mm256_div_ps(_mm256_add_ps(minusB, sqrtDiscriminant), twoA);
+
+    _mm256_storeu_ps(near + i, _mm256_blendv_ps(miss, t1, hit));
+    _mm256_storeu_ps(far + i, _mm256_blendv_ps(miss, t2, hit));
+  }
+
+  intersectSphereScalar(rayPacketsFrom(rays, i), sphere, near + i, far + i);
+}
+
+// See fastExp() in packetKernels.cpp
+static void expAVX2(const float *in, float *out, size_t count) {
+  const __m256 expMin = _mm256_set1_ps(-87.3365448f);
+  const __m256 expMax = _mm256_set1_ps(88.0f);
+  const __m256 log2e = _mm256_set1_ps(1.44269504088896341f);
+  const __m256 ln2High = _mm256_set1_ps(0.693359375f);
+  const __m256 ln2Low = _mm256_set1_ps(-2.12194440e-4f);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256i bias = _mm256_set1_epi32(127);
+
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_loadu_ps(in + i);
+    __m256 underflow = _mm256_cmp_ps(x, expMin, _CMP_LT_OQ);
+    x = _mm256_min_ps(x, expMax);
+
+    __m256i n = _mm256_cvtps_epi32(_mm256_mul_ps(x, log2e));
+    __m256 fn = _mm256_cvtepi32_ps(n);
+    __m256 r = _mm256_fnmadd_ps(fn, ln2Low, _mm256_fnmadd_ps(fn, ln2High, x));
+
+    __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    __m256 y = _mm256_add_ps(_mm256_fmadd_ps(p, _mm256_mul_ps(r, r), r), one);
+
+    __m256 scale = _mm256_castsi256_ps(
+        _mm256_slli_epi32(_mm256_add_epi32(n, bias), 23));
+    _mm256_storeu_ps(out + i,
+                     _mm256_andnot_ps(underflow, _mm256_mul_ps(y, scale)));
+  }
+
+  expScalar(in + i, out + i, count - i);
+}
+
+static const PacketKernels kernels = {PacketISA::AVX2, "AVX2", 8,
+                                      intersectSphereAVX2, expAVX2};
+
+const PacketKernels *packetKernelsAVX2() { return &kernels; }
+
+#else
+
+const PacketKernels *packetKernelsAVX2() { return nullptr; }
+
+#endif
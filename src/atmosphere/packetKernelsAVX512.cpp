@@ -0,0 +1,109 @@
+#include "packetKernels.hpp"
+
+// Compiled with -mavx512f (/arch:AVX512 on MSVC), see CMakeLists.txt
+#if defined(__AVX512F__)
+#include <immintrin.h>
+
+// The tail of an array is handled with masked loads and stores instead of
+// falling back to the scalar kernels
+static __mmask16 tailMask(size_t remaining) {
+  return remaining >= 16 ? (__mmask16)0xffff
+                         : (__mmask16)((1u << remaining) - 1u);
+}
+
+static void intersectSphereAVX512(const RayPackets &rays,
+                                  const PacketSphere &sphere, float *near,
+                                  float *far) {
+  const __m512 centerX = _mm512_set1_ps(sphere.x);
+  const __m512 centerY = _mm512_set1_ps(sphere.y);
+  const __m512 centerZ = _mm512_set1_ps(sphere.z);
+  const __m512 radiusSquared = _mm512_set1_ps(sphere.radius * sphere.radius);
+  const __m512 zero = _mm512_setzero_ps();
+  const __m512 miss = _mm512_set1_ps(-1.0f);
+  const __m512 two = _mm512_set1_ps(2.0f);
+  const __m512 four = _mm512_set1_ps(4.0f);
+
+  for (size_t i = 0; i < rays.count; i += 16) {
+    __mmask16 mask = tailMask(rays.count - i);
+
+    // Masked out lanes read as a zero direction, which the division turns
+    // into NaN, but those lanes are never stored
+    __m512 ox =
+        _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, rays.originX + i), centerX);
+    __m512 oy =
+        _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, rays.originY + i), centerY);
+    __m512 oz =
+        _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, rays.originZ + i), centerZ);
+    __m512 dx = _mm512_maskz_loadu_ps(mask, rays.directionX + i);
+    __m512 dy = _mm512_maskz_loadu_ps(mask, rays.directionY + i);
+    __m512 dz = _mm512_maskz_loadu_ps(mask, rays.directionZ + i);
+
+    __m512 a = _mm512_fmadd_ps(dz, dz,
+                               _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+    __m512 b = _mm512_mul_ps(
+        two, _mm512_fmadd_ps(dz, oz,
+                             _mm512_fmadd_ps(dy, oy, _mm512_mul_ps(dx, ox))));
+    __m512 c = _mm512_sub_ps(
+        _mm512_fmadd_ps(oz, oz, _mm512_fmadd_ps(oy, oy, _mm512_mul_ps(ox, ox))),
+        radiusSquared);
+    __m512 discriminant =
+        _mm512_fnmadd_ps(four, _mm512_mul_ps(a, c), _mm512_mul_ps(b, b));
+
+    __mmask16 hit = _mm512_cmp_ps_mask(discriminant, zero, _CMP_GE_OQ);
+    __m512 sqrtDiscriminant = _mm512_sqrt_ps(_mm512_max_ps(discriminant, zero));
+    __m512 twoA = _mm512_mul_ps(two, a);
+    __m512 minusB = _mm512_sub_ps(zero, b);
+    __m512 t1 = _mm512_div_ps(_mm512_sub_ps(minusB, sqrtDiscriminant), twoA);
+    __m512 t2 = _mm512_div_ps(_mm512_add_ps(minusB, sqrtDiscriminant), twoA);
+
+    _mm512_mask_storeu_ps(near + i, mask, _mm512_mask_blend_ps(hit, miss, t1));
+    _mm512_mask_storeu_ps(far + i, mask, _mm512_mask_blend_ps(hit, miss, t2));
+  }
+}
+
+// See fastExp() in packetKernels.cpp
+static void expAVX512(const float *in, float *out, size_t count) {
+  const __m512 expMin = _mm512_set1_ps(-87.3365448f);
+  const __m512 expMax = _mm512_set1_ps(88.0f);
+  const __m512 log2e = _mm512_set1_ps(1.44269504088896341f);
+  const __m512 ln2High = _mm512_set1_ps(0.693359375f);
+  const __m512 ln2Low = _mm512_set1_ps(-2.12194440e-4f);
+  const __m512 one = _mm512_set1_ps(1.0f);
+  const __m512i bias = _mm512_set1_epi32(127);
+
+  for (size_t i = 0; i < count; i += 16) {
+    __mmask16 mask = tailMask(count - i);
+
+    __m512 x = _mm512_maskz_loadu_ps(mask, in + i);
+    __mmask16 inRange = _mm512_cmp_ps_mask(x, expMin, _CMP_GE_OQ);
+    x = _mm512_min_ps(x, expMax);
+
+    __m512i n = _mm512_cvtps_epi32(_mm512_mul_ps(x, log2e));
+    __m512 fn = _mm512_cvtepi32_ps(n);
+    __m512 r = _mm512_fnmadd_ps(fn, ln2Low, _mm512_fnmadd_ps(fn, ln2High, x));
+
+    __m512 p = _mm512_set1_ps(1.9875691500e-4f);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.3981999507e-3f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(8.3334519073e-3f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(4.1665795894e-2f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.6666665459e-1f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(5.0000001201e-1f));
+    __m512 y = _mm512_add_ps(_mm512_fmadd_ps(p, _mm512_mul_ps(r, r), r), one);
+
+    __m512 scale = _mm512_castsi512_ps(
+        _mm512_slli_epi32(_mm512_add_epi32(n, bias), 23));
+    _mm512_mask_storeu_ps(out + i, mask,
+                          _mm512_maskz_mul_ps(inRange, y, scale));
+  }
+}
+
+static const PacketKernels kernels = {PacketISA::AVX512, "AVX-512", 16,
+                                      intersectSphereAVX512, expAVX512};
+
+const PacketKernels *packetKernelsAVX512() { return &kernels; }
+
+#else
+
+const PacketKernels *packetKernelsAVX512() { return nullptr; }
+
+#endif
@@ -0,0 +1,104 @@
+#include "packetKernels.hpp"
+
+// Only SSE2, which every x86-64 CPU has, so this file needs no extra flags
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+static void intersectSphereSSE(const RayPackets &rays,
+                               const PacketSphere &sphere, float *near,
+                               float *far) {
+  const __m128 centerX = _mm_set1_ps(sphere.x);
+  const __m128 centerY = _mm_set1_ps(sphere.y);
+  const __m128 centerZ = _mm_set1_ps(sphere.z);
+  const __m128 radiusSquared = _mm_set1_ps(sphere.radius * sphere.radius);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 miss = _mm_set1_ps(-1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 four = _mm_set1_ps(4.0f);
+
+  size_t i = 0;
+  for (; i + 4 <= rays.count; i += 4) {
+    __m128 ox = _mm_sub_ps(_mm_loadu_ps(rays.originX + i), centerX);
+    __m128 oy = _mm_sub_ps(_mm_loadu_ps(rays.originY + i), centerY);
+    __m128 oz = _mm_sub_ps(_mm_loadu_ps(rays.originZ + i), centerZ);
+    __m128 dx = _mm_loadu_ps(rays.directionX + i);
+    __m128 dy = _mm_loadu_ps(rays.directionY + i);
+    __m128 dz = _mm_loadu_ps(rays.directionZ + i);
+
+    __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                          _mm_mul_ps(dz, dz));
+    __m128 b = _mm_mul_ps(
+        two, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ox), _mm_mul_ps(dy, oy)),
+                        _mm_mul_ps(dz, oz)));
+    __m128 c = _mm_sub_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)),
+                   _mm_mul_ps(oz, oz)),
+        radiusSquared);
+    __m128 discriminant =
+        _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(four, _mm_mul_ps(a, c)));
+
+    __m128 hit = _mm_cmpge_ps(discriminant, zero);
+    __m128 sqrtDiscriminant = _mm_sqrt_ps(_mm_max_ps(discriminant, zero));
+    __m128 twoA = _mm_mul_ps(two, a);
+    __m128 minusB = _mm_sub_ps(zero, b);
+    __m128 t1 = _mm_div_ps(_mm_sub_ps(minusB, sqrtDiscriminant), twoA);
+    __m128 t2 = _mm_div_ps(_mm_add_ps(minusB, sqrtDiscriminant), twoA);
+
+    _mm_storeu_ps(near + i, _mm_or_ps(_mm_and_ps(hit, t1),
+                                      _mm_andnot_ps(hit, miss)));
+    _mm_storeu_ps(far + i, _mm_or_ps(_mm_and_ps(hit, t2),
+                                     _mm_andnot_ps(hit, miss)));
+  }
+
+  intersectSphereScalar(rayPacketsFrom(rays, i), sphere, near + i, far + i);
+}
+
+// See fastExp() in packetKernels.cpp
+static void expSSE(const float *in, float *out, size_t count) {
+  const __m128 expMin = _mm_set1_ps(-87.3365448f);
+  const __m128 expMax = _mm_set1_ps(88.0f);
+  const __m128 log2e = _mm_set1_ps(1.44269504088896341f);
+  const __m128 ln2High = _mm_set1_ps(0.693359375f);
+  const __m128 ln2Low = _mm_set1_ps(-2.12194440e-4f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128i bias = _mm_set1_epi32(127);
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_loadu_ps(in + i);
+    __m128 underflow = _mm_cmplt_ps(x, expMin);
+    x = _mm_min_ps(x, expMax);
+
+    // Rounds to nearest, like nearbyint() in the default rounding mode
+    __m128i n = _mm_cvtps_epi32(_mm_mul_ps(x, log2e));
+    __m128 fn = _mm_cvtepi32_ps(n);
+    __m128 r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(fn, ln2High)),
+                          _mm_mul_ps(fn, ln2Low));
+
+    __m128 p = _mm_set1_ps(1.9875691500e-4f);
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.3981999507e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(8.3334519073e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(4.1665795894e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.6666665459e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(5.0000001201e-1f));
+    __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p, _mm_mul_ps(r, r)), r), one);
+
+    __m128 scale =
+        _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, bias), 23));
+    _mm_storeu_ps(out + i, _mm_andnot_ps(underflow, _mm_mul_ps(y, scale)));
+  }
+
+  expScalar(in + i, out + i, count - i);
+}
+
+static const PacketKernels kernels = {PacketISA::SSE, "SSE", 4,
+                                      intersectSphereSSE, expSSE};
+
+const PacketKernels *packetKernelsSSE() { return &kernels; }
+
+#else
+
+const PacketKernels *packetKernelsSSE() { return nullptr; }
+
+#endif
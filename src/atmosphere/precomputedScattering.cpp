@@ -0,0 +1,705 @@
+#include "precomputedScattering.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fmt/format.h>
+#include <utilities/parallel.hpp>
+
+static const float PI = 3.14159265f;
+
+// Single scattering plus this many minus one orders of multiple scattering
+static const int SCATTERING_ORDERS = 4;
+
+// Resolution of the intermediate scattering density table, indexed by radius
+// and sun zenith cosine
+static const int DENSITY_TEXTURE_R_SIZE = 32;
+static const int DENSITY_TEXTURE_MU_S_SIZE = 64;
+
+// Integration steps along rays, and across the sphere of directions
+static const int TRANSMITTANCE_STEPS = 500;
+static const int SCATTERING_STEPS = 50;
+static const int SPHERE_STEPS = 16;
+
+static const char SCATTERING_FILE_MAGIC[4] = {'A', 'T', 'M', 'S'};
+static const uint32_t SCATTERING_FILE_VERSION = 1;
+static const uint64_t SCATTERING_FILE_ALIGNMENT = 4096;
+
+struct ScatteringFileHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t parameterHash;
+  uint32_t transmittanceSize[2];
+  uint32_t scatteringSize[4];
+  uint64_t transmittanceOffset;
+  uint64_t singleScatteringOffset;
+  uint64_t multipleScatteringOffset;
+};
+
+// Geometry and coefficients used throughout the bake
+struct Atmosphere {
+  float bottomRadius;
+  float topRadius;
+  float shellDepth;
+  // Distance to the top of the atmosphere along the horizon at the ground
+  float horizon;
+  float scaleDepth;
+  float g;
+  glm::vec3 rayleigh;
+  float mie;
+  glm::vec3 extinction;
+};
+
+static Atmosphere makeAtmosphere(const AtmosphereParameters &params) {
+  Atmosphere a;
+  a.bottomRadius = params.planetRadius;
+  a.topRadius = params.atmosphereRadius;
+  a.shellDepth = a.topRadius - a.bottomRadius;
+  a.horizon = std::sqrt(a.topRadius * a.topRadius -
+                        a.bottomRadius * a.bottomRadius);
+  a.scaleDepth = params.scaleDepth;
+  a.g = params.g;
+
+  glm::vec3 w = params.waveLengths;
+  glm::vec3 invWaveLength(1.0f / std::pow(w.x, 4.0f),
+                          1.0f / std::pow(w.y, 4.0f),
+                          1.0f / std::pow(w.z, 4.0f));
+  a.rayleigh = invWaveLength * params.Kr;
+  a.mie = params.Km;
+  a.extinction = (a.rayleigh + glm::vec3(a.mie)) * 4.0f * PI;
+  return a;
+}
+
+// === Geometry ===
+
+static float safeSqrt(float x) { return std::sqrt(std::max(x, 0.0f)); }
+
+static float clampCosine(float mu) { return glm::clamp(mu, -1.0f, 1.0f); }
+
+static float clampRadius(const Atmosphere &a, float r) {
+  return glm::clamp(r, a.bottomRadius, a.topRadius);
+}
+
+static float distanceToTopBoundary(const Atmosphere &a, float r, float mu) {
+  float discriminant = r * r * (mu * mu - 1.0f) + a.topRadius * a.topRadius;
+  return std::max(-r * mu + safeSqrt(discriminant), 0.0f);
+}
+
+static float distanceToBottomBoundary(const Atmosphere &a, float r, float mu) {
+  float discriminant =
+      r * r * (mu * mu - 1.0f) + a.bottomRadius * a.bottomRadius;
+  return std::max(-r * mu - safeSqrt(discriminant), 0.0f);
+}
+
+static bool rayIntersectsGround(const Atmosphere &a, float r, float mu) {
+  return mu < 0.0f &&
+         r * r * (mu * mu - 1.0f) + a.bottomRadius * a.bottomRadius >= 0.0f;
+}
+
+static float distanceToNearestBoundary(const Atmosphere &a, float r, float mu,
+                                       bool groundHit) {
+  return groundHit ? distanceToBottomBoundary(a, r, mu)
+                   : distanceToTopBoundary(a, r, mu);
+}
+
+// Same profile as the shaders, with the height normalised across the shell
+static float density(const Atmosphere &a, float r) {
+  return std::exp(-((r - a.bottomRadius) / a.shellDepth) / a.scaleDepth);
+}
+
+// Same phase function as the shaders, which evaluate it for the cosine
+// between the sun and the direction towards the camera
+static float miePhase(const Atmosphere &a, float nu) {
+  float theta = -nu;
+  float g = a.g;
+  return 1.5f * ((1.0f - g * g) / (2.0f + g * g)) * (1.0f + theta * theta) /
+         std::pow(1.0f + g * g - 2.0f * g * theta, 1.5f);
+}
+
+// === Texture access, matching GL_LINEAR with GL_CLAMP_TO_EDGE ===
+
+static float textureCoordFromUnitRange(float x, int size) {
+  return 0.5f / size + x * (1.0f - 1.0f / size);
+}
+
+static float unitRangeFromTextureCoord(float u, int size) {
+  return (u - 0.5f / size) / (1.0f - 1.0f / size);
+}
+
+static void texelWeights(float coordinate, int size, int &i0, int &i1,
+                         float &weight) {
+  float x = coordinate * size - 0.5f;
+  float x0 = std::floor(x);
+  weight = x - x0;
+  i0 = glm::clamp((int)x0, 0, size - 1);
+  i1 = glm::clamp((int)x0 + 1, 0, size - 1);
+}
+
+static glm::vec4 sampleTexture2D(const glm::vec4 *texels, int width, int height,
+                                 glm::vec2 uv) {
+  int x0, x1, y0, y1;
+  float fx, fy;
+  texelWeights(uv.x, width, x0, x1, fx);
+  texelWeights(uv.y, height, y0, y1, fy);
+
+  glm::vec4 bottom =
+      glm::mix(texels[y0 * width + x0], texels[y0 * width + x1], fx);
+  glm::vec4 top =
+      glm::mix(texels[y1 * width + x0], texels[y1 * width + x1], fx);
+  return glm::mix(bottom, top, fy);
+}
+
+static glm::vec4 sampleTexture3D(const glm::vec4 *texels, int width, int height,
+                                 int depth, glm::vec3 uvw) {
+  int z0, z1;
+  float fz;
+  texelWeights(uvw.z, depth, z0, z1, fz);
+
+  glm::vec2 uv(uvw.x, uvw.y);
+  return glm::mix(
+      sampleTexture2D(texels + z0 * width * height, width, height, uv),
+      sampleTexture2D(texels + z1 * width * height, width, height, uv), fz);
+}
+
+// === Transmittance ===
+
+static glm::vec2 transmittanceUvFromRMu(const Atmosphere &a, float r,
+                                        float mu) {
+  float rho = safeSqrt(r * r - a.bottomRadius * a.bottomRadius);
+  float d = distanceToTopBoundary(a, r, mu);
+  float dMin = a.topRadius - r;
+  float dMax = rho + a.horizon;
+  return glm::vec2(
+      textureCoordFromUnitRange((d - dMin) / (dMax - dMin),
+                                TRANSMITTANCE_TEXTURE_WIDTH),
+      textureCoordFromUnitRange(rho / a.horizon, TRANSMITTANCE_TEXTURE_HEIGHT));
+}
+
+static void transmittanceRMuFromUv(const Atmosphere &a, glm::vec2 uv, float &r,
+                                   float &mu) {
+  float xMu = unitRangeFromTextureCoord(uv.x, TRANSMITTANCE_TEXTURE_WIDTH);
+  float xR = unitRangeFromTextureCoord(uv.y, TRANSMITTANCE_TEXTURE_HEIGHT);
+  float rho = a.horizon * xR;
+  r = std::sqrt(rho * rho + a.bottomRadius * a.bottomRadius);
+  float dMin = a.topRadius - r;
+  float dMax = rho + a.horizon;
+  float d = dMin + xMu * (dMax - dMin);
+  mu = d == 0.0f ? 1.0f
+                 : clampCosine((a.horizon * a.horizon - rho * rho - d * d) /
+                               (2.0f * r * d));
+}
+
+// Optical depth to the top of the atmosphere, in units of the shell depth
+static float opticalDepthToTopBoundary(const Atmosphere &a, float r, float mu) {
+  float dx = distanceToTopBoundary(a, r, mu) / TRANSMITTANCE_STEPS;
+  float result = 0.0f;
+  for (int i = 0; i <= TRANSMITTANCE_STEPS; i++) {
+    float d = i * dx;
+    float rI = std::sqrt(d * d + 2.0f * r * mu * d + r * r);
+    float weight = (i == 0 || i == TRANSMITTANCE_STEPS) ? 0.5f : 1.0f;
+    result += density(a, rI) * weight * dx;
+  }
+  return result / a.shellDepth;
+}
+
+static glm::vec4 lookupTransmittance(const glm::vec4 *table,
+                                     const Atmosphere &a, float r, float mu) {
+  return sampleTexture2D(table, TRANSMITTANCE_TEXTURE_WIDTH,
+                         TRANSMITTANCE_TEXTURE_HEIGHT,
+                         transmittanceUvFromRMu(a, r, mu));
+}
+
+// Transmittance between a point and the point `d` further along the ray.
+// Rays hitting the ground are looked up in the opposite direction, which
+// never does.
+static glm::vec3 transmittanceBetween(const glm::vec4 *table,
+                                      const Atmosphere &a, float r, float mu,
+                                      float d, bool groundHit) {
+  float rD = clampRadius(a, std::sqrt(d * d + 2.0f * r * mu * d + r * r));
+  float muD = clampCosine((r * mu + d) / rD);
+
+  float opticalDepth =
+      groundHit ? lookupTransmittance(table, a, rD, -muD).a -
+                      lookupTransmittance(table, a, r, -mu).a
+                : lookupTransmittance(table, a, r, mu).a -
+                      lookupTransmittance(table, a, rD, muD).a;
+  return glm::exp(-std::max(opticalDepth, 0.0f) * a.extinction);
+}
+
+static glm::vec3 transmittanceToSun(const glm::vec4 *table,
+                                    const Atmosphere &a, float r, float muS) {
+  if (rayIntersectsGround(a, r, muS)) {
+    return glm::vec3(0.0f);
+  }
+  return glm::vec3(lookupTransmittance(table, a, r, muS));
+}
+
+// === In-scattering ===
+
+static glm::vec4 scatteringUvwzFromRMuMuSNu(const Atmosphere &a, float r,
+                                            float mu, float muS, float nu,
+                                            bool groundHit) {
+  float rho = safeSqrt(r * r - a.bottomRadius * a.bottomRadius);
+  float uR =
+      textureCoordFromUnitRange(rho / a.horizon, SCATTERING_TEXTURE_R_SIZE);
+
+  float rMu = r * mu;
+  float discriminant = rMu * rMu - r * r + a.bottomRadius * a.bottomRadius;
+  float uMu;
+  if (groundHit) {
+    float d = -rMu - safeSqrt(discriminant);
+    float dMin = r - a.bottomRadius;
+    float dMax = rho;
+    uMu = 0.5f - 0.5f * textureCoordFromUnitRange(
+                            dMax == dMin ? 0.0f : (d - dMin) / (dMax - dMin),
+                            SCATTERING_TEXTURE_MU_SIZE / 2);
+  } else {
+    float d = -rMu + safeSqrt(discriminant + a.horizon * a.horizon);
+    float dMin = a.topRadius - r;
+    float dMax = rho + a.horizon;
+    uMu = 0.5f + 0.5f * textureCoordFromUnitRange(
+                            (d - dMin) / (dMax - dMin),
+                            SCATTERING_TEXTURE_MU_SIZE / 2);
+  }
+
+  float d = distanceToTopBoundary(a, a.bottomRadius, muS);
+  float dMin = a.shellDepth;
+  float dMax = a.horizon;
+  float alpha = (d - dMin) / (dMax - dMin);
+  float D = distanceToTopBoundary(a, a.bottomRadius, SCATTERING_MU_S_MIN);
+  float A = (D - dMin) / (dMax - dMin);
+  float uMuS = textureCoordFromUnitRange(
+      std::max(1.0f - alpha / A, 0.0f) / (1.0f + alpha),
+      SCATTERING_TEXTURE_MU_S_SIZE);
+
+  float uNu = (nu + 1.0f) / 2.0f;
+  return glm::vec4(uNu, uMuS, uMu, uR);
+}
+
+static void scatteringRMuMuSNuFromTexel(const Atmosphere &a, int x, int y,
+                                        int z, float &r, float &mu, float &muS,
+                                        float &nu, bool &groundHit) {
+  float fragCoordNu = (float)(x / SCATTERING_TEXTURE_MU_S_SIZE);
+  float fragCoordMuS = (float)(x % SCATTERING_TEXTURE_MU_S_SIZE) + 0.5f;
+  glm::vec4 uvwz(fragCoordNu / (SCATTERING_TEXTURE_NU_SIZE - 1),
+                 fragCoordMuS / SCATTERING_TEXTURE_MU_S_SIZE,
+                 (y + 0.5f) / SCATTERING_TEXTURE_MU_SIZE,
+                 (z + 0.5f) / SCATTERING_TEXTURE_R_SIZE);
+
+  float rho =
+      a.horizon * unitRangeFromTextureCoord(uvwz.w, SCATTERING_TEXTURE_R_SIZE);
+  r = std::sqrt(rho * rho + a.bottomRadius * a.bottomRadius);
+
+  if (uvwz.z < 0.5f) {
+    float dMin = r - a.bottomRadius;
+    float dMax = rho;
+    float d = dMin + (dMax - dMin) * unitRangeFromTextureCoord(
+                                         1.0f - 2.0f * uvwz.z,
+                                         SCATTERING_TEXTURE_MU_SIZE / 2);
+    mu = d == 0.0f ? -1.0f
+                   : clampCosine(-(rho * rho + d * d) / (2.0f * r * d));
+    groundHit = true;
+  } else {
+    float dMin = a.topRadius - r;
+    float dMax = rho + a.horizon;
+    float d = dMin + (dMax - dMin) * unitRangeFromTextureCoord(
+                                         2.0f * uvwz.z - 1.0f,
+                                         SCATTERING_TEXTURE_MU_SIZE / 2);
+    mu = d == 0.0f ? 1.0f
+                   : clampCosine((a.horizon * a.horizon - rho * rho - d * d) /
+                                 (2.0f * r * d));
+    groundHit = false;
+  }
+
+  float xMuS =
+      unitRangeFromTextureCoord(uvwz.y, SCATTERING_TEXTURE_MU_S_SIZE);
+  float dMin = a.shellDepth;
+  float dMax = a.horizon;
+  float D = distanceToTopBoundary(a, a.bottomRadius, SCATTERING_MU_S_MIN);
+  float A = (D - dMin) / (dMax - dMin);
+  float alpha = (A - xMuS * A) / (1.0f + xMuS * A);
+  float d = dMin + std::min(alpha, A) * (dMax - dMin);
+  muS = d == 0.0f ? 1.0f
+                  : clampCosine((a.horizon * a.horizon - d * d) /
+                                (2.0f * a.bottomRadius * d));
+
+  // Only view-sun angles that are possible for the given mu and muS
+  nu = clampCosine(uvwz.x * 2.0f - 1.0f);
+  float spread = safeSqrt((1.0f - mu * mu) * (1.0f - muS * muS));
+  nu = glm::clamp(nu, mu * muS - spread, mu * muS + spread);
+}
+
+static glm::vec3 lookupScattering(const glm::vec4 *table, const Atmosphere &a,
+                                  float r, float mu, float muS, float nu,
+                                  bool groundHit) {
+  glm::vec4 uvwz = scatteringUvwzFromRMuMuSNu(a, r, mu, muS, nu, groundHit);
+  float texCoordX = uvwz.x * (SCATTERING_TEXTURE_NU_SIZE - 1);
+  float texX = std::floor(texCoordX);
+  float lerp = texCoordX - texX;
+  glm::vec3 uvw0((texX + uvwz.y) / SCATTERING_TEXTURE_NU_SIZE, uvwz.z, uvwz.w);
+  glm::vec3 uvw1((texX + 1.0f + uvwz.y) / SCATTERING_TEXTURE_NU_SIZE, uvwz.z,
+                 uvwz.w);
+  return glm::vec3(glm::mix(sampleTexture3D(table, SCATTERING_TEXTURE_WIDTH,
+                                            SCATTERING_TEXTURE_HEIGHT,
+                                            SCATTERING_TEXTURE_DEPTH, uvw0),
+                            sampleTexture3D(table, SCATTERING_TEXTURE_WIDTH,
+                                            SCATTERING_TEXTURE_HEIGHT,
+                                            SCATTERING_TEXTURE_DEPTH, uvw1),
+                            lerp));
+}
+
+// Integrates density * transmittance from the camera and from the sun along
+// the ray, with path lengths in units of the shell depth
+static glm::vec3 singleScattering(const glm::vec4 *transmittance,
+                                  const Atmosphere &a, float r, float mu,
+                                  float muS, float nu, bool groundHit) {
+  float dx =
+      distanceToNearestBoundary(a, r, mu, groundHit) / SCATTERING_STEPS;
+  glm::vec3 result(0.0f);
+  for (int i = 0; i <= SCATTERING_STEPS; i++) {
+    float d = i * dx;
+    float rD = clampRadius(a, std::sqrt(d * d + 2.0f * r * mu * d + r * r));
+    float muSD = clampCosine((r * muS + d * nu) / rD);
+
+    glm::vec3 t =
+        transmittanceBetween(transmittance, a, r, mu, d, groundHit) *
+        transmittanceToSun(transmittance, a, rD, muSD);
+    float weight = (i == 0 || i == SCATTERING_STEPS) ? 0.5f : 1.0f;
+    result += t * density(a, rD) * weight * dx;
+  }
+  return result / a.shellDepth;
+}
+
+// Radiance scattered towards any direction at a point, from all the light of
+// the previous order arriving at that point. Scattering of the higher orders
+// is treated as isotropic, which makes the density independent of the view
+// direction.
+static glm::vec3 scatteringDensity(const glm::vec4 *previousOrder,
+                                   bool previousIsSingle, const Atmosphere &a,
+                                   float r, float muS) {
+  glm::vec3 sun(safeSqrt(1.0f - muS * muS), 0.0f, muS);
+  float dTheta = PI / SPHERE_STEPS;
+  // Radiance is symmetric around the plane containing the sun, so half of the
+  // azimuth range is enough
+  float dPhi = PI / SPHERE_STEPS;
+
+  glm::vec3 radiance(0.0f);
+  for (int l = 0; l < SPHERE_STEPS; l++) {
+    float theta = (l + 0.5f) * dTheta;
+    float cosTheta = std::cos(theta);
+    float sinTheta = std::sin(theta);
+    bool groundHit = rayIntersectsGround(a, r, cosTheta);
+
+    for (int m = 0; m < SPHERE_STEPS; m++) {
+      float phi = (m + 0.5f) * dPhi;
+      glm::vec3 omega(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta,
+                      cosTheta);
+      float nu = glm::dot(omega, sun);
+
+      glm::vec3 incoming =
+          lookupScattering(previousOrder, a, r, cosTheta, muS, nu, groundHit);
+      if (previousIsSingle) {
+        incoming *= a.rayleigh + glm::vec3(a.mie * miePhase(a, nu));
+      }
+      radiance += incoming * sinTheta * dTheta * dPhi;
+    }
+  }
+
+  return (a.rayleigh + glm::vec3(a.mie)) * density(a, r) * radiance * 2.0f;
+}
+
+static glm::vec3 lookupDensity(const std::vector<glm::vec4> &table,
+                               const Atmosphere &a, float r, float muS) {
+  glm::vec2 uv(textureCoordFromUnitRange((muS + 1.0f) / 2.0f,
+                                         DENSITY_TEXTURE_MU_S_SIZE),
+               textureCoordFromUnitRange((r - a.bottomRadius) / a.shellDepth,
+                                         DENSITY_TEXTURE_R_SIZE));
+  return glm::vec3(sampleTexture2D(table.data(), DENSITY_TEXTURE_MU_S_SIZE,
+                                   DENSITY_TEXTURE_R_SIZE, uv));
+}
+
+static glm::vec3 multipleScattering(const glm::vec4 *transmittance,
+                                    const std::vector<glm::vec4> &densityTable,
+                                    const Atmosphere &a, float r, float mu,
+                                    float muS, float nu, bool groundHit) {
+  float dx =
+      distanceToNearestBoundary(a, r, mu, groundHit) / SCATTERING_STEPS;
+  glm::vec3 result(0.0f);
+  for (int i = 0; i <= SCATTERING_STEPS; i++) {
+    float d = i * dx;
+    float rD = clampRadius(a, std::sqrt(d * d + 2.0f * r * mu * d + r * r));
+    float muSD = clampCosine((r * muS + d * nu) / rD);
+
+    glm::vec3 t = transmittanceBetween(transmittance, a, r, mu, d, groundHit);
+    float weight = (i == 0 || i == SCATTERING_STEPS) ? 0.5f : 1.0f;
+    result += t * lookupDensity(densityTable, a, rD, muSD) * weight * dx;
+  }
+  return result / a.shellDepth;
+}
+
+// Runs `texel` for every texel of a scattering table, one row per task
+template <class F>
+static void forEachScatteringTexel(std::vector<glm::vec4>::iterator table,
+                                   unsigned int threadCount, const F &texel) {
+  parallelFor(
+      SCATTERING_TEXTURE_HEIGHT * SCATTERING_TEXTURE_DEPTH,
+      [&](unsigned int row) {
+        int y = row % SCATTERING_TEXTURE_HEIGHT;
+        int z = row / SCATTERING_TEXTURE_HEIGHT;
+        for (int x = 0; x < SCATTERING_TEXTURE_WIDTH; x++) {
+          table[row * SCATTERING_TEXTURE_WIDTH + x] =
+              glm::vec4(texel(x, y, z), 1.0f);
+        }
+      },
+      threadCount);
+}
+
+void bakeScatteringTables(const AtmosphereParameters &params,
+                          ScatteringTables &tables, unsigned int threadCount) {
+  Atmosphere a = makeAtmosphere(params);
+
+  tables.file.close();
+  tables.parameterHash = scatteringParameterHash(params);
+  tables.storage.assign(TRANSMITTANCE_TEXEL_COUNT + 2 * SCATTERING_TEXEL_COUNT,
+                        glm::vec4(0.0f));
+  auto transmittance = tables.storage.begin();
+  auto single = transmittance + TRANSMITTANCE_TEXEL_COUNT;
+  auto multiple = single + SCATTERING_TEXEL_COUNT;
+
+  parallelFor(
+      TRANSMITTANCE_TEXTURE_HEIGHT,
+      [&](unsigned int y) {
+        for (int x = 0; x < TRANSMITTANCE_TEXTURE_WIDTH; x++) {
+          float r, mu;
+          transmittanceRMuFromUv(
+              a,
+              glm::vec2((x + 0.5f) / TRANSMITTANCE_TEXTURE_WIDTH,
+                        (y + 0.5f) / TRANSMITTANCE_TEXTURE_HEIGHT),
+              r, mu);
+          float opticalDepth = opticalDepthToTopBoundary(a, r, mu);
+          transmittance[y * TRANSMITTANCE_TEXTURE_WIDTH + x] = glm::vec4(
+              glm::exp(-opticalDepth * a.extinction), opticalDepth);
+        }
+      },
+      threadCount);
+  const glm::vec4 *transmittanceTable = &*transmittance;
+
+  forEachScatteringTexel(single, threadCount, [&](int x, int y, int z) {
+    float r, mu, muS, nu;
+    bool groundHit;
+    scatteringRMuMuSNuFromTexel(a, x, y, z, r, mu, muS, nu, groundHit);
+    return singleScattering(transmittanceTable, a, r, mu, muS, nu, groundHit);
+  });
+
+  // Each order only scatters the light of the order before it
+  std::vector<glm::vec4> densityTable(DENSITY_TEXTURE_R_SIZE *
+                                      DENSITY_TEXTURE_MU_S_SIZE);
+  std::vector<glm::vec4> previousOrder(single, single + SCATTERING_TEXEL_COUNT);
+  std::vector<glm::vec4> currentOrder(SCATTERING_TEXEL_COUNT);
+
+  for (int order = 2; order <= SCATTERING_ORDERS; order++) {
+    parallelFor(
+        DENSITY_TEXTURE_R_SIZE,
+        [&](unsigned int y) {
+          float r = a.bottomRadius +
+                    a.shellDepth * unitRangeFromTextureCoord(
+                                       (y + 0.5f) / DENSITY_TEXTURE_R_SIZE,
+                                       DENSITY_TEXTURE_R_SIZE);
+          for (int x = 0; x < DENSITY_TEXTURE_MU_S_SIZE; x++) {
+            float muS = unitRangeFromTextureCoord(
+                            (x + 0.5f) / DENSITY_TEXTURE_MU_S_SIZE,
+                            DENSITY_TEXTURE_MU_S_SIZE) *
+                            2.0f -
+                        1.0f;
+            densityTable[y * DENSITY_TEXTURE_MU_S_SIZE + x] =
+                glm::vec4(scatteringDensity(previousOrder.data(), order == 2,
+                                            a, r, muS),
+                          1.0f);
+          }
+        },
+        threadCount);
+
+    forEachScatteringTexel(
+        currentOrder.begin(), threadCount, [&](int x, int y, int z) {
+          float r, mu, muS, nu;
+          bool groundHit;
+          scatteringRMuMuSNuFromTexel(a, x, y, z, r, mu, muS, nu, groundHit);
+          return multipleScattering(transmittanceTable, densityTable, a, r, mu,
+                                    muS, nu, groundHit);
+        });
+
+    for (int i = 0; i < SCATTERING_TEXEL_COUNT; i++) {
+      multiple[i] += glm::vec4(glm::vec3(currentOrder[i]), 0.0f);
+    }
+    std::swap(previousOrder, currentOrder);
+  }
+
+  for (int i = 0; i < SCATTERING_TEXEL_COUNT; i++) {
+    multiple[i].a = 1.0f;
+  }
+
+  tables.transmittance = transmittanceTable;
+  tables.singleScattering = &*single;
+  tables.multipleScattering = &*multiple;
+}
+
+// === Cache ===
+
+uint64_t scatteringParameterHash(const AtmosphereParameters &params) {
+  // Everything the tables depend on. ESun and the sample count do not matter.
+  uint32_t values[] = {SCATTERING_FILE_VERSION,
+                       TRANSMITTANCE_TEXTURE_WIDTH,
+                       TRANSMITTANCE_TEXTURE_HEIGHT,
+                       SCATTERING_TEXTURE_R_SIZE,
+                       SCATTERING_TEXTURE_MU_SIZE,
+                       SCATTERING_TEXTURE_MU_S_SIZE,
+                       SCATTERING_TEXTURE_NU_SIZE,
+                       SCATTERING_ORDERS,
+                       0, 0, 0, 0, 0, 0, 0, 0, 0};
+  float floats[] = {params.Kr,           params.Km,
+                    params.g,            params.scaleDepth,
+                    params.planetRadius, params.atmosphereRadius,
+                    params.waveLengths.x, params.waveLengths.y,
+                    params.waveLengths.z};
+  std::memcpy(&values[8], floats, sizeof(floats));
+
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(values);
+  for (std::size_t i = 0; i < sizeof(values); i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+static uint64_t alignOffset(uint64_t offset) {
+  return (offset + SCATTERING_FILE_ALIGNMENT - 1) / SCATTERING_FILE_ALIGNMENT *
+         SCATTERING_FILE_ALIGNMENT;
+}
+
+static bool writeAt(FILE *file, uint64_t offset, const void *data,
+                    std::size_t size) {
+  return std::fseek(file, (long)offset, SEEK_SET) == 0 &&
+         std::fwrite(data, 1, size, file) == size;
+}
+
+bool saveScatteringTables(const ScatteringTables &tables,
+                          const std::string &fileName) {
+  const std::size_t transmittanceBytes =
+      TRANSMITTANCE_TEXEL_COUNT * sizeof(glm::vec4);
+  const std::size_t scatteringBytes =
+      SCATTERING_TEXEL_COUNT * sizeof(glm::vec4);
+
+  ScatteringFileHeader header;
+  std::memcpy(header.magic, SCATTERING_FILE_MAGIC, sizeof(header.magic));
+  header.version = SCATTERING_FILE_VERSION;
+  header.parameterHash = tables.parameterHash;
+  header.transmittanceSize[0] = TRANSMITTANCE_TEXTURE_WIDTH;
+  header.transmittanceSize[1] = TRANSMITTANCE_TEXTURE_HEIGHT;
+  header.scatteringSize[0] = SCATTERING_TEXTURE_NU_SIZE;
+  header.scatteringSize[1] = SCATTERING_TEXTURE_MU_S_SIZE;
+  header.scatteringSize[2] = SCATTERING_TEXTURE_MU_SIZE;
+  header.scatteringSize[3] = SCATTERING_TEXTURE_R_SIZE;
+  header.transmittanceOffset = alignOffset(sizeof(header));
+  header.singleScatteringOffset =
+      alignOffset(header.transmittanceOffset + transmittanceBytes);
+  header.multipleScatteringOffset =
+      alignOffset(header.singleScatteringOffset + scatteringBytes);
+
+  // Written under a temporary name first, so that a reader never maps a
+  // partially written file
+  std::string temporaryName = fileName + ".tmp";
+  FILE *file = std::fopen(temporaryName.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+
+  bool ok =
+      writeAt(file, 0, &header, sizeof(header)) &&
+      writeAt(file, header.transmittanceOffset, tables.transmittance,
+              transmittanceBytes) &&
+      writeAt(file, header.singleScatteringOffset, tables.singleScattering,
+              scatteringBytes) &&
+      writeAt(file, header.multipleScatteringOffset, tables.multipleScattering,
+              scatteringBytes);
+  ok = std::fclose(file) == 0 && ok;
+
+  if (ok) {
+    std::remove(fileName.c_str());
+    ok = std::rename(temporaryName.c_str(), fileName.c_str()) == 0;
+  }
+  if (!ok) {
+    std::remove(temporaryName.c_str());
+  }
+  return ok;
+}
+
+bool loadScatteringTables(const std::string &fileName, uint64_t parameterHash,
+                          ScatteringTables &tables) {
+  MappedFile file;
+  if (!file.open(fileName) || file.size() < sizeof(ScatteringFileHeader)) {
+    return false;
+  }
+
+  ScatteringFileHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+
+  const uint64_t transmittanceBytes =
+      TRANSMITTANCE_TEXEL_COUNT * sizeof(glm::vec4);
+  const uint64_t scatteringBytes = SCATTERING_TEXEL_COUNT * sizeof(glm::vec4);
+
+  if (std::memcmp(header.magic, SCATTERING_FILE_MAGIC, sizeof(header.magic)) !=
+          0 ||
+      header.version != SCATTERING_FILE_VERSION ||
+      header.parameterHash != parameterHash ||
+      header.transmittanceSize[0] != TRANSMITTANCE_TEXTURE_WIDTH ||
+      header.transmittanceSize[1] != TRANSMITTANCE_TEXTURE_HEIGHT ||
+      header.scatteringSize[0] != SCATTERING_TEXTURE_NU_SIZE ||
+      header.scatteringSize[1] != SCATTERING_TEXTURE_MU_S_SIZE ||
+      header.scatteringSize[2] != SCATTERING_TEXTURE_MU_SIZE ||
+      header.scatteringSize[3] != SCATTERING_TEXTURE_R_SIZE ||
+      header.transmittanceOffset + transmittanceBytes > file.size() ||
+      header.singleScatteringOffset + scatteringBytes > file.size() ||
+      header.multipleScatteringOffset + scatteringBytes > file.size()) {
+    return false;
+  }
+
+  tables.storage.clear();
+  tables.storage.shrink_to_fit();
+  tables.parameterHash = parameterHash;
+  tables.transmittance = reinterpret_cast<const glm::vec4 *>(
+      file.data() + header.transmittanceOffset);
+  tables.singleScattering = reinterpret_cast<const glm::vec4 *>(
+      file.data() + header.singleScatteringOffset);
+  tables.multipleScattering = reinterpret_cast<const glm::vec4 *>(
+      file.data() + header.multipleScatteringOffset);
+  tables.file = std::move(file);
+  return true;
+}
+
+std::string scatteringTablesFileName(const std::string &cacheDirectory,
+                                     const AtmosphereParameters &params) {
+  return fmt::format("{}/scattering-{:016x}.bin", cacheDirectory,
+                     scatteringParameterHash(params));
+}
+
+void loadOrBakeScatteringTables(const AtmosphereParameters &params,
+                                const std::string &cacheDirectory,
+                                ScatteringTables &tables) {
+  std::string fileName = scatteringTablesFileName(cacheDirectory, params);
+  if (loadScatteringTables(fileName, scatteringParameterHash(params), tables)) {
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  bakeScatteringTables(params, tables);
+  std::chrono::duration<double> bakeTime =
+      std::chrono::steady_clock::now() - start;
+  fmt::print("Baked scattering tables in {:.2f}s\n", bakeTime.count());
+
+  if (!saveScatteringTables(tables, fileName)) {
+    fprintf(stderr, "Could not write scattering tables to \"%s\".\n",
+            fileName.c_str());
+  }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "scattering.hpp"
+#include <cstdint>
+#include <glm/vec4.hpp>
+#include <string>
+#include <utilities/mappedFile.hpp>
+#include <vector>
+
+// Bruneton style precomputed scattering. The tables use the parametrisation of
+// "Precomputed Atmospheric Scattering" (Bruneton and Neyret, 2008) as revised
+// in Bruneton's 2017 reference implementation, evaluated for the scattering
+// model of the shaders: a single exponential density profile shared by
+// Rayleigh and Mie scattering, with path lengths measured in units of the
+// atmosphere shell depth.
+//
+// None of the tables depend on ESun, which is applied when they are sampled.
+
+// Transmittance table, indexed by (view zenith cosine, radius). Every texel
+// holds the transmittance to the top of the atmosphere in rgb and the optical
+// depth in a, for rays that do not hit the planet.
+const int TRANSMITTANCE_TEXTURE_WIDTH = 256;
+const int TRANSMITTANCE_TEXTURE_HEIGHT = 64;
+
+// In-scattering tables, indexed by (radius, view zenith cosine, sun zenith
+// cosine, view-sun cosine). The last two dimensions are packed side by side
+// along x, so the tables are stored as 3D textures of NU * MU_S x MU x R.
+const int SCATTERING_TEXTURE_R_SIZE = 32;
+const int SCATTERING_TEXTURE_MU_SIZE = 128;
+const int SCATTERING_TEXTURE_MU_S_SIZE = 32;
+const int SCATTERING_TEXTURE_NU_SIZE = 8;
+
+const int SCATTERING_TEXTURE_WIDTH =
+    SCATTERING_TEXTURE_NU_SIZE * SCATTERING_TEXTURE_MU_S_SIZE;
+const int SCATTERING_TEXTURE_HEIGHT = SCATTERING_TEXTURE_MU_SIZE;
+const int SCATTERING_TEXTURE_DEPTH = SCATTERING_TEXTURE_R_SIZE;
+
+// Cosine of the lowest sun zenith angle with a non-negligible contribution
+const float SCATTERING_MU_S_MIN = -0.2f;
+
+const int TRANSMITTANCE_TEXEL_COUNT =
+    TRANSMITTANCE_TEXTURE_WIDTH * TRANSMITTANCE_TEXTURE_HEIGHT;
+const int SCATTERING_TEXEL_COUNT = SCATTERING_TEXTURE_WIDTH *
+                                   SCATTERING_TEXTURE_HEIGHT *
+                                   SCATTERING_TEXTURE_DEPTH;
+
+struct ScatteringTables {
+  // Hash of the parameters the tables were baked for
+  uint64_t parameterHash = 0;
+
+  // Rgb is the single scattering integral, which is multiplied by the
+  // Rayleigh and phase weighted Mie coefficients on lookup
+  const glm::vec4 *transmittance = nullptr;
+  const glm::vec4 *singleScattering = nullptr;
+
+  // Rgb is the radiance of all higher scattering orders, with the scattering
+  // coefficients already applied
+  const glm::vec4 *multipleScattering = nullptr;
+
+  // The pointers above point into one of these, depending on whether the
+  // tables were baked or loaded from disk
+  std::vector<glm::vec4> storage;
+  MappedFile file;
+};
+
+// Identifies the parameters the tables depend on, together with the table
+// layout and file format version
+uint64_t scatteringParameterHash(const AtmosphereParameters &params);
+
+// Bakes all tables on `threadCount` threads (0 uses every hardware thread)
+void bakeScatteringTables(const AtmosphereParameters &params,
+                          ScatteringTables &tables,
+                          unsigned int threadCount = 0);
+
+bool saveScatteringTables(const ScatteringTables &tables,
+                          const std::string &fileName);
+
+// Memory maps a table file, failing if it is missing, damaged, of another
+// version or baked for other parameters
+bool loadScatteringTables(const std::string &fileName, uint64_t parameterHash,
+                          ScatteringTables &tables);
+
+// Name of the cache file holding the tables for the given parameters
+std::string scatteringTablesFileName(const std::string &cacheDirectory,
+                                     const AtmosphereParameters &params);
+
+// Maps the cached tables for the given parameters, baking and caching them
+// first if needed
+void loadOrBakeScatteringTables(const AtmosphereParameters &params,
+                                const std::string &cacheDirectory,
+                                ScatteringTables &tables);
@@ -0,0 +1,441 @@
+#include "scattering.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Same (truncated) value as the shaders, so results match bit for bit where
+// the float math allows it
+static const float PI = 3.14159f;
+
+float raySphereIntersect(glm::vec3 r0, glm::vec3 rd, glm::vec3 s0, float sr) {
+  float a = glm::dot(rd, rd);
+  glm::vec3 s0_r0 = r0 - s0;
+  float b = 2.0f * glm::dot(rd, s0_r0);
+  float c = glm::dot(s0_r0, s0_r0) - (sr * sr);
+  float discriminant = b * b - 4.0f * a * c;
+
+  if (discriminant < 0.0f) {
+    return -1.0f;
+  }
+
+  float sqrtDiscriminant = std::sqrt(discriminant);
+  float t1 = (-b - sqrtDiscriminant) / (2.0f * a);
+  float t2 = (-b + sqrtDiscriminant) / (2.0f * a);
+
+  return (c < 0.0f) ? t2 : t1;
+}
+
+static glm::vec3 inverseWaveLength(const AtmosphereParameters &params) {
+  glm::vec3 w = params.waveLengths;
+  return glm::vec3(1.0f / std::pow(w.x, 4.0f), 1.0f / std::pow(w.y, 4.0f),
+                   1.0f / std::pow(w.z, 4.0f));
+}
+
+// Part of the ray in the planet's shadow, see shadowInterval() in the shaders
+static glm::vec2 shadowInterval(const AtmosphereParameters &params,
+                                glm::vec3 sunDirection, glm::vec3 start,
+                                glm::vec3 ray, float far) {
+  glm::vec3 fromCenter = start - params.planetPosition;
+  float k = glm::dot(fromCenter, sunDirection);
+  float m = glm::dot(ray, sunDirection);
+  glm::vec3 fromAxis = fromCenter - k * sunDirection;
+  glm::vec3 rayAcross = ray - m * sunDirection;
+
+  float a = glm::dot(rayAcross, rayAcross);
+  float b = glm::dot(fromAxis, rayAcross);
+  float c = glm::dot(fromAxis, fromAxis) -
+            params.planetRadius * params.planetRadius;
+  float enter = -1e30f;
+  float exit = 1e30f;
+  if (a > 1e-8f) {
+    float discriminant = b * b - a * c;
+    if (discriminant <= 0.0f) {
+      return glm::vec2(far);
+    }
+    enter = (-b - std::sqrt(discriminant)) / a;
+    exit = (-b + std::sqrt(discriminant)) / a;
+  } else if (c >= 0.0f) {
+    return glm::vec2(far);
+  }
+
+  // Only the half of the cylinder behind the planet
+  if (m > 1e-8f) {
+    exit = std::min(exit, -k / m);
+  } else if (m < -1e-8f) {
+    enter = std::max(enter, -k / m);
+  } else if (k >= 0.0f) {
+    return glm::vec2(far);
+  }
+
+  enter = glm::clamp(enter, 0.0f, far);
+  exit = glm::clamp(exit, 0.0f, far);
+  return enter < exit ? glm::vec2(enter, exit) : glm::vec2(far);
+}
+
+static float litDistance(glm::vec2 shadow, float d) {
+  return d < shadow.x ? d : d + (shadow.y - shadow.x);
+}
+
+// Optical depth to the edge of the atmosphere, see chapman() in the shaders
+static float chapman(const AtmosphereParameters &params, float height,
+                     float cosZenith) {
+  float scaleHeight =
+      params.scaleDepth * (params.atmosphereRadius - params.planetRadius);
+  float X = params.planetRadius / scaleHeight;
+  float h = std::max(height, 0.0f) / scaleHeight;
+  float c = std::sqrt(X + h);
+  if (cosZenith >= 0.0f) {
+    return scaleHeight * c / (c * cosZenith + 1.0f) * std::exp(-h);
+  }
+  float x0 = std::sqrt(1.0f - cosZenith * cosZenith) * (X + h);
+  float c0 = std::sqrt(x0);
+  return scaleHeight * (2.0f * c0 * std::exp(X - x0) -
+                        c / (1.0f - c * cosZenith) * std::exp(-h));
+}
+
+static float chapmanSegment(const AtmosphereParameters &params, glm::vec3 from,
+                            glm::vec3 to, glm::vec3 ray, bool groundHit) {
+  glm::vec3 a = from - params.planetPosition;
+  glm::vec3 b = to - params.planetPosition;
+  float ra = glm::length(a);
+  float rb = glm::length(b);
+  float R = params.planetRadius;
+  if (groundHit) {
+    return std::max(chapman(params, rb - R, -glm::dot(b, ray) / rb) -
+                        chapman(params, ra - R, -glm::dot(a, ray) / ra),
+                    0.0f);
+  }
+  return std::max(chapman(params, ra - R, glm::dot(a, ray) / ra) -
+                      chapman(params, rb - R, glm::dot(b, ray) / rb),
+                  0.0f);
+}
+
+// Adaptive marching, see planMarch() in the shaders
+struct MarchSegment {
+  float start;
+  float length;
+  float rate;
+  float mass;
+  int samples;
+};
+
+static float marchHeight(const AtmosphereParameters &params, glm::vec3 point) {
+  return std::max(glm::length(point - params.planetPosition) -
+                      params.planetRadius,
+                  0.0f) /
+         (params.atmosphereRadius - params.planetRadius);
+}
+
+static MarchSegment marchSegment(const AtmosphereParameters &params,
+                                 glm::vec3 start, glm::vec3 ray, float from,
+                                 float to) {
+  MarchSegment s;
+  s.start = from;
+  s.length = to - from;
+  s.rate = 0.0f;
+  s.mass = 0.0f;
+  s.samples = 0;
+  if (s.length > 0.0f) {
+    float h0 = marchHeight(params, start + ray * from);
+    float h1 = marchHeight(params, start + ray * to);
+    s.rate = glm::clamp((h0 - h1) / (params.scaleDepth * s.length),
+                        -80.0f / s.length, 80.0f / s.length);
+
+    float x = s.rate * s.length;
+    s.mass = std::exp(-h0 / params.scaleDepth) *
+             (std::abs(x) < 1e-3f ? s.length : (std::exp(x) - 1.0f) / s.rate);
+  }
+  return s;
+}
+
+static int planMarch(const AtmosphereParameters &params, glm::vec3 start,
+                     glm::vec3 ray, float far, glm::vec2 shadow,
+                     MarchSegment segments[4]) {
+  float closest = glm::clamp(-glm::dot(start - params.planetPosition, ray),
+                             0.0f, far);
+  float beforeShadow = std::min(closest, shadow.x);
+  float afterShadow = std::max(closest, shadow.y);
+  segments[0] = marchSegment(params, start, ray, 0.0f, beforeShadow);
+  segments[1] = marchSegment(params, start, ray, beforeShadow, shadow.x);
+  segments[2] = marchSegment(params, start, ray, shadow.y, afterShadow);
+  segments[3] = marchSegment(params, start, ray, afterShadow, far);
+
+  float totalMass = 0.0f;
+  for (int k = 0; k < 4; k++) {
+    totalMass += segments[k].mass;
+  }
+
+  float litLength = far - (shadow.y - shadow.x);
+  int total = std::min(
+      (int)std::ceil(params.sampleDensity * litLength /
+                     (params.atmosphereRadius - params.planetRadius)),
+      params.samples);
+  int sampleCount = 0;
+  for (int k = 0; k < 4; k++) {
+    if (segments[k].length > 0.0f) {
+      segments[k].samples = std::max(
+          (int)std::round(total * segments[k].mass /
+                          std::max(totalMass, 1e-20f)),
+          1);
+      sampleCount += segments[k].samples;
+    }
+  }
+  return sampleCount;
+}
+
+static float marchDistance(const MarchSegment &s, float u) {
+  float x = s.rate * s.length;
+  return std::abs(x) < 1e-3f
+             ? u * s.length
+             : std::log(1.0f + u * (std::exp(x) - 1.0f)) / s.rate;
+}
+
+// Distance along the ray and length of sample i
+static glm::vec2 marchSample(const MarchSegment segments[4], int i) {
+  int k = 0;
+  while (k < 3 && i >= segments[k].samples) {
+    i -= segments[k].samples;
+    k++;
+  }
+  const MarchSegment &s = segments[k];
+  float j = (float)i;
+  float n = (float)s.samples;
+
+  float t0 = marchDistance(s, j / n);
+  float t1 = marchDistance(s, (j + 1.0f) / n);
+  return glm::vec2(s.start + marchDistance(s, (j + 0.5f) / n), t1 - t0);
+}
+
+// Adds the attenuated light of one sample to every bin. Plain loops over
+// arrays, so the compiler can spread the bins over SIMD lanes.
+static void addAttenuatedSpectrum(const SpectralBins &bins, float scatter,
+                                  float weight, float *spectrum) {
+  for (int i = 0; i < bins.count; i++) {
+    spectrum[i] += std::exp(-scatter * bins.extinction[i]) * weight;
+  }
+}
+
+glm::vec4 atmosphereColor(const AtmosphereParameters &params,
+                          glm::vec3 cameraPosition, glm::vec3 sunDirection,
+                          glm::vec3 position, const SpectralBins *spectrum) {
+  if (!params.enabled) {
+    return glm::vec4(0.0f);
+  }
+
+  glm::vec3 invWaveLength = inverseWaveLength(params);
+  float fSamples = (float)params.samples;
+  float shellDepth = params.atmosphereRadius - params.planetRadius;
+
+  glm::vec3 ray = position - cameraPosition;
+  float far = glm::length(ray);
+  ray /= far;
+
+  float near = raySphereIntersect(cameraPosition, ray, params.planetPosition,
+                                  params.atmosphereRadius);
+  glm::vec3 start = cameraPosition + ray * near;
+  far -= near;
+  float startDepth = std::exp(-1.0f / params.scaleDepth);
+  float startSunRayLength = raySphereIntersect(
+      start, sunDirection, params.planetPosition, params.atmosphereRadius);
+  float startOffset = -startDepth * startSunRayLength;
+
+  glm::vec2 shadow = shadowInterval(params, sunDirection, start, ray, far);
+  float litLength = far - (shadow.y - shadow.x);
+  float raySamples =
+      params.useChapmanFunction ? (float)params.chapmanSamples : fSamples;
+  int sampleCount = (int)std::ceil(raySamples * litLength / far);
+  float sampleLength = litLength / (float)std::max(sampleCount, 1);
+  bool groundHit = raySphereIntersect(start, ray, params.planetPosition,
+                                      params.planetRadius) > 0.0f;
+
+  MarchSegment segments[4];
+  if (params.adaptiveSampling) {
+    sampleCount = planMarch(params, start, ray, far, shadow, segments);
+  }
+
+  glm::vec3 extinction = invWaveLength * params.Kr * 4.0f * PI +
+                         glm::vec3(params.Km * 4.0f * PI);
+
+  glm::vec3 scatteringColor(0.0f);
+  float scatteringSpectrum[MAX_SPECTRAL_BINS] = {};
+  for (int i = 0; i < sampleCount; i++) {
+    float sampleDistance;
+    if (params.adaptiveSampling) {
+      glm::vec2 marchStep = marchSample(segments, i);
+      sampleDistance = marchStep.x;
+      sampleLength = marchStep.y;
+    } else {
+      sampleDistance = litDistance(shadow, (i + 0.5f) * sampleLength);
+    }
+    glm::vec3 samplePoint = start + ray * sampleDistance;
+    float height = glm::length(samplePoint - params.planetPosition);
+
+    float h = (height - params.planetRadius) / shellDepth;
+    float depth = std::exp(-h / params.scaleDepth);
+
+    float scatter;
+    if (params.useChapmanFunction) {
+      scatter = chapman(params, height - params.planetRadius,
+                        glm::dot(samplePoint - params.planetPosition,
+                                 sunDirection) /
+                            height) +
+                chapmanSegment(params, start, samplePoint, ray, groundHit);
+    } else {
+      float sunRayLength = raySphereIntersect(
+          samplePoint, sunDirection, params.planetPosition,
+          params.atmosphereRadius);
+      float cameraRayLength = raySphereIntersect(
+          samplePoint, -ray, params.planetPosition, params.atmosphereRadius);
+      scatter = (startOffset + depth * (sunRayLength - cameraRayLength));
+    }
+
+    if (spectrum) {
+      addAttenuatedSpectrum(*spectrum, scatter,
+                            depth * sampleLength / shellDepth,
+                            scatteringSpectrum);
+      continue;
+    }
+
+    glm::vec3 attenuate = glm::exp(-scatter * extinction);
+    scatteringColor += attenuate * (depth * sampleLength / shellDepth);
+  }
+
+  glm::vec3 toCamera = cameraPosition - position;
+  float theta = glm::dot(sunDirection, toCamera) / glm::length(toCamera);
+  float g = params.g;
+  float phase = 1.5f * ((1.0f - g * g) / (2.0f + g * g)) *
+                (1.0f + theta * theta) /
+                std::pow(1.0f + g * g - 2.0f * g * theta, 1.5f);
+
+  if (spectrum) {
+    for (int i = 0; i < spectrum->count; i++) {
+      scatteringSpectrum[i] *=
+          (spectrum->rayleigh[i] + phase * params.Km) * params.ESun;
+    }
+    glm::vec3 color = spectrumToRGB(*spectrum, scatteringSpectrum);
+    return glm::vec4(color, glm::length(color));
+  }
+
+  glm::vec3 rayleighColor = scatteringColor * invWaveLength * params.Kr *
+                            params.ESun;
+  glm::vec3 mieColor = scatteringColor * params.Km * params.ESun;
+  glm::vec3 color = rayleighColor + phase * mieColor;
+  return glm::vec4(color, glm::length(color));
+}
+
+glm::vec4 planetColor(const AtmosphereParameters &params,
+                      glm::vec3 cameraPosition, glm::vec3 sunDirection,
+                      glm::vec3 position, glm::vec4 textureColor,
+                      const SpectralBins *spectrum) {
+  if (!params.enabled) {
+    return textureColor;
+  }
+
+  glm::vec3 invWaveLength = inverseWaveLength(params);
+  float fSamples = (float)params.samples;
+  float shellDepth = params.atmosphereRadius - params.planetRadius;
+
+  glm::vec3 ray = position - cameraPosition;
+  float far = glm::length(ray);
+  ray /= far;
+
+  float near = raySphereIntersect(cameraPosition, ray, params.planetPosition,
+                                  params.atmosphereRadius);
+  glm::vec3 start = cameraPosition + ray * near;
+  far -= near;
+  float startDepth =
+      std::exp((params.planetRadius - params.atmosphereRadius) /
+               params.scaleDepth);
+
+  float positionSunRayLength = raySphereIntersect(
+      position, sunDirection, params.planetPosition, params.atmosphereRadius);
+  float positionCameraRayLength = raySphereIntersect(
+      position, -ray, params.planetPosition, params.atmosphereRadius);
+
+  float cameraOffset =
+      startDepth * (positionSunRayLength - positionCameraRayLength);
+
+  glm::vec2 shadow = shadowInterval(params, sunDirection, start, ray, far);
+  float litLength = far - (shadow.y - shadow.x);
+  float raySamples =
+      params.useChapmanFunction ? (float)params.chapmanSamples : fSamples;
+  int sampleCount = (int)std::ceil(raySamples * litLength / far);
+  float sampleLength = litLength / (float)std::max(sampleCount, 1);
+
+  MarchSegment segments[4];
+  if (params.adaptiveSampling) {
+    sampleCount = planMarch(params, start, ray, far, shadow, segments);
+  }
+  float meanSampleLength = far / (float)std::max(sampleCount, 1);
+
+  glm::vec3 extinction = invWaveLength * params.Kr * 4.0f * PI +
+                         glm::vec3(params.Km * 4.0f * PI);
+
+  glm::vec3 scatteringColor(0.0f);
+  glm::vec3 attenuate(0.0f);
+  float scatteringSpectrum[MAX_SPECTRAL_BINS] = {};
+  float attenuateSpectrum[MAX_SPECTRAL_BINS] = {};
+  for (int i = 0; i < sampleCount; i++) {
+    float sampleDistance;
+    if (params.adaptiveSampling) {
+      glm::vec2 marchStep = marchSample(segments, i);
+      sampleDistance = marchStep.x;
+      sampleLength = marchStep.y;
+    } else {
+      sampleDistance = litDistance(shadow, (i + 0.5f) * sampleLength);
+    }
+    glm::vec3 samplePoint = start + ray * sampleDistance;
+    float sampleWeight = sampleLength / meanSampleLength;
+    float height = glm::length(samplePoint - params.planetPosition);
+
+    float h = (height - params.planetRadius) / shellDepth;
+    float depth = std::exp(-h / params.scaleDepth);
+
+    float scatter;
+    if (params.useChapmanFunction) {
+      // The view ray ends on the ground
+      scatter = chapman(params, height - params.planetRadius,
+                        glm::dot(samplePoint - params.planetPosition,
+                                 sunDirection) /
+                            height) +
+                chapmanSegment(params, start, samplePoint, ray, true);
+    } else {
+      float sunRayLength = raySphereIntersect(
+          samplePoint, sunDirection, params.planetPosition,
+          params.atmosphereRadius);
+      float cameraRayLength = raySphereIntersect(
+          samplePoint, -ray, params.planetPosition, params.atmosphereRadius);
+      scatter = (cameraOffset + depth * (sunRayLength - cameraRayLength));
+    }
+
+    if (spectrum) {
+      addAttenuatedSpectrum(*spectrum, scatter, sampleWeight,
+                            attenuateSpectrum);
+      float weight = depth * sampleLength / shellDepth;
+      for (int b = 0; b < spectrum->count; b++) {
+        scatteringSpectrum[b] += attenuateSpectrum[b] * weight;
+      }
+      continue;
+    }
+
+    attenuate += glm::exp(-scatter * extinction) * sampleWeight;
+    scatteringColor += attenuate * (depth * sampleLength / shellDepth);
+  }
+
+  if (spectrum) {
+    // The transmittance of white light, and the scattered light
+    attenuate = spectrumToRGB(*spectrum, attenuateSpectrum);
+    for (int b = 0; b < spectrum->count; b++) {
+      scatteringSpectrum[b] *=
+          (spectrum->rayleigh[b] + params.Km) * params.ESun;
+    }
+    scatteringColor = spectrumToRGB(*spectrum, scatteringSpectrum);
+  } else {
+    scatteringColor *= invWaveLength * params.Kr * params.ESun +
+                       glm::vec3(params.Km * params.ESun);
+  }
+
+  glm::vec3 color =
+      glm::vec3(textureColor) * attenuate / (float)std::max(sampleCount, 1);
+  color += scatteringColor * 0.1f / (float)std::max(sampleCount, 1);
+  return glm::vec4(color, 1.0f);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "spectrum.hpp"
+#include <glm/glm.hpp>
+
+// The parameters of the scattering model. Every field mirrors a uniform of the
+// same name in res/shaders/atmosphere.frag and res/shaders/planet.frag, except
+// waveLengths, which is uploaded as invWaveLength.
+struct AtmosphereParameters {
+  int samples = 50;
+  float Kr = 0.0025f;
+  float Km = 0.0010f;
+  float ESun = 10.0f;
+  float g = -0.5f;
+  float scaleDepth = 0.25f;
+  float planetRadius = 10.0f;
+  float atmosphereRadius = 10.25f;
+  glm::vec3 planetPosition = glm::vec3(0.0f);
+  glm::vec3 waveLengths = glm::vec3(0.650f, 0.570f, 0.475f);
+  bool enabled = true;
+  bool adaptiveSampling = false;
+  // Samples per shell depth of path length when sampling adaptively, capped
+  // at `samples`
+  float sampleDensity = 8.0f;
+  // Number of wavelength bins in spectral mode, 0 scatters waveLengths in RGB
+  int spectralBins = 0;
+  // Optical depth from the Chapman function instead of the numeric
+  // approximation, marched with chapmanSamples samples
+  bool useChapmanFunction = false;
+  int chapmanSamples = 8;
+};
+
+// Distance along the ray (r0, rd) to the sphere (s0, sr). Returns the far
+// intersection when r0 is inside the sphere and -1 when the ray misses.
+float raySphereIntersect(glm::vec3 r0, glm::vec3 rd, glm::vec3 s0, float sr);
+
+// CPU versions of main() in atmosphere.frag and planet.frag. `position` is the
+// world space fragment position, `textureColor` the sampled earth texture.
+// Scattering is spectral when `spectrum` is given.
+glm::vec4 atmosphereColor(const AtmosphereParameters &params,
+                          glm::vec3 cameraPosition, glm::vec3 sunDirection,
+                          glm::vec3 position,
+                          const SpectralBins *spectrum = nullptr);
+glm::vec4 planetColor(const AtmosphereParameters &params,
+                      glm::vec3 cameraPosition, glm::vec3 sunDirection,
+                      glm::vec3 position, glm::vec4 textureColor,
+                      const SpectralBins *spectrum = nullptr);
@@ -0,0 +1,93 @@
+#include "spectrum.hpp"
+#include <algorithm>
+#include <cmath>
+
+static const float PI = 3.14159f;
+
+// Visible range covered by the bins, in nanometres
+static const float MIN_WAVE_LENGTH = 380.0f;
+static const float MAX_WAVE_LENGTH = 720.0f;
+
+// Steps used to integrate the colour matching functions over each bin
+static const int BIN_INTEGRATION_STEPS = 16;
+
+static int roundUpToGroups(int count) {
+  int groups = (count + SPECTRAL_GROUP_SIZE - 1) / SPECTRAL_GROUP_SIZE;
+  return glm::clamp(groups, 1, MAX_SPECTRAL_GROUPS) * SPECTRAL_GROUP_SIZE;
+}
+
+// Piecewise Gaussian used by the colour matching function fit
+static float lobe(float x, float mean, float sigmaBelow, float sigmaAbove) {
+  float t = (x - mean) / (x < mean ? sigmaBelow : sigmaAbove);
+  return std::exp(-0.5f * t * t);
+}
+
+// CIE 1931 colour matching functions, using the multi-lobe fit from "Simple
+// Analytic Approximations to the CIE XYZ Color Matching Functions" (Wyman,
+// Sloan and Shirley, 2013)
+static glm::vec3 colorMatchingFunctions(float waveLength) {
+  float x = 1.056f * lobe(waveLength, 599.8f, 37.9f, 31.0f) +
+            0.362f * lobe(waveLength, 442.0f, 16.0f, 26.7f) -
+            0.065f * lobe(waveLength, 501.1f, 20.4f, 26.2f);
+  float y = 0.821f * lobe(waveLength, 568.8f, 46.9f, 40.5f) +
+            0.286f * lobe(waveLength, 530.9f, 16.3f, 31.1f);
+  float z = 1.217f * lobe(waveLength, 437.0f, 11.8f, 36.0f) +
+            0.681f * lobe(waveLength, 459.0f, 26.0f, 13.8f);
+  return glm::vec3(x, y, z);
+}
+
+static glm::vec3 xyzToLinearRGB(glm::vec3 xyz) {
+  return glm::vec3(3.2406f * xyz.x - 1.5372f * xyz.y - 0.4986f * xyz.z,
+                   -0.9689f * xyz.x + 1.8758f * xyz.y + 0.0415f * xyz.z,
+                   0.0557f * xyz.x - 0.2040f * xyz.y + 1.0570f * xyz.z);
+}
+
+SpectralBins makeSpectralBins(int count, float Kr, float Km) {
+  SpectralBins bins;
+  bins.count = roundUpToGroups(count);
+  bins.Kr = Kr;
+  bins.Km = Km;
+
+  float binWidth = (MAX_WAVE_LENGTH - MIN_WAVE_LENGTH) / bins.count;
+  glm::vec3 total(0.0f);
+  for (int i = 0; i < bins.count; i++) {
+    float binStart = MIN_WAVE_LENGTH + i * binWidth;
+
+    glm::vec3 xyz(0.0f);
+    for (int j = 0; j < BIN_INTEGRATION_STEPS; j++) {
+      xyz += colorMatchingFunctions(
+          binStart + (j + 0.5f) * binWidth / BIN_INTEGRATION_STEPS);
+    }
+    bins.toRGB[i] = xyzToLinearRGB(xyz);
+    total += bins.toRGB[i];
+
+    float waveLength = (binStart + 0.5f * binWidth) / 1000.0f;
+    bins.waveLengths[i] = waveLength;
+    bins.rayleigh[i] = Kr / std::pow(waveLength, 4.0f);
+    bins.extinction[i] = (bins.rayleigh[i] + Km) * 4.0f * PI;
+  }
+
+  // White balance, so that a sun with the same intensity in every bin is
+  // white like in RGB mode
+  for (int i = 0; i < bins.count; i++) {
+    bins.toRGB[i] /= total;
+  }
+  return bins;
+}
+
+bool spectralBinsMatch(const SpectralBins &bins, int count, float Kr,
+                       float Km) {
+  return bins.count == roundUpToGroups(count) && bins.Kr == Kr && bins.Km == Km;
+}
+
+int spectralGroupCount(const SpectralBins &bins) {
+  return bins.count / SPECTRAL_GROUP_SIZE;
+}
+
+glm::vec3 spectrumToRGB(const SpectralBins &bins, const float *spectrum) {
+  glm::vec3 rgb(0.0f);
+  for (int i = 0; i < bins.count; i++) {
+    rgb += bins.toRGB[i] * spectrum[i];
+  }
+  return rgb;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Spectral scattering splits the visible range into bins that are scattered
+// separately and converted to RGB at the end. Bins come in groups of four,
+// which the shaders process as vec4s.
+const int SPECTRAL_GROUP_SIZE = 4;
+const int MAX_SPECTRAL_GROUPS = 4;
+const int MAX_SPECTRAL_BINS = SPECTRAL_GROUP_SIZE * MAX_SPECTRAL_GROUPS;
+
+// Per bin constants, padded with zeros up to MAX_SPECTRAL_BINS so that loops
+// over whole groups need no special cases. The arrays are laid out to be
+// uploaded as is, to vec4 and mat4x3 uniform arrays.
+struct SpectralBins {
+  int count = 0;
+  float Kr = 0.0f;
+  float Km = 0.0f;
+
+  // Centre of each bin in micrometres, like AtmosphereParameters::waveLengths
+  float waveLengths[MAX_SPECTRAL_BINS] = {};
+  // Kr / wavelength^4
+  float rayleigh[MAX_SPECTRAL_BINS] = {};
+  // 4 PI (rayleigh + Km)
+  float extinction[MAX_SPECTRAL_BINS] = {};
+  // Linear RGB contribution of each bin. A flat spectrum maps to white.
+  glm::vec3 toRGB[MAX_SPECTRAL_BINS] = {};
+};
+
+// `count` is rounded up to a whole number of groups and clamped to
+// MAX_SPECTRAL_BINS
+SpectralBins makeSpectralBins(int count, float Kr, float Km);
+
+bool spectralBinsMatch(const SpectralBins &bins, int count, float Kr, float Km);
+
+int spectralGroupCount(const SpectralBins &bins);
+
+glm::vec3 spectrumToRGB(const SpectralBins &bins, const float *spectrum);
@@ -0,0 +1,131 @@
+#include "bodies.hpp"
+#include <cmath>
+#include <cstring>
+
+static const float PI = 3.14159265f;
+
+BodyDescriptor bodyDescriptor(const BodyParameters &parameters,
+                              const glm::mat4 &model, uint32_t flags) {
+  BodyDescriptor descriptor;
+  descriptor.model = model;
+  descriptor.planetRadius = parameters.planetRadius;
+  descriptor.atmosphereRadius = parameters.atmosphereRadius;
+  descriptor.Kr = parameters.Kr;
+  descriptor.Km = parameters.Km;
+  descriptor.ESun = parameters.ESun;
+  descriptor.g = parameters.g;
+  descriptor.scaleDepth = parameters.scaleDepth;
+  descriptor.flags = flags;
+  glm::vec3 waveLengths = parameters.waveLengths;
+  descriptor.invWaveLength =
+      1.0f / (waveLengths * waveLengths * waveLengths * waveLengths);
+  // Set, so that descriptors compare equal byte for byte
+  descriptor.padding = 0.0f;
+  return descriptor;
+}
+
+bool updateBodyDescriptors(const std::vector<Body> &bodies,
+                           const BodyParameters &tableParameters,
+                           std::vector<BodyDescriptor> &descriptors) {
+  bool changed = descriptors.size() != bodies.size();
+  descriptors.resize(bodies.size());
+  for (std::size_t i = 0; i < bodies.size(); i++) {
+    const Body &body = bodies[i];
+    SceneNode *node = sceneNodes.get(body.node);
+    glm::mat4 model =
+        node ? sceneTransforms.world(node->transform) : glm::mat4(1.0f);
+    uint32_t flags = sameAtmosphere(body.parameters, tableParameters)
+                         ? BODY_USES_TABLES
+                         : 0;
+    BodyDescriptor descriptor = bodyDescriptor(body.parameters, model, flags);
+    if (std::memcmp(&descriptor, &descriptors[i], sizeof(descriptor)) != 0) {
+      descriptors[i] = descriptor;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+void applyBodyParameters(const BodyParameters &parameters,
+                         AtmosphereParameters &params) {
+  params.planetRadius = parameters.planetRadius;
+  params.atmosphereRadius = parameters.atmosphereRadius;
+  params.Kr = parameters.Kr;
+  params.Km = parameters.Km;
+  params.ESun = parameters.ESun;
+  params.g = parameters.g;
+  params.scaleDepth = parameters.scaleDepth;
+  params.waveLengths = parameters.waveLengths;
+}
+
+bool sameAtmosphere(const BodyParameters &a, const BodyParameters &b) {
+  return a.planetRadius == b.planetRadius &&
+         a.atmosphereRadius == b.atmosphereRadius && a.Kr == b.Kr &&
+         a.Km == b.Km && a.ESun == b.ESun && a.g == b.g &&
+         a.scaleDepth == b.scaleDepth && a.waveLengths == b.waveLengths;
+}
+
+BodyParameters randomMoon(const BodyParameters &planet, std::mt19937 &random) {
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  BodyParameters moon = planet;
+  moon.planetRadius = planet.planetRadius * (0.05f + 0.15f * unit(random));
+  // The shell is as thick relative to the moon as the planet's, give or take
+  float shell = planet.atmosphereRadius / planet.planetRadius - 1.0f;
+  moon.atmosphereRadius =
+      moon.planetRadius * (1.0f + shell * (0.5f + 1.5f * unit(random)));
+  moon.Kr = planet.Kr * (0.25f + 1.75f * unit(random));
+  moon.Km = planet.Km * (0.25f + 1.75f * unit(random));
+  moon.scaleDepth = planet.scaleDepth * (0.5f + unit(random));
+  // Shifting the wavelengths tints the sky
+  moon.waveLengths *= glm::vec3(0.85f) + 0.3f * glm::vec3(unit(random),
+                                                          unit(random),
+                                                          unit(random));
+  return moon;
+}
+
+SceneNodeHandle createMoonNodes(SceneNodePool &nodes,
+                                SceneTransforms &transforms,
+                                const SceneNode &appearance, float meshRadius,
+                                const BodyParameters &planet,
+                                unsigned int count, std::vector<Body> &bodies) {
+  SceneNodeHandle moonsNode = nodes.create();
+  std::vector<SceneNodeHandle> moonNodes = nodes.create(2 * count);
+
+  std::mt19937 random(4230);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  for (unsigned int i = 0; i < count; i++) {
+    Body moon;
+    moon.node = moonNodes[2 * i];
+    moon.parameters = randomMoon(planet, random);
+    unsigned int body = (unsigned int)bodies.size();
+    bodies.push_back(moon);
+
+    SceneNode *planetNode = nodes.get(moonNodes[2 * i]);
+    SceneNode *atmosphereNode = nodes.get(moonNodes[2 * i + 1]);
+    for (SceneNode *node : {planetNode, atmosphereNode}) {
+      node->vertexArrayObjectID = appearance.vertexArrayObjectID;
+      node->VAOIndexCount = appearance.VAOIndexCount;
+      node->quantization = appearance.quantization;
+      node->textureID = appearance.textureID;
+      node->body = body;
+      node->boundingRadius = meshRadius;
+    }
+    atmosphereNode->nodeType = SceneNodeType::ATMOSPHERE;
+    nodes.addChild(moonsNode, moonNodes[2 * i]);
+    nodes.addChild(moonNodes[2 * i], moonNodes[2 * i + 1]);
+
+    // Uniformly spread over the directions, between 3 and 20 planet radii out
+    float z = 2.0f * unit(random) - 1.0f;
+    float angle = 2.0f * PI * unit(random);
+    float ring = std::sqrt(1.0f - z * z);
+    glm::vec3 direction(ring * std::cos(angle), ring * std::sin(angle), z);
+    float distance = meshRadius * (3.0f + 17.0f * unit(random));
+    transforms.setPosition(planetNode->transform, direction * distance);
+    transforms.setScale(planetNode->transform,
+                        glm::vec3(moon.parameters.planetRadius / meshRadius));
+    transforms.setScale(atmosphereNode->transform,
+                        glm::vec3(moon.parameters.atmosphereRadius /
+                                  moon.parameters.planetRadius));
+  }
+  return moonsNode;
+}
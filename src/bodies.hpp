@@ -0,0 +1,85 @@
+#pragma once
+
+#include "atmosphere/scattering.hpp"
+#include "sceneGraph.hpp"
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <random>
+#include <vector>
+
+// The constants that set one planet or moon apart from another. Those shared
+// by every body, like the number of samples, stay in AtmosphereParameters.
+struct BodyParameters {
+  float planetRadius = 10.0f;
+  float atmosphereRadius = 10.25f;
+  float Kr = 0.0025f;
+  float Km = 0.0010f;
+  float ESun = 10.0f;
+  float g = -0.5f;
+  float scaleDepth = 0.25f;
+  glm::vec3 waveLengths = glm::vec3(0.650f, 0.570f, 0.475f);
+};
+
+// A planet or moon, placed by its planet node. The nodes that draw it, the
+// planet node and the atmosphere node under it, name it by its index.
+struct Body {
+  SceneNodeHandle node;
+  BodyParameters parameters;
+};
+
+// The scattering tables and wavelength bins were made for the body's
+// constants, so the shaders may use them
+const uint32_t BODY_USES_TABLES = 1;
+
+// A body as the shaders read it from the body buffer, laid out by the std430
+// rules. See struct Body in planet.frag.
+struct BodyDescriptor {
+  glm::mat4 model;
+  float planetRadius;
+  float atmosphereRadius;
+  float Kr;
+  float Km;
+  float ESun;
+  float g;
+  float scaleDepth;
+  uint32_t flags;
+  glm::vec3 invWaveLength;
+  float padding;
+};
+static_assert(sizeof(BodyDescriptor) == 112,
+              "BodyDescriptor has to match the std430 layout of Body");
+
+// `model` is the world matrix of the body's planet node
+BodyDescriptor bodyDescriptor(const BodyParameters &parameters,
+                              const glm::mat4 &model, uint32_t flags);
+
+// Rebuilds the descriptors of the bodies from their parameters and the world
+// matrices in sceneTransforms. The tables were made for `tableParameters`.
+// Returns whether any descriptor changed, so that an unchanged buffer is not
+// uploaded again.
+bool updateBodyDescriptors(const std::vector<Body> &bodies,
+                           const BodyParameters &tableParameters,
+                           std::vector<BodyDescriptor> &descriptors);
+
+// Copies the body's constants over those in params
+void applyBodyParameters(const BodyParameters &parameters,
+                         AtmosphereParameters &params);
+
+// Whether tables made for the one set of constants hold for the other
+bool sameAtmosphere(const BodyParameters &a, const BodyParameters &b);
+
+// A moon of between a twentieth and a fifth of the planet's radius, with an
+// atmosphere of its own
+BodyParameters randomMoon(const BodyParameters &planet, std::mt19937 &random);
+
+// Creates `count` moons around a planet with the given constants, each a
+// planet node and an atmosphere node under it that draw what `appearance`
+// draws. meshRadius is the radius of the sphere appearance's mesh has. The
+// nodes are created in one go, next to each other in the pool, under a new
+// node that is returned. Their bodies are appended to `bodies`, and the same
+// count gives the same moons.
+SceneNodeHandle createMoonNodes(SceneNodePool &nodes,
+                                SceneTransforms &transforms,
+                                const SceneNode &appearance, float meshRadius,
+                                const BodyParameters &planet,
+                                unsigned int count, std::vector<Body> &bodies);
@@ -0,0 +1,233 @@
+#include "boundingVolumeHierarchy.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Objects per leaf. Testing a few spheres is cheaper than another level.
+const unsigned int LEAF_SIZE = 4;
+const unsigned int NO_OBJECT = 0xffffffff;
+const unsigned int NO_BOX = 0xffffffff;
+
+static double surfaceArea(glm::vec3 min, glm::vec3 max) {
+  glm::vec3 size = glm::max(max - min, glm::vec3(0.0f));
+  return 2.0 * (double(size.x) * size.y + double(size.y) * size.z +
+                double(size.z) * size.x);
+}
+
+BoundingVolumeHierarchy::Object
+BoundingVolumeHierarchy::object(SceneNode &node,
+                                const SceneTransforms &transforms) const {
+  const glm::mat4 &world = transforms.world(node.transform);
+  // The sphere grows with the largest of the scales
+  float scale = std::max(glm::length(glm::vec3(world[0])),
+                         std::max(glm::length(glm::vec3(world[1])),
+                                  glm::length(glm::vec3(world[2]))));
+  Object object;
+  object.center = glm::vec3(world * glm::vec4(node.boundingCenter, 1.0f));
+  object.radius = node.boundingRadius * scale;
+  object.transform = node.transform;
+  return object;
+}
+
+void BoundingVolumeHierarchy::build(SceneNodePool &nodes,
+                                    const SceneTransforms &transforms) {
+  mObjects.clear();
+  for (unsigned int index = 0; index < nodes.capacity(); index++) {
+    if (nodes.alive(index) && nodes[index].boundingRadius > 0.0f) {
+      Object object = this->object(nodes[index], transforms);
+      object.node = index;
+      mObjects.push_back(object);
+    }
+  }
+
+  unsigned int count = (unsigned int)mObjects.size();
+  mBoxes.clear();
+  mParents.clear();
+  mBoxes.reserve(2 * (count / LEAF_SIZE + 1));
+  mParents.reserve(2 * (count / LEAF_SIZE + 1));
+  mLeaves.assign(count, NO_BOX);
+  mArea = 0.0;
+  if (count > 0) {
+    buildBox(0, count, NO_BOX);
+  }
+  mBuiltArea = mArea;
+  mQueued.assign(mBoxes.size(), false);
+
+  // The objects are in their final order once every leaf is built
+  mObjectOfTransform.assign(mObjectOfTransform.size(), NO_OBJECT);
+  for (unsigned int i = 0; i < count; i++) {
+    unsigned int transform = mObjects[i].transform;
+    if (transform >= mObjectOfTransform.size()) {
+      mObjectOfTransform.resize(transform + 1, NO_OBJECT);
+    }
+    mObjectOfTransform[transform] = i;
+  }
+
+  mBuilt = true;
+  mVersion = nodes.version();
+}
+
+// Splits the objects at the median of their centres along the axis the
+// centres spread the most on
+unsigned int BoundingVolumeHierarchy::buildBox(unsigned int first,
+                                               unsigned int count,
+                                               unsigned int parent) {
+  unsigned int index = (unsigned int)mBoxes.size();
+  mBoxes.emplace_back();
+  mParents.push_back(parent);
+  mBoxes[index].first = first;
+  mBoxes[index].count = count;
+  mBoxes[index].second = 0;
+
+  if (count <= LEAF_SIZE) {
+    for (unsigned int i = first; i < first + count; i++) {
+      mLeaves[i] = index;
+    }
+    mArea += fit(index);
+    return index;
+  }
+
+  glm::vec3 min = mObjects[first].center;
+  glm::vec3 max = min;
+  for (unsigned int i = first + 1; i < first + count; i++) {
+    min = glm::min(min, mObjects[i].center);
+    max = glm::max(max, mObjects[i].center);
+  }
+  glm::vec3 extent = max - min;
+  int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                 : (extent.y > extent.z ? 1 : 2);
+
+  unsigned int half = count / 2;
+  std::nth_element(mObjects.begin() + first, mObjects.begin() + first + half,
+                   mObjects.begin() + first + count,
+                   [axis](const Object &a, const Object &b) {
+                     return a.center[axis] < b.center[axis];
+                   });
+  buildBox(first, half, index);
+  unsigned int second = buildBox(first + half, count - half, index);
+  mBoxes[index].second = second;
+  mArea += fit(index);
+  return index;
+}
+
+double BoundingVolumeHierarchy::fit(unsigned int index) {
+  Box &box = mBoxes[index];
+  if (box.second == 0) {
+    const Object &firstObject = mObjects[box.first];
+    box.min = firstObject.center - firstObject.radius;
+    box.max = firstObject.center + firstObject.radius;
+    box.maxRadius = firstObject.radius;
+    for (unsigned int i = box.first + 1; i < box.first + box.count; i++) {
+      const Object &object = mObjects[i];
+      box.min = glm::min(box.min, object.center - object.radius);
+      box.max = glm::max(box.max, object.center + object.radius);
+      box.maxRadius = std::max(box.maxRadius, object.radius);
+    }
+  } else {
+    const Box &a = mBoxes[index + 1];
+    const Box &b = mBoxes[box.second];
+    box.min = glm::min(a.min, b.min);
+    box.max = glm::max(a.max, b.max);
+    box.maxRadius = std::max(a.maxRadius, b.maxRadius);
+  }
+  return surfaceArea(box.min, box.max);
+}
+
+unsigned int
+BoundingVolumeHierarchy::update(SceneNodePool &nodes,
+                                const SceneTransforms &transforms) {
+  if (!mBuilt || nodes.version() != mVersion) {
+    build(nodes, transforms);
+    return boxCount();
+  }
+
+  mRefit.clear();
+  for (unsigned int transform : transforms.changed()) {
+    if (transform >= mObjectOfTransform.size() ||
+        mObjectOfTransform[transform] == NO_OBJECT) {
+      continue;
+    }
+    Object &object = mObjects[mObjectOfTransform[transform]];
+    Object moved = this->object(nodes[object.node], transforms);
+    object.center = moved.center;
+    object.radius = moved.radius;
+
+    // Every box above the object, up to one already queued
+    for (unsigned int box = mLeaves[mObjectOfTransform[transform]];
+         box != NO_BOX && !mQueued[box]; box = mParents[box]) {
+      mQueued[box] = true;
+      mRefit.push_back(box);
+    }
+  }
+
+  // Children come after their parents, so going from the last box back
+  // refits every child before its parent
+  std::sort(mRefit.begin(), mRefit.end());
+  for (unsigned int i = (unsigned int)mRefit.size(); i-- > 0;) {
+    unsigned int box = mRefit[i];
+    mArea -= surfaceArea(mBoxes[box].min, mBoxes[box].max);
+    mArea += fit(box);
+    mQueued[box] = false;
+  }
+
+  if (mArea > 2.0 * mBuiltArea) {
+    build(nodes, transforms);
+    return boxCount();
+  }
+  return (unsigned int)mRefit.size();
+}
+
+BVHCullStats
+BoundingVolumeHierarchy::cull(const CullView &view,
+                              const std::function<void(unsigned int)> &visible)
+    const {
+  BVHCullStats stats;
+  if (mBoxes.empty()) {
+    return stats;
+  }
+
+  // A sphere of radius r at distance d covers about r * projectionScale / d
+  // of the viewport's height
+  float smallDistance = view.projectionScale / view.minScreenSize;
+
+  // Splitting at the median keeps the tree balanced, so it is never nearly
+  // this deep
+  unsigned int stack[64];
+  unsigned int stackSize = 0;
+  stack[stackSize++] = 0;
+  while (stackSize > 0) {
+    unsigned int index = stack[--stackSize];
+    const Box &box = mBoxes[index];
+    stats.visited++;
+    if (boxOutsideFrustum(view.frustum, box.min, box.max)) {
+      stats.frustumCulled += box.count;
+      continue;
+    }
+    // No sphere in the box is nearer than the box
+    glm::vec3 nearest = glm::clamp(view.cameraPosition, box.min, box.max);
+    float distance = glm::length(nearest - view.cameraPosition);
+    if (distance > box.maxRadius * smallDistance) {
+      stats.smallCulled += box.count;
+      continue;
+    }
+
+    if (box.second != 0) {
+      stack[stackSize++] = box.second;
+      stack[stackSize++] = index + 1;
+      continue;
+    }
+    for (unsigned int i = box.first; i < box.first + box.count; i++) {
+      const Object &object = mObjects[i];
+      stats.visited++;
+      if (sphereOutsideFrustum(view.frustum, object.center, object.radius)) {
+        stats.frustumCulled++;
+      } else if (glm::length(object.center - view.cameraPosition) >
+                 object.radius * smallDistance) {
+        stats.smallCulled++;
+      } else {
+        stats.visible++;
+        visible(object.node);
+      }
+    }
+  }
+  return stats;
+}
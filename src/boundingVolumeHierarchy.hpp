@@ -0,0 +1,98 @@
+#pragma once
+
+#include "sceneGraph.hpp"
+#include <functional>
+#include <glm/glm.hpp>
+#include <utilities/frustum.hpp>
+#include <vector>
+
+// What the camera sees, for BoundingVolumeHierarchy::cull()
+struct CullView {
+  // In world space
+  Frustum frustum;
+  glm::vec3 cameraPosition;
+  // projection[1][1], one over the tangent of half the vertical field of view
+  float projectionScale;
+  // Nodes that would cover less than this fraction of the viewport's height
+  // are culled
+  float minScreenSize;
+};
+
+struct BVHCullStats {
+  // Boxes and bounding spheres tested
+  unsigned int visited = 0;
+  // Scene nodes culled by each test, and those left
+  unsigned int frustumCulled = 0;
+  unsigned int smallCulled = 0;
+  unsigned int visible = 0;
+};
+
+// The world space bounding spheres of the scene nodes, in a binary tree of
+// axis aligned boxes. A box that is outside the frustum, or too far away for
+// the largest sphere in it to be seen, is culled with everything in it, so
+// culling visits about as many boxes as it takes to reach what is visible.
+//
+// Boxes are stored depth first, so that an inner box is followed by its first
+// child and comes before all of its subtree.
+class BoundingVolumeHierarchy {
+public:
+  // Builds the tree again when nodes were created or destroyed since the last
+  // call. Otherwise, moves the spheres of the nodes whose world matrices the
+  // last transforms.update() recomputed, and refits the boxes above them.
+  // Refitting loosens the tree as nodes move apart, so it is built again
+  // once the boxes have grown to twice the area they had when built. Returns
+  // the number of boxes built or refitted.
+  unsigned int update(SceneNodePool &nodes, const SceneTransforms &transforms);
+  // From every live node with a bounding radius
+  void build(SceneNodePool &nodes, const SceneTransforms &transforms);
+
+  // Calls visible with the pool index of every scene node that may be seen
+  BVHCullStats cull(const CullView &view,
+                    const std::function<void(unsigned int)> &visible) const;
+
+  unsigned int objectCount() const { return (unsigned int)mObjects.size(); }
+  unsigned int boxCount() const { return (unsigned int)mBoxes.size(); }
+
+private:
+  struct Object {
+    glm::vec3 center;
+    float radius;
+    unsigned int node;
+    unsigned int transform;
+  };
+
+  struct Box {
+    glm::vec3 min;
+    // Of the largest sphere in the box
+    float maxRadius;
+    glm::vec3 max;
+    // The objects in the box are [first, first + count). An inner box's
+    // children are the box after it and `second`, which is 0 for leaves.
+    unsigned int first;
+    unsigned int count;
+    unsigned int second;
+  };
+
+  unsigned int buildBox(unsigned int first, unsigned int count,
+                        unsigned int parent);
+  // Fits the box around its objects or children, and returns its new area
+  double fit(unsigned int box);
+  Object object(SceneNode &node, const SceneTransforms &transforms) const;
+
+  std::vector<Object> mObjects;
+  std::vector<Box> mBoxes;
+  std::vector<unsigned int> mParents;
+  // The leaf box of each object, and the object of each transform id
+  std::vector<unsigned int> mLeaves;
+  std::vector<unsigned int> mObjectOfTransform;
+
+  bool mBuilt = false;
+  unsigned int mVersion = 0;
+  // Total surface area of the boxes, now and when built
+  double mArea = 0.0;
+  double mBuiltArea = 0.0;
+
+  // Boxes to refit, and whether each is already among them
+  std::vector<unsigned int> mRefit;
+  std::vector<bool> mQueued;
+};
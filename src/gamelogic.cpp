@@ -1,11 +1,26 @@
 #include "gamelogic.h"
+#include "atmosphere/cpuRenderer.hpp"
+#include "atmosphere/opticalDepth.hpp"
+#include "atmosphere/precomputedScattering.hpp"
+#include "atmosphere/spectrum.hpp"
+#include "bodies.hpp"
+#include "boundingVolumeHierarchy.hpp"
 #include "imgui.h"
+#include "planet/quadtree.hpp"
+#include "renderQueue.hpp"
 #include "sceneGraph.hpp"
+#include "utilities/assetLoader.hpp"
+#include "utilities/blockCompression.hpp"
 #include "utilities/camera.hpp"
 #include "utilities/imageLoader.hpp"
 #include <GLFW/glfw3.h>
 #include <SFML/Audio/Sound.hpp>
 #include <SFML/Audio/SoundBuffer.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
 #include <fmt/format.h>
 #include <glad/glad.h>
 #include <glm/gtc/matrix_transform.hpp>
@@ -13,9 +28,22 @@
 #include <glm/vec3.hpp>
 #include <utilities/glutils.h>
 #include <utilities/mesh.h>
+#include <utilities/meshFile.hpp>
+#include <utilities/meshOptimizer.hpp>
+#include <utilities/packedMesh.hpp>
 #include <utilities/shader.hpp>
 #include <utilities/shapes.h>
+#include <utilities/textureFile.hpp>
 #include <utilities/timeutils.h>
+#include <utilities/virtualTexture.hpp>
+// From EXT_texture_compression_s3tc, which is not part of core OpenGL and
+// is checked for in initGame()
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
 #define GLM_ENABLE_EXPERIMENTAL
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -23,12 +51,124 @@
 #include <glm/gtx/transform.hpp>
 
 Gloom::Camera *camera;
-SceneNode *rootNode;
-SceneNode *planetNode;
-SceneNode *atmosphereNode;
+SceneNodeHandle rootNode;
+SceneNodeHandle planetNode;
+SceneNodeHandle atmosphereNode;
 
 Gloom::Shader *planetShader;
 Gloom::Shader *atmopshereShader;
+Gloom::Shader *planetQuadtreeShader;
+
+// The scene's draws, sorted by the state they need and submitted through a
+// cache of that state. The shaders are named by their index in the queue.
+RenderQueue renderQueue;
+GLStateCache glState;
+unsigned int planetShaderIndex;
+unsigned int atmosphereShaderIndex;
+unsigned int planetQuadtreeShaderIndex;
+RenderQueueStats renderQueueStats;
+
+// The earth is body 0 and the moons follow. Their descriptors are uploaded to
+// the body buffer, bound to shader storage binding 0.
+std::vector<Body> bodies;
+std::vector<BodyDescriptor> bodyDescriptors;
+unsigned int bodyBufferID;
+SceneNodeHandle moonsNode;
+unsigned int moonsCreated = 0;
+
+OpticalDepthTable opticalDepthTable;
+unsigned int opticalDepthTextureID;
+
+ScatteringTables scatteringTables;
+unsigned int transmittanceTextureID;
+unsigned int singleScatteringTextureID;
+unsigned int multipleScatteringTextureID;
+
+SpectralBins spectralBins;
+
+// Planet surface level of detail, selected every frame in updateFrame()
+QuadtreeSettings quadtreeSettings;
+QuadtreeSelection quadtreeSelection;
+glm::vec3 quadtreeCameraPosition;
+unsigned int chunkGridVAO;
+unsigned int chunkQuadrantIndexCount;
+
+// Locations of the chunk uniforms in planetQuadtreeShader, which are set for
+// every chunk drawn
+struct ChunkUniforms {
+  GLint faceNormal;
+  GLint faceU;
+  GLint faceV;
+  GLint chunkOrigin;
+  GLint chunkSize;
+  GLint morphRange;
+  GLint gridResolution;
+  GLint localCameraPosition;
+};
+ChunkUniforms chunkUniforms;
+
+// The sphere's meshlets, culled every frame in drawItem()
+std::vector<Meshlet> sphereMeshlets;
+std::vector<DrawElementsIndirectCommand> meshletCommands;
+MeshletCullStats planetMeshletStats;
+MeshletCullStats atmosphereMeshletStats;
+
+// Loads the assets on worker threads while the first frames are drawn, and is
+// deleted once everything is uploaded. The tables are rebuilt on the GL thread
+// when the sliders move, except while the first ones are still loading.
+AssetLoader *assetLoader = nullptr;
+bool opticalDepthTableLoading = false;
+bool scatteringTablesLoading = false;
+bool firstFrameRendered = false;
+
+// The earth texture as tiles, of which the tile cache on texture unit 5 holds
+// the ones the feedback pass asks for. The tile table on unit 6 points the
+// planet shaders to them.
+VirtualTextureFile earthTiles;
+VirtualTextureCache *virtualTextureCache = nullptr;
+bool earthTilesLoading = false;
+// Whether the whole earth texture has been asked for, see loadEarthTexture()
+bool earthTextureRequested = false;
+unsigned int virtualTileCacheTextureID;
+unsigned int virtualTileTableTextureID;
+
+// Whether the driver samples BC1 and BC3 textures. Without it they are
+// decompressed before upload.
+bool s3tcSupported = false;
+
+// The feedback pass renders the tile each pixel needs into a small
+// framebuffer, read back through two pixel buffers a frame later so that the
+// read never waits for the GPU
+unsigned int feedbackFramebufferID;
+unsigned int feedbackRenderbuffers[2];
+unsigned int feedbackPixelBuffers[2];
+int feedbackWidth = 0;
+int feedbackHeight = 0;
+unsigned int feedbackFrameCount = 0;
+bool renderingFeedback = false;
+
+// Kept on the CPU to compare integrators with renderFrameCPU(), loaded the
+// first time it is needed
+PNGImage earthImage;
+
+// GPU time of the scene, measured with two queries so that reading one never
+// waits for the frame that is still in flight
+unsigned int frameTimeQueries[2];
+unsigned int frameCount = 0;
+double sceneGPUTime = 0.0;
+// World matrices recomputed by the last update of the scene's transformations
+unsigned int transformsUpdated = 0;
+
+// The bounds of the scene nodes, and what culling them left out last frame
+BoundingVolumeHierarchy sceneBounds;
+unsigned int boundsUpdated = 0;
+BVHCullStats sceneCullStats;
+
+// Last comparison of the Chapman integrator against the numeric loop
+bool integratorErrorMeasured = false;
+float chapmanError = 0.0f;
+double numericCPUTime = 0.0;
+double chapmanCPUTime = 0.0;
 
 glm::mat4 VP;
 
@@ -36,30 +176,115 @@ glm::mat4 VP;
 const float PI = 3.14159265359f;
 
 const int SAMPLES = 50;
-const float g = -0.5f;
 const float planetRadius = 10.0;
-const glm::vec3 waveLengths = glm::vec3(0.650f, 0.570f, 0.475f);
+const std::string cacheDirectory = "../res/cache";
+const std::string earthTextureFile = "../res/textures/earth.png";
+// 16 x 16 slots of 136 x 136 texels make a 2176 x 2176 cache texture, 18 MiB
+// whatever the size of the source image
+const unsigned int virtualCacheSlots = 16;
+// Each feedback pixel covers 8 x 8 pixels of the window
+const int feedbackScale = 8;
+// Spreads the copies into the cache over frames
+const unsigned int virtualTileUploadsPerFrame = 16;
+const int sphereSlices = 100;
+const int sphereLayers = 100;
+const float initialPlanetAngle = 343.0f / 360.0f * 2.0f * PI;
 
 // SIMULATION OPTIONS
 bool atmosphereEnabled = true;
+bool useOpticalDepthTable = true;
+bool usePrecomputedScattering = true;
+bool adaptiveSampling = false;
+float sampleDensity = 8.0f;
+bool spectralScattering = false;
+int spectralBinCount = 8;
+bool useChapmanFunction = false;
+int chapmanSamples = 8;
 bool sunOrbitEarth = false;
-float Kr = 0.0025f;
-float Km = 0.0010f;
-float ESun = 10.0f;
-float scaleDepth = 0.25f;
-float atmosphereRadius = 10.25f;
+bool useQuadtree = true;
+bool freezeQuadtree = false;
+bool useMeshletCulling = true;
+bool useVirtualTexture = true;
+bool useSceneCulling = true;
+// Nodes smaller than this on screen are culled
+float minScreenPixels = 1.0f;
+int moonCount = 0;
+// The earth's, edited by the sliders
+BodyParameters earthParameters;
 float sunAngle = 0.0f;
-float planetAngle = 343.0f / 360.0f * 2.0f * PI;
+float planetAngle = initialPlanetAngle;
 float cameraZoom = 1.0f;
 
-void updateCameraPosition() {
+glm::vec3 zoomedCameraPosition(float zoom) {
   glm::vec3 startPosition = glm::vec3(0.0f, 0.0f, -planetRadius - 6.5f);
   glm::vec3 endPosition =
-      glm::vec3(atmosphereRadius, 0.0f, -atmosphereRadius / 1.414 + 1.0f);
+      glm::vec3(earthParameters.atmosphereRadius, 0.0f,
+                -earthParameters.atmosphereRadius / 1.414 + 1.0f);
+
+  return startPosition + (endPosition - startPosition) * (zoom - 1.0f);
+}
+
+void updateCameraPosition() {
+  camera->setPosition(zoomedCameraPosition(cameraZoom));
+}
+
+// The planet's sphere, as uploaded. Change the generator name when the
+// generator changes, so that meshes cached before are not used.
+uint64_t planetMeshHash(int slices, int layers) {
+  return meshParameterHash("indexedSphere/optimized/meshlets/packed",
+                           {planetRadius, float(slices), float(layers)});
+}
 
-  glm::vec3 interpolatedPosition =
-      startPosition + (endPosition - startPosition) * (cameraZoom - 1.0f);
-  camera->setPosition(interpolatedPosition);
+PackedMesh generatePlanetMesh(int slices, int layers) {
+  Mesh mesh = generateIndexedSphere(planetRadius, slices, layers);
+  optimizeMesh(mesh);
+  // Clustering reorders the triangles, so the vertices are put in the new
+  // order of first use again
+  std::vector<Meshlet> meshlets = buildMeshlets(mesh);
+  optimizeVertexFetch(mesh);
+  PackedMesh packed = packMesh(mesh, true);
+  packed.meshlets = std::move(meshlets);
+  return packed;
+}
+
+glm::mat4 projectionMatrix(float aspectRatio) {
+  return glm::perspective(glm::radians(80.0f), aspectRatio, 0.1f, 350.f);
+}
+
+glm::vec3 sunDirection() {
+  return glm::vec3(cos(sunAngle), 0.0, sin(sunAngle));
+}
+
+CullView cullView(const glm::mat4 &viewProjection, glm::vec3 cameraPosition,
+                  int viewportHeight, float minScreenPixels) {
+  CullView view;
+  view.frustum = frustumFromMatrix(viewProjection);
+  view.cameraPosition = cameraPosition;
+  view.projectionScale = projectionMatrix(1.0f)[1][1];
+  view.minScreenSize = minScreenPixels / float(viewportHeight);
+  return view;
+}
+
+AtmosphereParameters atmosphereParameters() {
+  AtmosphereParameters params;
+  params.samples = SAMPLES;
+  applyBodyParameters(earthParameters, params);
+  params.enabled = atmosphereEnabled;
+  params.adaptiveSampling = adaptiveSampling;
+  params.sampleDensity = sampleDensity;
+  params.spectralBins = spectralScattering ? spectralBinCount : 0;
+  params.useChapmanFunction = useChapmanFunction;
+  params.chapmanSamples = chapmanSamples;
+  return params;
+}
+
+CPUScene cpuScene(const PNGImage *earthTexture) {
+  CPUScene scene;
+  scene.atmosphere = atmosphereParameters();
+  scene.sunDirection = sunDirection();
+  scene.planetModel = glm::rotate(planetAngle, glm::vec3(0, 1, 0));
+  scene.earthTexture = earthTexture;
+  return scene;
 }
 
 void cursorPosCallback(GLFWwindow *window, double x, double y) {
@@ -76,69 +301,481 @@ void mouseButtonCallback(GLFWwindow *, int button, int action, int) {
   io.AddMouseButtonEvent(button, action);
 }
 
-unsigned int genTexture(const PNGImage &img) {
+// Uploads every level as it is, straight from the mapped file. Block
+// compressed levels stay compressed on the GPU.
+unsigned int genTexture(const TextureData &texture) {
   unsigned int textureId;
   glGenTextures(1, &textureId);
   glBindTexture(GL_TEXTURE_2D, textureId);
+  if (texture.levelCount == 0) {
+    return textureId;
+  }
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img.width, img.height, 0, GL_RGBA,
-               GL_UNSIGNED_BYTE, img.pixels.data());
-  glGenerateMipmap(GL_TEXTURE_2D);
-  glTexParameteri(GL_TEXTURE_2D, GL_NEAREST_MIPMAP_LINEAR, GL_LINEAR);
+  // Compressed levels are uploaded as they are where the driver can sample
+  // them, and decoded to RGBA8 elsewhere
+  bool compressed = texture.format != TextureFormat::RGBA8 && s3tcSupported;
+  GLenum internalFormat = GL_RGBA8;
+  if (compressed && texture.format == TextureFormat::BC1) {
+    internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  } else if (compressed && texture.format == TextureFormat::BC3) {
+    internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  }
+  glTexStorage2D(GL_TEXTURE_2D, texture.levelCount, internalFormat,
+                 texture.levels[0].width, texture.levels[0].height);
+  for (unsigned int level = 0; level < texture.levelCount; level++) {
+    const TextureLevel &textureLevel = texture.levels[level];
+    if (texture.format == TextureFormat::RGBA8) {
+      glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, textureLevel.width,
+                      textureLevel.height, GL_RGBA, GL_UNSIGNED_BYTE,
+                      textureLevel.pixels);
+    } else if (!compressed) {
+      PNGImage decoded = decompressLevel(textureLevel, texture.format);
+      glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, textureLevel.width,
+                      textureLevel.height, GL_RGBA, GL_UNSIGNED_BYTE,
+                      decoded.pixels.data());
+    } else {
+      glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, textureLevel.width,
+                                textureLevel.height, internalFormat,
+                                (GLsizei)textureLevel.bytes,
+                                textureLevel.pixels);
+    }
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   return textureId;
 }
 
+// Level 0 of the earth texture, for the renderers on the CPU
+PNGImage loadEarthImage() {
+  CachedTexture texture;
+  loadOrConvertTexture(cacheDirectory, earthTextureFile, texture);
+  if (texture.data.levelCount == 0) {
+    return PNGImage();
+  }
+  return textureLevelImage(texture.data, 0);
+}
+
+// Uploads the optical depth table to texture unit 1, reusing the texture object
+// between rebuilds
+void uploadOpticalDepthTexture() {
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, opticalDepthTextureID);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, opticalDepthTable.heightResolution,
+               opticalDepthTable.angleResolution, 0, GL_RG, GL_FLOAT,
+               opticalDepthTable.texels.data());
+  glActiveTexture(GL_TEXTURE0);
+}
+
+// Bakes the optical depth table for the given parameters and uploads it
+void updateOpticalDepthTexture(const AtmosphereParameters &params) {
+  opticalDepthTable = bakeOpticalDepthTable(params);
+  uploadOpticalDepthTexture();
+}
+
+// Creates a texture with linear filtering and clamped edges on the active
+// texture unit
+unsigned int genTableTexture(GLenum target) {
+  unsigned int textureId;
+  glGenTextures(1, &textureId);
+  glBindTexture(target, textureId);
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  return textureId;
+}
+
+// Uploads the scattering tables to texture units 2, 3 and 4
+void updateScatteringTextures() {
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D, transmittanceTextureID);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, TRANSMITTANCE_TEXTURE_WIDTH,
+               TRANSMITTANCE_TEXTURE_HEIGHT, 0, GL_RGBA, GL_FLOAT,
+               scatteringTables.transmittance);
+
+  glActiveTexture(GL_TEXTURE3);
+  glBindTexture(GL_TEXTURE_3D, singleScatteringTextureID);
+  glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, SCATTERING_TEXTURE_WIDTH,
+               SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH, 0, GL_RGBA,
+               GL_FLOAT, scatteringTables.singleScattering);
+
+  glActiveTexture(GL_TEXTURE4);
+  glBindTexture(GL_TEXTURE_3D, multipleScatteringTextureID);
+  glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, SCATTERING_TEXTURE_WIDTH,
+               SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH, 0, GL_RGBA,
+               GL_FLOAT, scatteringTables.multipleScattering);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+// Bakes the scattering tables for `params` into `tables` and saves them to
+// the cache directory. Touches no globals, so it can run on a worker.
+void bakeAndSaveScatteringTables(const AtmosphereParameters &params,
+                                 ScatteringTables &tables) {
+  std::string fileName =
+      scatteringTablesFileName(cacheDirectory, params);
+
+  auto start = std::chrono::steady_clock::now();
+  bakeScatteringTables(params, tables);
+  double bakeTime = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+  if (!saveScatteringTables(tables, fileName)) {
+    fprintf(stderr, "Could not write scattering tables to \"%s\".\n",
+            fileName.c_str());
+    return;
+  }
+  fmt::print("Baked scattering tables to {} in {:.2f}s\n", fileName, bakeTime);
+}
+
+void bakeAtmosphere() {
+  bakeAndSaveScatteringTables(atmosphereParameters(), scatteringTables);
+}
+
+// Bakes the tables for the current constants on a worker, so that the window
+// keeps drawing with the old tables, and uploads them once they are done
+void bakeAtmosphereInBackground() {
+  AtmosphereParameters params = atmosphereParameters();
+  if (!assetLoader) {
+    assetLoader = new AssetLoader();
+  }
+  scatteringTablesLoading = true;
+  assetLoader->load<ScatteringTables>(
+      "Baked scattering",
+      [params](ScatteringTables &tables) {
+        bakeAndSaveScatteringTables(params, tables);
+      },
+      [](ScatteringTables &tables) {
+        scatteringTables = std::move(tables);
+        updateScatteringTextures();
+        scatteringTablesLoading = false;
+      });
+}
+
+// Renders a small CPU frame of the current view with the numeric loop and
+// with the Chapman integrator, and compares the two
+void measureIntegratorError() {
+  const unsigned int width = 192;
+  const unsigned int height = 108;
+
+  if (earthImage.pixels.empty()) {
+    earthImage = loadEarthImage();
+  }
+  CPUScene scene = cpuScene(&earthImage);
+  scene.atmosphere.planetPosition =
+      sceneTransforms.position(sceneNodes.get(planetNode)->transform);
+  glm::mat4 projection = projectionMatrix(float(width) / float(height));
+  ThreadPool pool;
+
+  scene.atmosphere.useChapmanFunction = false;
+  getTimeDeltaSeconds();
+  PNGImage numeric =
+      renderFrameCPU(scene, *camera, projection, width, height, pool);
+  numericCPUTime = getTimeDeltaSeconds() * 1000.0;
+
+  scene.atmosphere.useChapmanFunction = true;
+  PNGImage chapman =
+      renderFrameCPU(scene, *camera, projection, width, height, pool);
+  chapmanCPUTime = getTimeDeltaSeconds() * 1000.0;
+
+  chapmanError = relativeImageDifference(numeric, chapman);
+  integratorErrorMeasured = true;
+}
+
+// Creates the tile cache and table textures and the feedback framebuffer for
+// earthTiles. The framebuffer is sized on the first frame.
+void createVirtualTexture() {
+  virtualTextureCache = new VirtualTextureCache(earthTiles, virtualCacheSlots);
+  const VirtualTextureLayout &layout = earthTiles.layout();
+  int cacheSide = virtualCacheSlots * VIRTUAL_TILE_STRIDE;
+
+  glActiveTexture(GL_TEXTURE5);
+  glGenTextures(1, &virtualTileCacheTextureID);
+  glBindTexture(GL_TEXTURE_2D, virtualTileCacheTextureID);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, cacheSide, cacheSide);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  glActiveTexture(GL_TEXTURE6);
+  glGenTextures(1, &virtualTileTableTextureID);
+  glBindTexture(GL_TEXTURE_2D, virtualTileTableTextureID);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8UI, layout.tableWidth,
+                 layout.tableHeight);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glActiveTexture(GL_TEXTURE0);
+
+  glGenFramebuffers(1, &feedbackFramebufferID);
+  glGenRenderbuffers(2, feedbackRenderbuffers);
+  glGenBuffers(2, feedbackPixelBuffers);
+}
+
+// Replaces the moons with count new ones around the planet, see
+// createMoonNodes(). The moons take the planet's mesh and texture as they are
+// now.
+void createMoons(unsigned int count) {
+  if (sceneNodes.get(moonsNode)) {
+    destroySceneNode(moonsNode);
+  }
+  bodies.resize(1);
+  moonsCreated = count;
+  if (count == 0) {
+    return;
+  }
+
+  // Copied, as creating nodes may move the pool
+  SceneNode earth = *sceneNodes.get(planetNode);
+  moonsNode = createMoonNodes(sceneNodes, sceneTransforms, earth, planetRadius,
+                              earthParameters, count, bodies);
+  addChild(rootNode, moonsNode);
+}
+
+// The planet and its atmosphere, without their meshes and textures
+void createScene() {
+  rootNode = createSceneNode();
+  planetNode = createSceneNode();
+  atmosphereNode = createSceneNode();
+
+  addChild(rootNode, planetNode);
+  addChild(planetNode, atmosphereNode);
+  SceneNode *planet = sceneNodes.get(planetNode);
+  SceneNode *atmosphere = sceneNodes.get(atmosphereNode);
+  atmosphere->nodeType = SceneNodeType::ATMOSPHERE;
+  // Both draw the sphere mesh, which the atmosphere node scales up
+  planet->boundingRadius = planetRadius;
+  atmosphere->boundingRadius = planetRadius;
+  bodies.push_back(Body{planetNode, earthParameters});
+}
+
+// Loads everything that takes CPU time on the workers. The planet, its
+// texture and the atmosphere are drawn as they arrive; until then the planet
+// is skipped or untextured, and the atmosphere falls back to the sample loop.
+// The whole earth texture, with every mip level, takes far more memory than
+// the tile cache, so it is only loaded once the planet is drawn without the
+// virtual texture
+void loadEarthTexture() {
+  if (earthTextureRequested) {
+    return;
+  }
+  earthTextureRequested = true;
+  if (!assetLoader) {
+    assetLoader = new AssetLoader();
+  }
+  assetLoader->load<CachedTexture>(
+      "Earth texture",
+      [](CachedTexture &texture) {
+        loadOrConvertTexture(cacheDirectory, earthTextureFile, texture);
+      },
+      [](CachedTexture &texture) {
+        sceneNodes.get(planetNode)->textureID = genTexture(texture.data);
+        createMoons(moonsCreated);
+      });
+}
+
+void loadAssets() {
+  AtmosphereParameters params = atmosphereParameters();
+
+  opticalDepthTableLoading = true;
+  assetLoader->load<OpticalDepthTable>(
+      "Optical depth table",
+      [params](OpticalDepthTable &table) {
+        table = bakeOpticalDepthTable(params);
+      },
+      [](OpticalDepthTable &table) {
+        opticalDepthTable = std::move(table);
+        uploadOpticalDepthTexture();
+        opticalDepthTableLoading = false;
+      });
+
+  scatteringTablesLoading = true;
+  assetLoader->load<ScatteringTables>(
+      "Scattering tables",
+      [params](ScatteringTables &tables) {
+        loadOrBakeScatteringTables(params, cacheDirectory, tables);
+      },
+      [](ScatteringTables &tables) {
+        scatteringTables = std::move(tables);
+        updateScatteringTextures();
+        scatteringTablesLoading = false;
+      });
+
+  earthTilesLoading = true;
+  assetLoader->load<VirtualTextureFile>(
+      "Earth tiles",
+      [](VirtualTextureFile &file) {
+        openTiledTexture(cacheDirectory, earthTextureFile, file);
+      },
+      [](VirtualTextureFile &file) {
+        if (file.isOpen()) {
+          earthTiles = std::move(file);
+          createVirtualTexture();
+        } else {
+          fmt::print("No virtual texture for \"{}\", make one with "
+                     "--tile-texture.\n",
+                     earthTextureFile);
+        }
+        earthTilesLoading = false;
+      });
+
+  assetLoader->load<CachedMesh>(
+      "Sphere mesh",
+      [](CachedMesh &mesh) {
+        loadOrGenerateMesh(
+            cacheDirectory, planetMeshHash(sphereSlices, sphereLayers),
+            []() { return generatePlanetMesh(sphereSlices, sphereLayers); },
+            mesh);
+      },
+      [](CachedMesh &mesh) {
+        unsigned int sphereVAO = generateBuffer(mesh.data);
+        sphereMeshlets.assign(mesh.data.meshlets,
+                              mesh.data.meshlets + mesh.data.meshletCount);
+        for (SceneNodeHandle handle : {planetNode, atmosphereNode}) {
+          SceneNode *node = sceneNodes.get(handle);
+          node->vertexArrayObjectID = sphereVAO;
+          node->VAOIndexCount = mesh.data.indexCount;
+          node->quantization = mesh.data.quantization;
+          node->meshlets = sphereMeshlets.data();
+          node->meshletCount = (unsigned int)sphereMeshlets.size();
+        }
+        createMoons(moonsCreated);
+      });
+
+  int gridResolution = quadtreeSettings.gridResolution;
+  assetLoader->load<Mesh>(
+      "Chunk grid",
+      [gridResolution](Mesh &grid) {
+        grid = generateChunkGrid(gridResolution);
+      },
+      [](Mesh &grid) {
+        chunkGridVAO = generateBuffer(grid);
+        chunkQuadrantIndexCount = grid.indices.size() / 4;
+      });
+}
+
 void initGame(GLFWwindow *window, CommandLineOptions gameOptions) {
   glfwSetCursorPosCallback(window, cursorPosCallback);
   glfwSetMouseButtonCallback(window, mouseButtonCallback);
+  s3tcSupported = extensionSupported("GL_EXT_texture_compression_s3tc");
+
+  createScene();
+  SceneNode *planet = sceneNodes.get(planetNode);
+  SceneNode *atmosphere = sceneNodes.get(atmosphereNode);
+  moonCount = gameOptions.moonCount;
 
+  // The workers start on the assets before the shaders are compiled here
+  quadtreeSettings.planetRadius = planetRadius;
+  assetLoader = new AssetLoader();
+  loadAssets();
+
+  double shaderStart = glfwGetTime();
   planetShader = new Gloom::Shader();
   planetShader->makeBasicShader("../res/shaders/planet.vert",
                                 "../res/shaders/planet.frag");
   atmopshereShader = new Gloom::Shader();
   atmopshereShader->makeBasicShader("../res/shaders/atmosphere.vert",
                                     "../res/shaders/atmosphere.frag");
+  planetQuadtreeShader = new Gloom::Shader();
+  planetQuadtreeShader->makeBasicShader("../res/shaders/planetQuadtree.vert",
+                                        "../res/shaders/planet.frag");
+  planetQuadtreeShader->activate();
+  glUniform1i(planetQuadtreeShader->getUniformFromName("textureFromDirection"),
+              true);
+  chunkUniforms.faceNormal = planetQuadtreeShader->getUniformFromName(
+      "faceNormal");
+  chunkUniforms.faceU = planetQuadtreeShader->getUniformFromName("faceU");
+  chunkUniforms.faceV = planetQuadtreeShader->getUniformFromName("faceV");
+  chunkUniforms.chunkOrigin = planetQuadtreeShader->getUniformFromName(
+      "chunkOrigin");
+  chunkUniforms.chunkSize = planetQuadtreeShader->getUniformFromName(
+      "chunkSize");
+  chunkUniforms.morphRange = planetQuadtreeShader->getUniformFromName(
+      "morphRange");
+  chunkUniforms.gridResolution = planetQuadtreeShader->getUniformFromName(
+      "gridResolution");
+  chunkUniforms.localCameraPosition =
+      planetQuadtreeShader->getUniformFromName("localCameraPosition");
+  planetShaderIndex = renderQueue.addShader(planetShader);
+  atmosphereShaderIndex = renderQueue.addShader(atmopshereShader);
+  planetQuadtreeShaderIndex = renderQueue.addShader(planetQuadtreeShader);
+  fmt::print("Startup: shaders compiled in {:.1f} ms, at {:.1f} ms\n",
+             (glfwGetTime() - shaderStart) * 1e3, glfwGetTime() * 1e3);
 
-  int earthTextureID = genTexture(loadPNGFile("../res/textures/earth.png"));
-
-  Mesh sphereMesh = generateSphere(planetRadius, 100, 100);
-  unsigned int sphereVAO = generateBuffer(sphereMesh);
-
-  // Construct scene
-  rootNode = createSceneNode();
-  planetNode = createSceneNode();
-  atmosphereNode = createSceneNode();
+  glGenQueries(2, frameTimeQueries);
+  glGenBuffers(1, &bodyBufferID);
 
-  rootNode->children.push_back(planetNode);
-  planetNode->children.push_back(atmosphereNode);
+  glGenTextures(1, &opticalDepthTextureID);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, opticalDepthTextureID);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-  planetNode->vertexArrayObjectID = sphereVAO;
-  planetNode->VAOIndexCount = sphereMesh.indices.size();
-  planetNode->textureID = earthTextureID;
+  glActiveTexture(GL_TEXTURE2);
+  transmittanceTextureID = genTableTexture(GL_TEXTURE_2D);
+  glActiveTexture(GL_TEXTURE3);
+  singleScatteringTextureID = genTableTexture(GL_TEXTURE_3D);
+  glActiveTexture(GL_TEXTURE4);
+  multipleScatteringTextureID = genTableTexture(GL_TEXTURE_3D);
+  glActiveTexture(GL_TEXTURE0);
 
-  atmosphereNode->vertexArrayObjectID = sphereVAO;
-  atmosphereNode->VAOIndexCount = sphereMesh.indices.size();
-  atmosphereNode->nodeType = SceneNodeType::ATMOSPHERE;
+  glGenBuffers(1, &planet->indirectBufferID);
+  glGenBuffers(1, &atmosphere->indirectBufferID);
 
   camera = new Gloom::Camera(glm::vec3(0, 0, -planetRadius - 6.5f));
-  camera->lookAt(planetNode->position);
+  camera->lookAt(sceneTransforms.position(planet->transform));
   updateCameraPosition();
 
   getTimeDeltaSeconds();
 }
 
+// Uploads the assets that finished loading since the last frame
+void uploadLoadedAssets() {
+  for (const AssetTiming &timing : assetLoader->uploadLoaded()) {
+    if (!timing.error.empty()) {
+      fmt::print(stderr, "Startup: {} failed to load: {}\n", timing.name,
+                 timing.error);
+      continue;
+    }
+    fmt::print("Startup: {:<20} loaded in {:7.1f} ms, waited {:5.1f} ms, "
+               "uploaded in {:5.1f} ms, at {:.1f} ms\n",
+               timing.name, timing.loadTime * 1e3, timing.waitTime * 1e3,
+               timing.uploadTime * 1e3, glfwGetTime() * 1e3);
+  }
+  if (assetLoader->done()) {
+    fmt::print("Startup: everything loaded at {:.1f} ms\n",
+               glfwGetTime() * 1e3);
+    delete assetLoader;
+    assetLoader = nullptr;
+  }
+}
+
 void updateFrame(GLFWwindow *) {
   double deltaTime = getTimeDeltaSeconds();
 
+  if (!earthTilesLoading && !(useVirtualTexture && virtualTextureCache)) {
+    loadEarthTexture();
+  }
+  if (assetLoader) {
+    uploadLoadedAssets();
+  }
+
   glm::mat4 projection =
-      glm::perspective(glm::radians(80.0f),
-                       float(windowWidth) / float(windowHeight), 0.1f, 350.f);
+      projectionMatrix(float(windowWidth) / float(windowHeight));
 
   updateCameraPosition();
   camera->updateCamera(deltaTime);
 
-  planetNode->rotation.y = planetAngle;
+  if ((unsigned int)moonCount != moonsCreated) {
+    createMoons(moonCount);
+  }
+
+  SceneNode *planet = sceneNodes.get(planetNode);
+  sceneTransforms.setRotation(planet->transform, glm::vec3(0, planetAngle, 0));
 
   if (sunOrbitEarth) {
     sunAngle += deltaTime;
@@ -149,56 +786,328 @@ void updateFrame(GLFWwindow *) {
 
   VP = projection * camera->getViewMatrix();
 
-  updateNodeTransformations(rootNode, glm::mat4(1.0f));
+  planet->nodeType = useQuadtree ? PLANET_QUADTREE : GEOMETRY;
+  transformsUpdated = sceneTransforms.update();
+  boundsUpdated = sceneBounds.update(sceneNodes, sceneTransforms);
+
+  // Chunks are selected in the planet's model space, so that they turn with it
+  if (useQuadtree && !freezeQuadtree) {
+    glm::mat4 model = sceneTransforms.world(planet->transform);
+    quadtreeCameraPosition =
+        glm::vec3(glm::inverse(model) * glm::vec4(camera->getPosition(), 1.0f));
+    selectQuadtreeChunks(quadtreeSettings, quadtreeCameraPosition, VP * model,
+                         quadtreeSelection);
+  }
 }
 
-void updateNodeTransformations(SceneNode *node,
-                               glm::mat4 transformationThusFar) {
-  glm::mat4 transformationMatrix =
-      glm::translate(node->position) * glm::translate(node->referencePoint) *
-      glm::rotate(node->rotation.y, glm::vec3(0, 1, 0)) *
-      glm::rotate(node->rotation.x, glm::vec3(1, 0, 0)) *
-      glm::rotate(node->rotation.z, glm::vec3(0, 0, 1)) *
-      glm::scale(node->scale) * glm::translate(-node->referencePoint);
+// Draws the selected chunks with planetQuadtreeShader, which has to be active
+void renderQuadtreeChunks() {
+  if (chunkQuadrantIndexCount == 0) {
+    return;
+  }
+  glUniform1f(chunkUniforms.gridResolution,
+              (float)quadtreeSettings.gridResolution);
+  glUniform3fv(chunkUniforms.localCameraPosition, 1,
+               glm::value_ptr(quadtreeCameraPosition));
+
+  for (const QuadtreeChunk &chunk : quadtreeSelection.chunks) {
+    const CubeFace &face = CUBE_FACES[chunk.face];
+    glUniform3fv(chunkUniforms.faceNormal, 1, glm::value_ptr(face.normal));
+    glUniform3fv(chunkUniforms.faceU, 1, glm::value_ptr(face.u));
+    glUniform3fv(chunkUniforms.faceV, 1, glm::value_ptr(face.v));
+    glUniform2fv(chunkUniforms.chunkOrigin, 1, glm::value_ptr(chunk.origin));
+    glUniform1f(chunkUniforms.chunkSize, chunk.size);
+    glUniform2fv(chunkUniforms.morphRange, 1,
+                 glm::value_ptr(chunk.morphRange));
 
-  node->currentTransformationMatrix =
-      transformationThusFar * transformationMatrix;
+    if (chunk.quadrants == 0xf) {
+      glDrawElements(GL_TRIANGLES, 4 * chunkQuadrantIndexCount,
+                     GL_UNSIGNED_INT, nullptr);
+      continue;
+    }
+    for (unsigned int quadrant = 0; quadrant < 4; quadrant++) {
+      if (chunk.quadrants & (1u << quadrant)) {
+        size_t offset =
+            quadrant * chunkQuadrantIndexCount * sizeof(unsigned int);
+        glDrawElements(GL_TRIANGLES, chunkQuadrantIndexCount, GL_UNSIGNED_INT,
+                       (const void *)offset);
+      }
+    }
+  }
+}
 
-  for (SceneNode *child : node->children) {
-    updateNodeTransformations(child, node->currentTransformationMatrix);
+// Draws the meshlets that survive culling with one indirect multi-draw
+void renderMeshlets(SceneNode *node, MeshletCullStats &stats) {
+  glm::mat4 model = sceneTransforms.world(node->transform);
+  glm::vec3 localCamera =
+      glm::vec3(glm::inverse(model) * glm::vec4(camera->getPosition(), 1.0f));
+  CulledFaces culledFaces =
+      node->nodeType == ATMOSPHERE ? CulledFaces::Front : CulledFaces::Back;
+  cullMeshlets(node->meshlets, node->meshletCount, localCamera, VP * model,
+               culledFaces, meshletCommands, stats);
+  if (meshletCommands.empty()) {
+    return;
   }
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, node->indirectBufferID);
+  glBufferData(GL_DRAW_INDIRECT_BUFFER,
+               meshletCommands.size() * sizeof(DrawElementsIndirectCommand),
+               meshletCommands.data(), GL_STREAM_DRAW);
+  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+                              (GLsizei)meshletCommands.size(), 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 }
 
-void renderNode(SceneNode *node) {
-  Gloom::Shader *shader;
+// Adds a draw item for the node if it has something to draw
+void addDrawItem(SceneNode *node) {
+  DrawItem item;
+  item.node = node;
+  item.texture = 0;
+  item.vertexArray = node->vertexArrayObjectID;
+  item.body = node->body;
+  // Quadtree chunks and meshlets are chosen for the one node
+  item.instanced = node->nodeType != PLANET_QUADTREE &&
+                   !(useMeshletCulling && node->meshletCount > 0);
+  RenderPass pass = RenderPass::Opaque;
+  bool drawable = node->vertexArrayObjectID != -1;
 
   switch (node->nodeType) {
   case GEOMETRY:
-    glBindTexture(0, node->textureID);
-    shader = planetShader;
-    glCullFace(GL_BACK);
+    item.shader = planetShaderIndex;
+    item.texture = node->textureID;
+    item.cullFace = GL_BACK;
+    break;
+  case PLANET_QUADTREE:
+    item.shader = planetQuadtreeShaderIndex;
+    item.texture = node->textureID;
+    item.cullFace = GL_BACK;
+    item.vertexArray = chunkGridVAO;
+    drawable = chunkQuadrantIndexCount > 0;
     break;
   case ATMOSPHERE:
-    shader = atmopshereShader;
-    glCullFace(GL_FRONT);
+    item.shader = atmosphereShaderIndex;
+    item.cullFace = GL_FRONT;
+    pass = RenderPass::Blended;
     break;
   }
 
-  shader->activate();
+  if (drawable) {
+    glm::vec3 position = glm::vec3(sceneTransforms.world(node->transform)[3]);
+    float distance = glm::length(position - camera->getPosition());
+    item.key = renderQueue.key(pass, item.shader, item.cullFace, item.texture,
+                               item.vertexArray, distance);
+    renderQueue.add(item);
+  }
+}
 
-  glUniformMatrix4fv(shader->getUniformFromName("M"), 1, GL_FALSE,
-                     glm::value_ptr(node->currentTransformationMatrix));
+// Adds a draw item for every node under the node that has something to draw
+void collectDrawItems(SceneNode *node) {
+  // The planet hides whatever is behind it from the feedback pass
+  if (renderingFeedback && node->nodeType == ATMOSPHERE) {
+    return;
+  }
 
-  if (node->vertexArrayObjectID != -1) {
-    glBindVertexArray(node->vertexArrayObjectID);
-    glDrawElements(GL_TRIANGLES, node->VAOIndexCount, GL_UNSIGNED_INT, nullptr);
+  addDrawItem(node);
+  for (unsigned int child = node->firstChild; child != NO_NODE;
+       child = sceneNodes[child].nextSibling) {
+    collectDrawItems(&sceneNodes[child]);
   }
+}
 
-  for (SceneNode *child : node->children) {
-    renderNode(child);
+// The draw call of an item, once the queue has set up its state
+void drawItem(const DrawItem &item, Gloom::Shader *) {
+  SceneNode *node = item.node;
+  if (node->nodeType == PLANET_QUADTREE) {
+    renderQuadtreeChunks();
+  } else if (useMeshletCulling && node->meshletCount > 0) {
+    renderMeshlets(node, node->nodeType == ATMOSPHERE ? atmosphereMeshletStats
+                                                      : planetMeshletStats);
+  } else {
+    glDrawElementsInstanced(GL_TRIANGLES, node->VAOIndexCount,
+                            GL_UNSIGNED_INT, nullptr, item.instanceCount);
   }
 }
 
+// Draws the items collected in the render queue
+RenderQueueStats submitDrawItems() {
+  // The uniform loops and uploads change the state between the passes
+  glState.invalidate();
+  return renderQueue.submit(glState, drawItem);
+}
+
+// Draws everything under the node through the render queue
+RenderQueueStats renderScene(SceneNode *node) {
+  renderQueue.clear();
+  collectDrawItems(node);
+  return submitDrawItems();
+}
+
+// Draws the nodes of the scene the camera may see, found through the
+// bounding volume hierarchy rather than by walking the whole tree. Nodes are
+// culled by their size on a viewport of the given height in pixels.
+RenderQueueStats renderVisibleScene(int viewportHeight) {
+  if (!useSceneCulling) {
+    sceneCullStats = BVHCullStats();
+    return renderScene(sceneNodes.get(rootNode));
+  }
+  renderQueue.clear();
+  CullView view =
+      cullView(VP, camera->getPosition(), viewportHeight, minScreenPixels);
+  sceneCullStats = sceneBounds.cull(
+      view, [](unsigned int node) { addDrawItem(&sceneNodes[node]); });
+  return submitDrawItems();
+}
+
+void meshletStatsText(const char *name, const MeshletCullStats &stats) {
+  ImGui::Text("%s: %u of %u triangles in %u draws", name,
+              stats.triangles - stats.frustumCulledTriangles -
+                  stats.coneCulledTriangles,
+              stats.triangles, stats.drawCommands);
+  ImGui::Text("Culled: %u meshlets by the frustum, %u by their cones",
+              stats.frustumCulledMeshlets, stats.coneCulledMeshlets);
+}
+
+// Unpacks the tiles written by virtualTextureRequest() in planet.frag
+std::vector<unsigned int> virtualFeedbackTiles(const unsigned char *pixels,
+                                               std::size_t pixelCount) {
+  const VirtualTextureLayout &layout = earthTiles.layout();
+  std::vector<unsigned int> tiles;
+  for (std::size_t i = 0; i < pixelCount; i++) {
+    const unsigned char *pixel = pixels + 4 * i;
+    if (pixel[3] == 0) {
+      continue;
+    }
+    unsigned int level = pixel[3] - 1u;
+    unsigned int x = pixel[0] | (pixel[2] & 15u) << 8;
+    unsigned int y = pixel[1] | (pixel[2] >> 4) << 8;
+    if (level >= layout.levelCount || x >= layout.tilesX[level] ||
+        y >= layout.tilesY[level]) {
+      continue;
+    }
+    // Neighbouring pixels mostly need the same tile
+    unsigned int tile = layout.tileIndex(level, x, y);
+    if (tiles.empty() || tiles.back() != tile) {
+      tiles.push_back(tile);
+    }
+  }
+  return tiles;
+}
+
+// Resizes the feedback framebuffer and its pixel buffers to the window
+void resizeFeedback(int width, int height) {
+  feedbackWidth = width;
+  feedbackHeight = height;
+  feedbackFrameCount = 0;
+
+  glBindRenderbuffer(GL_RENDERBUFFER, feedbackRenderbuffers[0]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, feedbackRenderbuffers[1]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebufferID);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, feedbackRenderbuffers[0]);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, feedbackRenderbuffers[1]);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  for (unsigned int buffer : feedbackPixelBuffers) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, std::size_t(width) * height * 4,
+                 nullptr, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Requests the tiles the previous frame's feedback asked for, copies the
+// tiles loaded since into the cache, and renders this frame's feedback. The
+// uniforms of the planet shaders must be set for the frame.
+void updateVirtualTexture(int windowWidth, int windowHeight) {
+  int width = std::max(windowWidth / feedbackScale, 1);
+  int height = std::max(windowHeight / feedbackScale, 1);
+  if (width != feedbackWidth || height != feedbackHeight) {
+    resizeFeedback(width, height);
+  }
+  std::size_t pixelCount = std::size_t(width) * height;
+
+  if (feedbackFrameCount > 0) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER,
+                 feedbackPixelBuffers[(feedbackFrameCount - 1) % 2]);
+    const unsigned char *pixels = static_cast<const unsigned char *>(
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixelCount * 4,
+                         GL_MAP_READ_BIT));
+    if (pixels) {
+      virtualTextureCache->requestTiles(
+          virtualFeedbackTiles(pixels, pixelCount));
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+
+  std::vector<VirtualTileUpload> uploads =
+      virtualTextureCache->placeLoadedTiles(virtualTileUploadsPerFrame);
+  if (!uploads.empty()) {
+    glActiveTexture(GL_TEXTURE5);
+    for (const VirtualTileUpload &tile : uploads) {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, tile.slotX * VIRTUAL_TILE_STRIDE,
+                      tile.slotY * VIRTUAL_TILE_STRIDE, VIRTUAL_TILE_STRIDE,
+                      VIRTUAL_TILE_STRIDE, GL_RGBA, GL_UNSIGNED_BYTE,
+                      tile.texels.data());
+    }
+    glActiveTexture(GL_TEXTURE0);
+  }
+  // Only the entries that fall back on the placed and evicted tiles change
+  std::vector<VirtualTableRegion> tableChanges =
+      virtualTextureCache->takeTableChanges();
+  if (!tableChanges.empty()) {
+    const VirtualTextureLayout &layout = earthTiles.layout();
+    const uint32_t *table = virtualTextureCache->table().data();
+    glActiveTexture(GL_TEXTURE6);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, layout.tableWidth);
+    for (const VirtualTableRegion &region : tableChanges) {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, region.x, region.y, region.width,
+                      region.height, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE,
+                      table + std::size_t(region.y) * layout.tableWidth +
+                          region.x);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // Blending would mix the packed tiles of overlapping fragments
+  GLfloat clearColor[4];
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+  glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebufferID);
+  glViewport(0, 0, width, height);
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glDisable(GL_BLEND);
+
+  for (Gloom::Shader *shader : {planetShader, planetQuadtreeShader}) {
+    shader->activate();
+    glUniform1i(shader->getUniformFromName("virtualTextureFeedback"), true);
+  }
+  renderingFeedback = true;
+  renderScene(sceneNodes.get(planetNode));
+  renderingFeedback = false;
+  for (Gloom::Shader *shader : {planetShader, planetQuadtreeShader}) {
+    shader->activate();
+    glUniform1i(shader->getUniformFromName("virtualTextureFeedback"), false);
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER,
+               feedbackPixelBuffers[feedbackFrameCount % 2]);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  feedbackFrameCount++;
+
+  glEnable(GL_BLEND);
+  glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, windowWidth, windowHeight);
+}
+
 void renderFrame(GLFWwindow *window) {
   int windowWidth, windowHeight;
   glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
@@ -214,18 +1123,99 @@ void renderFrame(GLFWwindow *window) {
       ImGui::SliderFloat("Zoom", &cameraZoom, 1.0f, 2.0f);
     }
 
+    if (ImGui::CollapsingHeader("Surface")) {
+      ImGui::Checkbox("Quadtree level of detail", &useQuadtree);
+      ImGui::SliderFloat("Detail", &quadtreeSettings.detailFactor, 2.5f, 8.0f);
+      ImGui::Checkbox("Frustum culling", &quadtreeSettings.frustumCulling);
+      ImGui::Checkbox("Horizon culling", &quadtreeSettings.horizonCulling);
+      ImGui::Checkbox("Freeze selection", &freezeQuadtree);
+      if (useQuadtree) {
+        ImGui::Text("Chunks: %zu, triangles: %u",
+                    quadtreeSelection.chunks.size(),
+                    quadtreeTriangleCount(quadtreeSettings, quadtreeSelection));
+        ImGui::Text("Culled: %u by the frustum, %u by the horizon",
+                    quadtreeSelection.frustumCulledChunks,
+                    quadtreeSelection.horizonCulledChunks);
+      }
+      ImGui::Checkbox("Meshlet culling", &useMeshletCulling);
+      if (useMeshletCulling) {
+        if (!useQuadtree) {
+          meshletStatsText("Planet", planetMeshletStats);
+        }
+        meshletStatsText("Atmosphere", atmosphereMeshletStats);
+      }
+      if (virtualTextureCache) {
+        VirtualTextureStats stats = virtualTextureCache->stats();
+        ImGui::Checkbox("Virtual texture", &useVirtualTexture);
+        ImGui::Text("Tiles: %u of %u slots used, %u loading",
+                    stats.residentTiles, stats.slots, stats.pendingTiles);
+        ImGui::Text("Visible: %u tiles, %u missing", stats.requestedTiles,
+                    stats.missingTiles);
+        ImGui::Text("Loaded %u tiles, evicted %u", stats.loadedTiles,
+                    stats.evictedTiles);
+      }
+    }
+
     if (ImGui::CollapsingHeader("Planet")) {
       ImGui::Checkbox("Enable atmosphere", &atmosphereEnabled);
+      ImGui::Checkbox("Optical depth table", &useOpticalDepthTable);
+      ImGui::Checkbox("Precomputed scattering", &usePrecomputedScattering);
+      ImGui::Checkbox("Adaptive sampling", &adaptiveSampling);
+      ImGui::SliderFloat("Samples per shell depth", &sampleDensity, 1.0f,
+                         32.0f);
+      ImGui::Checkbox("Spectral scattering", &spectralScattering);
+      ImGui::SliderInt("Wavelength bins", &spectralBinCount,
+                       SPECTRAL_GROUP_SIZE, MAX_SPECTRAL_BINS);
+      ImGui::Checkbox("Chapman optical depth", &useChapmanFunction);
+      ImGui::SliderInt("Chapman samples", &chapmanSamples, 2, 16);
+      ImGui::Text("Scene GPU time: %.3f ms", sceneGPUTime);
+      ImGui::Text("Transforms: %u of %u updated", transformsUpdated,
+                  sceneTransforms.size());
+      ImGui::Checkbox("Cull the scene", &useSceneCulling);
+      ImGui::SliderFloat("Smallest size in pixels", &minScreenPixels, 0.0f,
+                         16.0f);
+      ImGui::Text("Bounds: %u boxes updated, %u visited", boundsUpdated,
+                  sceneCullStats.visited);
+      ImGui::Text("Culled: %u by the frustum, %u as too small, %u left",
+                  sceneCullStats.frustumCulled, sceneCullStats.smallCulled,
+                  sceneCullStats.visible);
+      ImGui::Text("Draws: %u for %u items", renderQueueStats.draws,
+                  renderQueueStats.instances);
+      ImGui::Text("State changes: %u, avoided: %u",
+                  renderQueueStats.stateChanges,
+                  renderQueueStats.stateChangesAvoided);
+      if (ImGui::Button("Measure Chapman error")) {
+        measureIntegratorError();
+      }
+      if (integratorErrorMeasured) {
+        ImGui::Text("Difference to numeric loop: %.2f%%",
+                    chapmanError * 100.0f);
+        ImGui::Text("CPU time: numeric %.1f ms, Chapman %.1f ms",
+                    numericCPUTime, chapmanCPUTime);
+      }
       ImGui::SliderAngle("Planet angle", &planetAngle);
+      ImGui::SliderInt("Moons", &moonCount, 0, 4096);
 
       ImGui::Text("Atmosphere constants:");
 
-      ImGui::SliderFloat("Kr", &Kr, 0.0f, 0.005f);
-      ImGui::SliderFloat("Km", &Km, 0.0f, 0.005f);
-      ImGui::SliderFloat("ESun", &ESun, 0.0f, 50.0f);
-      ImGui::SliderFloat("Scale Depth", &scaleDepth, 0.0f, 1.0f);
-      ImGui::SliderFloat("atmosphere Depth", &atmosphereRadius, planetRadius,
-                         planetRadius + 2.0f);
+      ImGui::SliderFloat("Kr", &earthParameters.Kr, 0.0f, 0.005f);
+      ImGui::SliderFloat("Km", &earthParameters.Km, 0.0f, 0.005f);
+      ImGui::SliderFloat("ESun", &earthParameters.ESun, 0.0f, 50.0f);
+      ImGui::SliderFloat("Scale Depth", &earthParameters.scaleDepth, 0.0f,
+                         1.0f);
+      ImGui::SliderFloat("atmosphere Depth", &earthParameters.atmosphereRadius,
+                         planetRadius, planetRadius + 2.0f);
+
+      // The tables are only valid for the constants they were baked for
+      if (scatteringTablesLoading) {
+        ImGui::Text("Loading precomputed scattering");
+      } else if (scatteringTables.parameterHash !=
+                 scatteringParameterHash(atmosphereParameters())) {
+        ImGui::Text("Precomputed scattering is out of date");
+        if (ImGui::Button("Bake tables")) {
+          bakeAtmosphereInBackground();
+        }
+      }
     }
     if (ImGui::CollapsingHeader("Sun")) {
       ImGui::Checkbox("Orbit around planet", &sunOrbitEarth);
@@ -234,39 +1224,348 @@ void renderFrame(GLFWwindow *window) {
 
     ImGui::End();
   }
-  atmosphereNode->scale = glm::vec3(atmosphereRadius / planetRadius);
+  sceneTransforms.setScale(
+      sceneNodes.get(atmosphereNode)->transform,
+      glm::vec3(earthParameters.atmosphereRadius / planetRadius));
+
+  AtmosphereParameters params = atmosphereParameters();
+  glm::vec3 sun = sunDirection();
 
-  glm::vec3 sunDirection = glm::vec3(cos(sunAngle), 0.0, sin(sunAngle));
+  // The sliders edit the earth
+  bodies[0].parameters = earthParameters;
+  if (updateBodyDescriptors(bodies, earthParameters, bodyDescriptors)) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bodyBufferID);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 bodyDescriptors.size() * sizeof(BodyDescriptor),
+                 bodyDescriptors.data(), GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bodyBufferID);
+  }
 
-  Gloom::Shader *shaders[2] = {planetShader, atmopshereShader};
+  // Only rebuilt when one of the sliders it depends on has moved
+  if (!opticalDepthTableLoading &&
+      !opticalDepthTableMatches(opticalDepthTable, params)) {
+    updateOpticalDepthTexture(params);
+  }
+
+  bool scatteringTablesValid =
+      scatteringTables.parameterHash == scatteringParameterHash(params);
+
+  // Per bin constants, only rebuilt when the bins or coefficients change
+  if (params.spectralBins > 0 &&
+      !spectralBinsMatch(spectralBins, params.spectralBins, params.Kr,
+                         params.Km)) {
+    spectralBins = makeSpectralBins(params.spectralBins, params.Kr, params.Km);
+  }
+  int spectralGroups = spectralGroupCount(spectralBins);
+
+  Gloom::Shader *shaders[3] = {planetShader, atmopshereShader,
+                               planetQuadtreeShader};
+  bool virtualTextureActive = useVirtualTexture && virtualTextureCache;
 
   for (Gloom::Shader *shader : shaders) {
     shader->activate();
 
-    glUniform1i(shader->getUniformFromName("nSamples"), SAMPLES);
-    glUniform1f(shader->getUniformFromName("fSamples"), (float)SAMPLES);
-    glUniform1f(shader->getUniformFromName("Kr"), Kr);
-    glUniform1f(shader->getUniformFromName("Km"), Km);
-    glUniform1f(shader->getUniformFromName("ESun"), ESun);
-    glUniform1f(shader->getUniformFromName("g"), g);
-    glUniform1f(shader->getUniformFromName("scaleDepth"), scaleDepth);
+    glUniform1i(shader->getUniformFromName("nSamples"), params.samples);
+    glUniform1f(shader->getUniformFromName("fSamples"), (float)params.samples);
 
     glUniformMatrix4fv(shader->getUniformFromName("VP"), 1, GL_FALSE,
                        glm::value_ptr(VP));
     glUniform1i(shader->getUniformFromName("enabledAtmosphere"),
-                atmosphereEnabled);
-    glUniform3fv(shader->getUniformFromName("planetPosition"), 1,
-                 glm::value_ptr(planetNode->position));
-    glUniform1f(shader->getUniformFromName("planetRadius"), planetRadius);
-    glUniform1f(shader->getUniformFromName("atmosphereRadius"),
-                atmosphereRadius);
+                params.enabled);
+    glUniform1i(shader->getUniformFromName("useOpticalDepthTable"),
+                useOpticalDepthTable && !opticalDepthTableLoading);
+    glUniform1i(shader->getUniformFromName("adaptiveSampling"),
+                params.adaptiveSampling);
+    glUniform1f(shader->getUniformFromName("sampleDensity"),
+                params.sampleDensity);
+    glUniform1i(shader->getUniformFromName("useChapmanFunction"),
+                params.useChapmanFunction);
+    glUniform1i(shader->getUniformFromName("chapmanSamples"),
+                params.chapmanSamples);
+    glUniform1i(shader->getUniformFromName("usePrecomputedScattering"),
+                usePrecomputedScattering && scatteringTablesValid &&
+                    params.spectralBins == 0);
+    glUniform4i(shader->getUniformFromName("scatteringTableSize"),
+                SCATTERING_TEXTURE_NU_SIZE, SCATTERING_TEXTURE_MU_S_SIZE,
+                SCATTERING_TEXTURE_MU_SIZE, SCATTERING_TEXTURE_R_SIZE);
+    // The radius of the quadtree's sphere. The constants of each body are
+    // read from the body buffer.
+    glUniform1f(shader->getUniformFromName("planetRadius"),
+                params.planetRadius);
     glUniform3fv(shader->getUniformFromName("cameraPosition"), 1,
                  glm::value_ptr(camera->getPosition()));
     glUniform3fv(shader->getUniformFromName("sunDirection"), 1,
-                 glm::value_ptr(sunDirection));
-    glUniform3fv(shader->getUniformFromName("waveLengths"), 1,
-                 glm::value_ptr(waveLengths));
+                 glm::value_ptr(sun));
+
+    glUniform1i(shader->getUniformFromName("spectralScattering"),
+                params.spectralBins > 0);
+    glUniform1i(shader->getUniformFromName("spectralGroups"), spectralGroups);
+    glUniform4fv(shader->getUniformFromName("spectralRayleigh"),
+                 spectralGroups, spectralBins.rayleigh);
+    glUniform4fv(shader->getUniformFromName("spectralExtinction"),
+                 spectralGroups, spectralBins.extinction);
+    glUniformMatrix4x3fv(shader->getUniformFromName("spectralToRGB"),
+                         spectralGroups, GL_FALSE,
+                         glm::value_ptr(spectralBins.toRGB[0]));
+
+    glUniform1i(shader->getUniformFromName("useVirtualTexture"),
+                virtualTextureActive);
+    if (virtualTextureActive) {
+      const VirtualTextureLayout &layout = earthTiles.layout();
+      int tableRows[MAX_TEXTURE_LEVELS];
+      std::copy(layout.tableRow, layout.tableRow + MAX_TEXTURE_LEVELS,
+                tableRows);
+      glUniform2f(shader->getUniformFromName("virtualTextureSize"),
+                  float(layout.width), float(layout.height));
+      glUniform1i(shader->getUniformFromName("virtualTextureLevels"),
+                  layout.levelCount);
+      glUniform1iv(shader->getUniformFromName("virtualTableRows"),
+                   MAX_TEXTURE_LEVELS, tableRows);
+      glUniform1f(shader->getUniformFromName("virtualFeedbackBias"),
+                  -std::log2(float(feedbackScale)));
+    }
+  }
+
+  if (virtualTextureActive) {
+    updateVirtualTexture(windowWidth, windowHeight);
+  }
+
+  // The query from the previous frame has usually finished by now. If not,
+  // the last result is shown for another frame.
+  if (frameCount > 0) {
+    unsigned int previousQuery = frameTimeQueries[(frameCount - 1) % 2];
+    int available = 0;
+    glGetQueryObjectiv(previousQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      GLuint64 nanoseconds = 0;
+      glGetQueryObjectui64v(previousQuery, GL_QUERY_RESULT, &nanoseconds);
+      sceneGPUTime = nanoseconds / 1e6;
+    }
+  }
+
+  glBeginQuery(GL_TIME_ELAPSED, frameTimeQueries[frameCount % 2]);
+  renderQueueStats = renderVisibleScene(windowHeight);
+  glEndQuery(GL_TIME_ELAPSED);
+  frameCount++;
+
+  if (!firstFrameRendered) {
+    firstFrameRendered = true;
+    fmt::print("Startup: first frame at {:.1f} ms\n", glfwGetTime() * 1e3);
+  }
+}
+
+void setupHeadlessCamera(Gloom::Camera &headlessCamera, float zoom) {
+  headlessCamera.lookAt(glm::vec3(0.0f));
+  headlessCamera.setPosition(zoomedCameraPosition(zoom));
+  headlessCamera.updateCamera(0.0f);
+}
+
+bool renderFrameHeadless(CommandLineOptions options) {
+  Gloom::Camera headlessCamera(glm::vec3(0, 0, -planetRadius - 6.5f));
+  setupHeadlessCamera(headlessCamera, cameraZoom);
+
+  PNGImage earthTexture = loadEarthImage();
+  CPUScene scene = cpuScene(&earthTexture);
+
+  glm::mat4 projection = projectionMatrix(float(options.renderWidth) /
+                                          float(options.renderHeight));
+  ThreadPool pool(options.threadCount);
+
+  getTimeDeltaSeconds();
+  PNGImage frame =
+      renderFrameCPU(scene, headlessCamera, projection, options.renderWidth,
+                     options.renderHeight, pool);
+  double renderTime = getTimeDeltaSeconds();
+
+  if (!savePNGFile(frame, options.renderFile)) {
+    return false;
+  }
+  fmt::print("Rendered {}x{} frame to {} in {:.3f}s\n", options.renderWidth,
+             options.renderHeight, options.renderFile, renderTime);
+  return true;
+}
+
+bool renderOrbitHeadless(CommandLineOptions options) {
+  Gloom::Camera headlessCamera(glm::vec3(0, 0, -planetRadius - 6.5f));
+  setupHeadlessCamera(headlessCamera, cameraZoom);
+
+  PNGImage earthTexture = loadEarthImage();
+  glm::mat4 projection = projectionMatrix(float(options.renderWidth) /
+                                          float(options.renderHeight));
+
+  // Frames still being encoded. Encoding runs on the pool next to the tiles
+  // of the following frames, and is capped so that a slow disk cannot make
+  // finished frames pile up in memory.
+  const size_t maxPendingEncodes = 2;
+  ThreadPool pool(options.threadCount);
+  std::deque<std::future<void>> encodes;
+  std::atomic<unsigned int> failedEncodes(0);
+
+  getTimeDeltaSeconds();
+  for (unsigned int i = 0; i < options.frameCount; i++) {
+    // The same motion as sunOrbitEarth in updateFrame(), at a fixed timestep
+    sunAngle = std::fmod(i * options.timestep, 2 * PI);
+    CPUScene scene = cpuScene(&earthTexture);
+
+    PNGImage frame = renderFrameCPU(scene, headlessCamera, projection,
+                                    options.renderWidth, options.renderHeight,
+                                    pool);
+
+    while (encodes.size() >= maxPendingEncodes) {
+      encodes.front().get();
+      encodes.pop_front();
+    }
+    std::string fileName =
+        fmt::format("{}{:04d}.png", options.sequencePrefix, i);
+    encodes.push_back(
+        pool.submit([frame = std::move(frame), fileName, &failedEncodes]() {
+          if (!savePNGFile(frame, fileName)) {
+            failedEncodes++;
+          }
+        }));
+  }
+  for (std::future<void> &encode : encodes) {
+    encode.get();
+  }
+  double totalTime = getTimeDeltaSeconds();
+
+  fmt::print("Rendered {} {}x{} frames to {}*.png on {} threads in {:.2f}s "
+             "({:.2f} frames/s)\n",
+             options.frameCount, options.renderWidth, options.renderHeight,
+             options.sequencePrefix, pool.threadCount(), totalTime,
+             options.frameCount / totalTime);
+  if (failedEncodes > 0) {
+    fmt::print(stderr, "{} of the frames could not be written\n",
+               failedEncodes.load());
+    return false;
+  }
+  return true;
+}
+
+// Box filters `image` down by `factor` into `sheet`, with the bottom left
+// corner at (x, y)
+void copyThumbnail(const PNGImage &image, unsigned int factor, PNGImage &sheet,
+                   unsigned int x, unsigned int y) {
+  unsigned int width = image.width / factor;
+  unsigned int height = image.height / factor;
+  for (unsigned int row = 0; row < height; row++) {
+    for (unsigned int column = 0; column < width; column++) {
+      for (unsigned int channel = 0; channel < 4; channel++) {
+        unsigned int sum = 0;
+        for (unsigned int j = 0; j < factor; j++) {
+          for (unsigned int i = 0; i < factor; i++) {
+            sum += image.pixels[4 * ((row * factor + j) * image.width +
+                                     column * factor + i) +
+                                channel];
+          }
+        }
+        sheet.pixels[4 * ((y + row) * sheet.width + x + column) + channel] =
+            (unsigned char)(sum / (factor * factor));
+      }
+    }
+  }
+}
+
+bool renderSweepHeadless(CommandLineOptions options) {
+  Gloom::Camera headlessCamera(glm::vec3(0, 0, -planetRadius - 6.5f));
+  setupHeadlessCamera(headlessCamera, cameraZoom);
+
+  PNGImage earthTexture = loadEarthImage();
+  CPUScene scene = cpuScene(&earthTexture);
+  glm::mat4 projection = projectionMatrix(float(options.renderWidth) /
+                                          float(options.renderHeight));
+
+  // Constants that are not swept keep their default
+  SweepRange ranges[4] = {options.Kr, options.Km, options.ESun,
+                          options.scaleDepth};
+  float defaults[4] = {earthParameters.Kr, earthParameters.Km,
+                       earthParameters.ESun, earthParameters.scaleDepth};
+  for (int i = 0; i < 4; i++) {
+    if (ranges[i].count == 0) {
+      ranges[i].min = ranges[i].max = defaults[i];
+      ranges[i].count = 1;
+    }
   }
+  const SweepRange &krRange = ranges[0], &kmRange = ranges[1],
+                   &eSunRange = ranges[2], &scaleDepthRange = ranges[3];
 
-  renderNode(rootNode);
+  getTimeDeltaSeconds();
+
+  // Ray setup, sphere intersections and texture lookups are the same for
+  // every combination, so they are done once
+  GBuffer gBuffer =
+      renderGBufferCPU(scene, headlessCamera, projection, options.renderWidth,
+                       options.renderHeight, options.threadCount);
+
+  // Kr and Km vary down the contact sheet, ESun and the scale depth across
+  const unsigned int maxSheetWidth = 4096;
+  unsigned int rows = krRange.count * kmRange.count;
+  unsigned int columns = eSunRange.count * scaleDepthRange.count;
+  unsigned int factor = std::max(
+      1u, (columns * options.renderWidth + maxSheetWidth - 1) / maxSheetWidth);
+  unsigned int thumbnailWidth = options.renderWidth / factor;
+  unsigned int thumbnailHeight = options.renderHeight / factor;
+
+  PNGImage sheet;
+  sheet.width = columns * thumbnailWidth;
+  sheet.height = rows * thumbnailHeight;
+  sheet.pixels.resize(4 * sheet.width * sheet.height);
+
+  std::string indexFileName = options.sweepPrefix + "sweep.csv";
+  FILE *index = fopen(indexFileName.c_str(), "w");
+  if (!index) {
+    fprintf(stderr, "Could not write \"%s\".\n", indexFileName.c_str());
+    return false;
+  }
+  fmt::print(index, "file,Kr,Km,ESun,scaleDepth\n");
+
+  // Every combination is shaded on one thread, which keeps all of them busy
+  // without any synchronisation inside a frame
+  ThreadPool pool(options.threadCount);
+  std::vector<std::future<void>> frames;
+  std::atomic<unsigned int> failedFrames(0);
+  unsigned int combination = 0;
+  for (unsigned int row = 0; row < rows; row++) {
+    for (unsigned int column = 0; column < columns; column++) {
+      AtmosphereParameters params = scene.atmosphere;
+      params.Kr = krRange.value(row / kmRange.count);
+      params.Km = kmRange.value(row % kmRange.count);
+      params.ESun = eSunRange.value(column / scaleDepthRange.count);
+      params.scaleDepth = scaleDepthRange.value(column % scaleDepthRange.count);
+
+      std::string fileName =
+          fmt::format("{}{:04d}.png", options.sweepPrefix, combination++);
+      fmt::print(index, "{},{},{},{},{}\n", fileName, params.Kr, params.Km,
+                 params.ESun, params.scaleDepth);
+
+      // The first row of the sheet is at the top of the image
+      unsigned int x = column * thumbnailWidth;
+      unsigned int y = (rows - 1 - row) * thumbnailHeight;
+      frames.push_back(pool.submit([&, params, fileName, x, y]() {
+        PNGImage frame = shadeGBufferCPU(gBuffer, params);
+        if (!savePNGFile(frame, fileName)) {
+          failedFrames++;
+        }
+        copyThumbnail(frame, factor, sheet, x, y);
+      }));
+    }
+  }
+  fclose(index);
+
+  for (std::future<void> &frame : frames) {
+    frame.get();
+  }
+  std::string sheetFileName = options.sweepPrefix + "sheet.png";
+  bool sheetSaved = savePNGFile(sheet, sheetFileName);
+  double sweepTime = getTimeDeltaSeconds();
+
+  fmt::print("Rendered {} {}x{} combinations to {}*.png on {} threads in "
+             "{:.2f}s, contact sheet in {}\n",
+             rows * columns, options.renderWidth, options.renderHeight,
+             options.sweepPrefix, pool.threadCount(), sweepTime, sheetFileName);
+  if (failedFrames > 0) {
+    fmt::print(stderr, "{} of the combinations could not be written\n",
+               failedFrames.load());
+  }
+  return sheetSaved && failedFrames == 0;
 }
@@ -2,11 +2,54 @@
 
 #include <GLFW/glfw3.h>
 
+#include "boundingVolumeHierarchy.hpp"
 #include "sceneGraph.hpp"
+#include <cstdint>
+#include <string>
+#include <utilities/camera.hpp>
+#include <utilities/packedMesh.hpp>
 #include <utilities/window.hpp>
 
-void updateNodeTransformations(SceneNode *node,
-                               glm::mat4 transformationThusFar);
 void initGame(GLFWwindow *window, CommandLineOptions options);
 void updateFrame(GLFWwindow *window);
-void renderFrame(GLFWwindow *window);
\ No newline at end of file
+void renderFrame(GLFWwindow *window);
+
+// Renders the initial view on the CPU to options.renderFile. Needs no window
+// or GL context. The headless renderers return false when a file could not be
+// written.
+bool renderFrameHeadless(CommandLineOptions options);
+
+// Renders options.frameCount frames of the sun orbiting the planet on the CPU,
+// options.timestep seconds apart, to numbered PNG files. Needs no window or GL
+// context.
+bool renderOrbitHeadless(CommandLineOptions options);
+
+// Renders every combination of the constant ranges in `options` on the CPU
+// from the initial view, to numbered PNG files, an index of the constants
+// used for each file and a contact sheet. Needs no window or GL context.
+bool renderSweepHeadless(CommandLineOptions options);
+
+// Bakes the scattering tables for the default constants into the cache
+// directory. Needs no window or GL context.
+void bakeAtmosphere();
+
+// Shared with the reports in reports.cpp
+extern const float planetRadius;
+extern const std::string cacheDirectory;
+extern const unsigned int virtualCacheSlots;
+extern const int feedbackScale;
+extern const unsigned int virtualTileUploadsPerFrame;
+extern const int sphereSlices;
+extern const int sphereLayers;
+extern const float initialPlanetAngle;
+
+uint64_t planetMeshHash(int slices, int layers);
+PackedMesh generatePlanetMesh(int slices, int layers);
+glm::mat4 projectionMatrix(float aspectRatio);
+// Nodes that cover fewer than minScreenPixels of the viewport's height are
+// culled
+CullView cullView(const glm::mat4 &viewProjection, glm::vec3 cameraPosition,
+                  int viewportHeight, float minScreenPixels);
+// Same camera setup as initGame() and updateFrame() at the given zoom, without
+// any GL calls
+void setupHeadlessCamera(Gloom::Camera &headlessCamera, float zoom);
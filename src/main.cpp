@@ -1,5 +1,8 @@
 // Local headers
+#include "gamelogic.h"
 #include "program.hpp"
+#include "reports.hpp"
+#include "utilities/blockCompression.hpp"
 #include "utilities/window.hpp"
 
 // System headers
@@ -8,7 +11,10 @@
 
 // Standard headers
 #include <arrrgh.hpp>
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
+#include <sstream>
 
 // A callback which allows GLFW to report errors whenever they occur
 static void glfwErrorCallback(int error, const char *description) {
@@ -58,10 +64,127 @@ GLFWwindow *initialise() {
   return window;
 }
 
+// Every one is written to its own PNG file
+const unsigned int MAX_SWEEP_COMBINATIONS = 1000;
+
+// Parses "min:max:count", or a single value to override the constant without
+// sweeping it
+static bool parseSweepRange(const std::string &text, SweepRange &range) {
+  if (text.empty()) {
+    return true;
+  }
+  std::istringstream stream(text);
+  if (!(stream >> range.min)) {
+    return false;
+  }
+  range.max = range.min;
+  range.count = 1;
+
+  if ((stream >> std::ws).eof()) {
+    return true;
+  }
+  char separator = 0;
+  stream >> separator;
+  int count = 0;
+  char secondSeparator = 0;
+  if (separator != ':' ||
+      !(stream >> range.max >> secondSeparator >> count) ||
+      secondSeparator != ':' || count < 1 || !(stream >> std::ws).eof()) {
+    return false;
+  }
+  range.count = count;
+  return true;
+}
+
 int main(int argc, const char *argb[]) {
   arrrgh::parser parser("tdt4230", "My final project for TDT4230");
   const auto &showHelp = parser.add<bool>("help", "Show this help message.",
                                           'h', arrrgh::Optional, false);
+  const auto &renderFile = parser.add<std::string>(
+      "render", "Render a frame on the CPU to the given PNG file and exit.",
+      'r', arrrgh::Optional, "");
+  const auto &bake = parser.add<bool>(
+      "bake-atmosphere",
+      "Bake the precomputed scattering tables into the cache and exit.", 'b',
+      arrrgh::Optional, false);
+  const auto &meshReport = parser.add<bool>(
+      "mesh-report",
+      "Print the size and vertex cache efficiency of the sphere meshes and "
+      "exit.",
+      'm', arrrgh::Optional, false);
+  const auto &lodReport = parser.add<bool>(
+      "lod-report",
+      "Print the planet surface chunks and triangles drawn from a range of "
+      "camera zooms and exit.",
+      'l', arrrgh::Optional, false);
+  const auto &cullReport = parser.add<bool>(
+      "cull-report",
+      "Print how many scene nodes culling visits and culls in scenes of more "
+      "and more moons and exit.",
+      0, arrrgh::Optional, false);
+  const auto &textureFile = parser.add<std::string>(
+      "convert-texture",
+      "Convert the given PNG file to a texture file with all mip levels in "
+      "the cache directory and exit.",
+      'c', arrrgh::Optional, "");
+  const auto &tiledTextureFile = parser.add<std::string>(
+      "tile-texture",
+      "Split the given PNG file into a virtual texture file in the cache "
+      "directory, print which tiles are loaded from a range of camera zooms "
+      "and exit.",
+      'v', arrrgh::Optional, "");
+  const auto &mipFilter = parser.add<std::string>(
+      "mip-filter",
+      "Filter the mip levels of --convert-texture and --tile-texture with "
+      "\"box\" or \"kaiser\".",
+      0, arrrgh::Optional, "kaiser");
+  const auto &textureFormat = parser.add<std::string>(
+      "texture-format",
+      "Compress the texture of --convert-texture to \"bc1\", \"bc3\", "
+      "\"rgba8\" or \"auto\", which picks BC1 for opaque images and BC3 "
+      "otherwise.",
+      0, arrrgh::Optional, "auto");
+  const auto &renderWidth = parser.add<int>(
+      "width", "Width of frames rendered on the CPU.", 'x', arrrgh::Optional,
+      windowWidth);
+  const auto &renderHeight = parser.add<int>(
+      "height", "Height of frames rendered on the CPU.", 'y',
+      arrrgh::Optional, windowHeight);
+  const auto &sequencePrefix = parser.add<std::string>(
+      "orbit",
+      "Render the sun orbiting the planet on the CPU to PNG files starting "
+      "with the given prefix and exit.",
+      'o', arrrgh::Optional, "");
+  const auto &frameCount = parser.add<int>(
+      "frames", "Number of frames rendered by --orbit.", 'n',
+      arrrgh::Optional, 120);
+  const auto &timestep = parser.add<float>(
+      "timestep", "Seconds of orbit between frames rendered by --orbit.", 't',
+      arrrgh::Optional, 1.0f / 30.0f);
+  const auto &sweepPrefix = parser.add<std::string>(
+      "sweep",
+      "Render every combination of --kr, --km, --esun and --scale-depth on the "
+      "CPU to PNG files starting with the given prefix, plus a contact sheet, "
+      "and exit.",
+      's', arrrgh::Optional, "");
+  const auto &sweepKr = parser.add<std::string>(
+      "kr", "Kr values for --sweep, as min:max:count.", 0, arrrgh::Optional,
+      "");
+  const auto &sweepKm = parser.add<std::string>(
+      "km", "Km values for --sweep, as min:max:count.", 0, arrrgh::Optional,
+      "");
+  const auto &sweepESun = parser.add<std::string>(
+      "esun", "ESun values for --sweep, as min:max:count.", 0,
+      arrrgh::Optional, "");
+  const auto &sweepScaleDepth = parser.add<std::string>(
+      "scale-depth", "Scale depth values for --sweep, as min:max:count.", 0,
+      arrrgh::Optional, "");
+  const auto &threadCount = parser.add<int>(
+      "threads", "Threads used for CPU rendering, 0 uses all of them.", 'j',
+      arrrgh::Optional, 0);
+  const auto &moonCount = parser.add<int>(
+      "moons", "Moons around the planet, each with its own atmosphere.", 0,
+      arrrgh::Optional, 0);
 
   try {
     parser.parse(argc, argb);
@@ -76,7 +199,106 @@ int main(int argc, const char *argb[]) {
     return 0;
   }
 
+  if (renderWidth.value() < 1 || renderHeight.value() < 1) {
+    std::cerr << "--width and --height have to be at least 1" << std::endl;
+    parser.show_usage(std::cerr);
+    exit(1);
+  }
+  if (frameCount.value() < 1 || threadCount.value() < 0) {
+    std::cerr << "--frames has to be at least 1 and --threads at least 0"
+              << std::endl;
+    parser.show_usage(std::cerr);
+    exit(1);
+  }
+
   CommandLineOptions options;
+  options.renderFile = renderFile.value();
+  options.renderWidth = renderWidth.value();
+  options.renderHeight = renderHeight.value();
+  options.sequencePrefix = sequencePrefix.value();
+  options.frameCount = frameCount.value();
+  options.timestep = timestep.value();
+  options.threadCount = threadCount.value();
+  options.moonCount = std::max(moonCount.value(), 0);
+  options.sweepPrefix = sweepPrefix.value();
+
+  const std::pair<const std::string &, SweepRange &> sweepRanges[] = {
+      {sweepKr.value(), options.Kr},
+      {sweepKm.value(), options.Km},
+      {sweepESun.value(), options.ESun},
+      {sweepScaleDepth.value(), options.scaleDepth}};
+  // Stops counting past the limit, so that large counts cannot overflow
+  uint64_t combinations = 1;
+  for (const auto &range : sweepRanges) {
+    if (!parseSweepRange(range.first, range.second)) {
+      std::cerr << "Invalid sweep range \"" << range.first
+                << "\", expected min:max:count" << std::endl;
+      parser.show_usage(std::cerr);
+      exit(1);
+    }
+    combinations = std::min<uint64_t>(
+        combinations * std::max(range.second.count, 1u),
+        MAX_SWEEP_COMBINATIONS + 1);
+  }
+  if (combinations > MAX_SWEEP_COMBINATIONS) {
+    std::cerr << "The sweep ranges make more than " << MAX_SWEEP_COMBINATIONS
+              << " combinations" << std::endl;
+    parser.show_usage(std::cerr);
+    exit(1);
+  }
+
+  if (meshReport.value()) {
+    printMeshReport();
+    return EXIT_SUCCESS;
+  }
+
+  if (lodReport.value()) {
+    printQuadtreeReport();
+    return EXIT_SUCCESS;
+  }
+
+  if (cullReport.value()) {
+    printCullReport();
+    return EXIT_SUCCESS;
+  }
+
+  if (!textureFile.value().empty() || !tiledTextureFile.value().empty()) {
+    MipFilter filter;
+    if (!parseMipFilter(mipFilter.value(), filter)) {
+      std::cerr << "Unknown mip filter \"" << mipFilter.value()
+                << "\", expected box or kaiser" << std::endl;
+      exit(1);
+    }
+    TextureFormat format;
+    if (textureFormat.value() != "auto" &&
+        !parseTextureFormat(textureFormat.value(), format)) {
+      std::cerr << "Unknown texture format \"" << textureFormat.value()
+                << "\", expected bc1, bc3, rgba8 or auto" << std::endl;
+      exit(1);
+    }
+    if (!textureFile.value().empty()) {
+      convertTextureFile(textureFile.value(), filter, textureFormat.value());
+    } else {
+      tileTextureFile(tiledTextureFile.value(), filter);
+    }
+    return EXIT_SUCCESS;
+  }
+
+  if (bake.value()) {
+    bakeAtmosphere();
+    return EXIT_SUCCESS;
+  }
+
+  // Headless rendering needs neither a window nor a GL context
+  if (!options.renderFile.empty()) {
+    return renderFrameHeadless(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (!options.sequencePrefix.empty()) {
+    return renderOrbitHeadless(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (!options.sweepPrefix.empty()) {
+    return renderSweepHeadless(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
 
   // Initialise window using GLFW
   GLFWwindow *window = initialise();
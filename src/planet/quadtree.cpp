@@ -0,0 +1,403 @@
+#include "quadtree.hpp"
+#include <cmath>
+#include <utilities/frustum.hpp>
+#include <utilities/meshOptimizer.hpp>
+
+const CubeFace CUBE_FACES[6] = {
+    {glm::vec3(1, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)},
+    {glm::vec3(-1, 0, 0), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0)},
+    {glm::vec3(0, 1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, -1)},
+    {glm::vec3(0, -1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1)},
+    {glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0)},
+    {glm::vec3(0, 0, -1), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0)},
+};
+
+const float QUARTER_PI = 0.78539816f;
+
+// Morph range of the whole faces, which are never replaced by anything
+const glm::vec2 NO_MORPHING = glm::vec2(1e30f, 2e30f);
+
+struct ChunkBounds {
+  glm::vec3 center;
+  float radius;
+};
+
+struct SelectionContext {
+  SelectionContext(const QuadtreeSettings &settings, glm::vec3 cameraPosition)
+      : settings(settings), cameraPosition(cameraPosition) {}
+
+  const QuadtreeSettings &settings;
+  glm::vec3 cameraPosition;
+  Frustum frustum;
+  // Points on the sphere closer to this plane than horizonDistance are
+  // hidden behind the planet
+  glm::vec3 horizonNormal = glm::vec3(0.0f);
+  float horizonDistance = 0.0f;
+  bool cameraAboveSurface = false;
+};
+
+glm::vec3 cubeSphereDirection(int face, glm::vec2 faceCoordinates) {
+  const CubeFace &cubeFace = CUBE_FACES[face];
+  glm::vec2 stretched(std::tan(faceCoordinates.x * QUARTER_PI),
+                      std::tan(faceCoordinates.y * QUARTER_PI));
+  return glm::normalize(cubeFace.normal + stretched.x * cubeFace.u +
+                        stretched.y * cubeFace.v);
+}
+
+float quadtreeLevelRange(const QuadtreeSettings &settings, int level) {
+  // A whole face is a quarter of a great circle across
+  float faceSize = settings.planetRadius * 2.0f * QUARTER_PI;
+  float chunkSize = std::ldexp(faceSize, level - (settings.levels - 1));
+  return settings.detailFactor * chunkSize;
+}
+
+// Edges of the chunk are great circle arcs, so no point on it is further from
+// the centre than the corners
+static ChunkBounds chunkBounds(const QuadtreeSettings &settings, int face,
+                               glm::vec2 origin, float size) {
+  ChunkBounds bounds;
+  bounds.center = settings.planetRadius *
+                  cubeSphereDirection(face, origin + glm::vec2(size * 0.5f));
+  bounds.radius = 0.0f;
+  for (int corner = 0; corner < 4; corner++) {
+    glm::vec2 offset(float(corner & 1), float(corner >> 1));
+    glm::vec3 point = settings.planetRadius *
+                      cubeSphereDirection(face, origin + offset * size);
+    bounds.radius = std::fmax(bounds.radius,
+                              glm::length(point - bounds.center));
+  }
+  return bounds;
+}
+
+static float closestDistance(const SelectionContext &context,
+                             const ChunkBounds &bounds) {
+  float distance = glm::length(bounds.center - context.cameraPosition);
+  return std::fmax(distance - bounds.radius, 0.0f);
+}
+
+static bool isVisible(const SelectionContext &context,
+                      const ChunkBounds &bounds,
+                      QuadtreeSelection &selection) {
+  selection.visitedChunks++;
+
+  if (context.settings.frustumCulling &&
+      sphereOutsideFrustum(context.frustum, bounds.center, bounds.radius)) {
+    selection.frustumCulledChunks++;
+    return false;
+  }
+
+  // The chunk is on the sphere, so if its whole bounding sphere is below the
+  // horizon plane, so is all of the chunk
+  if (context.settings.horizonCulling && context.cameraAboveSurface &&
+      glm::dot(bounds.center, context.horizonNormal) + bounds.radius <
+          context.horizonDistance) {
+    selection.horizonCulledChunks++;
+    return false;
+  }
+  return true;
+}
+
+static void addChunk(const SelectionContext &context, int face, int level,
+                     glm::vec2 origin, float size, unsigned int quadrants,
+                     QuadtreeSelection &selection) {
+  QuadtreeChunk chunk;
+  chunk.face = face;
+  chunk.level = level;
+  chunk.origin = origin;
+  chunk.size = size;
+  chunk.quadrants = quadrants;
+
+  if (level == context.settings.levels - 1) {
+    chunk.morphRange = NO_MORPHING;
+  } else {
+    float end = quadtreeLevelRange(context.settings, level);
+    float previous =
+        level > 0 ? quadtreeLevelRange(context.settings, level - 1) : 0.0f;
+    float start =
+        previous + (end - previous) * context.settings.morphStartRatio;
+    chunk.morphRange = glm::vec2(start, end);
+  }
+  selection.chunks.push_back(chunk);
+}
+
+// Selects a visible chunk that is in range of its level. Each quadrant is
+// either drawn as part of this chunk or replaced by finer chunks.
+static void selectChunk(const SelectionContext &context, int face, int level,
+                        glm::vec2 origin, float size,
+                        QuadtreeSelection &selection) {
+  if (level == 0) {
+    addChunk(context, face, level, origin, size, 0xf, selection);
+    return;
+  }
+
+  float childRange = quadtreeLevelRange(context.settings, level - 1);
+  float childSize = size * 0.5f;
+  unsigned int quadrants = 0;
+  for (unsigned int quadrant = 0; quadrant < 4; quadrant++) {
+    glm::vec2 childOrigin =
+        origin + glm::vec2(float(quadrant & 1), float(quadrant >> 1)) *
+                     childSize;
+    ChunkBounds bounds =
+        chunkBounds(context.settings, face, childOrigin, childSize);
+    if (!isVisible(context, bounds, selection)) {
+      continue;
+    }
+    if (closestDistance(context, bounds) >= childRange) {
+      quadrants |= 1u << quadrant;
+    } else {
+      selectChunk(context, face, level - 1, childOrigin, childSize,
+                  selection);
+    }
+  }
+
+  if (quadrants != 0) {
+    addChunk(context, face, level, origin, size, quadrants, selection);
+  }
+}
+
+void selectQuadtreeChunks(const QuadtreeSettings &settings,
+                          glm::vec3 cameraPosition,
+                          const glm::mat4 &viewProjection,
+                          QuadtreeSelection &selection) {
+  selection.chunks.clear();
+  selection.visitedChunks = 0;
+  selection.frustumCulledChunks = 0;
+  selection.horizonCulledChunks = 0;
+
+  SelectionContext context(settings, cameraPosition);
+  context.frustum = frustumFromMatrix(viewProjection);
+
+  float cameraDistance = glm::length(cameraPosition);
+  context.cameraAboveSurface = cameraDistance > settings.planetRadius;
+  if (context.cameraAboveSurface) {
+    context.horizonNormal = cameraPosition / cameraDistance;
+    context.horizonDistance =
+        settings.planetRadius * settings.planetRadius / cameraDistance;
+  }
+
+  for (int face = 0; face < 6; face++) {
+    glm::vec2 origin(-1.0f);
+    ChunkBounds bounds = chunkBounds(settings, face, origin, 2.0f);
+    if (isVisible(context, bounds, selection)) {
+      selectChunk(context, face, settings.levels - 1, origin, 2.0f,
+                  selection);
+    }
+  }
+}
+
+unsigned int quadtreeTriangleCount(const QuadtreeSettings &settings,
+                                   const QuadtreeSelection &selection) {
+  unsigned int quadrantTriangles =
+      settings.gridResolution * settings.gridResolution / 2;
+  unsigned int triangles = 0;
+  for (const QuadtreeChunk &chunk : selection.chunks) {
+    for (unsigned int quadrant = 0; quadrant < 4; quadrant++) {
+      if (chunk.quadrants & (1u << quadrant)) {
+        triangles += quadrantTriangles;
+      }
+    }
+  }
+  return triangles;
+}
+
+static glm::vec3 chunkSpherePoint(const QuadtreeSettings &settings,
+                                  const QuadtreeChunk &chunk, glm::vec2 grid) {
+  glm::vec2 faceCoordinates =
+      chunk.origin + grid / float(settings.gridResolution) * chunk.size;
+  return settings.planetRadius *
+         cubeSphereDirection(chunk.face, faceCoordinates);
+}
+
+// The same as main() in planetQuadtree.vert
+static glm::vec3 morphedChunkVertex(const QuadtreeSettings &settings,
+                                    const QuadtreeChunk &chunk,
+                                    glm::vec2 grid,
+                                    glm::vec3 cameraPosition) {
+  glm::vec3 position = chunkSpherePoint(settings, chunk, grid);
+  float morph = glm::clamp(
+      (glm::distance(position, cameraPosition) - chunk.morphRange.x) /
+          (chunk.morphRange.y - chunk.morphRange.x),
+      0.0f, 1.0f);
+  glm::vec2 odd = glm::mod(grid, 2.0f);
+  if (morph > 0.0f && odd != glm::vec2(0.0f)) {
+    glm::vec3 parentEdge =
+        0.5f * (chunkSpherePoint(settings, chunk, grid - odd) +
+                chunkSpherePoint(settings, chunk, grid + odd));
+    position = glm::mix(position, parentEdge, morph);
+  }
+  return position;
+}
+
+// The inverse of cubeSphereDirection() on the given face
+static glm::vec2 faceCoordinatesOf(int face, glm::vec3 direction) {
+  const CubeFace &cubeFace = CUBE_FACES[face];
+  float normal = glm::dot(direction, cubeFace.normal);
+  return glm::vec2(std::atan(glm::dot(direction, cubeFace.u) / normal),
+                   std::atan(glm::dot(direction, cubeFace.v) / normal)) /
+         QUARTER_PI;
+}
+
+static int cubeFaceOf(glm::vec3 direction) {
+  int face = 0;
+  for (int i = 1; i < 6; i++) {
+    if (glm::dot(direction, CUBE_FACES[i].normal) >
+        glm::dot(direction, CUBE_FACES[face].normal)) {
+      face = i;
+    }
+  }
+  return face;
+}
+
+// The chunk that draws the point, or -1 if it was culled
+static int drawingChunk(const QuadtreeSelection &selection, int face,
+                        glm::vec2 faceCoordinates) {
+  for (std::size_t i = 0; i < selection.chunks.size(); i++) {
+    const QuadtreeChunk &chunk = selection.chunks[i];
+    glm::vec2 local = (faceCoordinates - chunk.origin) / chunk.size;
+    if (chunk.face != face || local.x < 0.0f || local.x > 1.0f ||
+        local.y < 0.0f || local.y > 1.0f) {
+      continue;
+    }
+    unsigned int quadrant = (local.x >= 0.5f ? 1 : 0) +
+                            (local.y >= 0.5f ? 2 : 0);
+    if (chunk.quadrants & (1u << quadrant)) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+QuadtreeMeshCheck checkQuadtreeMesh(const QuadtreeSettings &settings,
+                                    const QuadtreeSelection &selection,
+                                    glm::vec3 cameraPosition) {
+  int resolution = settings.gridResolution;
+  int half = resolution / 2;
+  int rowLength = resolution + 1;
+
+  std::vector<std::vector<glm::vec3>> vertices(selection.chunks.size());
+  for (std::size_t i = 0; i < selection.chunks.size(); i++) {
+    for (int y = 0; y <= resolution; y++) {
+      for (int x = 0; x <= resolution; x++) {
+        vertices[i].push_back(morphedChunkVertex(
+            settings, selection.chunks[i], glm::vec2(x, y), cameraPosition));
+      }
+    }
+  }
+
+  QuadtreeMeshCheck check;
+  const glm::vec2 outwards[4] = {glm::vec2(-1, 0), glm::vec2(1, 0),
+                                 glm::vec2(0, -1), glm::vec2(0, 1)};
+  for (std::size_t i = 0; i < selection.chunks.size(); i++) {
+    const QuadtreeChunk &chunk = selection.chunks[i];
+    const std::vector<glm::vec3> &chunkVertices = vertices[i];
+    for (unsigned int quadrant = 0; quadrant < 4; quadrant++) {
+      if (!(chunk.quadrants & (1u << quadrant))) {
+        continue;
+      }
+      int startX = (quadrant & 1) * half;
+      int startY = (quadrant >> 1) * half;
+
+      // The triangles of generateChunkGrid()
+      for (int y = startY; y < startY + half; y++) {
+        for (int x = startX; x < startX + half; x++) {
+          const glm::vec3 &corner = chunkVertices[y * rowLength + x];
+          const glm::vec3 &right = chunkVertices[y * rowLength + x + 1];
+          const glm::vec3 &up = chunkVertices[(y + 1) * rowLength + x];
+          const glm::vec3 &opposite =
+              chunkVertices[(y + 1) * rowLength + x + 1];
+          if (glm::dot(glm::cross(right - corner, opposite - corner),
+                       corner + right + opposite) <= 0.0f) {
+            check.inwardTriangles++;
+          }
+          if (glm::dot(glm::cross(opposite - corner, up - corner),
+                       corner + opposite + up) <= 0.0f) {
+            check.inwardTriangles++;
+          }
+        }
+      }
+
+      // Every vertex on a side of the quadrant has to lie on the edge of the
+      // chunk across that side, which may be on another face
+      for (int side = 0; side < 4; side++) {
+        for (int step = 0; step <= half; step++) {
+          int x = side < 2 ? startX + (side == 1 ? half : 0) : startX + step;
+          int y = side < 2 ? startY + step : startY + (side == 3 ? half : 0);
+          glm::vec2 faceCoordinates =
+              chunk.origin +
+              glm::vec2(float(x), float(y)) / float(resolution) * chunk.size;
+          glm::vec2 across =
+              faceCoordinates + outwards[side] * (chunk.size * 1e-3f);
+          glm::vec3 direction =
+              cubeSphereDirection(chunk.face, faceCoordinates);
+          glm::vec3 acrossDirection = cubeSphereDirection(chunk.face, across);
+
+          int face = cubeFaceOf(acrossDirection);
+          int other = drawingChunk(selection, face,
+                                   faceCoordinatesOf(face, acrossDirection));
+          if (other < 0 || other == (int)i) {
+            continue;
+          }
+
+          // Where the vertex is on the other chunk's grid. It is on one of
+          // the grid lines, and may be between two vertices on it.
+          const QuadtreeChunk &otherChunk = selection.chunks[other];
+          glm::vec2 otherGrid =
+              (faceCoordinatesOf(face, direction) - otherChunk.origin) /
+              otherChunk.size * float(resolution);
+          glm::vec2 offset = glm::abs(otherGrid - glm::round(otherGrid));
+          int along = offset.x < offset.y ? 1 : 0;
+          int lineAxis = 1 - along;
+          int line = glm::clamp((int)std::round(otherGrid[lineAxis]), 0,
+                                resolution);
+          int first = glm::clamp((int)std::floor(otherGrid[along]), 0,
+                                 resolution - 1);
+          float t = glm::clamp(otherGrid[along] - first, 0.0f, 1.0f);
+          int firstIndex = along == 0 ? line * rowLength + first
+                                      : first * rowLength + line;
+          int secondIndex = firstIndex + (along == 0 ? 1 : rowLength);
+          glm::vec3 edgePoint = glm::mix(vertices[other][firstIndex],
+                                         vertices[other][secondIndex], t);
+
+          float gap = glm::distance(chunkVertices[y * rowLength + x],
+                                    edgePoint);
+          check.maxGap = std::fmax(check.maxGap, gap);
+        }
+      }
+    }
+  }
+  return check;
+}
+
+Mesh generateChunkGrid(int gridResolution) {
+  Mesh mesh;
+  int rowLength = gridResolution + 1;
+  for (int y = 0; y <= gridResolution; y++) {
+    for (int x = 0; x <= gridResolution; x++) {
+      mesh.vertices.push_back(glm::vec3(float(x), float(y), 0.0f));
+    }
+  }
+
+  // All diagonals go the same way, so that every other diagonal lines up
+  // with the diagonals of the parent's grid, which the morph relies on
+  int half = gridResolution / 2;
+  for (int quadrant = 0; quadrant < 4; quadrant++) {
+    std::vector<unsigned int> indices;
+    int startX = (quadrant & 1) * half;
+    int startY = (quadrant >> 1) * half;
+    for (int y = startY; y < startY + half; y++) {
+      for (int x = startX; x < startX + half; x++) {
+        unsigned int corner = y * rowLength + x;
+        unsigned int triangles[6] = {corner,
+                                     corner + 1,
+                                     corner + rowLength + 1,
+                                     corner,
+                                     corner + rowLength + 1,
+                                     corner + rowLength};
+        indices.insert(indices.end(), triangles, triangles + 6);
+      }
+    }
+    optimizeVertexCache(indices, (unsigned int)mesh.vertices.size());
+    mesh.indices.insert(mesh.indices.end(), indices.begin(), indices.end());
+  }
+  return mesh;
+}
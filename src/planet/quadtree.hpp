@@ -0,0 +1,97 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <utilities/mesh.h>
+#include <vector>
+
+// Continuous distance-dependent level of detail ("CDLOD", Strugar 2009) for a
+// sphere made of six cube faces, each a quadtree of square chunks. Every chunk
+// is drawn with the same grid, see generateChunkGrid(), and morphs into its
+// parent's grid as it nears the end of its range so that levels meet without
+// cracks or popping.
+//
+// Face coordinates run from -1 to 1 along each face. They are stretched with
+// tan(x * pi / 4) before being projected onto the sphere, which keeps chunks
+// of one level close to the same size.
+
+struct CubeFace {
+  glm::vec3 normal;
+  glm::vec3 u;
+  glm::vec3 v;
+};
+
+// Right handed, so that counter-clockwise in (u, v) faces outwards
+extern const CubeFace CUBE_FACES[6];
+
+struct QuadtreeSettings {
+  float planetRadius = 10.0f;
+  // Level 0 is the finest, levels - 1 the whole faces
+  int levels = 8;
+  // Quads along each side of a chunk. Must be divisible by 4.
+  int gridResolution = 16;
+  // Distance a level is used to, in chunk sizes of that level
+  float detailFactor = 3.0f;
+  // Where in its range a level starts morphing into the next one
+  float morphStartRatio = 0.66f;
+  bool frustumCulling = true;
+  bool horizonCulling = true;
+};
+
+struct QuadtreeChunk {
+  int face;
+  int level;
+  // Lower corner and side length in face coordinates
+  glm::vec2 origin;
+  float size;
+  // Quadrants to draw, bit y * 2 + x. Parts of a chunk covered by finer
+  // chunks are left out.
+  unsigned int quadrants;
+  // Distances from the camera the grid morphs between, in world units
+  glm::vec2 morphRange;
+};
+
+struct QuadtreeSelection {
+  std::vector<QuadtreeChunk> chunks;
+  // Chunks considered, and those rejected by each test
+  unsigned int visitedChunks = 0;
+  unsigned int frustumCulledChunks = 0;
+  unsigned int horizonCulledChunks = 0;
+};
+
+// Chunks to draw for a camera at `cameraPosition`, with the planet centred at
+// the origin. `viewProjection` is the camera's view projection matrix times
+// the planet's model matrix, and cameraPosition is in the same model space.
+void selectQuadtreeChunks(const QuadtreeSettings &settings,
+                          glm::vec3 cameraPosition,
+                          const glm::mat4 &viewProjection,
+                          QuadtreeSelection &selection);
+
+// Triangles drawn for the selected chunks
+unsigned int quadtreeTriangleCount(const QuadtreeSettings &settings,
+                                   const QuadtreeSelection &selection);
+
+struct QuadtreeMeshCheck {
+  // Largest distance from a vertex on the side of a chunk to the edge of the
+  // chunk across that side, in world units. Anything above rounding errors
+  // is a crack.
+  float maxGap = 0.0f;
+  // Triangles the morph turned to face the centre of the planet
+  unsigned int inwardTriangles = 0;
+};
+
+// Places the vertices of the selected chunks the way planetQuadtree.vert
+// does, and checks that the chunks meet and stay facing outwards
+QuadtreeMeshCheck checkQuadtreeMesh(const QuadtreeSettings &settings,
+                                    const QuadtreeSelection &selection,
+                                    glm::vec3 cameraPosition);
+
+// Point on the unit sphere for the given face coordinates
+glm::vec3 cubeSphereDirection(int face, glm::vec2 faceCoordinates);
+
+// Distance from the camera each level is used to
+float quadtreeLevelRange(const QuadtreeSettings &settings, int level);
+
+// The grid every chunk is drawn with. Vertices are the integer grid
+// coordinates (x, y, 0), and the triangles of each quadrant are stored
+// together, quadrant 0 first, so that quadrants can be drawn on their own.
+Mesh generateChunkGrid(int gridResolution);
@@ -0,0 +1,225 @@
+#include "renderQueue.hpp"
+#include <algorithm>
+#include <cstring>
+#include <glm/gtc/type_ptr.hpp>
+
+// Not a value any of the state can have, so the next call always goes through
+const GLuint UNKNOWN_STATE = 0xffffffff;
+
+void GLStateCache::invalidate() {
+  mProgram = UNKNOWN_STATE;
+  mCullFace = UNKNOWN_STATE;
+  mActiveTexture = UNKNOWN_STATE;
+  mTexture = UNKNOWN_STATE;
+  mVertexArray = UNKNOWN_STATE;
+}
+
+bool GLStateCache::change(GLuint &current, GLuint value) {
+  if (current == value) {
+    avoided++;
+    return false;
+  }
+  current = value;
+  changes++;
+  return true;
+}
+
+void GLStateCache::useProgram(GLuint program) {
+  if (change(mProgram, program) && !mCountOnly) {
+    glUseProgram(program);
+  }
+}
+
+void GLStateCache::cullFace(GLenum face) {
+  if (change(mCullFace, face) && !mCountOnly) {
+    glCullFace(face);
+  }
+}
+
+void GLStateCache::bindTexture(unsigned int unit, GLuint texture) {
+  if (change(mActiveTexture, GL_TEXTURE0 + unit)) {
+    if (!mCountOnly) {
+      glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    // Only one unit is tracked
+    mTexture = UNKNOWN_STATE;
+  }
+  if (change(mTexture, texture) && !mCountOnly) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+  }
+}
+
+void GLStateCache::bindVertexArray(GLuint vertexArray) {
+  if (change(mVertexArray, vertexArray) && !mCountOnly) {
+    glBindVertexArray(vertexArray);
+  }
+}
+
+unsigned int RenderQueue::addShader(Gloom::Shader *shader) {
+  ShaderState state;
+  state.shader = shader;
+  state.firstInstance = shader->getUniformFromName("firstInstance");
+  state.positionOffset = shader->getUniformFromName("positionOffset");
+  state.positionScale = shader->getUniformFromName("positionScale");
+  state.textureOffset = shader->getUniformFromName("textureOffset");
+  state.textureScale = shader->getUniformFromName("textureScale");
+  mShaders.push_back(state);
+  return (unsigned int)mShaders.size() - 1;
+}
+
+uint64_t RenderQueue::key(RenderPass pass, unsigned int shader,
+                          GLenum cullFace, GLuint texture, GLuint vertexArray,
+                          float distance) const {
+  // The bits of a positive float sort like the float. The lowest mantissa
+  // bits are dropped to fit.
+  uint32_t distanceBits;
+  distance = std::max(distance, 0.0f);
+  std::memcpy(&distanceBits, &distance, sizeof(distanceBits));
+  distanceBits >>= 8;
+
+  uint64_t stateBits = uint64_t(shader & 63) << 33 |
+                       uint64_t(cullFace == GL_FRONT) << 32 |
+                       uint64_t(texture & 0xffff) << 16 |
+                       uint64_t(vertexArray & 0xffff);
+  if (pass == RenderPass::Blended) {
+    uint64_t farToNear = ~distanceBits & 0x7fffff;
+    return uint64_t(pass) << 62 | farToNear << 39 | stateBits;
+  }
+  return uint64_t(pass) << 62 | stateBits << 23 | distanceBits;
+}
+
+static bool sameQuantization(const VertexQuantization &a,
+                             const VertexQuantization &b) {
+  return a.positionOffset == b.positionOffset &&
+         a.positionScale == b.positionScale &&
+         a.textureOffset == b.textureOffset && a.textureScale == b.textureScale;
+}
+
+// Whether the items can be drawn by the same call
+static bool sameState(const DrawItem &a, const DrawItem &b) {
+  const int passShift = 62;
+  return a.key >> passShift == b.key >> passShift && a.shader == b.shader &&
+         a.cullFace == b.cullFace && a.texture == b.texture &&
+         a.vertexArray == b.vertexArray;
+}
+
+// Sorts the items and merges runs of instanced ones into batches
+void RenderQueue::batch() {
+  // Items with equal keys keep the order they were added in
+  std::stable_sort(
+      mItems.begin(), mItems.end(),
+      [](const DrawItem &a, const DrawItem &b) { return a.key < b.key; });
+
+  // Instances are drawn in order, so a batch of blended items stays sorted
+  // from far to near
+  mBatches.clear();
+  mInstanceBodies.clear();
+  for (const DrawItem &item : mItems) {
+    if (item.instanced && !mBatches.empty() && mBatches.back().instanced &&
+        sameState(mBatches.back(), item)) {
+      mBatches.back().instanceCount++;
+    } else {
+      mBatches.push_back(item);
+      mBatches.back().firstInstance = (unsigned int)mInstanceBodies.size();
+      mBatches.back().instanceCount = 1;
+    }
+    mInstanceBodies.push_back(item.body);
+  }
+}
+
+void RenderQueue::setState(GLStateCache &state, const DrawItem &item,
+                           GLuint program) {
+  state.useProgram(program);
+  state.cullFace(item.cullFace);
+  if (item.texture != 0) {
+    state.bindTexture(0, item.texture);
+  }
+  state.bindVertexArray(item.vertexArray);
+}
+
+RenderQueueStats RenderQueue::submit(
+    GLStateCache &state,
+    const std::function<void(const DrawItem &, Gloom::Shader *)> &draw) {
+  batch();
+
+  if (mInstanceBuffer == 0) {
+    glGenBuffers(1, &mInstanceBuffer);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, mInstanceBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               mInstanceBodies.size() * sizeof(uint32_t),
+               mInstanceBodies.data(), GL_STREAM_DRAW);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mInstanceBuffer);
+
+  state.resetCounts();
+  unsigned int uploads = 0;
+  unsigned int uploadsAvoided = 0;
+  for (const DrawItem &item : mBatches) {
+    ShaderState &shader = mShaders[item.shader];
+    setState(state, item, shader.shader->get());
+
+    glUniform1i(shader.firstInstance, (GLint)item.firstInstance);
+    // Every draw of a mesh has the same quantization, and the uniforms keep
+    // their values while other shaders are used
+    SceneNode *node = item.node;
+    if (shader.quantizationSet &&
+        sameQuantization(shader.quantization, node->quantization)) {
+      uploadsAvoided++;
+    } else {
+      const VertexQuantization &quantization = node->quantization;
+      glUniform3fv(shader.positionOffset, 1,
+                   glm::value_ptr(quantization.positionOffset));
+      glUniform3fv(shader.positionScale, 1,
+                   glm::value_ptr(quantization.positionScale));
+      glUniform2fv(shader.textureOffset, 1,
+                   glm::value_ptr(quantization.textureOffset));
+      glUniform2fv(shader.textureScale, 1,
+                   glm::value_ptr(quantization.textureScale));
+      shader.quantization = quantization;
+      shader.quantizationSet = true;
+      uploads++;
+    }
+
+    draw(item, shader.shader);
+  }
+
+  RenderQueueStats stats;
+  stats.draws = (unsigned int)mBatches.size();
+  stats.instances = (unsigned int)mItems.size();
+  stats.stateChanges = state.changes + uploads;
+  stats.stateChangesAvoided = state.avoided + uploadsAvoided;
+  return stats;
+}
+
+RenderQueueStats RenderQueue::countStateChanges() {
+  batch();
+
+  GLStateCache state(true);
+  // The quantization each shader was last given, by shader index
+  std::vector<const VertexQuantization *> quantizations;
+  unsigned int uploads = 0;
+  unsigned int uploadsAvoided = 0;
+  for (const DrawItem &item : mBatches) {
+    // Any program name will do, as long as every shader has its own
+    setState(state, item, item.shader + 1);
+
+    if (item.shader >= quantizations.size()) {
+      quantizations.resize(item.shader + 1, nullptr);
+    }
+    const VertexQuantization *&quantization = quantizations[item.shader];
+    if (quantization &&
+        sameQuantization(*quantization, item.node->quantization)) {
+      uploadsAvoided++;
+    } else {
+      quantization = &item.node->quantization;
+      uploads++;
+    }
+  }
+
+  RenderQueueStats stats;
+  stats.draws = (unsigned int)mBatches.size();
+  stats.instances = (unsigned int)mItems.size();
+  stats.stateChanges = state.changes + uploads;
+  stats.stateChangesAvoided = state.avoided + uploadsAvoided;
+  return stats;
+}
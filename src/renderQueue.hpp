@@ -0,0 +1,139 @@
+#pragma once
+
+#include "sceneGraph.hpp"
+#include <cstdint>
+#include <functional>
+#include <glad/glad.h>
+#include <utilities/shader.hpp>
+#include <vector>
+
+// Passes are drawn in order. Blended draws go last, so that they blend over
+// everything opaque.
+enum class RenderPass : unsigned int { Opaque, Blended };
+
+// Remembers the GL state it has set, and skips the calls that would set it
+// to what it already is. Code that changes the state behind its back has to
+// be followed by invalidate(). A cache that only counts makes no GL calls at
+// all, for the reports, which have no GL context.
+class GLStateCache {
+public:
+  explicit GLStateCache(bool countOnly = false) : mCountOnly(countOnly) {
+    invalidate();
+  }
+
+  void invalidate();
+
+  void useProgram(GLuint program);
+  void cullFace(GLenum face);
+  // Binds to GL_TEXTURE_2D on the unit, leaving that unit active
+  void bindTexture(unsigned int unit, GLuint texture);
+  void bindVertexArray(GLuint vertexArray);
+
+  // Calls made and skipped since the last resetCounts()
+  unsigned int changes = 0;
+  unsigned int avoided = 0;
+  void resetCounts() { changes = avoided = 0; }
+
+private:
+  // Whether value is new, remembering it if so
+  bool change(GLuint &current, GLuint value);
+
+  bool mCountOnly;
+  GLuint mProgram;
+  GLuint mCullFace;
+  GLuint mActiveTexture;
+  GLuint mTexture;
+  GLuint mVertexArray;
+};
+
+// Everything one draw needs. The node's own draw call is left to the caller
+// of RenderQueue::submit(), which only sets up the state for it.
+struct DrawItem {
+  uint64_t key;
+  SceneNode *node;
+  unsigned int shader;
+  GLenum cullFace;
+  // 0 for none
+  GLuint texture;
+  GLuint vertexArray;
+  // Index into the body buffer, which the shaders look up by instance
+  unsigned int body;
+  // Whether the item may be drawn in one instanced draw call together with
+  // the items next to it in the queue that need the same state
+  bool instanced;
+  // Set by submit(): the range of the instance buffer drawn. The shaders find
+  // the body of instance i at firstInstance + i.
+  unsigned int firstInstance;
+  unsigned int instanceCount;
+};
+
+struct RenderQueueStats {
+  unsigned int draws = 0;
+  // Items drawn, more than the draws when some are instanced together
+  unsigned int instances = 0;
+  // GL calls and uniform uploads made and skipped as redundant
+  unsigned int stateChanges = 0;
+  unsigned int stateChangesAvoided = 0;
+};
+
+// Draw items collected during a traversal of the scene, sorted by their key
+// before they are submitted so that draws that share state are next to each
+// other.
+class RenderQueue {
+public:
+  // Shaders are named by the index this returns. At most 64 shaders.
+  unsigned int addShader(Gloom::Shader *shader);
+  Gloom::Shader *shader(unsigned int index) const {
+    return mShaders[index].shader;
+  }
+
+  // From the most significant bits down: the pass, shader, cull face,
+  // texture and vertex array, and then the distance to the camera from near
+  // to far. Blended draws have to be drawn from far to near, so in that pass
+  // the distance comes before the state. Textures and vertex arrays are cut
+  // to 16 bits, which only makes sorting group them less well if there are
+  // more.
+  uint64_t key(RenderPass pass, unsigned int shader, GLenum cullFace,
+               GLuint texture, GLuint vertexArray, float distance) const;
+
+  void clear() { mItems.clear(); }
+  void add(const DrawItem &item) { mItems.push_back(item); }
+  const std::vector<DrawItem> &items() const { return mItems; }
+
+  // Sorts the items and merges runs of instanced ones into batches. Uploads
+  // the body of every instance to the instance buffer, bound to shader
+  // storage binding 1. Then, for each batch, sets the state it needs through
+  // the cache, uploads its first instance and the mesh' quantization to the
+  // shader, and calls draw for it.
+  RenderQueueStats
+  submit(GLStateCache &state,
+         const std::function<void(const DrawItem &, Gloom::Shader *)> &draw);
+
+  // The draws and state changes submit() would make, from a cache and
+  // shaders that have nothing set yet, without any GL calls. The shaders
+  // need not have been added.
+  RenderQueueStats countStateChanges();
+
+private:
+  struct ShaderState {
+    Gloom::Shader *shader;
+    GLint firstInstance;
+    GLint positionOffset;
+    GLint positionScale;
+    GLint textureOffset;
+    GLint textureScale;
+    // What the shader's uniforms were last set to
+    bool quantizationSet = false;
+    VertexQuantization quantization;
+  };
+
+  void batch();
+  static void setState(GLStateCache &state, const DrawItem &item,
+                       GLuint program);
+
+  std::vector<ShaderState> mShaders;
+  std::vector<DrawItem> mItems;
+  std::vector<DrawItem> mBatches;
+  std::vector<uint32_t> mInstanceBodies;
+  GLuint mInstanceBuffer = 0;
+};
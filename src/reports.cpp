@@ -0,0 +1,648 @@
+#include "reports.hpp"
+#include "bodies.hpp"
+#include "boundingVolumeHierarchy.hpp"
+#include "gamelogic.h"
+#include "planet/quadtree.hpp"
+#include "renderQueue.hpp"
+#include "sceneGraph.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fmt/format.h>
+#include <string>
+#include <thread>
+#include <utilities/blockCompression.hpp>
+#include <utilities/camera.hpp>
+#include <utilities/imageLoader.hpp>
+#include <utilities/mesh.h>
+#include <utilities/meshFile.hpp>
+#include <utilities/meshOptimizer.hpp>
+#include <utilities/meshlets.hpp>
+#include <utilities/mipmaps.hpp>
+#include <utilities/packedMesh.hpp>
+#include <utilities/shapes.h>
+#include <utilities/textureFile.hpp>
+#include <utilities/timeutils.h>
+#include <utilities/virtualTexture.hpp>
+#include <utilities/window.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/transform.hpp>
+
+static void printMeshReportRow(const std::string &name, const Mesh &mesh) {
+  // Position, normal and texture coordinates
+  size_t vertexBytes = mesh.vertices.size() * (3 + 3 + 2) * sizeof(float);
+  size_t packedBytes = mesh.vertices.size() * sizeof(QuantizedPositionVertex);
+  size_t indexBytes = mesh.indices.size() * sizeof(unsigned int);
+  unsigned int vertexCount = (unsigned int)mesh.vertices.size();
+  size_t triangleCount = mesh.indices.size() / 3;
+  float acmr16 = averageCacheMissRatio(mesh.indices, vertexCount, 16);
+  float acmr32 = averageCacheMissRatio(mesh.indices, vertexCount, 32);
+
+  fmt::print("{:<32} {:>8} {:>9} {:>10.1f} {:>10.1f} {:>10.1f} {:>7.3f} "
+             "{:>7.3f} {:>12.0f}\n",
+             name, vertexCount, triangleCount, vertexBytes / 1024.0,
+             packedBytes / 1024.0, indexBytes / 1024.0, acmr16, acmr32,
+             acmr32 * triangleCount);
+}
+
+static std::string meshletCullColumns(const MeshletCullStats &stats) {
+  return fmt::format("{:>9} {:>9} {:>9} {:>6}",
+                     stats.triangles - stats.frustumCulledTriangles -
+                         stats.coneCulledTriangles,
+                     stats.frustumCulledTriangles, stats.coneCulledTriangles,
+                     stats.drawCommands);
+}
+
+// Sizes of the meshlets, and what culling them leaves of the planet and the
+// atmosphere shell along the zoom range
+static void printMeshletReport(Mesh &mesh) {
+  getTimeDeltaSeconds();
+  std::vector<Meshlet> meshlets = buildMeshlets(mesh);
+  double buildTime = getTimeDeltaSeconds();
+
+  unsigned int maxVertices = 0;
+  unsigned int maxTriangles = 0;
+  double vertexSum = 0.0;
+  double coneSum = 0.0;
+  for (const Meshlet &meshlet : meshlets) {
+    maxVertices = std::max(maxVertices, meshlet.vertexCount);
+    maxTriangles = std::max(maxTriangles, meshlet.indexCount / 3);
+    vertexSum += meshlet.vertexCount;
+    coneSum += glm::degrees(std::asin(meshlet.coneSine));
+  }
+  fmt::print("\n{} meshlets built in {:.1f} ms: {:.1f} vertices and {:.1f} "
+             "triangles on average,\nat most {} and {}, with cones of {:.1f} "
+             "degrees on average. ACMR32 is {:.3f}.\n\n",
+             meshlets.size(), buildTime * 1e3, vertexSum / meshlets.size(),
+             mesh.indices.size() / 3.0 / meshlets.size(), maxVertices,
+             maxTriangles, coneSum / meshlets.size(),
+             averageCacheMissRatio(mesh.indices,
+                                   (unsigned int)mesh.vertices.size(), 32));
+
+  glm::mat4 projection =
+      projectionMatrix(float(windowWidth) / float(windowHeight));
+  glm::mat4 planetModel = glm::rotate(initialPlanetAngle, glm::vec3(0, 1, 0));
+  glm::mat4 atmosphereModel =
+      planetModel *
+      glm::scale(glm::vec3(BodyParameters().atmosphereRadius / planetRadius));
+
+  fmt::print("{:>5} | {:>9} {:>9} {:>9} {:>6} | {:>9} {:>9} {:>9} {:>6}\n",
+             "Zoom", "Planet", "Frustum", "Cone", "Draws", "Shell",
+             "Frustum", "Cone", "Draws");
+
+  std::vector<DrawElementsIndirectCommand> commands;
+  unsigned int missing = 0;
+  for (float zoom = 1.0f; zoom <= 2.0f; zoom += 0.25f) {
+    Gloom::Camera headlessCamera(glm::vec3(0, 0, -planetRadius - 6.5f));
+    setupHeadlessCamera(headlessCamera, zoom);
+    glm::mat4 viewProjection = projection * headlessCamera.getViewMatrix();
+    glm::vec4 cameraPosition(headlessCamera.getPosition(), 1.0f);
+
+    // Each cull is checked against culling the triangles one by one
+    glm::vec3 localCamera =
+        glm::vec3(glm::inverse(planetModel) * cameraPosition);
+    MeshletCullStats planet;
+    cullMeshlets(meshlets.data(), (unsigned int)meshlets.size(),
+                 localCamera, viewProjection * planetModel,
+                 CulledFaces::Back, commands, planet);
+    missing += missingTriangles(mesh, commands, localCamera,
+                                viewProjection * planetModel,
+                                CulledFaces::Back);
+    localCamera = glm::vec3(glm::inverse(atmosphereModel) * cameraPosition);
+    MeshletCullStats shell;
+    cullMeshlets(meshlets.data(), (unsigned int)meshlets.size(),
+                 localCamera, viewProjection * atmosphereModel,
+                 CulledFaces::Front, commands, shell);
+    missing += missingTriangles(mesh, commands, localCamera,
+                                viewProjection * atmosphereModel,
+                                CulledFaces::Front);
+    fmt::print("{:>5.2f} | {} | {}\n", zoom, meshletCullColumns(planet),
+               meshletCullColumns(shell));
+  }
+
+  fmt::print("\nThe planet and shell columns are the triangles drawn out of "
+             "{}, followed by\nthe triangles culled by the frustum and by the "
+             "normal cones. The shell is\ndrawn from the inside, so its "
+             "cones are tested the other way around.\n",
+             mesh.indices.size() / 3);
+  fmt::print("\nCulling the triangles one by one by facing and by the "
+             "frustum planes finds\n{} visible triangles that the meshlets "
+             "left out.\n",
+             missing);
+}
+
+void printMeshReport() {
+  fmt::print("{:<32} {:>8} {:>9} {:>10} {:>10} {:>10} {:>7} {:>7} {:>12}\n",
+             "Mesh", "Vertices", "Triangles", "Vertex KiB", "Packed KiB",
+             "Index KiB", "ACMR16", "ACMR32", "Vertex shader");
+
+  std::string uvName = fmt::format("UV sphere {}x{}", sphereSlices,
+                                   sphereLayers);
+  printMeshReportRow(uvName,
+                     generateSphere(planetRadius, sphereSlices, sphereLayers));
+
+  Mesh indexed =
+      generateIndexedSphere(planetRadius, sphereSlices, sphereLayers);
+  printMeshReportRow(uvName + ", indexed", indexed);
+  optimizeMesh(indexed);
+  printMeshReportRow(uvName + ", indexed, optimized", indexed);
+
+  // Level 5 is the first with a smaller chord error than the UV sphere
+  Mesh icosphere = generateIcosphere(planetRadius, 5);
+  printMeshReportRow("Icosphere level 5", icosphere);
+  optimizeMesh(icosphere);
+  printMeshReportRow("Icosphere level 5, optimized", icosphere);
+
+  fmt::print("\nACMR is vertex shader invocations per triangle through a FIFO "
+             "cache of 16 or 32\nvertices. The last column is the number of "
+             "invocations with 32 entries. Packed\nvertices have 16-bit "
+             "positions, octahedral normals and 16-bit UVs.\n");
+
+  printMeshletReport(indexed);
+
+  // Startup cost of a planet of a million triangles, generated, and mapped
+  // from the cache
+  const int largeSlices = 708;
+  const int largeLayers = 708;
+  uint64_t hash = planetMeshHash(largeSlices, largeLayers);
+  std::string fileName = meshFileName(cacheDirectory, hash);
+
+  getTimeDeltaSeconds();
+  PackedMesh generated = generatePlanetMesh(largeSlices, largeLayers);
+  double generateTime = getTimeDeltaSeconds();
+  bool saved = saveMeshFile(meshData(generated), hash, fileName);
+  double saveTime = getTimeDeltaSeconds();
+
+  CachedMesh cached;
+  bool loaded = saved && loadMeshFile(fileName, hash, cached);
+  // Read every page once, as the upload would
+  unsigned int checksum = 0;
+  for (std::size_t i = 0; loaded && i < cached.file.size(); i += 4096) {
+    checksum += cached.file.data()[i];
+  }
+  double loadTime = getTimeDeltaSeconds();
+  std::remove(fileName.c_str());
+
+  if (!loaded) {
+    fmt::print("\nCould not cache the mesh in \"{}\".\n", fileName);
+    return;
+  }
+  fmt::print("\n{} triangles: generated, optimized and packed in {:.1f} ms, "
+             "cached in {:.1f} ms,\nmapped from the cache in {:.2f} ms "
+             "({:.1f} MiB, checksum {}).\n",
+             cached.data.indexCount / 3, generateTime * 1e3, saveTime * 1e3,
+             loadTime * 1e3, cached.file.size() / 1048576.0, checksum);
+}
+
+void printQuadtreeReport() {
+  QuadtreeSettings settings;
+  settings.planetRadius = planetRadius;
+  QuadtreeSettings unculled = settings;
+  unculled.frustumCulling = false;
+  unculled.horizonCulling = false;
+
+  glm::mat4 projection =
+      projectionMatrix(float(windowWidth) / float(windowHeight));
+  glm::mat4 model = glm::rotate(initialPlanetAngle, glm::vec3(0, 1, 0));
+  const int repetitions = 100;
+
+  fmt::print("{:>5} {:>8} {:>7} {:>10} {:>8} {:>8} {:>11} {:>12}\n", "Zoom",
+             "Altitude", "Chunks", "Triangles", "Frustum", "Horizon",
+             "Not culled", "Selection us");
+
+  QuadtreeMeshCheck worst;
+  for (float zoom = 1.0f; zoom <= 2.0f; zoom += 0.25f) {
+    Gloom::Camera headlessCamera(glm::vec3(0, 0, -planetRadius - 6.5f));
+    setupHeadlessCamera(headlessCamera, zoom);
+    glm::mat4 viewProjection =
+        projection * headlessCamera.getViewMatrix() * model;
+    glm::vec3 localCamera = glm::vec3(
+        glm::inverse(model) * glm::vec4(headlessCamera.getPosition(), 1.0f));
+
+    QuadtreeSelection selection;
+    getTimeDeltaSeconds();
+    for (int i = 0; i < repetitions; i++) {
+      selectQuadtreeChunks(settings, localCamera, viewProjection, selection);
+    }
+    double selectionTime = getTimeDeltaSeconds() / repetitions;
+
+    QuadtreeSelection everything;
+    selectQuadtreeChunks(unculled, localCamera, viewProjection, everything);
+
+    // Chunks left out by culling are not there to meet, so the check runs on
+    // every chunk
+    QuadtreeMeshCheck check =
+        checkQuadtreeMesh(unculled, everything, localCamera);
+    worst.maxGap = std::max(worst.maxGap, check.maxGap);
+    worst.inwardTriangles += check.inwardTriangles;
+
+    fmt::print("{:>5.2f} {:>8.2f} {:>7} {:>10} {:>8} {:>8} {:>11} {:>12.1f}\n",
+               zoom, glm::length(localCamera) - planetRadius,
+               selection.chunks.size(),
+               quadtreeTriangleCount(settings, selection),
+               selection.frustumCulledChunks, selection.horizonCulledChunks,
+               quadtreeTriangleCount(unculled, everything),
+               selectionTime * 1e6);
+  }
+
+  fmt::print("\nThe UV sphere draws {} triangles from every view. Frustum and "
+             "horizon count\nthe chunks culled by each test, and the last "
+             "column is the selection time on\nthe CPU.\n",
+             2 * sphereSlices * sphereLayers);
+  fmt::print("\nPlaced as planetQuadtree.vert places them, no vertex on the "
+             "side of a chunk is\nfurther than {:.1e} from the edge of its "
+             "neighbour, and {} triangles face\ninwards.\n",
+             worst.maxGap, worst.inwardTriangles);
+}
+
+// The item addDrawItem() makes for a planet or atmosphere node drawn without
+// meshlet culling, with shader 0 standing in for the planet shader and 1 for
+// the atmosphere shader
+static void addReportDrawItem(RenderQueue &queue, SceneNode &node,
+                              const SceneTransforms &transforms,
+                              glm::vec3 cameraPosition) {
+  if (node.vertexArrayObjectID == -1) {
+    return;
+  }
+  DrawItem item;
+  item.node = &node;
+  item.vertexArray = node.vertexArrayObjectID;
+  item.body = node.body;
+  item.instanced = true;
+  RenderPass pass = RenderPass::Opaque;
+  if (node.nodeType == SceneNodeType::ATMOSPHERE) {
+    item.shader = 1;
+    item.cullFace = GL_FRONT;
+    item.texture = 0;
+    pass = RenderPass::Blended;
+  } else {
+    item.shader = 0;
+    item.cullFace = GL_BACK;
+    item.texture = node.textureID;
+  }
+  glm::vec3 position = glm::vec3(transforms.world(node.transform)[3]);
+  item.key = queue.key(pass, item.shader, item.cullFace, item.texture,
+                       item.vertexArray,
+                       glm::length(position - cameraPosition));
+  queue.add(item);
+}
+
+void printCullReport() {
+  glm::mat4 projection =
+      projectionMatrix(float(windowWidth) / float(windowHeight));
+  Gloom::Camera headlessCamera(glm::vec3(0, 0, -planetRadius - 6.5f));
+  setupHeadlessCamera(headlessCamera, 1.0f);
+  glm::mat4 viewProjection = projection * headlessCamera.getViewMatrix();
+  glm::vec3 cameraPosition = headlessCamera.getPosition();
+  const int repetitions = 20;
+
+  fmt::print("{:>6} {:>6} {:>6} {:>8} {:>7} {:>8} {:>7} {:>7} {:>8} {:>9} "
+             "{:>7} {:>8}\n",
+             "Moons", "Pixels", "Nodes", "Build ms", "Visited", "Frustum",
+             "Small", "Visible", "Cull us", "Linear us", "Refit", "Refit us");
+
+  // What the render queue makes of the visible nodes of each row
+  struct QueueRow {
+    unsigned int count;
+    float pixels;
+    RenderQueueStats stats;
+  };
+  std::vector<QueueRow> queueRows;
+
+  for (unsigned int count : {1000u, 10000u, 100000u}) {
+    // The planet and its moons as the game creates them, in a scene of their
+    // own
+    SceneTransforms transforms;
+    SceneNodePool nodes(transforms);
+    std::vector<Body> bodies;
+    SceneNodeHandle root = nodes.create();
+    SceneNodeHandle planet = nodes.create();
+    SceneNodeHandle atmosphere = nodes.create();
+    nodes.addChild(root, planet);
+    nodes.addChild(planet, atmosphere);
+    nodes.get(planet)->boundingRadius = planetRadius;
+    nodes.get(atmosphere)->boundingRadius = planetRadius;
+    nodes.get(atmosphere)->nodeType = SceneNodeType::ATMOSPHERE;
+    // Stand-ins for the mesh and texture every body shares. Without a GL
+    // context they only have to tell the render queue they are the same.
+    for (SceneNodeHandle node : {planet, atmosphere}) {
+      nodes.get(node)->vertexArrayObjectID = 1;
+      nodes.get(node)->textureID = 1;
+    }
+    bodies.push_back(Body{planet, BodyParameters()});
+    SceneNode earth = *nodes.get(planet);
+    nodes.addChild(root, createMoonNodes(nodes, transforms, earth,
+                                         planetRadius, BodyParameters(), count,
+                                         bodies));
+
+    BoundingVolumeHierarchy bounds;
+    transforms.update();
+    getTimeDeltaSeconds();
+    bounds.update(nodes, transforms);
+    double buildTime = getTimeDeltaSeconds();
+
+    // A hundredth of the moons move a little, and only the boxes above them
+    // are refitted
+    for (unsigned int i = 1; i < bodies.size(); i += 100) {
+      unsigned int transform = nodes.get(bodies[i].node)->transform;
+      transforms.setPosition(transform,
+                             transforms.position(transform) * 1.01f);
+    }
+    transforms.update();
+    getTimeDeltaSeconds();
+    unsigned int refitted = bounds.update(nodes, transforms);
+    double refitTime = getTimeDeltaSeconds();
+
+    for (float pixels : {1.0f, 4.0f}) {
+      CullView view =
+          cullView(viewProjection, cameraPosition, windowHeight, pixels);
+
+      BVHCullStats stats;
+      unsigned int visible = 0;
+      getTimeDeltaSeconds();
+      for (int i = 0; i < repetitions; i++) {
+        stats = bounds.cull(view, [&visible](unsigned int) { visible++; });
+      }
+      double cullTime = getTimeDeltaSeconds() / repetitions;
+
+      // The same tests for every node, as without the hierarchy
+      float smallDistance = view.projectionScale / view.minScreenSize;
+      unsigned int linearVisible = 0;
+      for (int i = 0; i < repetitions; i++) {
+        linearVisible = 0;
+        for (unsigned int node = 0; node < nodes.capacity(); node++) {
+          if (!nodes.alive(node) || nodes[node].boundingRadius == 0.0f) {
+            continue;
+          }
+          const glm::mat4 &world = transforms.world(nodes[node].transform);
+          glm::vec3 center =
+              glm::vec3(world * glm::vec4(nodes[node].boundingCenter, 1.0f));
+          float radius = nodes[node].boundingRadius *
+                         std::max(glm::length(glm::vec3(world[0])),
+                                  std::max(glm::length(glm::vec3(world[1])),
+                                           glm::length(glm::vec3(world[2]))));
+          if (!sphereOutsideFrustum(view.frustum, center, radius) &&
+              glm::length(center - cameraPosition) <= radius * smallDistance) {
+            linearVisible++;
+          }
+        }
+      }
+      double linearTime = getTimeDeltaSeconds() / repetitions;
+      if (linearVisible != stats.visible) {
+        fmt::print("The hierarchy kept {} nodes, testing every node kept {}\n",
+                   stats.visible, linearVisible);
+      }
+
+      fmt::print("{:>6} {:>6.0f} {:>6} {:>8.2f} {:>7} {:>8} {:>7} {:>7} "
+                 "{:>8.1f} {:>9.1f} {:>7} {:>8.1f}\n",
+                 count, pixels, bounds.objectCount(), buildTime * 1e3,
+                 stats.visited, stats.frustumCulled, stats.smallCulled,
+                 stats.visible, cullTime * 1e6, linearTime * 1e6, refitted,
+                 refitTime * 1e6);
+
+      RenderQueue queue;
+      bounds.cull(view, [&](unsigned int node) {
+        addReportDrawItem(queue, nodes[node], transforms, cameraPosition);
+      });
+      queueRows.push_back({count, pixels, queue.countStateChanges()});
+    }
+  }
+
+  fmt::print("\n{:>6} {:>6} {:>7} {:>6} {:>7} {:>7}\n", "Moons", "Pixels",
+             "Items", "Draws", "Changes", "Avoided");
+  for (const QueueRow &row : queueRows) {
+    fmt::print("{:>6} {:>6.0f} {:>7} {:>6} {:>7} {:>7}\n", row.count,
+               row.pixels, row.stats.instances, row.stats.draws,
+               row.stats.stateChanges, row.stats.stateChangesAvoided);
+  }
+
+  fmt::print("\nEach moon and the planet are a planet node and an atmosphere "
+             "node. Visited counts\nthe boxes and spheres culling tested, "
+             "Frustum and Small the nodes culled by\neach test. Linear is "
+             "the time to test every node on its own. Refit counts the\n"
+             "boxes refitted after a hundredth of the moons moved.\n\n"
+             "The second table puts the visible nodes through the render "
+             "queue as the game\ndoes, without meshlet culling. Changes and "
+             "Avoided count the GL state calls\nand uniform uploads made and "
+             "skipped by the state cache in one frame.\n");
+}
+
+void convertTextureFile(const std::string &pngFileName, MipFilter filter,
+                        const std::string &formatName) {
+  std::string fileName = textureFileName(cacheDirectory, pngFileName);
+
+  getTimeDeltaSeconds();
+  PNGImage image = loadPNGFile(pngFileName);
+  double decodeTime = getTimeDeltaSeconds();
+  if (image.pixels.empty()) {
+    fmt::print("Could not decode \"{}\".\n", pngFileName);
+    return;
+  }
+  TextureFormat format;
+  if (!parseTextureFormat(formatName, format)) {
+    format = blockFormatFor(image);
+  }
+  MipChain chain = generateMipChain(image, filter);
+  double mipTime = getTimeDeltaSeconds();
+  MipChain compressed = compressMipChain(chain, format);
+  double compressTime = getTimeDeltaSeconds();
+  TextureData texture = textureData(compressed);
+  if (!saveTextureFile(texture, textureSourceHash(pngFileName), fileName)) {
+    fmt::print("Could not write \"{}\".\n", fileName);
+    return;
+  }
+  double saveTime = getTimeDeltaSeconds();
+
+  CachedTexture loaded;
+  bool mapped = loadTextureFile(fileName, textureSourceHash(pngFileName),
+                                loaded);
+  // Read every page once, as the upload would
+  unsigned int checksum = 0;
+  for (std::size_t i = 0; mapped && i < loaded.file.size(); i += 4096) {
+    checksum += loaded.file.data()[i];
+  }
+  double loadTime = getTimeDeltaSeconds();
+
+  fmt::print("Wrote {}: {}x{}, {} levels, {}, {:.1f} MiB ({:.1f}x smaller "
+             "than RGBA8).\n",
+             fileName, chain.width, chain.height, chain.levelCount,
+             textureFormatName(format), compressed.pixels.size() / 1048576.0,
+             double(chain.pixels.size()) / compressed.pixels.size());
+  fmt::print("Decoding the PNG took {:.1f} ms, the {} filtered mip chain "
+             "{:.1f} ms, compressing\n{:.1f} ms and writing {:.1f} ms. "
+             "Mapping the texture file takes {:.2f} ms\n(checksum {}).\n",
+             decodeTime * 1e3, filter == MipFilter::Box ? "box" : "Kaiser",
+             mipTime * 1e3, compressTime * 1e3, saveTime * 1e3,
+             loadTime * 1e3, checksum);
+  if (format == TextureFormat::RGBA8) {
+    return;
+  }
+
+  // Level 0 against the PNG, and the others against the uncompressed levels
+  // they were encoded from
+  TextureData reference = textureData(chain);
+  fmt::print("\n{:>5} {:>11} {:>8}\n", "Level", "Size", "PSNR dB");
+  for (unsigned int level = 0; level < chain.levelCount; level++) {
+    double psnr = imagePSNR(textureLevelImage(reference, level),
+                            textureLevelImage(texture, level),
+                            format == TextureFormat::BC3);
+    fmt::print("{:>5} {:>11} {:>8.2f}\n", level,
+               fmt::format("{}x{}", texture.levels[level].width,
+                           texture.levels[level].height),
+               psnr);
+  }
+}
+
+// The tiles the feedback pass asks for from the given view, found by casting
+// a ray through each feedback pixel and its neighbours instead of taking
+// derivatives
+static std::vector<unsigned int>
+cpuFeedbackTiles(const VirtualTextureLayout &layout,
+                 Gloom::Camera &headlessCamera, const glm::mat4 &projection,
+                 const glm::mat4 &model, int width, int height) {
+  glm::mat4 inverseVP =
+      glm::inverse(projection * headlessCamera.getViewMatrix());
+  glm::mat4 inverseModel = glm::inverse(model);
+  glm::vec3 origin = headlessCamera.getPosition();
+
+  auto surfaceUV = [&](float x, float y, glm::vec2 &uv) {
+    glm::vec4 far = inverseVP * glm::vec4(2.0f * x / width - 1.0f,
+                                          2.0f * y / height - 1.0f, 1.0f, 1.0f);
+    glm::vec3 ray = glm::normalize(glm::vec3(far) / far.w - origin);
+    float b = glm::dot(origin, ray);
+    float c = glm::dot(origin, origin) - planetRadius * planetRadius;
+    float discriminant = b * b - c;
+    if (discriminant < 0.0f || -b - std::sqrt(discriminant) <= 0.0f) {
+      return false;
+    }
+    glm::vec3 hit = origin + ray * (-b - std::sqrt(discriminant));
+    glm::vec3 d =
+        glm::normalize(glm::vec3(inverseModel * glm::vec4(hit, 1.0f)));
+    uv = sphereTextureCoordinates(d);
+    return true;
+  };
+  // Across the seam u is taken the short way around
+  auto footprint = [&](glm::vec2 uv, glm::vec2 neighbour) {
+    glm::vec2 delta = neighbour - uv;
+    delta.x -= std::round(delta.x);
+    delta *= glm::vec2(layout.width, layout.height);
+    return glm::dot(delta, delta);
+  };
+
+  std::vector<unsigned int> tiles;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      glm::vec2 uv, right, up;
+      if (!surfaceUV(x + 0.5f, y + 0.5f, uv)) {
+        continue;
+      }
+      float size = 0.0f;
+      if (surfaceUV(x + 1.5f, y + 0.5f, right) ||
+          surfaceUV(x - 0.5f, y + 0.5f, right)) {
+        size = std::max(size, footprint(uv, right));
+      }
+      if (surfaceUV(x + 0.5f, y + 1.5f, up) ||
+          surfaceUV(x + 0.5f, y - 0.5f, up)) {
+        size = std::max(size, footprint(uv, up));
+      }
+
+      float levelBias = std::log2(float(feedbackScale));
+      int level = int(std::floor(0.5f * std::log2(size) - levelBias));
+      level = std::min(std::max(level, 0), int(layout.levelCount) - 1);
+      glm::vec2 levelSize =
+          glm::vec2(std::max(layout.width >> level, 1u),
+                    std::max(layout.height >> level, 1u));
+      glm::vec2 texel =
+          glm::clamp(uv * levelSize, glm::vec2(0.0f), levelSize - 1.0f);
+      unsigned int tile =
+          layout.tileIndex(level, unsigned(texel.x) / VIRTUAL_TILE_SIZE,
+                           unsigned(texel.y) / VIRTUAL_TILE_SIZE);
+      if (tiles.empty() || tiles.back() != tile) {
+        tiles.push_back(tile);
+      }
+    }
+  }
+  return tiles;
+}
+
+void tileTextureFile(const std::string &pngFileName, MipFilter filter) {
+  std::string fileName = virtualTextureFileName(cacheDirectory, pngFileName);
+
+  getTimeDeltaSeconds();
+  PNGImage image = loadPNGFile(pngFileName);
+  double decodeTime = getTimeDeltaSeconds();
+  if (image.pixels.empty()) {
+    fmt::print("Could not decode \"{}\".\n", pngFileName);
+    return;
+  }
+  MipChain chain = generateMipChain(image, filter);
+  double mipTime = getTimeDeltaSeconds();
+  uint64_t sourceHash = textureSourceHash(pngFileName);
+  if (!saveVirtualTextureFile(textureData(chain), sourceHash, fileName)) {
+    fmt::print("Could not write \"{}\".\n", fileName);
+    return;
+  }
+  double saveTime = getTimeDeltaSeconds();
+  chain = MipChain();
+  image = PNGImage();
+
+  VirtualTextureFile file;
+  if (!file.open(fileName, sourceHash)) {
+    fmt::print("Could not map \"{}\".\n", fileName);
+    return;
+  }
+  const VirtualTextureLayout &layout = file.layout();
+  double tileMiB = VIRTUAL_TILE_BYTES / 1048576.0;
+  fmt::print("Wrote {}: {}x{}, {} levels, {} tiles, {:.1f} MiB.\n", fileName,
+             layout.width, layout.height, layout.levelCount, layout.tileCount,
+             layout.tileCount * tileMiB);
+  fmt::print("Decoding the PNG took {:.1f} ms, the mip chain {:.1f} ms and "
+             "tiling {:.1f} ms.\n\n",
+             decodeTime * 1e3, mipTime * 1e3, saveTime * 1e3);
+
+  glm::mat4 projection =
+      projectionMatrix(float(windowWidth) / float(windowHeight));
+  glm::mat4 model = glm::rotate(initialPlanetAngle, glm::vec3(0, 1, 0));
+  int width = std::max(windowWidth / feedbackScale, 1);
+  int height = std::max(windowHeight / feedbackScale, 1);
+
+  fmt::print("{:>5} {:>8} {:>8} {:>8} {:>9} {:>7} {:>8} {:>8}\n", "Zoom",
+             "Altitude", "Visible", "Missing", "Resident", "Loaded",
+             "Evicted", "Load ms");
+
+  // One cache for the whole sweep, as when zooming in the window. Each view
+  // requests its tiles until every tile that fits has been loaded.
+  VirtualTextureCache cache(file, virtualCacheSlots);
+  for (float zoom = 1.0f; zoom <= 2.0f; zoom += 0.25f) {
+    Gloom::Camera headlessCamera(glm::vec3(0, 0, -planetRadius - 6.5f));
+    setupHeadlessCamera(headlessCamera, zoom);
+    std::vector<unsigned int> tiles = cpuFeedbackTiles(
+        layout, headlessCamera, projection, model, width, height);
+
+    VirtualTextureStats before = cache.stats();
+    getTimeDeltaSeconds();
+    for (int frame = 0; frame < 1000; frame++) {
+      while (cache.stats().pendingTiles > 0) {
+        cache.placeLoadedTiles(virtualTileUploadsPerFrame);
+        std::this_thread::yield();
+      }
+      cache.requestTiles(tiles);
+      if (cache.stats().pendingTiles == 0) {
+        break;
+      }
+    }
+    double loadTime = getTimeDeltaSeconds();
+
+    VirtualTextureStats after = cache.stats();
+    fmt::print("{:>5.2f} {:>8.2f} {:>8} {:>8} {:>9} {:>7} {:>8} {:>8.1f}\n",
+               zoom, glm::length(headlessCamera.getPosition()) - planetRadius,
+               after.requestedTiles, after.missingTiles, after.residentTiles,
+               after.loadedTiles - before.loadedTiles,
+               after.evictedTiles - before.evictedTiles, loadTime * 1e3);
+  }
+
+  fmt::print("\nThe tile cache holds {} tiles, {:.1f} MiB, however large the "
+             "texture. Missing\ntiles did not fit and are drawn from a "
+             "coarser level.\n",
+             cache.stats().slots, cache.stats().slots * tileMiB);
+}
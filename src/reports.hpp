@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <utilities/mipmaps.hpp>
+
+// Prints the size and vertex cache efficiency of the sphere meshes
+void printMeshReport();
+
+// Prints the planet surface chunks and triangles selected from a range of
+// camera zooms
+void printQuadtreeReport();
+
+// Builds scenes of more and more moons and prints how many nodes culling
+// them through the bounding volume hierarchy visits and culls, and how long
+// that and refitting take. Needs no window or GL context.
+void printCullReport();
+
+// Converts a PNG file to a texture file with all mip levels in the cache
+// directory, in the format named "rgba8", "bc1" or "bc3", or else the one
+// blockFormatFor() picks. Prints how long each step and loading either file
+// takes, and the PSNR of each compressed level.
+void convertTextureFile(const std::string &pngFileName, MipFilter filter,
+                        const std::string &formatName);
+
+// Splits a PNG file into a virtual texture file in the cache directory, which
+// is the only place the app gets tile files from, and prints the tiles the
+// feedback pass would load into the tile cache from a range of camera zooms.
+// Needs no window or GL context.
+void tileTextureFile(const std::string &pngFileName, MipFilter filter);
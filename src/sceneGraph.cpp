@@ -1,23 +1,199 @@
 #include "sceneGraph.hpp"
+#include <algorithm>
 #include <iostream>
 
-SceneNode *createSceneNode() { return new SceneNode(); }
+SceneTransforms sceneTransforms;
+SceneNodePool sceneNodes(sceneTransforms);
+
+// A free slot if there is one, or a new one at the end
+unsigned int SceneNodePool::allocate() {
+  if (mFreeSlots.empty()) {
+    return append();
+  }
+  unsigned int index = mFreeSlots.back();
+  mFreeSlots.pop_back();
+  mNodes[index] = SceneNode();
+  mNodes[index].transform = mTransforms.add();
+  mAlive[index] = true;
+  mCount++;
+  mVersion++;
+  return index;
+}
+
+unsigned int SceneNodePool::append() {
+  unsigned int index = (unsigned int)mNodes.size();
+  mNodes.emplace_back();
+  mNodes[index].transform = mTransforms.add();
+  if (mGenerations.size() == index) {
+    mGenerations.push_back(0);
+    mAlive.push_back(false);
+  }
+  mAlive[index] = true;
+  mCount++;
+  mVersion++;
+  return index;
+}
+
+SceneNodeHandle SceneNodePool::create() { return handle(allocate()); }
+
+std::vector<SceneNodeHandle> SceneNodePool::create(unsigned int count) {
+  std::size_t total = mNodes.size() + count;
+  mNodes.reserve(total);
+  mGenerations.reserve(total);
+  mAlive.reserve(total);
+  mTransforms.reserve(mTransforms.size() + count);
+
+  // Appended rather than put in free slots, so that they are together
+  std::vector<SceneNodeHandle> handles(count);
+  for (unsigned int i = 0; i < count; i++) {
+    handles[i] = handle(append());
+  }
+  return handles;
+}
+
+SceneNode *SceneNodePool::get(SceneNodeHandle node) {
+  if (node.index >= mNodes.size() || !mAlive[node.index] ||
+      mGenerations[node.index] != node.generation) {
+    return nullptr;
+  }
+  return &mNodes[node.index];
+}
+
+// Takes the node out of its parent's children
+void SceneNodePool::detach(unsigned int index) {
+  SceneNode &node = mNodes[index];
+  if (node.parent == NO_NODE) {
+    return;
+  }
+  SceneNode &parent = mNodes[node.parent];
+  unsigned int previous = NO_NODE;
+  for (unsigned int child = parent.firstChild; child != index;
+       child = mNodes[child].nextSibling) {
+    previous = child;
+  }
+  if (previous == NO_NODE) {
+    parent.firstChild = node.nextSibling;
+  } else {
+    mNodes[previous].nextSibling = node.nextSibling;
+  }
+  if (parent.lastChild == index) {
+    parent.lastChild = previous;
+  }
+  node.parent = NO_NODE;
+  node.nextSibling = NO_NODE;
+}
+
+bool SceneNodePool::addChild(SceneNodeHandle parentHandle,
+                             SceneNodeHandle childHandle) {
+  SceneNode *parent = get(parentHandle);
+  SceneNode *child = get(childHandle);
+  if (!parent || !child) {
+    return false;
+  }
+  for (unsigned int ancestor = parentHandle.index; ancestor != NO_NODE;
+       ancestor = mNodes[ancestor].parent) {
+    if (ancestor == childHandle.index) {
+      return false;
+    }
+  }
+
+  detach(childHandle.index);
+  child->parent = parentHandle.index;
+  if (parent->lastChild == NO_NODE) {
+    parent->firstChild = childHandle.index;
+  } else {
+    mNodes[parent->lastChild].nextSibling = childHandle.index;
+  }
+  parent->lastChild = childHandle.index;
+  return mTransforms.setParent(child->transform, int(parent->transform));
+}
+
+void SceneNodePool::destroy(SceneNodeHandle handle) {
+  if (!get(handle)) {
+    return;
+  }
+  detach(handle.index);
+  mVersion++;
+
+  // Depth first through the links, which freeing a node leaves as they are
+  unsigned int index = handle.index;
+  while (true) {
+    const SceneNode &node = mNodes[index];
+    mTransforms.remove(node.transform);
+    mGenerations[index]++;
+    mAlive[index] = false;
+    mFreeSlots.push_back(index);
+    mCount--;
+
+    if (node.firstChild != NO_NODE) {
+      index = node.firstChild;
+      continue;
+    }
+    while (index != handle.index && mNodes[index].nextSibling == NO_NODE) {
+      index = mNodes[index].parent;
+    }
+    if (index == handle.index) {
+      break;
+    }
+    index = mNodes[index].nextSibling;
+  }
+
+  // Gives back the free slots at the end
+  std::size_t end = mNodes.size();
+  while (end > 0 && !mAlive[end - 1]) {
+    end--;
+  }
+  if (end < mNodes.size()) {
+    mNodes.resize(end);
+    mFreeSlots.erase(std::remove_if(mFreeSlots.begin(), mFreeSlots.end(),
+                                    [end](unsigned int slot) {
+                                      return slot >= end;
+                                    }),
+                     mFreeSlots.end());
+  }
+}
+
+SceneNodeHandle createSceneNode() { return sceneNodes.create(); }
+
+std::vector<SceneNodeHandle> createSceneNodes(unsigned int count) {
+  return sceneNodes.create(count);
+}
+
+void destroySceneNode(SceneNodeHandle node) { sceneNodes.destroy(node); }
 
 // Add a child node to its parent's list of children
-void addChild(SceneNode *parent, SceneNode *child) {
-  parent->children.push_back(child);
+void addChild(SceneNodeHandle parent, SceneNodeHandle child) {
+  sceneNodes.addChild(parent, child);
 }
 
-int totalChildren(SceneNode *parent) {
-  int count = parent->children.size();
-  for (SceneNode *child : parent->children) {
-    count += totalChildren(child);
+int totalChildren(SceneNodeHandle parent) {
+  SceneNode *node = sceneNodes.get(parent);
+  if (!node) {
+    return 0;
+  }
+  int count = 0;
+  for (unsigned int child = node->firstChild;
+       child != NO_NODE; child = sceneNodes[child].nextSibling) {
+    count += 1 + totalChildren(sceneNodes.handle(child));
   }
   return count;
 }
 
 // Pretty prints the current values of a SceneNode instance to stdout
-void printNode(SceneNode *node) {
+void printNode(SceneNodeHandle handle) {
+  SceneNode *node = sceneNodes.get(handle);
+  if (!node) {
+    printf("SceneNode { destroyed }\n");
+    return;
+  }
+  int childCount = 0;
+  for (unsigned int child = node->firstChild; child != NO_NODE;
+       child = sceneNodes[child].nextSibling) {
+    childCount++;
+  }
+  glm::vec3 rotation = sceneTransforms.rotation(node->transform);
+  glm::vec3 position = sceneTransforms.position(node->transform);
+  glm::vec3 referencePoint = sceneTransforms.referencePoint(node->transform);
   printf("SceneNode {\n"
          "    Child count: %i\n"
          "    Rotation: (%f, %f, %f)\n"
@@ -25,8 +201,7 @@ void printNode(SceneNode *node) {
          "    Reference point: (%f, %f, %f)\n"
          "    VAO ID: %i\n"
          "}\n",
-         int(node->children.size()), node->rotation.x, node->rotation.y,
-         node->rotation.z, node->position.x, node->position.y, node->position.z,
-         node->referencePoint.x, node->referencePoint.y, node->referencePoint.z,
-         node->vertexArrayObjectID);
+         childCount, rotation.x, rotation.y, rotation.z, position.x,
+         position.y, position.z, referencePoint.x, referencePoint.y,
+         referencePoint.z, node->vertexArrayObjectID);
 }
@@ -3,6 +3,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/mat4x4.hpp>
+#include <sceneTransforms.hpp>
+#include <utilities/packedMesh.hpp>
 
 #include <chrono>
 #include <cstdio>
@@ -13,52 +15,145 @@
 #include <stdbool.h>
 #include <vector>
 
-enum SceneNodeType { GEOMETRY, ATMOSPHERE };
+enum SceneNodeType { GEOMETRY, PLANET_QUADTREE, ATMOSPHERE };
+
+// The index of no node
+const unsigned int NO_NODE = 0xffffffff;
 
 struct SceneNode {
   SceneNode() {
-    position = glm::vec3(0, 0, 0);
-    rotation = glm::vec3(0, 0, 0);
-    scale = glm::vec3(1, 1, 1);
-
-    referencePoint = glm::vec3(0, 0, 0);
+    parent = NO_NODE;
+    firstChild = NO_NODE;
+    lastChild = NO_NODE;
+    nextSibling = NO_NODE;
+    transform = 0;
     vertexArrayObjectID = -1;
     VAOIndexCount = 0;
+    meshlets = nullptr;
+    meshletCount = 0;
+    indirectBufferID = 0;
+    textureID = 0;
+    body = 0;
+    boundingCenter = glm::vec3(0.0f);
+    boundingRadius = 0.0f;
 
     nodeType = GEOMETRY;
   }
 
-  // A list of all children that belong to this node.
-  // For instance, in case of the scene graph of a human body shown in the
-  // assignment text, the "Upper Torso" node would contain the "Left Arm",
-  // "Right Arm", "Head" and "Lower Torso" nodes in its list of children.
-  std::vector<SceneNode *> children;
-
-  // The node's position and rotation relative to its parent
-  glm::vec3 position;
-  glm::vec3 rotation;
-  glm::vec3 scale;
+  // The children that belong to this node, as a list linked through their
+  // nextSibling, by index in the pool. For instance, in case of the scene
+  // graph of a human body shown in the assignment text, the "Upper Torso"
+  // node would have the "Left Arm", "Right Arm", "Head" and "Lower Torso"
+  // nodes as its children.
+  unsigned int parent;
+  unsigned int firstChild;
+  unsigned int lastChild;
+  unsigned int nextSibling;
 
-  // A transformation matrix representing the transformation of the node's
-  // location relative to its parent. This matrix is updated every frame.
-  glm::mat4 currentTransformationMatrix;
-
-  // The location of the node's reference point
-  glm::vec3 referencePoint;
+  // The node's position, rotation, scale and reference point, and the
+  // matrices made from them, are kept in sceneTransforms under this id
+  unsigned int transform;
 
   // The ID of the VAO containing the "appearance" of this SceneNode.
   int vertexArrayObjectID;
   unsigned int VAOIndexCount;
 
+  // How to map the VAO's quantized attributes back, if it has any
+  VertexQuantization quantization;
+
+  // Clusters of the VAO's triangles, culled on the CPU every frame and drawn
+  // from the indirect buffer
+  const Meshlet *meshlets;
+  unsigned int meshletCount;
+  unsigned int indirectBufferID;
+
   unsigned int textureID;
 
+  // Around what the node draws, in its model space. A radius of 0 bounds
+  // nothing, and leaves the node out of the bounding volume hierarchy.
+  glm::vec3 boundingCenter;
+  float boundingRadius;
+
+  // The planet or moon the node draws, by index in the body buffer
+  unsigned int body;
+
   // Node type is used to determine how to handle the contents of a node
   SceneNodeType nodeType;
 };
 
-SceneNode *createSceneNode();
-void addChild(SceneNode *parent, SceneNode *child);
-void printNode(SceneNode *node);
-int totalChildren(SceneNode *parent);
+// A node's index in the pool, and the generation of the slot at that index
+// when the node was created. The generation goes up when the node is
+// destroyed, so that a handle to it is not mistaken for a handle to the node
+// that reuses the slot.
+struct SceneNodeHandle {
+  unsigned int index = NO_NODE;
+  unsigned int generation = 0;
+};
+
+// Every scene node, in one array. Nodes created together are next to each
+// other, and slots freed at the end of the array are given back, so that a
+// scene loaded after another is unloaded takes the same slots again.
+// Pointers to nodes stay valid until the next node is created.
+class SceneNodePool {
+public:
+  // Each node has a transformation in transforms
+  explicit SceneNodePool(SceneTransforms &transforms)
+      : mTransforms(transforms) {}
+
+  SceneNodeHandle create();
+  // Creates count nodes in consecutive slots, growing the arrays at most
+  // once
+  std::vector<SceneNodeHandle> create(unsigned int count);
+  // Destroys the node and every node under it. Does not free their GL
+  // objects.
+  void destroy(SceneNodeHandle node);
+  // Moves the child, with its subtree, to the end of the parent's children.
+  // Fails if the parent is in the child's subtree.
+  bool addChild(SceneNodeHandle parent, SceneNodeHandle child);
+
+  // nullptr if the node has been destroyed
+  SceneNode *get(SceneNodeHandle node);
+  SceneNodeHandle handle(unsigned int index) const {
+    return SceneNodeHandle{index, mGenerations[index]};
+  }
+  // For walking the links between nodes, which are always to live nodes
+  SceneNode &operator[](unsigned int index) { return mNodes[index]; }
+
+  // Live nodes
+  unsigned int size() const { return mCount; }
+  // Slots, live or free, for walking every node by index
+  unsigned int capacity() const { return (unsigned int)mNodes.size(); }
+  bool alive(unsigned int index) const { return mAlive[index]; }
+  // Goes up whenever a node is created or destroyed
+  unsigned int version() const { return mVersion; }
+
+private:
+  SceneNodePool(SceneNodePool const &) = delete;
+  SceneNodePool &operator=(SceneNodePool const &) = delete;
+
+  unsigned int allocate();
+  unsigned int append();
+  void detach(unsigned int index);
+
+  SceneTransforms &mTransforms;
+  std::vector<SceneNode> mNodes;
+  // Do not shrink with mNodes, so that generations are never reused
+  std::vector<unsigned int> mGenerations;
+  std::vector<bool> mAlive;
+  std::vector<unsigned int> mFreeSlots;
+  unsigned int mCount = 0;
+  unsigned int mVersion = 0;
+};
+
+// The transformations and the nodes of the scene
+extern SceneTransforms sceneTransforms;
+extern SceneNodePool sceneNodes;
+
+SceneNodeHandle createSceneNode();
+std::vector<SceneNodeHandle> createSceneNodes(unsigned int count);
+void destroySceneNode(SceneNodeHandle node);
+void addChild(SceneNodeHandle parent, SceneNodeHandle child);
+void printNode(SceneNodeHandle node);
+int totalChildren(SceneNodeHandle parent);
 
 // For more details, see SceneGraph.cpp.
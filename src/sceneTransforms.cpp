@@ -0,0 +1,324 @@
+#include "sceneTransforms.hpp"
+#include <algorithm>
+#include <cmath>
+
+// out = a * b, all column major. SSE2 is part of every x86-64 CPU, so it needs
+// no extra compiler flags or runtime dispatch.
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+static inline void multiplyMatrices(const float *a, const float *b,
+                                    float *out) {
+  __m128 a0 = _mm_loadu_ps(a);
+  __m128 a1 = _mm_loadu_ps(a + 4);
+  __m128 a2 = _mm_loadu_ps(a + 8);
+  __m128 a3 = _mm_loadu_ps(a + 12);
+  for (int column = 0; column < 4; column++) {
+    const float *b0 = b + 4 * column;
+    __m128 sum = _mm_mul_ps(a0, _mm_set1_ps(b0[0]));
+    sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_set1_ps(b0[1])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_set1_ps(b0[2])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_set1_ps(b0[3])));
+    _mm_storeu_ps(out + 4 * column, sum);
+  }
+}
+#else
+static inline void multiplyMatrices(const float *a, const float *b,
+                                    float *out) {
+  for (int column = 0; column < 4; column++) {
+    for (int row = 0; row < 4; row++) {
+      out[4 * column + row] = a[row] * b[4 * column] +
+                              a[4 + row] * b[4 * column + 1] +
+                              a[8 + row] * b[4 * column + 2] +
+                              a[12 + row] * b[4 * column + 3];
+    }
+  }
+}
+#endif
+
+// translate(position) * translate(referencePoint) * rotate(rotation.y) *
+// rotate(rotation.x) * rotate(rotation.z) * scale(scale) *
+// translate(-referencePoint), written out
+static glm::mat4 localMatrix(glm::vec3 position, glm::vec3 rotation,
+                             glm::vec3 scale, glm::vec3 referencePoint) {
+  float sx = std::sin(rotation.x), cx = std::cos(rotation.x);
+  float sy = std::sin(rotation.y), cy = std::cos(rotation.y);
+  float sz = std::sin(rotation.z), cz = std::cos(rotation.z);
+
+  glm::mat4 matrix(1.0f);
+  matrix[0] = glm::vec4(cy * cz + sy * sx * sz, cx * sz,
+                        cy * sx * sz - sy * cz, 0.0f) *
+              scale.x;
+  matrix[1] = glm::vec4(sy * sx * cz - cy * sz, cx * cz,
+                        sy * sz + cy * sx * cz, 0.0f) *
+              scale.y;
+  matrix[2] = glm::vec4(sy * cx, -sx, cy * cx, 0.0f) * scale.z;
+
+  glm::vec3 pivot = glm::vec3(matrix[0]) * referencePoint.x +
+                    glm::vec3(matrix[1]) * referencePoint.y +
+                    glm::vec3(matrix[2]) * referencePoint.z;
+  matrix[3] = glm::vec4(position + referencePoint - pivot, 1.0f);
+  return matrix;
+}
+
+// The slot of a removed node
+const unsigned int NO_SLOT = 0xffffffff;
+
+unsigned int SceneTransforms::add() {
+  // A root at the end keeps the arrays in depth first order
+  unsigned int slot = (unsigned int)mIds.size();
+  unsigned int node;
+  if (mFreeIds.empty()) {
+    node = (unsigned int)mSlots.size();
+    mSlots.push_back(slot);
+    mParentIds.push_back(NO_PARENT);
+  } else {
+    node = mFreeIds.back();
+    mFreeIds.pop_back();
+    mSlots[node] = slot;
+    mParentIds[node] = NO_PARENT;
+  }
+
+  mIds.push_back(node);
+  mParents.push_back(NO_PARENT);
+  mSubtreeEnds.push_back(slot + 1);
+  mFlags.push_back(0);
+  mPositions.push_back(glm::vec3(0.0f));
+  mRotations.push_back(glm::vec3(0.0f));
+  mScales.push_back(glm::vec3(1.0f));
+  mReferencePoints.push_back(glm::vec3(0.0f));
+  mLocal.push_back(glm::mat4(1.0f));
+  mWorld.push_back(glm::mat4(1.0f));
+  return node;
+}
+
+void SceneTransforms::remove(unsigned int node) {
+  mFlags[mSlots[node]] |= Removed;
+  mSlots[node] = NO_SLOT;
+  mParentIds[node] = NO_PARENT;
+  mFreeIds.push_back(node);
+  mRemovedSlots++;
+  mOrderChanged = true;
+}
+
+void SceneTransforms::reserve(unsigned int count) {
+  mSlots.reserve(count);
+  mParentIds.reserve(count);
+  mIds.reserve(count);
+  mParents.reserve(count);
+  mSubtreeEnds.reserve(count);
+  mFlags.reserve(count);
+  mPositions.reserve(count);
+  mRotations.reserve(count);
+  mScales.reserve(count);
+  mReferencePoints.reserve(count);
+  mLocal.reserve(count);
+  mWorld.reserve(count);
+}
+
+bool SceneTransforms::setParent(unsigned int node, int parent) {
+  for (int ancestor = parent; ancestor != NO_PARENT;
+       ancestor = mParentIds[ancestor]) {
+    if (ancestor == int(node)) {
+      return false;
+    }
+  }
+  if (mParentIds[node] != parent) {
+    mParentIds[node] = parent;
+    mOrderChanged = true;
+    flag(node, WorldDirty);
+  }
+  return true;
+}
+
+void SceneTransforms::setPosition(unsigned int node, glm::vec3 position) {
+  glm::vec3 &current = mPositions[mSlots[node]];
+  if (current != position) {
+    current = position;
+    flag(node, LocalDirty);
+  }
+}
+
+void SceneTransforms::setRotation(unsigned int node, glm::vec3 rotation) {
+  glm::vec3 &current = mRotations[mSlots[node]];
+  if (current != rotation) {
+    current = rotation;
+    flag(node, LocalDirty);
+  }
+}
+
+void SceneTransforms::setScale(unsigned int node, glm::vec3 scale) {
+  glm::vec3 &current = mScales[mSlots[node]];
+  if (current != scale) {
+    current = scale;
+    flag(node, LocalDirty);
+  }
+}
+
+void SceneTransforms::setReferencePoint(unsigned int node,
+                                        glm::vec3 referencePoint) {
+  glm::vec3 &current = mReferencePoints[mSlots[node]];
+  if (current != referencePoint) {
+    current = referencePoint;
+    flag(node, LocalDirty);
+  }
+}
+
+void SceneTransforms::flag(unsigned int node, unsigned char flags) {
+  unsigned char &current = mFlags[mSlots[node]];
+  if (current == 0) {
+    mDirty.push_back(node);
+  }
+  current |= flags;
+}
+
+// Lays the nodes out depth first again, keeping siblings in the order they
+// were in and leaving out the removed nodes
+void SceneTransforms::reorder() {
+  unsigned int slotCount = (unsigned int)mIds.size();
+  unsigned int idCount = (unsigned int)mSlots.size();
+
+  // The children of each node, grouped by parent with a counting sort
+  std::vector<unsigned int> firstChild(idCount + 1, 0);
+  for (unsigned int slot = 0; slot < slotCount; slot++) {
+    int parent = mParentIds[mIds[slot]];
+    if (!(mFlags[slot] & Removed) && parent != NO_PARENT) {
+      firstChild[parent + 1]++;
+    }
+  }
+  for (unsigned int node = 0; node < idCount; node++) {
+    firstChild[node + 1] += firstChild[node];
+  }
+  std::vector<unsigned int> children(firstChild[idCount]);
+  std::vector<unsigned int> childCount(idCount, 0);
+  for (unsigned int slot = 0; slot < slotCount; slot++) {
+    if (mFlags[slot] & Removed) {
+      continue;
+    }
+    unsigned int node = mIds[slot];
+    int parent = mParentIds[node];
+    if (parent != NO_PARENT) {
+      children[firstChild[parent] + childCount[parent]++] = node;
+    }
+  }
+
+  std::vector<unsigned int> order;
+  order.reserve(slotCount);
+  std::vector<unsigned int> stack;
+  for (unsigned int slot = 0; slot < slotCount; slot++) {
+    if ((mFlags[slot] & Removed) || mParentIds[mIds[slot]] != NO_PARENT) {
+      continue;
+    }
+    stack.push_back(mIds[slot]);
+    while (!stack.empty()) {
+      unsigned int node = stack.back();
+      stack.pop_back();
+      order.push_back(node);
+      for (unsigned int child = firstChild[node + 1];
+           child > firstChild[node]; child--) {
+        stack.push_back(children[child - 1]);
+      }
+    }
+  }
+
+  unsigned int count = (unsigned int)order.size();
+  std::vector<unsigned char> flags(count);
+  std::vector<glm::vec3> positions(count);
+  std::vector<glm::vec3> rotations(count);
+  std::vector<glm::vec3> scales(count);
+  std::vector<glm::vec3> referencePoints(count);
+  std::vector<glm::mat4> local(count);
+  std::vector<glm::mat4> world(count);
+  for (unsigned int slot = 0; slot < count; slot++) {
+    unsigned int from = mSlots[order[slot]];
+    flags[slot] = mFlags[from];
+    positions[slot] = mPositions[from];
+    rotations[slot] = mRotations[from];
+    scales[slot] = mScales[from];
+    referencePoints[slot] = mReferencePoints[from];
+    local[slot] = mLocal[from];
+    world[slot] = mWorld[from];
+  }
+  mFlags.swap(flags);
+  mPositions.swap(positions);
+  mRotations.swap(rotations);
+  mScales.swap(scales);
+  mReferencePoints.swap(referencePoints);
+  mLocal.swap(local);
+  mWorld.swap(world);
+  mIds.swap(order);
+  mParents.resize(count);
+  mSubtreeEnds.resize(count);
+
+  for (unsigned int slot = 0; slot < count; slot++) {
+    mSlots[mIds[slot]] = slot;
+  }
+  for (unsigned int slot = 0; slot < count; slot++) {
+    int parent = mParentIds[mIds[slot]];
+    mParents[slot] = parent == NO_PARENT ? NO_PARENT : int(mSlots[parent]);
+    mSubtreeEnds[slot] = slot + 1;
+  }
+  // Children come after their parents, so walking backwards finishes every
+  // subtree before its root is reached
+  for (unsigned int slot = count; slot-- > 0;) {
+    if (mParents[slot] != NO_PARENT) {
+      unsigned int &end = mSubtreeEnds[mParents[slot]];
+      end = std::max(end, mSubtreeEnds[slot]);
+    }
+  }
+  mOrderChanged = false;
+  mRemovedSlots = 0;
+}
+
+void SceneTransforms::updateRange(unsigned int first, unsigned int end) {
+  for (unsigned int slot = first; slot < end; slot++) {
+    if (mFlags[slot] & LocalDirty) {
+      mLocal[slot] = localMatrix(mPositions[slot], mRotations[slot],
+                                 mScales[slot], mReferencePoints[slot]);
+    }
+    mFlags[slot] = 0;
+    mChanged.push_back(mIds[slot]);
+  }
+
+  // Every parent is either before the range or earlier in it, so its world
+  // matrix is already up to date
+  for (unsigned int slot = first; slot < end; slot++) {
+    int parent = mParents[slot];
+    if (parent == NO_PARENT) {
+      mWorld[slot] = mLocal[slot];
+    } else {
+      multiplyMatrices(&mWorld[parent][0][0], &mLocal[slot][0][0],
+                       &mWorld[slot][0][0]);
+    }
+  }
+}
+
+unsigned int SceneTransforms::update() {
+  if (mOrderChanged) {
+    reorder();
+  }
+
+  mDirtySlots.clear();
+  mChanged.clear();
+  for (unsigned int node : mDirty) {
+    if (mSlots[node] != NO_SLOT) {
+      mDirtySlots.push_back(mSlots[node]);
+    }
+  }
+  mDirty.clear();
+  std::sort(mDirtySlots.begin(), mDirtySlots.end());
+
+  // A dirty node inside the subtree of an earlier one is updated with it
+  unsigned int updated = 0;
+  unsigned int updatedEnd = 0;
+  for (unsigned int slot : mDirtySlots) {
+    if (slot < updatedEnd) {
+      continue;
+    }
+    updatedEnd = mSubtreeEnds[slot];
+    updateRange(slot, updatedEnd);
+    updated += updatedEnd - slot;
+  }
+  return updated;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+const int NO_PARENT = -1;
+
+// The transformations of the scene nodes, as one array per field. The arrays
+// are kept in depth first order, so that every node comes after its parent
+// and every subtree is a contiguous range. Changing a node flags it as dirty,
+// and update() recomputes the subtrees of the dirty nodes only, each in one
+// pass over its range.
+//
+// Nodes are named by ids, which stay the same when a reparented node moves
+// in the arrays. The ids of removed nodes are reused.
+class SceneTransforms {
+public:
+  // A new root node at the origin
+  unsigned int add();
+  // Removes the node. Its children have to be removed or moved too.
+  void remove(unsigned int node);
+  // Makes room for count nodes in every array
+  void reserve(unsigned int count);
+
+  // Moves the node and its subtree under the parent, or makes it a root if
+  // the parent is NO_PARENT. Fails if the parent is in the node's subtree.
+  bool setParent(unsigned int node, int parent);
+  int parent(unsigned int node) const { return mParentIds[node]; }
+
+  unsigned int size() const {
+    return (unsigned int)mIds.size() - mRemovedSlots;
+  }
+
+  const glm::vec3 &position(unsigned int node) const {
+    return mPositions[mSlots[node]];
+  }
+  const glm::vec3 &rotation(unsigned int node) const {
+    return mRotations[mSlots[node]];
+  }
+  const glm::vec3 &scale(unsigned int node) const {
+    return mScales[mSlots[node]];
+  }
+  const glm::vec3 &referencePoint(unsigned int node) const {
+    return mReferencePoints[mSlots[node]];
+  }
+
+  // Relative to the parent. Setting a field to the value it has already does
+  // not flag the node.
+  void setPosition(unsigned int node, glm::vec3 position);
+  void setRotation(unsigned int node, glm::vec3 rotation);
+  void setScale(unsigned int node, glm::vec3 scale);
+  void setReferencePoint(unsigned int node, glm::vec3 referencePoint);
+
+  // Recomputes the local matrices of the nodes that changed since the last
+  // call and the world matrices of their subtrees. Returns the number of
+  // world matrices recomputed.
+  unsigned int update();
+
+  // Ids of the nodes whose world matrices the last update() recomputed
+  const std::vector<unsigned int> &changed() const { return mChanged; }
+
+  // As of the last update()
+  const glm::mat4 &local(unsigned int node) const {
+    return mLocal[mSlots[node]];
+  }
+  const glm::mat4 &world(unsigned int node) const {
+    return mWorld[mSlots[node]];
+  }
+
+private:
+  enum DirtyFlags : unsigned char {
+    LocalDirty = 1,
+    WorldDirty = 2,
+    // The slot stays in the arrays until the next reorder()
+    Removed = 4
+  };
+
+  void flag(unsigned int node, unsigned char flags);
+  void reorder();
+  void updateRange(unsigned int first, unsigned int end);
+
+  // Indexed by id
+  std::vector<unsigned int> mSlots;
+  std::vector<int> mParentIds;
+  // Ids of the flagged nodes, each once
+  std::vector<unsigned int> mDirty;
+  std::vector<unsigned int> mFreeIds;
+
+  // Indexed by slot, in depth first order. The parents and subtree ends are
+  // slots too, and are out of date while mOrderChanged.
+  std::vector<unsigned int> mIds;
+  std::vector<int> mParents;
+  std::vector<unsigned int> mSubtreeEnds;
+  std::vector<unsigned char> mFlags;
+  std::vector<glm::vec3> mPositions;
+  std::vector<glm::vec3> mRotations;
+  std::vector<glm::vec3> mScales;
+  std::vector<glm::vec3> mReferencePoints;
+  std::vector<glm::mat4> mLocal;
+  std::vector<glm::mat4> mWorld;
+
+  bool mOrderChanged = false;
+  unsigned int mRemovedSlots = 0;
+  std::vector<unsigned int> mDirtySlots;
+  std::vector<unsigned int> mChanged;
+};
@@ -0,0 +1,54 @@
+#include "assetLoader.hpp"
+#include <exception>
+
+static double secondsBetween(std::chrono::steady_clock::time_point start,
+                             std::chrono::steady_clock::time_point end) {
+  return std::chrono::duration<double>(end - start).count();
+}
+
+AssetLoader::AssetLoader(unsigned int threadCount) : mPool(threadCount) {}
+
+void AssetLoader::submit(const std::string &name, std::function<void()> load,
+                         std::function<void()> upload) {
+  mPending++;
+  mPool.submit([this, name, load, upload]() {
+    LoadedAsset asset;
+    Clock::time_point start = Clock::now();
+    // An exception escaping the task would leave the asset pending forever
+    try {
+      load();
+    } catch (const std::exception &e) {
+      asset.timing.error = e.what();
+    } catch (...) {
+      asset.timing.error = "unknown exception";
+    }
+    asset.loaded = Clock::now();
+    asset.timing.name = name;
+    asset.timing.loadTime = secondsBetween(start, asset.loaded);
+    asset.upload = upload;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mLoaded.push_back(std::move(asset));
+  });
+}
+
+std::vector<AssetTiming> AssetLoader::uploadLoaded() {
+  std::deque<LoadedAsset> loaded;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    loaded.swap(mLoaded);
+  }
+
+  std::vector<AssetTiming> timings;
+  for (LoadedAsset &asset : loaded) {
+    Clock::time_point start = Clock::now();
+    if (asset.timing.error.empty()) {
+      asset.upload();
+    }
+    asset.timing.waitTime = secondsBetween(asset.loaded, start);
+    asset.timing.uploadTime = secondsBetween(start, Clock::now());
+    timings.push_back(asset.timing);
+    mPending--;
+  }
+  return timings;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "threadPool.hpp"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// How long one asset took, in seconds
+struct AssetTiming {
+  std::string name;
+  // On the worker thread
+  double loadTime;
+  // From the end of loading until the GL thread started the upload
+  double waitTime;
+  double uploadTime;
+  // What the load threw, if it did. The asset is then not uploaded.
+  std::string error;
+};
+
+// Runs the CPU side of loading assets on worker threads, and hands each loaded
+// asset back to the thread that owns the GL context, which uploads it between
+// frames
+class AssetLoader {
+public:
+  // 0 starts one worker per hardware thread
+  explicit AssetLoader(unsigned int threadCount = 0);
+
+  // Calls load on a worker and then upload on the thread calling
+  // uploadLoaded(), both with the same default constructed T
+  template <typename T>
+  void load(const std::string &name, std::function<void(T &)> load,
+            std::function<void(T &)> upload) {
+    auto asset = std::make_shared<T>();
+    submit(name, [asset, load]() { load(*asset); },
+           [asset, upload]() { upload(*asset); });
+  }
+
+  // Uploads every asset that has finished loading, in the order they
+  // finished, and returns their timings. Assets that failed to load are
+  // returned with their error instead of being uploaded.
+  std::vector<AssetTiming> uploadLoaded();
+
+  // True once every asset has been uploaded or has failed
+  bool done() const { return mPending == 0; }
+
+private:
+  AssetLoader(AssetLoader const &) = delete;
+  AssetLoader &operator=(AssetLoader const &) = delete;
+
+  typedef std::chrono::steady_clock Clock;
+
+  struct LoadedAsset {
+    AssetTiming timing;
+    Clock::time_point loaded;
+    std::function<void()> upload;
+  };
+
+  void submit(const std::string &name, std::function<void()> load,
+              std::function<void()> upload);
+
+  unsigned int mPending = 0;
+  std::deque<LoadedAsset> mLoaded;
+  std::mutex mMutex;
+  // Last, so that the workers are stopped before the members they use go
+  ThreadPool mPool;
+};
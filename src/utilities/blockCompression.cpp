@@ -0,0 +1,514 @@
+#include "blockCompression.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+static uint16_t packRGB565(const float color[3]) {
+  int r = std::min(std::max(int(color[0] * (31.0f / 255.0f) + 0.5f), 0), 31);
+  int g = std::min(std::max(int(color[1] * (63.0f / 255.0f) + 0.5f), 0), 63);
+  int b = std::min(std::max(int(color[2] * (31.0f / 255.0f) + 0.5f), 0), 31);
+  return uint16_t(r << 11 | g << 5 | b);
+}
+
+// Expanded to 8 bits by repeating the high bits, as the hardware does
+static void unpackRGB565(uint16_t packed, int color[3]) {
+  int r = packed >> 11 & 31;
+  int g = packed >> 5 & 63;
+  int b = packed & 31;
+  color[0] = r << 3 | r >> 2;
+  color[1] = g << 2 | g >> 4;
+  color[2] = b << 3 | b >> 2;
+}
+
+// The four colours of a block in four colour mode, where the middle two are
+// a third of the way from each end
+static void colorPalette(uint16_t color0, uint16_t color1, int palette[4][3]) {
+  unpackRGB565(color0, palette[0]);
+  unpackRGB565(color1, palette[1]);
+  for (int channel = 0; channel < 3; channel++) {
+    palette[2][channel] =
+        (2 * palette[0][channel] + palette[1][channel] + 1) / 3;
+    palette[3][channel] =
+        (palette[0][channel] + 2 * palette[1][channel] + 1) / 3;
+  }
+}
+
+// For each 8 bit value, the pair of 5 or 6 bit endpoints whose colour a
+// third of the way from the first to the second is closest to it. Flat
+// blocks use these instead of rounding to 565, which would be off by up to 4.
+struct SingleColorTable {
+  uint8_t end0[256];
+  uint8_t end1[256];
+};
+
+static SingleColorTable singleColorTable(int bits) {
+  SingleColorTable table;
+  int levels = 1 << bits;
+  for (int value = 0; value < 256; value++) {
+    int bestError = std::numeric_limits<int>::max();
+    for (int end0 = 0; end0 < levels; end0++) {
+      for (int end1 = 0; end1 < levels; end1++) {
+        int expanded0 = end0 << (8 - bits) | end0 >> (2 * bits - 8);
+        int expanded1 = end1 << (8 - bits) | end1 >> (2 * bits - 8);
+        int interpolated = (2 * expanded0 + expanded1 + 1) / 3;
+        int error = std::abs(interpolated - value) * 256 +
+                    std::abs(expanded0 - expanded1);
+        if (error < bestError) {
+          bestError = error;
+          table.end0[value] = uint8_t(end0);
+          table.end1[value] = uint8_t(end1);
+        }
+      }
+    }
+  }
+  return table;
+}
+
+// Picks the nearest palette colour for each texel, and returns the summed
+// squared error
+static int colorIndices(const unsigned char *texels, const int palette[4][3],
+                        uint32_t &indices) {
+  indices = 0;
+  int totalError = 0;
+  for (int i = 0; i < 16; i++) {
+    const unsigned char *texel = texels + 4 * i;
+    int bestIndex = 0;
+    int bestError = std::numeric_limits<int>::max();
+    for (int index = 0; index < 4; index++) {
+      int dr = texel[0] - palette[index][0];
+      int dg = texel[1] - palette[index][1];
+      int db = texel[2] - palette[index][2];
+      int error = dr * dr + dg * dg + db * db;
+      if (error < bestError) {
+        bestError = error;
+        bestIndex = index;
+      }
+    }
+    indices |= uint32_t(bestIndex) << (2 * i);
+    totalError += bestError;
+  }
+  return totalError;
+}
+
+// Endpoints that fit the texels best for the given indices, by least squares
+// ("Real-Time DXT Compression", van Waveren 2006; stb_dxt)
+static bool refineEndpoints(const unsigned char *texels, uint32_t indices,
+                            float end0[3], float end1[3]) {
+  static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+  float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+  float ax[3] = {}, bx[3] = {};
+  for (int i = 0; i < 16; i++) {
+    float a = weights[indices >> (2 * i) & 3];
+    float b = 1.0f - a;
+    aa += a * a;
+    bb += b * b;
+    ab += a * b;
+    for (int channel = 0; channel < 3; channel++) {
+      ax[channel] += a * texels[4 * i + channel];
+      bx[channel] += b * texels[4 * i + channel];
+    }
+  }
+  float determinant = aa * bb - ab * ab;
+  if (std::fabs(determinant) < 1e-6f) {
+    return false;
+  }
+  for (int channel = 0; channel < 3; channel++) {
+    end0[channel] = (ax[channel] * bb - bx[channel] * ab) / determinant;
+    end1[channel] = (bx[channel] * aa - ax[channel] * ab) / determinant;
+  }
+  return true;
+}
+
+static void writeColorBlock(uint16_t color0, uint16_t color1, uint32_t indices,
+                            unsigned char *block) {
+  // Four colour mode needs color0 > color1. Swapping the endpoints swaps
+  // indices 0 and 1, and 2 and 3.
+  if (color0 < color1) {
+    std::swap(color0, color1);
+    indices ^= 0x55555555u;
+  } else if (color0 == color1) {
+    indices = 0;
+  }
+  block[0] = uint8_t(color0);
+  block[1] = uint8_t(color0 >> 8);
+  block[2] = uint8_t(color1);
+  block[3] = uint8_t(color1 >> 8);
+  for (int i = 0; i < 4; i++) {
+    block[4 + i] = uint8_t(indices >> (8 * i));
+  }
+}
+
+// The colour block of BC1 and BC3. The endpoints start at the ends of the
+// texels' principal axis and are then refined twice by least squares.
+static void encodeColorBlock(const unsigned char *texels,
+                             unsigned char *block) {
+  float mean[3] = {};
+  for (int i = 0; i < 16; i++) {
+    for (int channel = 0; channel < 3; channel++) {
+      mean[channel] += texels[4 * i + channel] / 16.0f;
+    }
+  }
+  float covariance[3][3] = {};
+  for (int i = 0; i < 16; i++) {
+    float d[3];
+    for (int channel = 0; channel < 3; channel++) {
+      d[channel] = texels[4 * i + channel] - mean[channel];
+    }
+    for (int row = 0; row < 3; row++) {
+      for (int column = 0; column < 3; column++) {
+        covariance[row][column] += d[row] * d[column];
+      }
+    }
+  }
+
+  // Power iteration, starting from the channel that varies most
+  int largest = 0;
+  for (int channel = 1; channel < 3; channel++) {
+    if (covariance[channel][channel] > covariance[largest][largest]) {
+      largest = channel;
+    }
+  }
+  if (covariance[largest][largest] < 1e-3f) {
+    static const SingleColorTable table5 = singleColorTable(5);
+    static const SingleColorTable table6 = singleColorTable(6);
+    const unsigned char *texel = texels;
+    uint16_t color0 = uint16_t(table5.end0[texel[0]] << 11 |
+                               table6.end0[texel[1]] << 5 |
+                               table5.end0[texel[2]]);
+    uint16_t color1 = uint16_t(table5.end1[texel[0]] << 11 |
+                               table6.end1[texel[1]] << 5 |
+                               table5.end1[texel[2]]);
+    // Every texel takes the colour a third of the way, index 2
+    writeColorBlock(color0, color1, 0xaaaaaaaau, block);
+    return;
+  }
+  float axis[3] = {covariance[largest][0], covariance[largest][1],
+                   covariance[largest][2]};
+  for (int iteration = 0; iteration < 8; iteration++) {
+    float next[3];
+    float length = 0.0f;
+    for (int row = 0; row < 3; row++) {
+      next[row] = covariance[row][0] * axis[0] + covariance[row][1] * axis[1] +
+                  covariance[row][2] * axis[2];
+      length = std::max(length, std::fabs(next[row]));
+    }
+    if (length == 0.0f) {
+      break;
+    }
+    for (int row = 0; row < 3; row++) {
+      axis[row] = next[row] / length;
+    }
+  }
+
+  float low = std::numeric_limits<float>::max();
+  float high = -low;
+  for (int i = 0; i < 16; i++) {
+    float projection = 0.0f;
+    for (int channel = 0; channel < 3; channel++) {
+      projection += (texels[4 * i + channel] - mean[channel]) * axis[channel];
+    }
+    low = std::min(low, projection);
+    high = std::max(high, projection);
+  }
+  float axisLength2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+  float end0[3], end1[3];
+  for (int channel = 0; channel < 3; channel++) {
+    end0[channel] = mean[channel] + axis[channel] * high / axisLength2;
+    end1[channel] = mean[channel] + axis[channel] * low / axisLength2;
+  }
+
+  uint16_t bestColor0 = packRGB565(end0);
+  uint16_t bestColor1 = packRGB565(end1);
+  int palette[4][3];
+  colorPalette(bestColor0, bestColor1, palette);
+  uint32_t bestIndices;
+  int bestError = colorIndices(texels, palette, bestIndices);
+
+  for (int iteration = 0; iteration < 2 && bestError > 0; iteration++) {
+    if (!refineEndpoints(texels, bestIndices, end0, end1)) {
+      break;
+    }
+    uint16_t color0 = packRGB565(end0);
+    uint16_t color1 = packRGB565(end1);
+    colorPalette(color0, color1, palette);
+    uint32_t indices;
+    int error = colorIndices(texels, palette, indices);
+    if (error >= bestError) {
+      break;
+    }
+    bestColor0 = color0;
+    bestColor1 = color1;
+    bestIndices = indices;
+    bestError = error;
+  }
+  writeColorBlock(bestColor0, bestColor1, bestIndices, block);
+}
+
+// Six values between the two when alpha0 > alpha1, and otherwise four and
+// then 0 and 255
+static void alphaPalette(int alpha0, int alpha1, int palette[8]) {
+  palette[0] = alpha0;
+  palette[1] = alpha1;
+  if (alpha0 > alpha1) {
+    for (int index = 2; index < 8; index++) {
+      palette[index] = ((8 - index) * alpha0 + (index - 1) * alpha1) / 7;
+    }
+  } else {
+    for (int index = 2; index < 6; index++) {
+      palette[index] = ((6 - index) * alpha0 + (index - 1) * alpha1) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+// Eight alpha values between the smallest and the largest alpha of the block
+static void encodeAlphaBlock(const unsigned char *texels,
+                             unsigned char *block) {
+  int alpha0 = 0;
+  int alpha1 = 255;
+  for (int i = 0; i < 16; i++) {
+    alpha0 = std::max(alpha0, int(texels[4 * i + 3]));
+    alpha1 = std::min(alpha1, int(texels[4 * i + 3]));
+  }
+  block[0] = uint8_t(alpha0);
+  block[1] = uint8_t(alpha1);
+
+  uint64_t indices = 0;
+  if (alpha0 > alpha1) {
+    int palette[8];
+    alphaPalette(alpha0, alpha1, palette);
+    for (int i = 0; i < 16; i++) {
+      int alpha = texels[4 * i + 3];
+      int bestIndex = 0;
+      for (int index = 1; index < 8; index++) {
+        if (std::abs(palette[index] - alpha) <
+            std::abs(palette[bestIndex] - alpha)) {
+          bestIndex = index;
+        }
+      }
+      indices |= uint64_t(bestIndex) << (3 * i);
+    }
+  }
+  for (int i = 0; i < 6; i++) {
+    block[2 + i] = uint8_t(indices >> (8 * i));
+  }
+}
+
+void encodeBC1Block(const unsigned char *texels, unsigned char *block) {
+  encodeColorBlock(texels, block);
+}
+
+void encodeBC3Block(const unsigned char *texels, unsigned char *block) {
+  encodeAlphaBlock(texels, block);
+  encodeColorBlock(texels, block + 8);
+}
+
+// BC1 falls back to three colours and transparent black when color0 is not
+// larger than color1. BC3 always uses four colours.
+static void decodeColorBlock(const unsigned char *block, bool threeColorMode,
+                             unsigned char *texels) {
+  uint16_t color0 = uint16_t(block[0] | block[1] << 8);
+  uint16_t color1 = uint16_t(block[2] | block[3] << 8);
+  int palette[4][3];
+  colorPalette(color0, color1, palette);
+  bool transparentBlack = threeColorMode && color0 <= color1;
+  if (transparentBlack) {
+    for (int channel = 0; channel < 3; channel++) {
+      palette[2][channel] = (palette[0][channel] + palette[1][channel]) / 2;
+      palette[3][channel] = 0;
+    }
+  }
+
+  uint32_t indices = uint32_t(block[4]) | uint32_t(block[5]) << 8 |
+                     uint32_t(block[6]) << 16 | uint32_t(block[7]) << 24;
+  for (int i = 0; i < 16; i++) {
+    int index = indices >> (2 * i) & 3;
+    for (int channel = 0; channel < 3; channel++) {
+      texels[4 * i + channel] = uint8_t(palette[index][channel]);
+    }
+    texels[4 * i + 3] = transparentBlack && index == 3 ? 0 : 255;
+  }
+}
+
+void decodeBC1Block(const unsigned char *block, unsigned char *texels) {
+  decodeColorBlock(block, true, texels);
+}
+
+void decodeBC3Block(const unsigned char *block, unsigned char *texels) {
+  decodeColorBlock(block + 8, false, texels);
+
+  int palette[8];
+  alphaPalette(block[0], block[1], palette);
+  uint64_t indices = 0;
+  for (int i = 0; i < 6; i++) {
+    indices |= uint64_t(block[2 + i]) << (8 * i);
+  }
+  for (int i = 0; i < 16; i++) {
+    texels[4 * i + 3] = uint8_t(palette[indices >> (3 * i) & 7]);
+  }
+}
+
+TextureFormat blockFormatFor(const PNGImage &image) {
+  for (std::size_t i = 3; i < image.pixels.size(); i += 4) {
+    if (image.pixels[i] != 255) {
+      return TextureFormat::BC3;
+    }
+  }
+  return TextureFormat::BC1;
+}
+
+static std::size_t blockBytes(TextureFormat format) {
+  return format == TextureFormat::BC1 ? 8 : 16;
+}
+
+// Texels past the edges of a level smaller than a block repeat the edge
+static void gatherBlock(const TextureLevel &level, unsigned int blockX,
+                        unsigned int blockY, unsigned char *texels) {
+  for (unsigned int y = 0; y < 4; y++) {
+    unsigned int row = std::min(blockY * 4 + y, level.height - 1);
+    for (unsigned int x = 0; x < 4; x++) {
+      unsigned int column = std::min(blockX * 4 + x, level.width - 1);
+      std::memcpy(texels + 4 * (4 * y + x),
+                  level.pixels + 4 * (std::size_t(row) * level.width + column),
+                  4);
+    }
+  }
+}
+
+MipChain compressMipChain(const MipChain &chain, TextureFormat format,
+                          unsigned int threadCount) {
+  if (format == TextureFormat::RGBA8 || chain.format != TextureFormat::RGBA8) {
+    return chain;
+  }
+
+  MipChain compressed;
+  compressed.format = format;
+  compressed.width = chain.width;
+  compressed.height = chain.height;
+  compressed.levelCount = chain.levelCount;
+  TextureData source = textureData(chain);
+
+  // Block rows are numbered across all levels, so that the small levels do
+  // not each wait for the threads to start
+  std::size_t totalBytes = 0;
+  std::vector<unsigned int> firstRow(chain.levelCount + 1, 0);
+  for (unsigned int level = 0; level < chain.levelCount; level++) {
+    const TextureLevel &sourceLevel = source.levels[level];
+    compressed.levelOffsets[level] = totalBytes;
+    totalBytes +=
+        textureLevelBytes(format, sourceLevel.width, sourceLevel.height);
+    firstRow[level + 1] = firstRow[level] + (sourceLevel.height + 3) / 4;
+  }
+  compressed.pixels.resize(totalBytes);
+
+  std::size_t bytesPerBlock = blockBytes(format);
+  parallelFor(
+      firstRow[chain.levelCount],
+      [&](unsigned int row) {
+        unsigned int level = 0;
+        while (row >= firstRow[level + 1]) {
+          level++;
+        }
+        const TextureLevel &sourceLevel = source.levels[level];
+        unsigned int blocksX = (sourceLevel.width + 3) / 4;
+        unsigned int blockY = row - firstRow[level];
+        unsigned char *block = compressed.pixels.data() +
+                               compressed.levelOffsets[level] +
+                               std::size_t(blockY) * blocksX * bytesPerBlock;
+        unsigned char texels[64];
+        for (unsigned int blockX = 0; blockX < blocksX; blockX++) {
+          gatherBlock(sourceLevel, blockX, blockY, texels);
+          if (format == TextureFormat::BC1) {
+            encodeBC1Block(texels, block);
+          } else {
+            encodeBC3Block(texels, block);
+          }
+          block += bytesPerBlock;
+        }
+      },
+      threadCount);
+  return compressed;
+}
+
+PNGImage decompressLevel(const TextureLevel &level, TextureFormat format) {
+  PNGImage image;
+  image.width = level.width;
+  image.height = level.height;
+  if (format == TextureFormat::RGBA8) {
+    image.pixels.assign(level.pixels, level.pixels + level.bytes);
+    return image;
+  }
+
+  image.pixels.resize(std::size_t(level.width) * level.height * 4);
+  unsigned int blocksX = (level.width + 3) / 4;
+  unsigned int blocksY = (level.height + 3) / 4;
+  const unsigned char *block = level.pixels;
+  unsigned char texels[64];
+  for (unsigned int blockY = 0; blockY < blocksY; blockY++) {
+    for (unsigned int blockX = 0; blockX < blocksX; blockX++) {
+      if (format == TextureFormat::BC1) {
+        decodeBC1Block(block, texels);
+      } else {
+        decodeBC3Block(block, texels);
+      }
+      block += blockBytes(format);
+
+      for (unsigned int y = 0; y < 4 && blockY * 4 + y < level.height; y++) {
+        for (unsigned int x = 0; x < 4 && blockX * 4 + x < level.width; x++) {
+          std::size_t pixel =
+              std::size_t(blockY * 4 + y) * level.width + blockX * 4 + x;
+          std::memcpy(&image.pixels[4 * pixel], texels + 4 * (4 * y + x), 4);
+        }
+      }
+    }
+  }
+  return image;
+}
+
+double imagePSNR(const PNGImage &reference, const PNGImage &image,
+                 bool includeAlpha) {
+  std::size_t count = std::min(reference.pixels.size(), image.pixels.size());
+  int channels = includeAlpha ? 4 : 3;
+  double squaredError = 0.0;
+  for (std::size_t i = 0; i < count; i += 4) {
+    for (int channel = 0; channel < channels; channel++) {
+      double d = double(reference.pixels[i + channel]) -
+                 double(image.pixels[i + channel]);
+      squaredError += d * d;
+    }
+  }
+  if (squaredError == 0.0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  double meanSquaredError = squaredError / (count / 4 * channels);
+  return 10.0 * std::log10(255.0 * 255.0 / meanSquaredError);
+}
+
+bool parseTextureFormat(const std::string &name, TextureFormat &format) {
+  if (name == "rgba8") {
+    format = TextureFormat::RGBA8;
+  } else if (name == "bc1") {
+    format = TextureFormat::BC1;
+  } else if (name == "bc3") {
+    format = TextureFormat::BC3;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *textureFormatName(TextureFormat format) {
+  switch (format) {
+  case TextureFormat::BC1:
+    return "BC1";
+  case TextureFormat::BC3:
+    return "BC3";
+  default:
+    return "RGBA8";
+  }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "textureFile.hpp"
+#include <string>
+
+// BC1 (DXT1) and BC3 (DXT5) block compression. Each block holds 4x4 texels,
+// in 8 bytes for BC1 and 16 for BC3, which is 8 and 4 times smaller than
+// RGBA8. BC1 has no alpha, and BC3 adds an alpha block in front of a BC1
+// colour block.
+
+// The 16 texels are RGBA8, row by row
+void encodeBC1Block(const unsigned char *texels, unsigned char *block);
+void encodeBC3Block(const unsigned char *texels, unsigned char *block);
+void decodeBC1Block(const unsigned char *block, unsigned char *texels);
+void decodeBC3Block(const unsigned char *block, unsigned char *texels);
+
+// BC1 if every texel is opaque, BC3 otherwise
+TextureFormat blockFormatFor(const PNGImage &image);
+
+// Encodes every level of an RGBA8 chain. The rows of blocks of all levels are
+// split between `threadCount` threads (0 uses every hardware thread).
+MipChain compressMipChain(const MipChain &chain, TextureFormat format,
+                          unsigned int threadCount = 0);
+
+// Decodes a level of any format to RGBA8
+PNGImage decompressLevel(const TextureLevel &level, TextureFormat format);
+
+// Peak signal to noise ratio of the colour channels, and of alpha if
+// includeAlpha, in dB. Infinite if the images are equal.
+double imagePSNR(const PNGImage &reference, const PNGImage &image,
+                 bool includeAlpha);
+
+// "rgba8", "bc1" or "bc3"
+bool parseTextureFormat(const std::string &name, TextureFormat &format);
+const char *textureFormatName(TextureFormat format);
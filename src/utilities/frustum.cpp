@@ -0,0 +1,40 @@
+#include "frustum.hpp"
+
+Frustum frustumFromMatrix(const glm::mat4 &viewProjection) {
+  glm::vec4 rows[4];
+  for (int row = 0; row < 4; row++) {
+    rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row],
+                          viewProjection[2][row], viewProjection[3][row]);
+  }
+
+  Frustum frustum;
+  for (int plane = 0; plane < 6; plane++) {
+    float sign = plane % 2 == 0 ? 1.0f : -1.0f;
+    glm::vec4 equation = rows[3] + sign * rows[plane / 2];
+    frustum.planes[plane] = equation / glm::length(glm::vec3(equation));
+  }
+  return frustum;
+}
+
+bool sphereOutsideFrustum(const Frustum &frustum, glm::vec3 center,
+                          float radius) {
+  for (const glm::vec4 &plane : frustum.planes) {
+    if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool boxOutsideFrustum(const Frustum &frustum, glm::vec3 min, glm::vec3 max) {
+  for (const glm::vec4 &plane : frustum.planes) {
+    // The corner furthest along the plane's normal
+    glm::vec3 corner(plane.x > 0.0f ? max.x : min.x,
+                     plane.y > 0.0f ? max.y : min.y,
+                     plane.z > 0.0f ? max.z : min.z);
+    if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+      return true;
+    }
+  }
+  return false;
+}
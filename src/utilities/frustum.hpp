@@ -0,0 +1,20 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+struct Frustum {
+  // Normalised plane equations with normals pointing inwards
+  glm::vec4 planes[6];
+};
+
+// The frustum of a view projection matrix, in the space the matrix transforms
+// from. "Fast Extraction of Viewing Frustum Planes from the
+// World-View-Projection Matrix" (Gribb and Hartmann, 2001).
+Frustum frustumFromMatrix(const glm::mat4 &viewProjection);
+
+// Conservative: may return false for spheres just outside a frustum corner
+bool sphereOutsideFrustum(const Frustum &frustum, glm::vec3 center,
+                          float radius);
+
+// Conservative like sphereOutsideFrustum(), for an axis aligned box
+bool boxOutsideFrustum(const Frustum &frustum, glm::vec3 min, glm::vec3 max);
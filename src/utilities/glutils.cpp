@@ -3,9 +3,12 @@
 #include <program.hpp>
 #include <vector>
 
+// Byte offset into the bound vertex buffer, as glVertexAttribPointer takes it
+#define BUFFER_OFFSET(offset) ((const void *)(size_t)(offset))
+
 template <class T>
 unsigned int generateAttribute(int id, int elementsPerEntry,
-                               std::vector<T> data, bool normalize) {
+                               const std::vector<T> &data, bool normalize) {
   unsigned int bufferID;
   glGenBuffers(1, &bufferID);
   glBindBuffer(GL_ARRAY_BUFFER, bufferID);
@@ -39,3 +42,61 @@ unsigned int generateBuffer(Mesh &mesh) {
 
   return vaoID;
 }
+
+static GLenum attributeType(AttributeType type) {
+  switch (type) {
+  case AttributeType::Short:
+    return GL_SHORT;
+  case AttributeType::UnsignedShort:
+    return GL_UNSIGNED_SHORT;
+  case AttributeType::Float:
+  default:
+    return GL_FLOAT;
+  }
+}
+
+unsigned int generateBuffer(const MeshData &mesh) {
+  unsigned int vaoID;
+  glGenVertexArrays(1, &vaoID);
+  glBindVertexArray(vaoID);
+
+  // All attributes come from the one block of vertex data
+  unsigned int bufferID;
+  glGenBuffers(1, &bufferID);
+  glBindBuffer(GL_ARRAY_BUFFER, bufferID);
+  glBufferData(GL_ARRAY_BUFFER, mesh.vertexBytes, mesh.vertexData,
+               GL_STATIC_DRAW);
+
+  for (unsigned int i = 0; i < mesh.attributeCount; i++) {
+    const VertexAttribute &attribute = mesh.attributes[i];
+    glVertexAttribPointer(attribute.location, attribute.components,
+                          attributeType(attribute.type),
+                          attribute.normalized ? GL_TRUE : GL_FALSE,
+                          attribute.stride, BUFFER_OFFSET(attribute.offset));
+    glEnableVertexAttribArray(attribute.location);
+  }
+
+  unsigned int indexBufferID;
+  glGenBuffers(1, &indexBufferID);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indexCount * sizeof(unsigned int),
+               mesh.indices, GL_STATIC_DRAW);
+
+  return vaoID;
+}
+
+unsigned int generateBuffer(const PackedMesh &mesh) {
+  return generateBuffer(meshData(mesh));
+}
+
+bool extensionSupported(const std::string &name) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const GLubyte *extension = glGetStringi(GL_EXTENSIONS, i);
+    if (extension && name == reinterpret_cast<const char *>(extension)) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -1,5 +1,22 @@
 #pragma once
 
 #include "mesh.h"
+#include "meshFile.hpp"
+#include "packedMesh.hpp"
+#include <string>
 
-unsigned int generateBuffer(Mesh &mesh);
\ No newline at end of file
+unsigned int generateBuffer(Mesh &mesh);
+
+// Uploads the interleaved vertex data as is. Packed normals arrive in the
+// shaders octahedral encoded in the xy of location 1, and quantized positions
+// and texture coordinates in [0, 1], to be mapped back with the mesh'
+// VertexQuantization.
+unsigned int generateBuffer(const PackedMesh &mesh);
+
+// Uploads the vertex data and indices as they are, for example straight from
+// a mapped mesh file
+unsigned int generateBuffer(const MeshData &mesh);
+
+// Whether the current context exposes the named extension, for example
+// "GL_EXT_texture_compression_s3tc"
+bool extensionSupported(const std::string &name);
@@ -1,4 +1,5 @@
 #include "imageLoader.hpp"
+#include <algorithm>
 #include <iostream>
 
 // Original source:
@@ -42,4 +43,25 @@ PNGImage loadPNGFile(std::string fileName) {
   image.pixels = pixels;
 
   return image;
-}
\ No newline at end of file
+}
+
+bool savePNGFile(const PNGImage &image, std::string fileName) {
+  // PNG files store the top row first, so the rows go out in reverse order
+  unsigned int widthBytes = 4 * image.width;
+  std::vector<unsigned char> pixels(image.pixels.size());
+  for (unsigned int row = 0; row < image.height; row++) {
+    std::copy(image.pixels.begin() + row * widthBytes,
+              image.pixels.begin() + (row + 1) * widthBytes,
+              pixels.begin() + (image.height - 1 - row) * widthBytes);
+  }
+
+  unsigned error =
+      lodepng::encode(fileName, pixels, image.width, image.height);
+
+  if (error) {
+    std::cerr << "Could not write \"" << fileName << "\": encoder error "
+              << error << ": " << lodepng_error_text(error) << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -11,3 +11,7 @@ typedef struct PNGImage {
 } PNGImage;
 
 PNGImage loadPNGFile(std::string fileName);
+
+// Encodes an image with the same bottom-left origin as loadPNGFile() returns.
+// Returns false and prints why when the file could not be written.
+bool savePNGFile(const PNGImage &image, std::string fileName);
@@ -0,0 +1,120 @@
+#include "mappedFile.hpp"
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() { close(); }
+
+MappedFile::MappedFile(MappedFile &&other) { *this = std::move(other); }
+
+MappedFile &MappedFile::operator=(MappedFile &&other) {
+  if (this != &other) {
+    close();
+    std::swap(mData, other.mData);
+    std::swap(mSize, other.mSize);
+#ifdef _WIN32
+    std::swap(mFile, other.mFile);
+    std::swap(mMapping, other.mMapping);
+#endif
+  }
+  return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string &fileName) {
+  close();
+
+  HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping =
+      CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping) {
+    CloseHandle(file);
+    return false;
+  }
+
+  void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+
+  mFile = file;
+  mMapping = mapping;
+  mData = static_cast<const unsigned char *>(data);
+  mSize = (std::size_t)size.QuadPart;
+  return true;
+}
+
+void MappedFile::close() {
+  if (mData) {
+    UnmapViewOfFile(mData);
+    CloseHandle(mMapping);
+    CloseHandle(mFile);
+  }
+  mData = nullptr;
+  mSize = 0;
+  mFile = nullptr;
+  mMapping = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const std::string &fileName) {
+  close();
+
+  int file = ::open(fileName.c_str(), O_RDONLY);
+  if (file < 0) {
+    return false;
+  }
+
+  struct stat status;
+  if (fstat(file, &status) != 0 || status.st_size == 0) {
+    ::close(file);
+    return false;
+  }
+
+  void *data = mmap(nullptr, (std::size_t)status.st_size, PROT_READ,
+                    MAP_PRIVATE, file, 0);
+  // The mapping keeps its own reference to the file
+  ::close(file);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  mData = static_cast<const unsigned char *>(data);
+  mSize = (std::size_t)status.st_size;
+  return true;
+}
+
+void MappedFile::close() {
+  if (mData) {
+    munmap(const_cast<unsigned char *>(mData), mSize);
+  }
+  mData = nullptr;
+  mSize = 0;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A read-only memory mapping of a whole file. The mapping is released when the
+// object is destroyed.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(MappedFile &&other);
+  MappedFile &operator=(MappedFile &&other);
+
+  // Maps the given file, replacing any previous mapping. Returns false if the
+  // file could not be opened or mapped.
+  bool open(const std::string &fileName);
+  void close();
+
+  const unsigned char *data() const { return mData; }
+  std::size_t size() const { return mSize; }
+  bool isOpen() const { return mData != nullptr; }
+
+private:
+  // Disable copying and assignment
+  MappedFile(MappedFile const &) = delete;
+  MappedFile &operator=(MappedFile const &) = delete;
+
+  const unsigned char *mData = nullptr;
+  std::size_t mSize = 0;
+#ifdef _WIN32
+  void *mFile = nullptr;
+  void *mMapping = nullptr;
+#endif
+};
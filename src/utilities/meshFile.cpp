@@ -0,0 +1,270 @@
+#include "meshFile.hpp"
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fmt/format.h>
+
+static const char MESH_FILE_MAGIC[4] = {'M', 'E', 'S', 'H'};
+static const uint32_t MESH_FILE_VERSION = 2;
+static const uint64_t MESH_FILE_ALIGNMENT = 64;
+
+struct MeshFileHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t parameterHash;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint32_t attributeCount;
+  uint32_t meshletCount;
+  VertexAttribute attributes[MAX_VERTEX_ATTRIBUTES];
+  float positionOffset[3];
+  float positionScale[3];
+  float textureOffset[2];
+  float textureScale[2];
+  uint64_t vertexOffset;
+  uint64_t vertexBytes;
+  uint64_t indexOffset;
+  uint64_t meshletOffset;
+};
+
+static VertexAttribute vertexAttribute(uint32_t location, uint32_t components,
+                                       AttributeType type, bool normalized,
+                                       uint32_t stride, std::size_t offset) {
+  return VertexAttribute{location, components, type, normalized ? 1u : 0u,
+                         stride, (uint32_t)offset};
+}
+
+MeshData meshData(const PackedMesh &mesh) {
+  MeshData data;
+  data.vertexData = mesh.vertexData.data();
+  data.vertexBytes = mesh.vertexData.size();
+  data.vertexCount = mesh.vertexCount;
+  data.indices = mesh.indices.data();
+  data.indexCount = (unsigned int)mesh.indices.size();
+  data.quantization = mesh.quantization;
+  data.meshlets = mesh.meshlets.data();
+  data.meshletCount = (unsigned int)mesh.meshlets.size();
+
+  data.attributeCount = 3;
+  if (mesh.quantizedPositions) {
+    data.attributes[0] = vertexAttribute(
+        0, 3, AttributeType::UnsignedShort, true, mesh.stride,
+        offsetof(QuantizedPositionVertex, position));
+    data.attributes[1] =
+        vertexAttribute(1, 2, AttributeType::Short, true, mesh.stride,
+                        offsetof(QuantizedPositionVertex, normal));
+    data.attributes[2] = vertexAttribute(
+        2, 2, AttributeType::UnsignedShort, true, mesh.stride,
+        offsetof(QuantizedPositionVertex, textureCoordinates));
+  } else {
+    data.attributes[0] =
+        vertexAttribute(0, 3, AttributeType::Float, false, mesh.stride,
+                        offsetof(FloatPositionVertex, position));
+    data.attributes[1] =
+        vertexAttribute(1, 2, AttributeType::Short, true, mesh.stride,
+                        offsetof(FloatPositionVertex, normal));
+    data.attributes[2] = vertexAttribute(
+        2, 2, AttributeType::UnsignedShort, true, mesh.stride,
+        offsetof(FloatPositionVertex, textureCoordinates));
+  }
+  return data;
+}
+
+uint64_t meshParameterHash(const std::string &generator,
+                           std::initializer_list<float> parameters) {
+  // FNV-1a over the version, the generator name and the parameters
+  uint64_t hash = 14695981039346656037ull;
+  auto addBytes = [&hash](const void *data, std::size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (std::size_t i = 0; i < size; i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+  };
+  addBytes(&MESH_FILE_VERSION, sizeof(MESH_FILE_VERSION));
+  addBytes(generator.data(), generator.size());
+  for (float parameter : parameters) {
+    addBytes(&parameter, sizeof(parameter));
+  }
+  return hash;
+}
+
+static uint32_t attributeTypeSize(AttributeType type) {
+  switch (type) {
+  case AttributeType::Float:
+    return 4;
+  case AttributeType::Short:
+  case AttributeType::UnsignedShort:
+    return 2;
+  }
+  return 0;
+}
+
+// Whether the attributes fit in the vertices, the vertices in the vertex
+// data, and the indices and meshlets refer only to what is there. A file
+// that passes the header checks can still be damaged, and drawing it would
+// read past the buffers on the GPU.
+static bool meshDataConsistent(const MeshData &data) {
+  if (data.attributeCount == 0) {
+    return false;
+  }
+  uint32_t stride = data.attributes[0].stride;
+  if (stride == 0 || data.vertexBytes != uint64_t(data.vertexCount) * stride) {
+    return false;
+  }
+  for (unsigned int i = 0; i < data.attributeCount; i++) {
+    const VertexAttribute &attribute = data.attributes[i];
+    uint64_t size =
+        uint64_t(attribute.components) * attributeTypeSize(attribute.type);
+    if (attribute.stride != stride || size == 0 ||
+        attribute.offset + size > stride) {
+      return false;
+    }
+  }
+  for (unsigned int i = 0; i < data.indexCount; i++) {
+    if (data.indices[i] >= data.vertexCount) {
+      return false;
+    }
+  }
+  for (unsigned int i = 0; i < data.meshletCount; i++) {
+    const Meshlet &meshlet = data.meshlets[i];
+    if (uint64_t(meshlet.firstIndex) + meshlet.indexCount > data.indexCount) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static uint64_t alignOffset(uint64_t offset) {
+  return (offset + MESH_FILE_ALIGNMENT - 1) / MESH_FILE_ALIGNMENT *
+         MESH_FILE_ALIGNMENT;
+}
+
+static bool writeAt(FILE *file, uint64_t offset, const void *data,
+                    std::size_t size) {
+  return std::fseek(file, (long)offset, SEEK_SET) == 0 &&
+         std::fwrite(data, 1, size, file) == size;
+}
+
+bool saveMeshFile(const MeshData &mesh, uint64_t parameterHash,
+                  const std::string &fileName) {
+  MeshFileHeader header = {};
+  std::memcpy(header.magic, MESH_FILE_MAGIC, sizeof(header.magic));
+  header.version = MESH_FILE_VERSION;
+  header.parameterHash = parameterHash;
+  header.vertexCount = mesh.vertexCount;
+  header.indexCount = mesh.indexCount;
+  header.attributeCount = mesh.attributeCount;
+  header.meshletCount = mesh.meshletCount;
+  std::memcpy(header.attributes, mesh.attributes, sizeof(header.attributes));
+  const VertexQuantization &q = mesh.quantization;
+  std::memcpy(header.positionOffset, &q.positionOffset, sizeof(float) * 3);
+  std::memcpy(header.positionScale, &q.positionScale, sizeof(float) * 3);
+  std::memcpy(header.textureOffset, &q.textureOffset, sizeof(float) * 2);
+  std::memcpy(header.textureScale, &q.textureScale, sizeof(float) * 2);
+  header.vertexOffset = alignOffset(sizeof(header));
+  header.vertexBytes = mesh.vertexBytes;
+  header.indexOffset = alignOffset(header.vertexOffset + mesh.vertexBytes);
+  header.meshletOffset = alignOffset(header.indexOffset +
+                                     mesh.indexCount * sizeof(unsigned int));
+
+  // Written under a temporary name first, so that a reader never maps a
+  // partially written file
+  std::string temporaryName = fileName + ".tmp";
+  FILE *file = std::fopen(temporaryName.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+
+  bool ok = writeAt(file, 0, &header, sizeof(header)) &&
+            writeAt(file, header.vertexOffset, mesh.vertexData,
+                    mesh.vertexBytes) &&
+            writeAt(file, header.indexOffset, mesh.indices,
+                    mesh.indexCount * sizeof(unsigned int)) &&
+            writeAt(file, header.meshletOffset, mesh.meshlets,
+                    mesh.meshletCount * sizeof(Meshlet));
+  ok = std::fclose(file) == 0 && ok;
+
+  if (ok) {
+    std::remove(fileName.c_str());
+    ok = std::rename(temporaryName.c_str(), fileName.c_str()) == 0;
+  }
+  if (!ok) {
+    std::remove(temporaryName.c_str());
+  }
+  return ok;
+}
+
+bool loadMeshFile(const std::string &fileName, uint64_t parameterHash,
+                  CachedMesh &mesh) {
+  MappedFile file;
+  if (!file.open(fileName) || file.size() < sizeof(MeshFileHeader)) {
+    return false;
+  }
+
+  MeshFileHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+
+  uint64_t indexBytes = uint64_t(header.indexCount) * sizeof(unsigned int);
+  uint64_t meshletBytes = uint64_t(header.meshletCount) * sizeof(Meshlet);
+  if (std::memcmp(header.magic, MESH_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != MESH_FILE_VERSION ||
+      header.parameterHash != parameterHash ||
+      header.attributeCount > MAX_VERTEX_ATTRIBUTES ||
+      header.vertexOffset % MESH_FILE_ALIGNMENT != 0 ||
+      header.indexOffset % MESH_FILE_ALIGNMENT != 0 ||
+      header.meshletOffset % MESH_FILE_ALIGNMENT != 0 ||
+      header.vertexOffset + header.vertexBytes > file.size() ||
+      header.indexOffset + indexBytes > file.size() ||
+      header.meshletOffset + meshletBytes > file.size()) {
+    return false;
+  }
+
+  MeshData &data = mesh.data;
+  data.vertexData = file.data() + header.vertexOffset;
+  data.vertexBytes = header.vertexBytes;
+  data.vertexCount = header.vertexCount;
+  data.indices =
+      reinterpret_cast<const unsigned int *>(file.data() + header.indexOffset);
+  data.indexCount = header.indexCount;
+  data.meshlets =
+      reinterpret_cast<const Meshlet *>(file.data() + header.meshletOffset);
+  data.meshletCount = header.meshletCount;
+  data.attributeCount = header.attributeCount;
+  std::memcpy(data.attributes, header.attributes, sizeof(data.attributes));
+  VertexQuantization &q = data.quantization;
+  std::memcpy(&q.positionOffset, header.positionOffset, sizeof(float) * 3);
+  std::memcpy(&q.positionScale, header.positionScale, sizeof(float) * 3);
+  std::memcpy(&q.textureOffset, header.textureOffset, sizeof(float) * 2);
+  std::memcpy(&q.textureScale, header.textureScale, sizeof(float) * 2);
+  if (!meshDataConsistent(data)) {
+    data = MeshData();
+    return false;
+  }
+
+  mesh.storage = PackedMesh();
+  mesh.file = std::move(file);
+  return true;
+}
+
+std::string meshFileName(const std::string &cacheDirectory,
+                         uint64_t parameterHash) {
+  return fmt::format("{}/mesh-{:016x}.bin", cacheDirectory, parameterHash);
+}
+
+void loadOrGenerateMesh(const std::string &cacheDirectory,
+                        uint64_t parameterHash,
+                        const std::function<PackedMesh()> &generate,
+                        CachedMesh &mesh) {
+  std::string fileName = meshFileName(cacheDirectory, parameterHash);
+  if (loadMeshFile(fileName, parameterHash, mesh)) {
+    return;
+  }
+
+  mesh.file.close();
+  mesh.storage = generate();
+  mesh.data = meshData(mesh.storage);
+
+  if (!saveMeshFile(mesh.data, parameterHash, fileName)) {
+    fprintf(stderr, "Could not write mesh to \"%s\".\n", fileName.c_str());
+  }
+}
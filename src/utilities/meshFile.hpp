@@ -0,0 +1,77 @@
+#pragma once
+
+#include "mappedFile.hpp"
+#include "packedMesh.hpp"
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <string>
+
+enum class AttributeType : uint32_t { Float, Short, UnsignedShort };
+
+// Where an attribute is in the vertex data, in the terms of
+// glVertexAttribPointer
+struct VertexAttribute {
+  uint32_t location;
+  uint32_t components;
+  AttributeType type;
+  uint32_t normalized;
+  uint32_t stride;
+  uint32_t offset;
+};
+
+const int MAX_VERTEX_ATTRIBUTES = 4;
+
+// A mesh laid out the way it is uploaded: one block of vertex data described
+// by `attributes`, and 32-bit indices. Points into the mesh or file it was
+// made from.
+struct MeshData {
+  const unsigned char *vertexData = nullptr;
+  std::size_t vertexBytes = 0;
+  unsigned int vertexCount = 0;
+  const unsigned int *indices = nullptr;
+  unsigned int indexCount = 0;
+  unsigned int attributeCount = 0;
+  VertexAttribute attributes[MAX_VERTEX_ATTRIBUTES] = {};
+  VertexQuantization quantization;
+  const Meshlet *meshlets = nullptr;
+  unsigned int meshletCount = 0;
+};
+
+MeshData meshData(const PackedMesh &mesh);
+
+struct CachedMesh {
+  MeshData data;
+
+  // data points into one of these, depending on whether the mesh was
+  // generated or loaded from disk
+  PackedMesh storage;
+  MappedFile file;
+};
+
+// Identifies a generated mesh by the name of its generator and the parameters
+// it was called with, together with the file format version
+uint64_t meshParameterHash(const std::string &generator,
+                           std::initializer_list<float> parameters);
+
+// Writes the header and the raw arrays, each aligned for direct use
+bool saveMeshFile(const MeshData &mesh, uint64_t parameterHash,
+                  const std::string &fileName);
+
+// Memory maps a mesh file, failing if it is missing, damaged, of another
+// version or generated with other parameters. Every index is checked against
+// the vertex count, so that a damaged file is generated again instead of
+// being drawn.
+bool loadMeshFile(const std::string &fileName, uint64_t parameterHash,
+                  CachedMesh &mesh);
+
+// Name of the cache file holding the mesh for the given parameters
+std::string meshFileName(const std::string &cacheDirectory,
+                         uint64_t parameterHash);
+
+// Maps the cached mesh for the given parameters, generating and caching it
+// first if needed
+void loadOrGenerateMesh(const std::string &cacheDirectory,
+                        uint64_t parameterHash,
+                        const std::function<PackedMesh()> &generate,
+                        CachedMesh &mesh);
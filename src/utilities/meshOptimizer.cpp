@@ -0,0 +1,205 @@
+#include "meshOptimizer.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Tuning constants from Forsyth's article
+const int CACHE_SIZE = 32;
+const float CACHE_DECAY_POWER = 1.5f;
+const float LAST_TRIANGLE_SCORE = 0.75f;
+const float VALENCE_BOOST_SCALE = 2.0f;
+const float VALENCE_BOOST_POWER = 0.5f;
+
+// How much adding a triangle using this vertex next is worth. Vertices in the
+// cache score by how recently they were used, and vertices with few triangles
+// left score higher so that they are finished off instead of left behind.
+static float vertexScore(int cachePosition, unsigned int remainingTriangles) {
+  if (remainingTriangles == 0) {
+    return -1.0f;
+  }
+
+  float score = 0.0f;
+  if (cachePosition >= 0) {
+    if (cachePosition < 3) {
+      // Used by the last triangle. Scored a bit lower, to avoid long strips.
+      score = LAST_TRIANGLE_SCORE;
+    } else {
+      score = std::pow(1.0f - float(cachePosition - 3) / (CACHE_SIZE - 3),
+                       CACHE_DECAY_POWER);
+    }
+  }
+  return score + VALENCE_BOOST_SCALE *
+                     std::pow((float)remainingTriangles, -VALENCE_BOOST_POWER);
+}
+
+void optimizeVertexCache(std::vector<unsigned int> &indices,
+                         unsigned int vertexCount) {
+  size_t triangleCount = indices.size() / 3;
+
+  // Triangles using each vertex, in compressed rows
+  std::vector<unsigned int> firstTriangle(vertexCount + 1, 0);
+  for (unsigned int index : indices) {
+    firstTriangle[index + 1]++;
+  }
+  for (unsigned int vertex = 0; vertex < vertexCount; vertex++) {
+    firstTriangle[vertex + 1] += firstTriangle[vertex];
+  }
+  std::vector<unsigned int> vertexTriangles(indices.size());
+  std::vector<unsigned int> filled(firstTriangle.begin(),
+                                  firstTriangle.end() - 1);
+  for (size_t i = 0; i < indices.size(); i++) {
+    vertexTriangles[filled[indices[i]]++] = (unsigned int)(i / 3);
+  }
+
+  // Triangles not yet added are kept at the front of each vertex' row
+  std::vector<unsigned int> remaining(vertexCount);
+  std::vector<int> cachePosition(vertexCount, -1);
+  std::vector<float> score(vertexCount);
+  for (unsigned int vertex = 0; vertex < vertexCount; vertex++) {
+    remaining[vertex] = firstTriangle[vertex + 1] - firstTriangle[vertex];
+    score[vertex] = vertexScore(-1, remaining[vertex]);
+  }
+
+  std::vector<float> triangleScore(triangleCount);
+  std::vector<bool> added(triangleCount, false);
+  for (size_t triangle = 0; triangle < triangleCount; triangle++) {
+    triangleScore[triangle] = score[indices[3 * triangle]] +
+                              score[indices[3 * triangle + 1]] +
+                              score[indices[3 * triangle + 2]];
+  }
+
+  // LRU cache, with room for the three vertices pushed in by each triangle
+  std::vector<unsigned int> cache, nextCache;
+  cache.reserve(CACHE_SIZE + 3);
+  nextCache.reserve(CACHE_SIZE + 3);
+
+  std::vector<unsigned int> result;
+  result.reserve(indices.size());
+
+  // Where to continue looking when no triangle in the cache is left
+  size_t scanPosition = 0;
+  long bestTriangle = -1;
+
+  for (size_t emitted = 0; emitted < triangleCount; emitted++) {
+    if (bestTriangle < 0) {
+      // Nothing left around the cache. Forsyth restarts from the best of all
+      // remaining triangles; taking the next unused one in input order keeps
+      // this linear and loses little on meshes generated in order.
+      while (added[scanPosition]) {
+        scanPosition++;
+      }
+      bestTriangle = (long)scanPosition;
+    }
+
+    unsigned int *triangleIndices = &indices[3 * bestTriangle];
+    added[bestTriangle] = true;
+    result.insert(result.end(), triangleIndices, triangleIndices + 3);
+
+    // Move the triangle to the back of its vertices' rows
+    for (int corner = 0; corner < 3; corner++) {
+      unsigned int vertex = triangleIndices[corner];
+      unsigned int *row = &vertexTriangles[firstTriangle[vertex]];
+      unsigned int *end = row + remaining[vertex];
+      std::swap(*std::find(row, end, (unsigned int)bestTriangle), *(end - 1));
+      remaining[vertex]--;
+    }
+
+    // Push the triangle's vertices to the front of the cache
+    nextCache.assign(triangleIndices, triangleIndices + 3);
+    for (unsigned int vertex : cache) {
+      if (vertex != triangleIndices[0] && vertex != triangleIndices[1] &&
+          vertex != triangleIndices[2]) {
+        nextCache.push_back(vertex);
+      }
+    }
+    std::swap(cache, nextCache);
+
+    // Rescore everything that was in the cache, including the vertices that
+    // just fell out of it, and pick the best triangle among their remaining
+    // triangles
+    for (size_t position = 0; position < cache.size(); position++) {
+      unsigned int vertex = cache[position];
+      int newPosition = (int)position < CACHE_SIZE ? (int)position : -1;
+      cachePosition[vertex] = newPosition;
+
+      float newScore = vertexScore(newPosition, remaining[vertex]);
+      float change = newScore - score[vertex];
+      score[vertex] = newScore;
+      for (unsigned int i = 0; i < remaining[vertex]; i++) {
+        triangleScore[vertexTriangles[firstTriangle[vertex] + i]] += change;
+      }
+    }
+    if ((int)cache.size() > CACHE_SIZE) {
+      cache.resize(CACHE_SIZE);
+    }
+
+    bestTriangle = -1;
+    float bestScore = -1.0f;
+    for (unsigned int vertex : cache) {
+      for (unsigned int i = 0; i < remaining[vertex]; i++) {
+        unsigned int triangle = vertexTriangles[firstTriangle[vertex] + i];
+        if (triangleScore[triangle] > bestScore) {
+          bestScore = triangleScore[triangle];
+          bestTriangle = triangle;
+        }
+      }
+    }
+  }
+
+  indices.swap(result);
+}
+
+template <class T>
+static void remapAttribute(std::vector<T> &attribute,
+                           const std::vector<unsigned int> &newIndex,
+                           unsigned int newCount) {
+  if (attribute.empty()) {
+    return;
+  }
+  std::vector<T> remapped(newCount);
+  for (size_t vertex = 0; vertex < attribute.size(); vertex++) {
+    if (newIndex[vertex] < newCount) {
+      remapped[newIndex[vertex]] = attribute[vertex];
+    }
+  }
+  attribute.swap(remapped);
+}
+
+void optimizeVertexFetch(Mesh &mesh) {
+  const unsigned int unused = ~0u;
+  std::vector<unsigned int> newIndex(mesh.vertices.size(), unused);
+  unsigned int newCount = 0;
+  for (unsigned int &index : mesh.indices) {
+    if (newIndex[index] == unused) {
+      newIndex[index] = newCount++;
+    }
+    index = newIndex[index];
+  }
+
+  remapAttribute(mesh.vertices, newIndex, newCount);
+  remapAttribute(mesh.normals, newIndex, newCount);
+  remapAttribute(mesh.textureCoordinates, newIndex, newCount);
+}
+
+void optimizeMesh(Mesh &mesh) {
+  optimizeVertexCache(mesh.indices, (unsigned int)mesh.vertices.size());
+  optimizeVertexFetch(mesh);
+}
+
+float averageCacheMissRatio(const std::vector<unsigned int> &indices,
+                            unsigned int vertexCount, unsigned int cacheSize) {
+  if (indices.empty()) {
+    return 0.0f;
+  }
+
+  // Time each vertex entered the FIFO. A vertex is cached when it entered
+  // less than cacheSize misses ago.
+  std::vector<size_t> entered(vertexCount, 0);
+  size_t misses = 0;
+  for (unsigned int index : indices) {
+    if (entered[index] == 0 || misses - entered[index] >= cacheSize) {
+      misses++;
+      entered[index] = misses;
+    }
+  }
+  return float(misses) / float(indices.size() / 3);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "mesh.h"
+
+// Reorders the triangles of an indexed triangle list for the post-transform
+// vertex cache, using "Linear-Speed Vertex Cache Optimisation" (Forsyth, 2006).
+// The result works well for any cache of roughly 16 entries or more.
+void optimizeVertexCache(std::vector<unsigned int> &indices,
+                         unsigned int vertexCount);
+
+// Reorders the vertices of a mesh in the order the index buffer first uses
+// them, so that vertex fetches walk through memory linearly, and rewrites the
+// indices to match. Vertices no triangle uses are dropped.
+void optimizeVertexFetch(Mesh &mesh);
+
+// Both of the above, in the order they have to be done
+void optimizeMesh(Mesh &mesh);
+
+// Average cache miss ratio: vertex shader invocations per triangle when the
+// triangles are drawn through a FIFO cache of `cacheSize` vertices. 3 means no
+// reuse, 0.5 is the lower bound for large regular meshes.
+float averageCacheMissRatio(const std::vector<unsigned int> &indices,
+                            unsigned int vertexCount, unsigned int cacheSize);
@@ -0,0 +1,277 @@
+#include "meshlets.hpp"
+#include "frustum.hpp"
+#include "meshOptimizer.hpp"
+#include <algorithm>
+#include <cmath>
+
+static Meshlet meshletBounds(const Mesh &mesh,
+                             const std::vector<glm::vec3> &triangleNormals,
+                             const std::vector<unsigned int> &triangles,
+                             const std::vector<unsigned int> &vertices) {
+  Meshlet meshlet = {};
+
+  glm::vec3 low = mesh.vertices[vertices[0]];
+  glm::vec3 high = low;
+  for (unsigned int vertex : vertices) {
+    low = glm::min(low, mesh.vertices[vertex]);
+    high = glm::max(high, mesh.vertices[vertex]);
+  }
+  meshlet.center = 0.5f * (low + high);
+  for (unsigned int vertex : vertices) {
+    meshlet.radius = std::fmax(
+        meshlet.radius, glm::length(mesh.vertices[vertex] - meshlet.center));
+  }
+
+  glm::vec3 normalSum(0.0f);
+  for (unsigned int triangle : triangles) {
+    normalSum += triangleNormals[triangle];
+  }
+  float length = glm::length(normalSum);
+  meshlet.coneAxis = length > 0.0f ? normalSum / length : glm::vec3(0, 0, 1);
+  float minimumCosine = 1.0f;
+  for (unsigned int triangle : triangles) {
+    minimumCosine = std::fmin(
+        minimumCosine, glm::dot(triangleNormals[triangle], meshlet.coneAxis));
+  }
+  meshlet.coneSine = minimumCosine <= 0.0f
+                         ? 1.0f
+                         : std::sqrt(1.0f - minimumCosine * minimumCosine);
+
+  meshlet.vertexCount = (unsigned int)vertices.size();
+  meshlet.indexCount = 3 * (unsigned int)triangles.size();
+  return meshlet;
+}
+
+std::vector<Meshlet> buildMeshlets(Mesh &mesh, unsigned int maxVertices,
+                                   unsigned int maxTriangles) {
+  unsigned int vertexCount = (unsigned int)mesh.vertices.size();
+  unsigned int triangleCount = (unsigned int)mesh.indices.size() / 3;
+
+  std::vector<glm::vec3> triangleNormals(triangleCount);
+  for (unsigned int triangle = 0; triangle < triangleCount; triangle++) {
+    const unsigned int *corners = &mesh.indices[3 * triangle];
+    glm::vec3 a = mesh.vertices[corners[0]];
+    glm::vec3 normal = glm::cross(mesh.vertices[corners[1]] - a,
+                                  mesh.vertices[corners[2]] - a);
+    float length = glm::length(normal);
+    triangleNormals[triangle] = length > 0.0f ? normal / length : normal;
+  }
+
+  // Triangles using each vertex, in compressed rows
+  std::vector<unsigned int> firstTriangle(vertexCount + 1, 0);
+  for (unsigned int index : mesh.indices) {
+    firstTriangle[index + 1]++;
+  }
+  for (unsigned int vertex = 0; vertex < vertexCount; vertex++) {
+    firstTriangle[vertex + 1] += firstTriangle[vertex];
+  }
+  std::vector<unsigned int> vertexTriangles(mesh.indices.size());
+  std::vector<unsigned int> filled(firstTriangle.begin(),
+                                  firstTriangle.end() - 1);
+  for (size_t i = 0; i < mesh.indices.size(); i++) {
+    vertexTriangles[filled[mesh.indices[i]]++] = (unsigned int)(i / 3);
+  }
+
+  std::vector<Meshlet> meshlets;
+  std::vector<unsigned int> result;
+  result.reserve(mesh.indices.size());
+  std::vector<bool> added(triangleCount, false);
+  // Meshlet each vertex was last added to
+  std::vector<unsigned int> vertexMeshlet(vertexCount, ~0u);
+
+  std::vector<unsigned int> triangles;
+  std::vector<unsigned int> vertices;
+  size_t scanPosition = 0;
+
+  while (result.size() < mesh.indices.size()) {
+    unsigned int meshletIndex = (unsigned int)meshlets.size();
+    triangles.clear();
+    vertices.clear();
+    glm::vec3 normalSum(0.0f);
+
+    auto newVertices = [&](unsigned int triangle) {
+      unsigned int count = 0;
+      for (int corner = 0; corner < 3; corner++) {
+        count += vertexMeshlet[mesh.indices[3 * triangle + corner]] !=
+                 meshletIndex;
+      }
+      return count;
+    };
+    auto addTriangle = [&](unsigned int triangle) {
+      added[triangle] = true;
+      triangles.push_back(triangle);
+      normalSum += triangleNormals[triangle];
+      for (int corner = 0; corner < 3; corner++) {
+        unsigned int vertex = mesh.indices[3 * triangle + corner];
+        if (vertexMeshlet[vertex] != meshletIndex) {
+          vertexMeshlet[vertex] = meshletIndex;
+          vertices.push_back(vertex);
+        }
+        result.push_back(vertex);
+      }
+    };
+
+    // Start from the next triangle in the current order, which the vertex
+    // cache optimisation has made local
+    while (added[scanPosition]) {
+      scanPosition++;
+    }
+    addTriangle((unsigned int)scanPosition);
+
+    while (triangles.size() < maxTriangles) {
+      glm::vec3 axis = glm::normalize(normalSum);
+      long best = -1;
+      float bestScore = 0.0f;
+      for (unsigned int vertex : vertices) {
+        for (unsigned int i = firstTriangle[vertex];
+             i < firstTriangle[vertex + 1]; i++) {
+          unsigned int triangle = vertexTriangles[i];
+          if (added[triangle]) {
+            continue;
+          }
+          unsigned int count = newVertices(triangle);
+          if (vertices.size() + count > maxVertices) {
+            continue;
+          }
+          float score =
+              count + (1.0f - glm::dot(triangleNormals[triangle], axis));
+          if (best < 0 || score < bestScore) {
+            best = triangle;
+            bestScore = score;
+          }
+        }
+      }
+      if (best < 0) {
+        break;
+      }
+      addTriangle((unsigned int)best);
+    }
+
+    Meshlet meshlet = meshletBounds(mesh, triangleNormals, triangles, vertices);
+    meshlet.firstIndex = (uint32_t)(result.size() - meshlet.indexCount);
+    meshlets.push_back(meshlet);
+  }
+
+  // Each meshlet is drawn on its own, so its triangles are ordered for the
+  // vertex cache separately, on indices local to the meshlet
+  std::vector<unsigned int> localIndex(vertexCount, ~0u);
+  for (const Meshlet &meshlet : meshlets) {
+    auto first = result.begin() + meshlet.firstIndex;
+    auto last = first + meshlet.indexCount;
+    std::vector<unsigned int> meshletVertices;
+    std::vector<unsigned int> indices;
+    for (auto index = first; index != last; index++) {
+      if (localIndex[*index] == ~0u) {
+        localIndex[*index] = (unsigned int)meshletVertices.size();
+        meshletVertices.push_back(*index);
+      }
+      indices.push_back(localIndex[*index]);
+    }
+    optimizeVertexCache(indices, (unsigned int)meshletVertices.size());
+    for (unsigned int index : indices) {
+      *first++ = meshletVertices[index];
+    }
+    for (unsigned int vertex : meshletVertices) {
+      localIndex[vertex] = ~0u;
+    }
+  }
+
+  mesh.indices.swap(result);
+  return meshlets;
+}
+
+// No normal in the cone is more than 90 degrees from a ray from the camera to
+// any point in the bounding sphere, if the axis is within 90 degrees minus the
+// cone angle minus the angle the sphere subtends. Comparing with the sum of
+// the sines is a conservative form of that.
+static bool facesAway(const Meshlet &meshlet, glm::vec3 axis,
+                      glm::vec3 cameraPosition) {
+  glm::vec3 toCenter = meshlet.center - cameraPosition;
+  return glm::dot(axis, toCenter) >=
+         glm::length(toCenter) * meshlet.coneSine + meshlet.radius;
+}
+
+void cullMeshlets(const Meshlet *meshlets, unsigned int meshletCount,
+                  glm::vec3 cameraPosition, const glm::mat4 &viewProjection,
+                  CulledFaces culledFaces,
+                  std::vector<DrawElementsIndirectCommand> &commands,
+                  MeshletCullStats &stats) {
+  commands.clear();
+  stats = MeshletCullStats();
+  Frustum frustum = frustumFromMatrix(viewProjection);
+  float axisSign = culledFaces == CulledFaces::Back ? 1.0f : -1.0f;
+
+  for (unsigned int i = 0; i < meshletCount; i++) {
+    const Meshlet &meshlet = meshlets[i];
+    unsigned int triangles = meshlet.indexCount / 3;
+    stats.meshlets++;
+    stats.triangles += triangles;
+
+    if (sphereOutsideFrustum(frustum, meshlet.center, meshlet.radius)) {
+      stats.frustumCulledMeshlets++;
+      stats.frustumCulledTriangles += triangles;
+      continue;
+    }
+    if (facesAway(meshlet, axisSign * meshlet.coneAxis, cameraPosition)) {
+      stats.coneCulledMeshlets++;
+      stats.coneCulledTriangles += triangles;
+      continue;
+    }
+
+    if (!commands.empty() && commands.back().firstIndex +
+                                     commands.back().count ==
+                                 meshlet.firstIndex) {
+      commands.back().count += meshlet.indexCount;
+    } else {
+      commands.push_back({meshlet.indexCount, 1, meshlet.firstIndex, 0, 0});
+    }
+  }
+  stats.drawCommands = (unsigned int)commands.size();
+}
+
+unsigned int missingTriangles(const Mesh &mesh,
+                              const std::vector<DrawElementsIndirectCommand>
+                                  &commands,
+                              glm::vec3 cameraPosition,
+                              const glm::mat4 &viewProjection,
+                              CulledFaces culledFaces) {
+  unsigned int triangleCount = (unsigned int)mesh.indices.size() / 3;
+  std::vector<bool> drawn(triangleCount, false);
+  for (const DrawElementsIndirectCommand &command : commands) {
+    for (unsigned int i = 0; i < command.count / 3; i++) {
+      drawn[command.firstIndex / 3 + i] = true;
+    }
+  }
+
+  Frustum frustum = frustumFromMatrix(viewProjection);
+  float facingSign = culledFaces == CulledFaces::Back ? 1.0f : -1.0f;
+  unsigned int missing = 0;
+  for (unsigned int triangle = 0; triangle < triangleCount; triangle++) {
+    if (drawn[triangle]) {
+      continue;
+    }
+    const unsigned int *corners = &mesh.indices[3 * triangle];
+    glm::vec3 a = mesh.vertices[corners[0]];
+    glm::vec3 b = mesh.vertices[corners[1]];
+    glm::vec3 c = mesh.vertices[corners[2]];
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    if (facingSign * glm::dot(normal, cameraPosition - a) <= 0.0f) {
+      continue;
+    }
+
+    bool outside = false;
+    for (const glm::vec4 &plane : frustum.planes) {
+      glm::vec3 planeNormal(plane);
+      if (glm::dot(planeNormal, a) + plane.w < 0.0f &&
+          glm::dot(planeNormal, b) + plane.w < 0.0f &&
+          glm::dot(planeNormal, c) + plane.w < 0.0f) {
+        outside = true;
+        break;
+      }
+    }
+    if (!outside) {
+      missing++;
+    }
+  }
+  return missing;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "mesh.h"
+#include <cstdint>
+#include <vector>
+
+// A cluster of triangles that are contiguous in the index buffer, with the
+// bounds needed to cull it as a whole. Stored as is in mesh files.
+struct Meshlet {
+  glm::vec3 center;
+  float radius;
+  // Every triangle normal is within the cone angle of the axis. coneSine is
+  // the sine of that angle, or 1 if the cone is too wide to ever cull.
+  glm::vec3 coneAxis;
+  float coneSine;
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  uint32_t vertexCount;
+  uint32_t padding;
+};
+
+const unsigned int MESHLET_MAX_VERTICES = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+// Groups the triangles of an indexed mesh into meshlets, growing each one
+// across shared vertices while preferring triangles that add few vertices and
+// face the way the meshlet does. Reorders mesh.indices so that the triangles
+// of each meshlet are contiguous and in vertex cache order; the vertices are
+// left as they are.
+std::vector<Meshlet>
+buildMeshlets(Mesh &mesh, unsigned int maxVertices = MESHLET_MAX_VERTICES,
+              unsigned int maxTriangles = MESHLET_MAX_TRIANGLES);
+
+// Same layout as OpenGL's indirect element draws
+struct DrawElementsIndirectCommand {
+  uint32_t count;
+  uint32_t instanceCount;
+  uint32_t firstIndex;
+  int32_t baseVertex;
+  uint32_t baseInstance;
+};
+
+// Which faces the draw throws away, as with glCullFace
+enum class CulledFaces { Back, Front };
+
+struct MeshletCullStats {
+  unsigned int meshlets = 0;
+  unsigned int triangles = 0;
+  unsigned int frustumCulledMeshlets = 0;
+  unsigned int frustumCulledTriangles = 0;
+  unsigned int coneCulledMeshlets = 0;
+  unsigned int coneCulledTriangles = 0;
+  // Commands after merging meshlets that follow each other
+  unsigned int drawCommands = 0;
+};
+
+// Replaces `commands` with draws of the meshlets that are in the frustum and
+// have some triangle that is not culled by `culledFaces`. `cameraPosition` and
+// `viewProjection` are in the mesh's model space. Meshlets that are next to
+// each other in the index buffer share a command.
+void cullMeshlets(const Meshlet *meshlets, unsigned int meshletCount,
+                  glm::vec3 cameraPosition, const glm::mat4 &viewProjection,
+                  CulledFaces culledFaces,
+                  std::vector<DrawElementsIndirectCommand> &commands,
+                  MeshletCullStats &stats);
+
+// Triangles of the mesh that are drawn one by one, facing the camera and not
+// wholly outside a frustum plane, but that `commands` leaves out. Culling
+// meshlets is conservative, so this should always be 0.
+unsigned int missingTriangles(const Mesh &mesh,
+                              const std::vector<DrawElementsIndirectCommand>
+                                  &commands,
+                              glm::vec3 cameraPosition,
+                              const glm::mat4 &viewProjection,
+                              CulledFaces culledFaces);
@@ -0,0 +1,323 @@
+#include "mipmaps.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// One RGBA texel in linear light. SSE2 is part of every x86-64 CPU, so it
+// needs no extra compiler flags or runtime dispatch.
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+typedef __m128 Float4;
+
+static inline Float4 float4(float r, float g, float b, float a) {
+  return _mm_set_ps(a, b, g, r);
+}
+static inline Float4 splat(float value) { return _mm_set1_ps(value); }
+static inline Float4 load(const float *texel) { return _mm_loadu_ps(texel); }
+static inline void store(float *texel, Float4 value) {
+  _mm_storeu_ps(texel, value);
+}
+// a * b + c
+static inline Float4 multiplyAdd(Float4 a, Float4 b, Float4 c) {
+  return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+
+static inline Float4 clamp01(Float4 x) {
+  return _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+
+// Rounds each channel of x * scale, clamped to [0, scale], to an integer
+static inline void quantize(Float4 x, Float4 scale, int32_t *out) {
+  x = clamp01(x);
+  __m128i rounded = _mm_cvtps_epi32(_mm_mul_ps(x, scale));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out), rounded);
+}
+#else
+struct Float4 {
+  float v[4];
+};
+
+static inline Float4 float4(float r, float g, float b, float a) {
+  return Float4{{r, g, b, a}};
+}
+static inline Float4 splat(float value) {
+  return Float4{{value, value, value, value}};
+}
+static inline Float4 load(const float *texel) {
+  return Float4{{texel[0], texel[1], texel[2], texel[3]}};
+}
+static inline void store(float *texel, Float4 value) {
+  std::copy(value.v, value.v + 4, texel);
+}
+static inline Float4 multiplyAdd(Float4 a, Float4 b, Float4 c) {
+  for (int channel = 0; channel < 4; channel++) {
+    c.v[channel] += a.v[channel] * b.v[channel];
+  }
+  return c;
+}
+
+static inline Float4 clamp01(Float4 x) {
+  for (int channel = 0; channel < 4; channel++) {
+    x.v[channel] = std::min(std::max(x.v[channel], 0.0f), 1.0f);
+  }
+  return x;
+}
+
+static inline void quantize(Float4 x, Float4 scale, int32_t *out) {
+  for (int channel = 0; channel < 4; channel++) {
+    float clamped = std::min(std::max(x.v[channel], 0.0f), 1.0f);
+    out[channel] = (int32_t)std::lround(clamped * scale.v[channel]);
+  }
+}
+#endif
+
+// Linear values are quantized this finely before encoding, which is finer
+// than the smallest step between two sRGB codes
+const int LINEAR_STEPS = 16383;
+
+struct SRGBTables {
+  float toLinear[256];
+  unsigned char fromLinear[LINEAR_STEPS + 1];
+};
+
+static const SRGBTables &srgbTables() {
+  static const SRGBTables tables = [] {
+    SRGBTables tables;
+    for (int code = 0; code < 256; code++) {
+      float value = code / 255.0f;
+      tables.toLinear[code] =
+          value <= 0.04045f ? value / 12.92f
+                            : std::pow((value + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int step = 0; step <= LINEAR_STEPS; step++) {
+      float value = float(step) / LINEAR_STEPS;
+      float encoded = value <= 0.0031308f
+                          ? value * 12.92f
+                          : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+      tables.fromLinear[step] = (unsigned char)std::lround(encoded * 255.0f);
+    }
+    return tables;
+  }();
+  return tables;
+}
+
+// Texel x of the new level is centred between source texels 2x and 2x + 1,
+// and covers source texels first + 2x up to first + 2x + taps - 1
+struct MipKernel {
+  int first;
+  int taps;
+  float weights[6];
+};
+
+static double besselI0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 32; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+static MipKernel mipKernel(MipFilter filter) {
+  if (filter == MipFilter::Box) {
+    return MipKernel{0, 2, {0.5f, 0.5f}};
+  }
+
+  // Three texels of the new level wide, with the window parameter of NVIDIA's
+  // texture tools
+  const double alpha = 4.0;
+  const double halfWidth = 1.5;
+  const double pi = 3.14159265358979323846;
+  MipKernel kernel = {-2, 6, {}};
+  double sum = 0.0;
+  double weights[6];
+  for (int tap = 0; tap < kernel.taps; tap++) {
+    // Distance from the centre, in texels of the new level
+    double distance = (tap - 2.5) / 2.0;
+    double sinc = std::sin(pi * distance) / (pi * distance);
+    double ratio = distance / halfWidth;
+    double window = besselI0(alpha * std::sqrt(1.0 - ratio * ratio)) /
+                    besselI0(alpha);
+    weights[tap] = sinc * window;
+    sum += weights[tap];
+  }
+  for (int tap = 0; tap < kernel.taps; tap++) {
+    kernel.weights[tap] = float(weights[tap] / sum);
+  }
+  return kernel;
+}
+
+// A level as the filter reads or writes it. Level 0 is read from its sRGB
+// encoded pixels. The levels below it are kept in linear light as well, four
+// floats per texel, so that each is filtered from the unrounded values of the
+// one above it and rounding does not add up down the chain.
+struct LevelView {
+  unsigned char *pixels;
+  float *linear;
+  unsigned int width;
+  unsigned int height;
+};
+
+static inline Float4 decode(const SRGBTables &tables,
+                            const unsigned char *texel) {
+  return float4(tables.toLinear[texel[0]], tables.toLinear[texel[1]],
+                tables.toLinear[texel[2]], texel[3] * (1.0f / 255.0f));
+}
+
+// Rows past either edge repeat the edge
+static inline unsigned int clampIndex(int index, unsigned int size) {
+  return (unsigned int)std::min(std::max(index, 0), int(size) - 1);
+}
+
+// Filters rows [firstRow, lastRow) of the target level, first across each
+// source row the band needs and then down the filtered rows. Reads the
+// source's linear values if it has them, and writes the target's if it keeps
+// them as well as its pixels.
+static void filterBand(const LevelView &source, const LevelView &target,
+                       unsigned int firstRow, unsigned int lastRow,
+                       const MipKernel &kernel) {
+  const SRGBTables &tables = srgbTables();
+  int firstSourceRow = int(2 * firstRow) + kernel.first;
+  unsigned int sourceRows = 2 * (lastRow - firstRow) + kernel.taps - 2;
+
+  // Four floats per texel, for a decoded row of level 0
+  std::vector<float> linearRow;
+  if (!source.linear) {
+    linearRow.resize(std::size_t(source.width) * 4);
+  }
+  std::vector<float> filtered(std::size_t(sourceRows) * target.width * 4);
+  Float4 weights[6];
+  for (int tap = 0; tap < kernel.taps; tap++) {
+    weights[tap] = splat(kernel.weights[tap]);
+  }
+
+  for (unsigned int row = 0; row < sourceRows; row++) {
+    std::size_t sourceOffset =
+        std::size_t(clampIndex(firstSourceRow + int(row), source.height)) *
+        source.width * 4;
+    const float *linear = linearRow.data();
+    if (source.linear) {
+      linear = source.linear + sourceOffset;
+    } else {
+      const unsigned char *sourceRow = source.pixels + sourceOffset;
+      for (unsigned int x = 0; x < source.width; x++) {
+        store(&linearRow[4 * x], decode(tables, sourceRow + 4 * x));
+      }
+    }
+
+    float *filteredRow = &filtered[std::size_t(row) * target.width * 4];
+    for (unsigned int x = 0; x < target.width; x++) {
+      int first = int(2 * x) + kernel.first;
+      Float4 sum = splat(0.0f);
+      if (first >= 0 && first + kernel.taps <= int(source.width)) {
+        for (int tap = 0; tap < kernel.taps; tap++) {
+          sum = multiplyAdd(weights[tap], load(&linear[4 * (first + tap)]),
+                            sum);
+        }
+      } else {
+        for (int tap = 0; tap < kernel.taps; tap++) {
+          unsigned int column = clampIndex(first + tap, source.width);
+          sum = multiplyAdd(weights[tap], load(&linear[4 * column]), sum);
+        }
+      }
+      store(&filteredRow[4 * x], sum);
+    }
+  }
+
+  const Float4 scale = float4(LINEAR_STEPS, LINEAR_STEPS, LINEAR_STEPS, 255);
+  for (unsigned int y = firstRow; y < lastRow; y++) {
+    const float *column =
+        &filtered[std::size_t(2 * (y - firstRow)) * target.width * 4];
+    std::size_t tapStride = std::size_t(target.width) * 4;
+    std::size_t targetOffset = std::size_t(y) * target.width * 4;
+    unsigned char *targetRow = target.pixels + targetOffset;
+    for (unsigned int x = 0; x < target.width; x++) {
+      Float4 sum = splat(0.0f);
+      for (int tap = 0; tap < kernel.taps; tap++) {
+        sum = multiplyAdd(weights[tap], load(&column[tap * tapStride + 4 * x]),
+                          sum);
+      }
+      if (target.linear) {
+        store(&target.linear[targetOffset + 4 * x], clamp01(sum));
+      }
+      int32_t quantized[4];
+      quantize(sum, scale, quantized);
+      targetRow[4 * x + 0] = tables.fromLinear[quantized[0]];
+      targetRow[4 * x + 1] = tables.fromLinear[quantized[1]];
+      targetRow[4 * x + 2] = tables.fromLinear[quantized[2]];
+      targetRow[4 * x + 3] = (unsigned char)quantized[3];
+    }
+  }
+}
+
+MipChain generateMipChain(const PNGImage &image, MipFilter filter,
+                          unsigned int threadCount) {
+  MipChain chain;
+  chain.width = image.width;
+  chain.height = image.height;
+
+  std::size_t totalBytes = 0;
+  unsigned int largestSide = std::max(image.width, image.height);
+  while (chain.levelCount < (unsigned int)MAX_TEXTURE_LEVELS) {
+    unsigned int level = chain.levelCount++;
+    chain.levelOffsets[level] = totalBytes;
+    totalBytes += std::size_t(std::max(image.width >> level, 1u)) *
+                  std::max(image.height >> level, 1u) * 4;
+    if ((largestSide >> level) <= 1) {
+      break;
+    }
+  }
+
+  chain.pixels.resize(totalBytes);
+  std::copy(image.pixels.begin(), image.pixels.end(), chain.pixels.begin());
+
+  // Each level is filtered from the one above it, so the levels are built in
+  // turn and the rows of each are split between the threads. The linear
+  // values of the level above are kept until the next level is built.
+  const unsigned int bandRows = 16;
+  MipKernel kernel = mipKernel(filter);
+  std::vector<float> sourceLinear, targetLinear;
+  for (unsigned int level = 1; level < chain.levelCount; level++) {
+    LevelView source = {chain.pixels.data() + chain.levelOffsets[level - 1],
+                        level > 1 ? sourceLinear.data() : nullptr,
+                        std::max(image.width >> (level - 1), 1u),
+                        std::max(image.height >> (level - 1), 1u)};
+    LevelView target = {chain.pixels.data() + chain.levelOffsets[level],
+                        nullptr, std::max(image.width >> level, 1u),
+                        std::max(image.height >> level, 1u)};
+    // The last level is not filtered from
+    if (level + 1 < chain.levelCount) {
+      targetLinear.resize(std::size_t(target.width) * target.height * 4);
+      target.linear = targetLinear.data();
+    }
+
+    unsigned int bands = (target.height + bandRows - 1) / bandRows;
+    // Not worth starting threads for the small levels
+    unsigned int levelThreads =
+        std::size_t(target.width) * target.height < 65536 ? 1 : threadCount;
+    parallelFor(
+        bands,
+        [&](unsigned int band) {
+          filterBand(source, target, band * bandRows,
+                     std::min((band + 1) * bandRows, target.height), kernel);
+        },
+        levelThreads);
+    std::swap(sourceLinear, targetLinear);
+  }
+  return chain;
+}
+
+bool parseMipFilter(const std::string &name, MipFilter &filter) {
+  if (name == "box") {
+    filter = MipFilter::Box;
+  } else if (name == "kaiser") {
+    filter = MipFilter::Kaiser;
+  } else {
+    return false;
+  }
+  return true;
+}
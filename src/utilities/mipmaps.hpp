@@ -0,0 +1,23 @@
+#pragma once
+
+#include "imageLoader.hpp"
+#include "textureFile.hpp"
+
+// How each level is filtered from the one above it. Box averages the 2x2
+// texels under each new one. Kaiser is a Kaiser windowed sinc three texels
+// of the new level wide, which keeps more detail at the cost of slight
+// ringing at hard edges.
+enum class MipFilter { Box, Kaiser };
+
+// Builds the full chain down to 1x1, halving each side rounded down. Colour
+// channels are taken to be sRGB encoded and are filtered in linear light;
+// alpha is filtered as it is. Each level is filtered from the float values
+// of the one above it and only rounded to 8 bits when written out. Rows of
+// each level are filtered in bands on `threadCount` threads (0 uses every
+// hardware thread).
+MipChain generateMipChain(const PNGImage &image,
+                          MipFilter filter = MipFilter::Kaiser,
+                          unsigned int threadCount = 0);
+
+// "box" or "kaiser". Returns false for any other name.
+bool parseMipFilter(const std::string &name, MipFilter &filter);
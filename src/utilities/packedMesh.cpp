@@ -0,0 +1,120 @@
+#include "packedMesh.hpp"
+#include <cmath>
+#include <cstring>
+
+static glm::vec2 signNotZero(glm::vec2 v) {
+  return glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+glm::vec2 octahedralEncode(glm::vec3 normal) {
+  normal /= std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+  glm::vec2 encoded(normal.x, normal.y);
+  if (normal.z < 0.0f) {
+    // Fold the lower hemisphere over the diagonals
+    encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) *
+              signNotZero(encoded);
+  }
+  return encoded;
+}
+
+glm::vec3 octahedralDecode(glm::vec2 encoded) {
+  glm::vec3 normal(encoded, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+  if (normal.z < 0.0f) {
+    glm::vec2 folded = (1.0f - glm::abs(glm::vec2(normal.y, normal.x))) *
+                       signNotZero(glm::vec2(normal));
+    normal.x = folded.x;
+    normal.y = folded.y;
+  }
+  return glm::normalize(normal);
+}
+
+static int16_t toSnorm16(float value) {
+  return (int16_t)std::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+static uint16_t toUnorm16(float value) {
+  return (uint16_t)std::round(glm::clamp(value, 0.0f, 1.0f) * 65535.0f);
+}
+
+// Offset and scale mapping [0, 1] onto the bounds of `values`. Flat axes get
+// a scale of 1 so that they still decode to their single value.
+template <class T>
+static void quantizationRange(const std::vector<T> &values, T &offset,
+                              T &scale) {
+  if (values.empty()) {
+    offset = T(0.0f);
+    scale = T(1.0f);
+    return;
+  }
+  T low = values[0], high = values[0];
+  for (const T &value : values) {
+    low = glm::min(low, value);
+    high = glm::max(high, value);
+  }
+  offset = low;
+  scale = high - low;
+  for (int i = 0; i < T::length(); i++) {
+    if (scale[i] == 0.0f) {
+      scale[i] = 1.0f;
+    }
+  }
+}
+
+template <class Vertex>
+static void packVertices(const Mesh &mesh, PackedMesh &packed) {
+  const VertexQuantization &q = packed.quantization;
+  packed.stride = sizeof(Vertex);
+  packed.vertexData.resize(packed.vertexCount * sizeof(Vertex));
+
+  for (unsigned int i = 0; i < packed.vertexCount; i++) {
+    Vertex vertex = {};
+
+    if (packed.quantizedPositions) {
+      glm::vec3 position =
+          (mesh.vertices[i] - q.positionOffset) / q.positionScale;
+      for (int axis = 0; axis < 3; axis++) {
+        vertex.position[axis] = toUnorm16(position[axis]);
+      }
+    } else {
+      for (int axis = 0; axis < 3; axis++) {
+        vertex.position[axis] = mesh.vertices[i][axis];
+      }
+    }
+
+    if (i < mesh.normals.size()) {
+      glm::vec2 normal = octahedralEncode(mesh.normals[i]);
+      vertex.normal[0] = toSnorm16(normal.x);
+      vertex.normal[1] = toSnorm16(normal.y);
+    }
+
+    if (i < mesh.textureCoordinates.size()) {
+      glm::vec2 uv =
+          (mesh.textureCoordinates[i] - q.textureOffset) / q.textureScale;
+      vertex.textureCoordinates[0] = toUnorm16(uv.x);
+      vertex.textureCoordinates[1] = toUnorm16(uv.y);
+    }
+
+    std::memcpy(&packed.vertexData[i * sizeof(Vertex)], &vertex,
+                sizeof(Vertex));
+  }
+}
+
+PackedMesh packMesh(const Mesh &mesh, bool quantizePositions) {
+  PackedMesh packed;
+  packed.quantizedPositions = quantizePositions;
+  packed.vertexCount = (unsigned int)mesh.vertices.size();
+  packed.indices = mesh.indices;
+
+  VertexQuantization &q = packed.quantization;
+  if (quantizePositions) {
+    quantizationRange(mesh.vertices, q.positionOffset, q.positionScale);
+  }
+  quantizationRange(mesh.textureCoordinates, q.textureOffset, q.textureScale);
+
+  if (quantizePositions) {
+    packVertices<QuantizedPositionVertex>(mesh, packed);
+  } else {
+    packVertices<FloatPositionVertex>(mesh, packed);
+  }
+  return packed;
+}
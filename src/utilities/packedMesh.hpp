@@ -0,0 +1,52 @@
+#pragma once
+
+#include "mesh.h"
+#include "meshlets.hpp"
+#include <cstdint>
+
+// Maps quantized attributes back to their original range, as
+// offset + value * scale. Uploaded to the vertex shaders with the uniforms of
+// the same names.
+struct VertexQuantization {
+  glm::vec3 positionOffset = glm::vec3(0.0f);
+  glm::vec3 positionScale = glm::vec3(1.0f);
+  glm::vec2 textureOffset = glm::vec2(0.0f);
+  glm::vec2 textureScale = glm::vec2(1.0f);
+};
+
+// Interleaved vertex layouts. Normals are octahedral encoded as two snorm16
+// and texture coordinates are unorm16 within the bounds of the mesh'
+// coordinates. Positions are either floats, or unorm16 within the mesh bounds
+// padded to four components to keep the attributes aligned.
+struct FloatPositionVertex {
+  float position[3];
+  int16_t normal[2];
+  uint16_t textureCoordinates[2];
+};
+
+struct QuantizedPositionVertex {
+  uint16_t position[4];
+  int16_t normal[2];
+  uint16_t textureCoordinates[2];
+};
+
+// A mesh ready to be uploaded as is, in one vertex buffer and one index buffer
+struct PackedMesh {
+  bool quantizedPositions = false;
+  unsigned int stride = 0;
+  unsigned int vertexCount = 0;
+  std::vector<unsigned char> vertexData;
+  std::vector<unsigned int> indices;
+  VertexQuantization quantization;
+  // Clusters of the triangles, if any were built
+  std::vector<Meshlet> meshlets;
+};
+
+// 20 bytes per vertex instead of 32, or 16 with quantized positions. Meshes
+// without normals or texture coordinates get zeros for them.
+PackedMesh packMesh(const Mesh &mesh, bool quantizePositions = false);
+
+// "A Survey of Efficient Representations for Independent Unit Vectors"
+// (Cigolle et al., 2014). Maps a unit vector to [-1, 1]^2 and back.
+glm::vec2 octahedralEncode(glm::vec3 normal);
+glm::vec3 octahedralDecode(glm::vec2 encoded);
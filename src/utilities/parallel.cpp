@@ -0,0 +1,49 @@
+#include "parallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+
+void parallelFor(ThreadPool &pool, unsigned int count,
+                 const std::function<void(unsigned int)> &body) {
+  // Dynamic scheduling keeps every thread busy even when the cost of the
+  // individual indices varies a lot
+  std::atomic<unsigned int> next(0);
+  auto worker = [&]() {
+    for (unsigned int i = next++; i < count; i = next++) {
+      body(i);
+    }
+  };
+
+  std::vector<std::future<void>> workers;
+  for (unsigned int i = 0; i < std::min(pool.threadCount(), count); i++) {
+    workers.push_back(pool.submit(worker));
+  }
+  // Every worker uses this frame, so all of them have to finish before an
+  // exception from any of them is passed on
+  for (std::future<void> &result : workers) {
+    result.wait();
+  }
+  for (std::future<void> &result : workers) {
+    result.get();
+  }
+}
+
+void parallelFor(unsigned int count,
+                 const std::function<void(unsigned int)> &body,
+                 unsigned int threadCount) {
+  if (threadCount == 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threadCount = std::min(threadCount, count);
+
+  if (threadCount <= 1) {
+    for (unsigned int i = 0; i < count; i++) {
+      body(i);
+    }
+    return;
+  }
+  ThreadPool pool(threadCount);
+  parallelFor(pool, count, body);
+}
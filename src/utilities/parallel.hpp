@@ -0,0 +1,17 @@
+#pragma once
+
+#include "threadPool.hpp"
+#include <functional>
+
+// Calls body(i) for every i in [0, count), handing the indices out one at a
+// time to the threads of `pool`, and returns once every index has been
+// processed. Tasks submitted to the pool earlier keep running alongside.
+void parallelFor(ThreadPool &pool, unsigned int count,
+                 const std::function<void(unsigned int)> &body);
+
+// Same, on a pool of `threadCount` threads (0 uses every hardware thread)
+// started for the call. With a single thread the calling thread does the
+// work itself.
+void parallelFor(unsigned int count,
+                 const std::function<void(unsigned int)> &body,
+                 unsigned int threadCount = 0);
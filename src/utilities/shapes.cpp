@@ -1,5 +1,6 @@
 #include "shapes.h"
 #include <iostream>
+#include <map>
 
 #ifndef M_PI
 #define M_PI 3.14159265359f
@@ -204,3 +205,122 @@ Mesh generateSphere(float sphereRadius, int slices, int layers) {
   mesh.textureCoordinates = uvs;
   return mesh;
 }
+
+glm::vec2 sphereTextureCoordinates(glm::vec3 direction) {
+  return glm::vec2(0.5 + (glm::atan(direction.z, -direction.x) / (2.0 * M_PI)),
+                   0.5 + (glm::asin(direction.y) / M_PI));
+}
+
+static void addSphereVertex(Mesh &mesh, float sphereRadius,
+                            glm::vec3 direction) {
+  mesh.vertices.push_back(sphereRadius * direction);
+  mesh.normals.push_back(direction);
+  mesh.textureCoordinates.push_back(sphereTextureCoordinates(direction));
+}
+
+// Skips the triangles that collapse into the poles
+static void addTriangle(Mesh &mesh, unsigned int a, unsigned int b,
+                        unsigned int c) {
+  if (a == b || b == c || c == a) {
+    return;
+  }
+  mesh.indices.push_back(a);
+  mesh.indices.push_back(b);
+  mesh.indices.push_back(c);
+}
+
+Mesh generateIndexedSphere(float sphereRadius, int slices, int layers) {
+  Mesh mesh;
+  const float degreesPerLayer = 180.0 / (float)layers;
+  const float degreesPerSlice = 360.0 / (float)slices;
+
+  // The poles, followed by one ring of `slices` vertices per inner layer
+  // boundary. The last slice wraps around to the first.
+  addSphereVertex(mesh, sphereRadius, glm::vec3(0, 0, -1));
+  addSphereVertex(mesh, sphereRadius, glm::vec3(0, 0, 1));
+  for (int layer = 1; layer < layers; layer++) {
+    float z = -cos(glm::radians(degreesPerLayer * layer));
+    float radius = sin(glm::radians(degreesPerLayer * layer));
+    for (int slice = 0; slice < slices; slice++) {
+      float angle = glm::radians(slice * degreesPerSlice);
+      addSphereVertex(mesh, sphereRadius,
+                      glm::vec3(radius * cos(angle), radius * sin(angle), z));
+    }
+  }
+
+  auto vertex = [&](int layer, int slice) -> unsigned int {
+    if (layer == 0) {
+      return 0;
+    }
+    if (layer == layers) {
+      return 1;
+    }
+    return 2 + (layer - 1) * slices + slice % slices;
+  };
+
+  // Same triangles and winding as generateSphere
+  for (int layer = 0; layer < layers; layer++) {
+    for (int slice = 0; slice < slices; slice++) {
+      addTriangle(mesh, vertex(layer, slice), vertex(layer, slice + 1),
+                  vertex(layer + 1, slice + 1));
+      addTriangle(mesh, vertex(layer, slice), vertex(layer + 1, slice + 1),
+                  vertex(layer + 1, slice));
+    }
+  }
+
+  return mesh;
+}
+
+Mesh generateIcosphere(float sphereRadius, int subdivisions) {
+  // Corners of the icosahedron: three orthogonal golden rectangles
+  const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+  std::vector<glm::vec3> directions = {
+      {-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+      {0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+      {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1},
+  };
+  for (glm::vec3 &direction : directions) {
+    direction = glm::normalize(direction);
+  }
+
+  std::vector<unsigned int> indices = {
+      0, 11, 5,  0, 5,  1, 0,  1, 7, 0,  7,  10, 0, 10, 11,
+      1, 5,  9,  5, 11, 4, 11, 10, 2, 10, 7, 6,  7, 1,  8,
+      3, 9,  4,  3, 4,  2, 3,  2, 6, 3,  6,  8,  3, 8,  9,
+      4, 9,  5,  2, 4,  11, 6, 2, 10, 8, 6, 7,  9, 8,  1,
+  };
+
+  for (int level = 0; level < subdivisions; level++) {
+    // Midpoints are shared by the two triangles on either side of an edge
+    std::map<std::pair<unsigned int, unsigned int>, unsigned int> midpoints;
+    auto midpoint = [&](unsigned int a, unsigned int b) {
+      auto key = std::make_pair(std::min(a, b), std::max(a, b));
+      auto found = midpoints.find(key);
+      if (found != midpoints.end()) {
+        return found->second;
+      }
+      directions.push_back(glm::normalize(directions[a] + directions[b]));
+      unsigned int index = (unsigned int)directions.size() - 1;
+      midpoints[key] = index;
+      return index;
+    };
+
+    std::vector<unsigned int> subdivided;
+    subdivided.reserve(4 * indices.size());
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+      unsigned int ab = midpoint(a, b), bc = midpoint(b, c),
+                   ca = midpoint(c, a);
+      subdivided.insert(subdivided.end(),
+                        {a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca});
+    }
+    indices.swap(subdivided);
+  }
+
+  Mesh mesh;
+  for (glm::vec3 direction : directions) {
+    addSphereVertex(mesh, sphereRadius, direction);
+  }
+  mesh.indices = indices;
+  return mesh;
+}
@@ -6,4 +6,17 @@ Mesh cube(glm::vec3 scale = glm::vec3(1), glm::vec2 textureScale = glm::vec2(1),
           glm::vec3 textureScale3d = glm::vec3(1));
 Mesh generateBox(float width, float height, float depth,
                  bool flipFaces = false);
-Mesh generateSphere(float radius, int slices, int layers);
\ No newline at end of file
+Mesh generateSphere(float radius, int slices, int layers);
+
+// The texture coordinates generateSphere() gives the vertex in the direction,
+// which has to be normalised
+glm::vec2 sphereTextureCoordinates(glm::vec3 direction);
+
+// The same sphere as generateSphere, with the vertices shared between
+// neighbouring quads and a single vertex at each pole
+Mesh generateIndexedSphere(float radius, int slices, int layers);
+
+// Icosahedron with every face split into 4^subdivisions triangles, projected
+// onto the sphere. Spreads the vertices evenly instead of crowding them at the
+// poles, so it needs fewer of them for the same silhouette.
+Mesh generateIcosphere(float radius, int subdivisions);
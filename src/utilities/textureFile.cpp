@@ -0,0 +1,236 @@
+#include "textureFile.hpp"
+#include "blockCompression.hpp"
+#include "mipmaps.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fmt/format.h>
+#include <sys/stat.h>
+
+static const char TEXTURE_FILE_MAGIC[4] = {'T', 'E', 'X', 'R'};
+static const uint32_t TEXTURE_FILE_VERSION = 3;
+static const uint64_t TEXTURE_FILE_ALIGNMENT = 64;
+
+struct TextureFileLevel {
+  uint32_t width;
+  uint32_t height;
+  uint64_t offset;
+  uint64_t bytes;
+};
+
+struct TextureFileHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t sourceHash;
+  TextureFormat format;
+  uint32_t levelCount;
+  TextureFileLevel levels[MAX_TEXTURE_LEVELS];
+};
+
+std::size_t textureLevelBytes(TextureFormat format, unsigned int width,
+                              unsigned int height) {
+  std::size_t blocks = std::size_t((width + 3) / 4) * ((height + 3) / 4);
+  switch (format) {
+  case TextureFormat::BC1:
+    return blocks * 8;
+  case TextureFormat::BC3:
+    return blocks * 16;
+  default:
+    return std::size_t(width) * height * 4;
+  }
+}
+
+TextureData textureData(const MipChain &chain) {
+  TextureData data;
+  data.format = chain.format;
+  data.levelCount = chain.levelCount;
+  for (unsigned int level = 0; level < chain.levelCount; level++) {
+    TextureLevel &textureLevel = data.levels[level];
+    textureLevel.width = std::max(chain.width >> level, 1u);
+    textureLevel.height = std::max(chain.height >> level, 1u);
+    textureLevel.pixels = chain.pixels.data() + chain.levelOffsets[level];
+    textureLevel.bytes = textureLevelBytes(chain.format, textureLevel.width,
+                                           textureLevel.height);
+  }
+  return data;
+}
+
+PNGImage textureLevelImage(const TextureData &texture, unsigned int level) {
+  return decompressLevel(texture.levels[level], texture.format);
+}
+
+// FNV-1a
+static uint64_t addBytes(uint64_t hash, const void *data, std::size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (std::size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+
+uint64_t textureSourceHash(const std::string &sourceFileName) {
+  struct stat status;
+  if (stat(sourceFileName.c_str(), &status) != 0) {
+    return 0;
+  }
+
+  int64_t size = status.st_size;
+  int64_t modified = status.st_mtime;
+  uint64_t hash = FNV_OFFSET_BASIS;
+  hash = addBytes(hash, &TEXTURE_FILE_VERSION, sizeof(TEXTURE_FILE_VERSION));
+  hash = addBytes(hash, sourceFileName.data(), sourceFileName.size());
+  hash = addBytes(hash, &size, sizeof(size));
+  hash = addBytes(hash, &modified, sizeof(modified));
+  return hash == 0 ? 1 : hash;
+}
+
+static uint64_t alignOffset(uint64_t offset) {
+  return (offset + TEXTURE_FILE_ALIGNMENT - 1) / TEXTURE_FILE_ALIGNMENT *
+         TEXTURE_FILE_ALIGNMENT;
+}
+
+static bool writeAt(FILE *file, uint64_t offset, const void *data,
+                    std::size_t size) {
+  return std::fseek(file, (long)offset, SEEK_SET) == 0 &&
+         std::fwrite(data, 1, size, file) == size;
+}
+
+bool saveTextureFile(const TextureData &texture, uint64_t sourceHash,
+                     const std::string &fileName) {
+  TextureFileHeader header = {};
+  std::memcpy(header.magic, TEXTURE_FILE_MAGIC, sizeof(header.magic));
+  header.version = TEXTURE_FILE_VERSION;
+  header.sourceHash = sourceHash;
+  header.format = texture.format;
+  header.levelCount = texture.levelCount;
+  uint64_t offset = alignOffset(sizeof(header));
+  for (unsigned int level = 0; level < texture.levelCount; level++) {
+    TextureFileLevel &fileLevel = header.levels[level];
+    fileLevel.width = texture.levels[level].width;
+    fileLevel.height = texture.levels[level].height;
+    fileLevel.offset = offset;
+    fileLevel.bytes = texture.levels[level].bytes;
+    offset = alignOffset(offset + fileLevel.bytes);
+  }
+
+  // Written under a temporary name first, so that a reader never maps a
+  // partially written file
+  std::string temporaryName = fileName + ".tmp";
+  FILE *file = std::fopen(temporaryName.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+
+  bool ok = writeAt(file, 0, &header, sizeof(header));
+  for (unsigned int level = 0; ok && level < texture.levelCount; level++) {
+    ok = writeAt(file, header.levels[level].offset,
+                 texture.levels[level].pixels, texture.levels[level].bytes);
+  }
+  ok = std::fclose(file) == 0 && ok;
+
+  if (ok) {
+    std::remove(fileName.c_str());
+    ok = std::rename(temporaryName.c_str(), fileName.c_str()) == 0;
+  }
+  if (!ok) {
+    std::remove(temporaryName.c_str());
+  }
+  return ok;
+}
+
+bool loadTextureFile(const std::string &fileName, uint64_t sourceHash,
+                     CachedTexture &texture) {
+  MappedFile file;
+  if (!file.open(fileName) || file.size() < sizeof(TextureFileHeader)) {
+    return false;
+  }
+
+  TextureFileHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, TEXTURE_FILE_MAGIC, sizeof(header.magic)) !=
+          0 ||
+      header.version != TEXTURE_FILE_VERSION ||
+      (sourceHash != 0 && header.sourceHash != sourceHash) ||
+      header.format > TextureFormat::BC3 || header.levelCount == 0 ||
+      header.levelCount > (uint32_t)MAX_TEXTURE_LEVELS) {
+    return false;
+  }
+  for (unsigned int level = 0; level < header.levelCount; level++) {
+    const TextureFileLevel &fileLevel = header.levels[level];
+    if (fileLevel.offset % TEXTURE_FILE_ALIGNMENT != 0 ||
+        fileLevel.bytes != textureLevelBytes(header.format, fileLevel.width,
+                                             fileLevel.height) ||
+        fileLevel.offset + fileLevel.bytes > file.size()) {
+      return false;
+    }
+  }
+
+  TextureData &data = texture.data;
+  data.format = header.format;
+  data.levelCount = header.levelCount;
+  for (unsigned int level = 0; level < header.levelCount; level++) {
+    const TextureFileLevel &fileLevel = header.levels[level];
+    data.levels[level].width = fileLevel.width;
+    data.levels[level].height = fileLevel.height;
+    data.levels[level].pixels = file.data() + fileLevel.offset;
+    data.levels[level].bytes = fileLevel.bytes;
+  }
+
+  texture.storage = MipChain();
+  texture.file = std::move(file);
+  return true;
+}
+
+std::string cacheFileName(const std::string &cacheDirectory,
+                          const std::string &pngFileName,
+                          const std::string &extension) {
+  std::size_t slash = pngFileName.find_last_of("/\\");
+  std::string directory =
+      slash == std::string::npos ? "" : pngFileName.substr(0, slash);
+  std::string name =
+      slash == std::string::npos ? pngFileName : pngFileName.substr(slash + 1);
+  std::size_t dot = name.rfind('.');
+  if (dot != std::string::npos) {
+    name = name.substr(0, dot);
+  }
+  uint64_t directoryHash =
+      addBytes(FNV_OFFSET_BASIS, directory.data(), directory.size());
+  return fmt::format("{}/{}-{:016x}{}", cacheDirectory, name, directoryHash,
+                     extension);
+}
+
+std::string textureFileName(const std::string &cacheDirectory,
+                            const std::string &pngFileName) {
+  return cacheFileName(cacheDirectory, pngFileName, ".tex");
+}
+
+bool convertTexture(const std::string &cacheDirectory,
+                    const std::string &pngFileName, CachedTexture &texture) {
+  PNGImage image = loadPNGFile(pngFileName);
+  if (image.pixels.empty()) {
+    return false;
+  }
+
+  texture.file.close();
+  texture.storage =
+      compressMipChain(generateMipChain(image), blockFormatFor(image));
+  texture.data = textureData(texture.storage);
+  return saveTextureFile(texture.data, textureSourceHash(pngFileName),
+                         textureFileName(cacheDirectory, pngFileName));
+}
+
+void loadOrConvertTexture(const std::string &cacheDirectory,
+                          const std::string &pngFileName,
+                          CachedTexture &texture) {
+  std::string fileName = textureFileName(cacheDirectory, pngFileName);
+  if (loadTextureFile(fileName, textureSourceHash(pngFileName), texture)) {
+    return;
+  }
+
+  if (!convertTexture(cacheDirectory, pngFileName, texture) &&
+      texture.data.levelCount > 0) {
+    fprintf(stderr, "Could not write texture to \"%s\".\n", fileName.c_str());
+  }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "imageLoader.hpp"
+#include "mappedFile.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Block compressed formats are described in blockCompression.hpp
+enum class TextureFormat : uint32_t { RGBA8, BC1, BC3 };
+
+// Enough for a 32768 texel wide texture
+const int MAX_TEXTURE_LEVELS = 16;
+
+struct TextureLevel {
+  unsigned int width = 0;
+  unsigned int height = 0;
+  const unsigned char *pixels = nullptr;
+  std::size_t bytes = 0;
+};
+
+// A texture laid out the way it is uploaded: every mip level, each with the
+// bottom row first as OpenGL expects. Points into the chain or file it was
+// made from.
+struct TextureData {
+  TextureFormat format = TextureFormat::RGBA8;
+  unsigned int levelCount = 0;
+  TextureLevel levels[MAX_TEXTURE_LEVELS];
+};
+
+// All levels of a texture in one allocation, level 0 first
+struct MipChain {
+  TextureFormat format = TextureFormat::RGBA8;
+  unsigned int width = 0;
+  unsigned int height = 0;
+  unsigned int levelCount = 0;
+  std::size_t levelOffsets[MAX_TEXTURE_LEVELS] = {};
+  std::vector<unsigned char> pixels;
+};
+
+// Bytes of a level, in whole 4x4 blocks for the block compressed formats
+std::size_t textureLevelBytes(TextureFormat format, unsigned int width,
+                              unsigned int height);
+
+TextureData textureData(const MipChain &chain);
+
+// A copy of one level as RGBA8, decoded if it is block compressed, for the
+// code that samples textures on the CPU
+PNGImage textureLevelImage(const TextureData &texture, unsigned int level);
+
+struct CachedTexture {
+  TextureData data;
+
+  // data points into one of these, depending on whether the texture was
+  // converted or loaded from disk
+  MipChain storage;
+  MappedFile file;
+};
+
+// Identifies the image a texture file was converted from by its path, size
+// and modification time, together with the file format version. The image
+// is not read, so this costs a stat() call. An edited, moved, copied or
+// touched image no longer matches and is converted again. 0 if the image
+// does not exist.
+uint64_t textureSourceHash(const std::string &sourceFileName);
+
+// Writes the header and every level, each aligned for direct upload
+bool saveTextureFile(const TextureData &texture, uint64_t sourceHash,
+                     const std::string &fileName);
+
+// Memory maps a texture file, failing if it is missing, damaged, of another
+// version or converted from another image. A source hash of 0 accepts a file
+// converted from any image.
+bool loadTextureFile(const std::string &fileName, uint64_t sourceHash,
+                     CachedTexture &texture);
+
+// The file in the cache directory for a PNG file, named after the PNG file
+// and a hash of the directory it is in, so that images of the same name in
+// different directories do not share a file. `extension` includes the dot.
+std::string cacheFileName(const std::string &cacheDirectory,
+                          const std::string &pngFileName,
+                          const std::string &extension);
+
+// The texture file for a PNG file, see cacheFileName()
+std::string textureFileName(const std::string &cacheDirectory,
+                            const std::string &pngFileName);
+
+// Decodes the PNG file, builds its mip chain with generateMipChain(),
+// compresses it to the format blockFormatFor() picks and writes its texture
+// file in the cache directory. Returns false if decoding or writing fails.
+bool convertTexture(const std::string &cacheDirectory,
+                    const std::string &pngFileName, CachedTexture &texture);
+
+// Maps the texture file for the PNG file, converting the PNG file first if
+// the texture file is missing or was converted from another image
+void loadOrConvertTexture(const std::string &cacheDirectory,
+                          const std::string &pngFileName,
+                          CachedTexture &texture);
@@ -0,0 +1,51 @@
+#include "threadPool.hpp"
+#include <algorithm>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned int threadCount) {
+  if (threadCount == 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (unsigned int i = 0; i < threadCount; i++) {
+    mThreads.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStopping = true;
+  }
+  mTaskAdded.notify_all();
+  for (std::thread &thread : mThreads) {
+    thread.join();
+  }
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+  // std::function needs a copyable target, which packaged_task is not
+  auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+  std::future<void> result = packaged->get_future();
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mTasks.emplace_back([packaged]() { (*packaged)(); });
+  }
+  mTaskAdded.notify_one();
+  return result;
+}
+
+void ThreadPool::work() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mTaskAdded.wait(lock, [this]() { return mStopping || !mTasks.empty(); });
+      if (mTasks.empty()) {
+        return;
+      }
+      task = std::move(mTasks.front());
+      mTasks.pop_front();
+    }
+    task();
+  }
+}
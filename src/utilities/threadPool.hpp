@@ -0,0 +1,38 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads running submitted tasks in the order they were
+// submitted. The threads are started once and kept for the lifetime of the
+// pool, and the caller can keep working while its tasks run. parallelFor()
+// spreads a loop over them.
+class ThreadPool {
+public:
+  // 0 starts one thread per hardware thread
+  explicit ThreadPool(unsigned int threadCount = 0);
+
+  // Finishes every task already submitted before returning
+  ~ThreadPool();
+
+  std::future<void> submit(std::function<void()> task);
+
+  unsigned int threadCount() const { return (unsigned int)mThreads.size(); }
+
+private:
+  ThreadPool(ThreadPool const &) = delete;
+  ThreadPool &operator=(ThreadPool const &) = delete;
+
+  void work();
+
+  std::vector<std::thread> mThreads;
+  std::deque<std::function<void()>> mTasks;
+  std::mutex mMutex;
+  std::condition_variable mTaskAdded;
+  bool mStopping = false;
+};
@@ -0,0 +1,410 @@
+#include "virtualTexture.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+static const char VIRTUAL_TEXTURE_FILE_MAGIC[4] = {'V', 'T', 'E', 'X'};
+static const uint32_t VIRTUAL_TEXTURE_FILE_VERSION = 1;
+static const uint64_t VIRTUAL_TEXTURE_FILE_ALIGNMENT = 4096;
+
+// The tiles follow the header, in the order of their index
+struct VirtualTextureFileHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t sourceHash;
+  uint32_t width;
+  uint32_t height;
+  uint32_t tileSize;
+  uint32_t tileBorder;
+  uint32_t tileCount;
+  uint32_t padding;
+  uint64_t tileOffset;
+};
+
+VirtualTextureLayout virtualTextureLayout(unsigned int width,
+                                          unsigned int height) {
+  VirtualTextureLayout layout;
+  layout.width = width;
+  layout.height = height;
+  unsigned int largestSide = std::max(width, height);
+  while (layout.levelCount < (unsigned int)MAX_TEXTURE_LEVELS) {
+    unsigned int level = layout.levelCount++;
+    unsigned int levelWidth = std::max(width >> level, 1u);
+    unsigned int levelHeight = std::max(height >> level, 1u);
+    layout.tilesX[level] =
+        (levelWidth + VIRTUAL_TILE_SIZE - 1) / VIRTUAL_TILE_SIZE;
+    layout.tilesY[level] =
+        (levelHeight + VIRTUAL_TILE_SIZE - 1) / VIRTUAL_TILE_SIZE;
+    layout.firstTile[level] = layout.tileCount;
+    layout.tileCount += layout.tilesX[level] * layout.tilesY[level];
+    layout.tableRow[level] = layout.tableHeight;
+    layout.tableHeight += layout.tilesY[level];
+    if ((largestSide >> level) <= 1) {
+      break;
+    }
+  }
+  layout.tableWidth = layout.tilesX[0];
+  return layout;
+}
+
+static uint64_t alignOffset(uint64_t offset) {
+  return (offset + VIRTUAL_TEXTURE_FILE_ALIGNMENT - 1) /
+         VIRTUAL_TEXTURE_FILE_ALIGNMENT * VIRTUAL_TEXTURE_FILE_ALIGNMENT;
+}
+
+// Copies a tile and its border out of a level
+static void copyTile(const TextureLevel &level, unsigned int tileX,
+                     unsigned int tileY, unsigned char *tile) {
+  int left = int(tileX * VIRTUAL_TILE_SIZE) - int(VIRTUAL_TILE_BORDER);
+  int bottom = int(tileY * VIRTUAL_TILE_SIZE) - int(VIRTUAL_TILE_BORDER);
+  for (unsigned int y = 0; y < VIRTUAL_TILE_STRIDE; y++) {
+    int row = std::min(std::max(bottom + int(y), 0), int(level.height) - 1);
+    const unsigned char *source =
+        level.pixels + std::size_t(row) * level.width * 4;
+    unsigned char *target = tile + std::size_t(y) * VIRTUAL_TILE_STRIDE * 4;
+    for (unsigned int x = 0; x < VIRTUAL_TILE_STRIDE; x++) {
+      int column =
+          std::min(std::max(left + int(x), 0), int(level.width) - 1);
+      std::memcpy(target + 4 * x, source + 4 * column, 4);
+    }
+  }
+}
+
+bool saveVirtualTextureFile(const TextureData &texture, uint64_t sourceHash,
+                            const std::string &fileName) {
+  VirtualTextureLayout layout =
+      virtualTextureLayout(texture.levels[0].width, texture.levels[0].height);
+  if (texture.format != TextureFormat::RGBA8 ||
+      texture.levelCount != layout.levelCount) {
+    return false;
+  }
+
+  VirtualTextureFileHeader header = {};
+  std::memcpy(header.magic, VIRTUAL_TEXTURE_FILE_MAGIC, sizeof(header.magic));
+  header.version = VIRTUAL_TEXTURE_FILE_VERSION;
+  header.sourceHash = sourceHash;
+  header.width = layout.width;
+  header.height = layout.height;
+  header.tileSize = VIRTUAL_TILE_SIZE;
+  header.tileBorder = VIRTUAL_TILE_BORDER;
+  header.tileCount = layout.tileCount;
+  header.tileOffset = alignOffset(sizeof(header));
+
+  // Written under a temporary name first, so that a reader never maps a
+  // partially written file
+  std::string temporaryName = fileName + ".tmp";
+  FILE *file = std::fopen(temporaryName.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+
+  // The file can be larger than a long, so it is written front to back
+  // instead of seeking to each tile
+  std::vector<unsigned char> tile(
+      std::max(VIRTUAL_TILE_BYTES, std::size_t(header.tileOffset)));
+  std::memcpy(tile.data(), &header, sizeof(header));
+  bool ok = std::fwrite(tile.data(), 1, header.tileOffset, file) ==
+            header.tileOffset;
+  for (unsigned int level = 0; ok && level < layout.levelCount; level++) {
+    for (unsigned int y = 0; ok && y < layout.tilesY[level]; y++) {
+      for (unsigned int x = 0; ok && x < layout.tilesX[level]; x++) {
+        copyTile(texture.levels[level], x, y, tile.data());
+        ok = std::fwrite(tile.data(), 1, VIRTUAL_TILE_BYTES, file) ==
+             VIRTUAL_TILE_BYTES;
+      }
+    }
+  }
+  ok = std::fclose(file) == 0 && ok;
+
+  if (ok) {
+    std::remove(fileName.c_str());
+    ok = std::rename(temporaryName.c_str(), fileName.c_str()) == 0;
+  }
+  if (!ok) {
+    std::remove(temporaryName.c_str());
+  }
+  return ok;
+}
+
+bool VirtualTextureFile::open(const std::string &fileName,
+                              uint64_t sourceHash) {
+  MappedFile file;
+  if (!file.open(fileName) || file.size() < sizeof(VirtualTextureFileHeader)) {
+    return false;
+  }
+
+  VirtualTextureFileHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, VIRTUAL_TEXTURE_FILE_MAGIC,
+                  sizeof(header.magic)) != 0 ||
+      header.version != VIRTUAL_TEXTURE_FILE_VERSION ||
+      (sourceHash != 0 && header.sourceHash != sourceHash) ||
+      header.tileSize != VIRTUAL_TILE_SIZE ||
+      header.tileBorder != VIRTUAL_TILE_BORDER || header.width == 0 ||
+      header.height == 0 ||
+      header.tileOffset % VIRTUAL_TEXTURE_FILE_ALIGNMENT != 0) {
+    return false;
+  }
+
+  VirtualTextureLayout layout = virtualTextureLayout(header.width,
+                                                     header.height);
+  if (header.tileCount != layout.tileCount ||
+      header.tileOffset + uint64_t(layout.tileCount) * VIRTUAL_TILE_BYTES >
+          file.size()) {
+    return false;
+  }
+
+  mFile = std::move(file);
+  mLayout = layout;
+  mTileOffset = header.tileOffset;
+  return true;
+}
+
+std::string virtualTextureFileName(const std::string &cacheDirectory,
+                                   const std::string &pngFileName) {
+  return cacheFileName(cacheDirectory, pngFileName, ".vtex");
+}
+
+bool openTiledTexture(const std::string &cacheDirectory,
+                      const std::string &pngFileName,
+                      VirtualTextureFile &file) {
+  return file.open(virtualTextureFileName(cacheDirectory, pngFileName),
+                   textureSourceHash(pngFileName));
+}
+
+VirtualTextureCache::VirtualTextureCache(const VirtualTextureFile &file,
+                                         unsigned int slotsPerSide,
+                                         unsigned int threadCount)
+    : mFile(file), mLayout(file.layout()),
+      mSlotsPerSide(std::min(std::max(slotsPerSide, 1u), 256u)),
+      mSlots(mSlotsPerSide * mSlotsPerSide),
+      mTileStates(mLayout.tileCount, Missing),
+      mTileSlots(mLayout.tileCount, -1),
+      mPinnedTiles(mLayout.tileCount, false),
+      mTable(std::size_t(mLayout.tableWidth) * mLayout.tableHeight, 0),
+      mTableChanges(mLayout.levelCount), mPool(threadCount) {
+  mStats.slots = (unsigned int)mSlots.size();
+
+  // The table texture starts out undefined, so all of it is uploaded once
+  for (unsigned int level = 0; level < mLayout.levelCount; level++) {
+    mTableChanges[level] = {0, 0, mLayout.tilesX[level] - 1,
+                            mLayout.tilesY[level] - 1, false};
+  }
+
+  // Pins whole levels, coarsest first, while they fit in a quarter of the
+  // cache. The single tile of the coarsest level is always pinned.
+  unsigned int pinnedTiles = 0;
+  for (int level = int(mLayout.levelCount) - 1; level >= 0; level--) {
+    unsigned int levelTiles = mLayout.tilesX[level] * mLayout.tilesY[level];
+    if (pinnedTiles > 0 && pinnedTiles + levelTiles > mSlots.size() / 4) {
+      break;
+    }
+    for (unsigned int tile = 0; tile < levelTiles; tile++) {
+      mPinnedTiles[mLayout.firstTile[level] + tile] = true;
+      load(mLayout.firstTile[level] + tile);
+    }
+    pinnedTiles += levelTiles;
+  }
+}
+
+void VirtualTextureCache::requestTiles(std::vector<unsigned int> tiles) {
+  mFrame++;
+  std::sort(tiles.begin(), tiles.end());
+  tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+  tiles.erase(std::lower_bound(tiles.begin(), tiles.end(), mLayout.tileCount),
+              tiles.end());
+
+  mStats.requestedTiles = (unsigned int)tiles.size();
+  mStats.missingTiles = 0;
+  for (unsigned int tile : tiles) {
+    if (mTileStates[tile] == Resident) {
+      mSlots[mTileSlots[tile]].lastUsed = mFrame;
+    } else {
+      mStats.missingTiles++;
+    }
+  }
+
+  // Tiles that would find no slot are not read at all
+  unsigned int freeSlots = 0;
+  for (const Slot &slot : mSlots) {
+    if (slot.tile < 0 || (!slot.pinned && slot.lastUsed < mFrame)) {
+      freeSlots++;
+    }
+  }
+  unsigned int maxPending = std::min(maxPendingTiles, freeSlots);
+
+  // Coarser levels have higher indices, and are loaded first since they
+  // replace the blurriest fallbacks
+  for (auto tile = tiles.rbegin(); tile != tiles.rend(); ++tile) {
+    if (mStats.pendingTiles >= maxPending) {
+      break;
+    }
+    if (mTileStates[*tile] == Missing) {
+      load(*tile);
+    }
+  }
+}
+
+void VirtualTextureCache::load(unsigned int tile) {
+  mTileStates[tile] = Pending;
+  mStats.pendingTiles++;
+  mPool.submit([this, tile]() {
+    const unsigned char *texels = mFile.tile(tile);
+    LoadedTile loaded = {
+        tile, std::vector<unsigned char>(texels, texels + VIRTUAL_TILE_BYTES)};
+    std::lock_guard<std::mutex> lock(mMutex);
+    mLoaded.push_back(std::move(loaded));
+  });
+}
+
+// An empty slot, or else the slot used least recently. Slots used in the
+// current frame are only given up for pinned tiles, so that a view needing
+// more tiles than fit falls back to coarser tiles instead of thrashing.
+int VirtualTextureCache::freeSlot(bool evictVisible) {
+  int leastRecent = -1;
+  for (std::size_t slot = 0; slot < mSlots.size(); slot++) {
+    if (mSlots[slot].tile < 0) {
+      return int(slot);
+    }
+    if (!mSlots[slot].pinned &&
+        (leastRecent < 0 ||
+         mSlots[slot].lastUsed < mSlots[leastRecent].lastUsed)) {
+      leastRecent = int(slot);
+    }
+  }
+  if (leastRecent >= 0 && mSlots[leastRecent].lastUsed == mFrame &&
+      !evictVisible) {
+    return -1;
+  }
+  return leastRecent;
+}
+
+std::vector<VirtualTileUpload>
+VirtualTextureCache::placeLoadedTiles(unsigned int maxTiles) {
+  std::vector<LoadedTile> loaded;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::size_t count = std::min(mLoaded.size(), std::size_t(maxTiles));
+    std::move(mLoaded.begin(), mLoaded.begin() + count,
+              std::back_inserter(loaded));
+    mLoaded.erase(mLoaded.begin(), mLoaded.begin() + count);
+  }
+
+  std::vector<VirtualTileUpload> uploads;
+  for (LoadedTile &tile : loaded) {
+    mStats.pendingTiles--;
+    int slot = freeSlot(mPinnedTiles[tile.tile]);
+    if (slot < 0) {
+      mTileStates[tile.tile] = Missing;
+      continue;
+    }
+
+    Slot &cacheSlot = mSlots[slot];
+    if (cacheSlot.tile >= 0) {
+      mTileStates[cacheSlot.tile] = Missing;
+      mTileSlots[cacheSlot.tile] = -1;
+      mStats.residentTiles--;
+      mStats.evictedTiles++;
+      updateTable(unsigned(cacheSlot.tile));
+    }
+    cacheSlot.tile = int(tile.tile);
+    cacheSlot.lastUsed = mFrame;
+    cacheSlot.pinned = mPinnedTiles[tile.tile];
+    mTileStates[tile.tile] = Resident;
+    mTileSlots[tile.tile] = slot;
+    mStats.residentTiles++;
+    mStats.loadedTiles++;
+    updateTable(tile.tile);
+
+    uploads.push_back(VirtualTileUpload{unsigned(slot) % mSlotsPerSide,
+                                        unsigned(slot) / mSlotsPerSide,
+                                        std::move(tile.texels)});
+  }
+  return uploads;
+}
+
+// The tile's own slot if it is in the cache, or else the entry of the tile
+// covering it one level up
+uint32_t VirtualTextureCache::tableEntry(unsigned int level, unsigned int x,
+                                         unsigned int y) const {
+  unsigned int tile = mLayout.tileIndex(level, x, y);
+  if (mTileStates[tile] == Resident) {
+    unsigned int slot = (unsigned int)mTileSlots[tile];
+    return virtualTableEntry(slot % mSlotsPerSide, slot / mSlotsPerSide,
+                             level);
+  }
+  if (level + 1 >= mLayout.levelCount) {
+    return 0;
+  }
+  // Odd sized levels can have one more tile than the level above
+  unsigned int parentX = std::min(x / 2, mLayout.tilesX[level + 1] - 1);
+  unsigned int parentY = std::min(y / 2, mLayout.tilesY[level + 1] - 1);
+  return mTable[std::size_t(mLayout.tableRow[level + 1] + parentY) *
+                    mLayout.tableWidth +
+                parentX];
+}
+
+// Updates the entries that can fall back on the tile after it was placed or
+// evicted: its own, and those of the tiles it covers on every finer level.
+// Goes from the tile down, so each entry's parent is up to date when read.
+void VirtualTextureCache::updateTable(unsigned int tile) {
+  unsigned int level = mLayout.levelCount - 1;
+  while (tile < mLayout.firstTile[level]) {
+    level--;
+  }
+  unsigned int index = tile - mLayout.firstTile[level];
+  TileRange range;
+  range.x0 = range.x1 = index % mLayout.tilesX[level];
+  range.y0 = range.y1 = index / mLayout.tilesX[level];
+
+  for (int current = int(level); current >= 0; current--) {
+    if (current < int(level)) {
+      // The last tile of a level also covers the extra tile of an odd
+      // sized level below it
+      unsigned int tilesX = mLayout.tilesX[current];
+      unsigned int tilesY = mLayout.tilesY[current];
+      bool lastX = range.x1 == mLayout.tilesX[current + 1] - 1;
+      bool lastY = range.y1 == mLayout.tilesY[current + 1] - 1;
+      range.x0 = std::min(2 * range.x0, tilesX - 1);
+      range.y0 = std::min(2 * range.y0, tilesY - 1);
+      range.x1 = lastX ? tilesX - 1 : std::min(2 * range.x1 + 1, tilesX - 1);
+      range.y1 = lastY ? tilesY - 1 : std::min(2 * range.y1 + 1, tilesY - 1);
+    }
+    for (unsigned int y = range.y0; y <= range.y1; y++) {
+      std::size_t rowStart =
+          std::size_t(mLayout.tableRow[current] + y) * mLayout.tableWidth;
+      for (unsigned int x = range.x0; x <= range.x1; x++) {
+        mTable[rowStart + x] = tableEntry(unsigned(current), x, y);
+      }
+    }
+
+    TileRange &changes = mTableChanges[current];
+    if (changes.empty) {
+      changes = range;
+      changes.empty = false;
+    } else {
+      changes.x0 = std::min(changes.x0, range.x0);
+      changes.y0 = std::min(changes.y0, range.y0);
+      changes.x1 = std::max(changes.x1, range.x1);
+      changes.y1 = std::max(changes.y1, range.y1);
+    }
+  }
+}
+
+std::vector<VirtualTableRegion> VirtualTextureCache::takeTableChanges() {
+  std::vector<VirtualTableRegion> regions;
+  for (unsigned int level = 0; level < mLayout.levelCount; level++) {
+    TileRange &changes = mTableChanges[level];
+    if (changes.empty) {
+      continue;
+    }
+    regions.push_back({changes.x0, mLayout.tableRow[level] + changes.y0,
+                       changes.x1 - changes.x0 + 1,
+                       changes.y1 - changes.y0 + 1});
+    changes.empty = true;
+  }
+  return regions;
+}
+
+VirtualTextureStats VirtualTextureCache::stats() const { return mStats; }
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "mappedFile.hpp"
+#include "textureFile.hpp"
+#include "threadPool.hpp"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A texture split into square tiles on every mip level, of which only the
+// tiles that are visible are kept in a fixed size cache on the GPU. An
+// indirection table tells the shader where each tile is in the cache, or
+// which coarser tile to use instead while it is not.
+
+// Texels of a tile, and the texels copied from its neighbours around it so
+// that filtering inside the tile never reads another tile
+const unsigned int VIRTUAL_TILE_SIZE = 128;
+const unsigned int VIRTUAL_TILE_BORDER = 4;
+// Side of a tile with its border, as stored in the file and the cache
+const unsigned int VIRTUAL_TILE_STRIDE =
+    VIRTUAL_TILE_SIZE + 2 * VIRTUAL_TILE_BORDER;
+const std::size_t VIRTUAL_TILE_BYTES =
+    std::size_t(VIRTUAL_TILE_STRIDE) * VIRTUAL_TILE_STRIDE * 4;
+
+// Tiles are numbered level by level, row by row, starting from level 0
+struct VirtualTextureLayout {
+  unsigned int width = 0;
+  unsigned int height = 0;
+  unsigned int levelCount = 0;
+  unsigned int tilesX[MAX_TEXTURE_LEVELS] = {};
+  unsigned int tilesY[MAX_TEXTURE_LEVELS] = {};
+  unsigned int firstTile[MAX_TEXTURE_LEVELS] = {};
+  unsigned int tileCount = 0;
+
+  // The indirection table stacks the levels on top of each other, level 0
+  // at the bottom, one entry per tile
+  unsigned int tableRow[MAX_TEXTURE_LEVELS] = {};
+  unsigned int tableWidth = 0;
+  unsigned int tableHeight = 0;
+
+  unsigned int tileIndex(unsigned int level, unsigned int x,
+                         unsigned int y) const {
+    return firstTile[level] + y * tilesX[level] + x;
+  }
+};
+
+// Levels down to 1x1, like generateMipChain()
+VirtualTextureLayout virtualTextureLayout(unsigned int width,
+                                          unsigned int height);
+
+// Splits every level of the texture into tiles and writes them with a
+// header. Borders past the edges of a level repeat the edge.
+bool saveVirtualTextureFile(const TextureData &texture, uint64_t sourceHash,
+                            const std::string &fileName);
+
+// A memory mapped tile file. Reading a tile that is not in memory yet reads
+// it from disk, which is left to the cache's worker threads.
+class VirtualTextureFile {
+public:
+  // Fails if the file is missing, damaged, of another version or tiled from
+  // another image. A source hash of 0 accepts any image.
+  bool open(const std::string &fileName, uint64_t sourceHash);
+
+  bool isOpen() const { return mFile.isOpen(); }
+  const VirtualTextureLayout &layout() const { return mLayout; }
+  const unsigned char *tile(unsigned int index) const {
+    return mFile.data() + mTileOffset + index * VIRTUAL_TILE_BYTES;
+  }
+
+private:
+  MappedFile mFile;
+  VirtualTextureLayout mLayout;
+  uint64_t mTileOffset = 0;
+};
+
+// The tile file for a PNG file, see cacheFileName()
+std::string virtualTextureFileName(const std::string &cacheDirectory,
+                                   const std::string &pngFileName);
+
+// Opens the tile file for the PNG file. Tiling holds the whole image and its
+// mip chain in memory, so it is left to --tile-texture. Returns false if the
+// tile file is missing or was tiled from another image.
+bool openTiledTexture(const std::string &cacheDirectory,
+                      const std::string &pngFileName,
+                      VirtualTextureFile &file);
+
+// Indirection table entries, as the RGBA8UI texels the shader reads: the
+// cache slot in r and g, the level of the tile in the slot in b, and 1 in a
+// when there is one at all
+inline uint32_t virtualTableEntry(unsigned int slotX, unsigned int slotY,
+                                  unsigned int level) {
+  return slotX | slotY << 8 | level << 16 | 1u << 24;
+}
+
+struct VirtualTextureStats {
+  unsigned int slots = 0;
+  unsigned int residentTiles = 0;
+  unsigned int pendingTiles = 0;
+  // In the last call to requestTiles()
+  unsigned int requestedTiles = 0;
+  unsigned int missingTiles = 0;
+  // Since the cache was created
+  unsigned int loadedTiles = 0;
+  unsigned int evictedTiles = 0;
+};
+
+// A rectangle of the indirection table, in entries
+struct VirtualTableRegion {
+  unsigned int x;
+  unsigned int y;
+  unsigned int width;
+  unsigned int height;
+};
+
+// A tile to copy into the cache texture
+struct VirtualTileUpload {
+  unsigned int slotX;
+  unsigned int slotY;
+  std::vector<unsigned char> texels;
+};
+
+// Decides which tiles are in which of the slotsPerSide^2 slots of the cache,
+// and keeps the indirection table up to date. Tiles are read from the file by
+// worker threads and placed by the thread that owns the cache texture, which
+// evicts the tile that was used least recently when the cache is full. The
+// coarsest levels are loaded first and never evicted, so that every part of
+// the texture always has some tile to fall back on. The table stores slots in
+// 8 bits, so at most 256 slots per side are used.
+class VirtualTextureCache {
+public:
+  VirtualTextureCache(const VirtualTextureFile &file,
+                      unsigned int slotsPerSide, unsigned int threadCount = 2);
+
+  // Starts a new frame in which the given tiles are visible. Starts loading
+  // those that are not in the cache, coarsest first, as long as fewer than
+  // maxPendingTiles are loading and there are slots not used in this frame
+  // to put them in. The rest are requested again next frame.
+  void requestTiles(std::vector<unsigned int> tiles);
+
+  // Places up to maxTiles loaded tiles in the cache and returns them
+  std::vector<VirtualTileUpload> placeLoadedTiles(unsigned int maxTiles);
+
+  // Whole indirection table, tableWidth x tableHeight entries.
+  // takeTableChanges() returns the parts that changed since the last call,
+  // at most one per level, starting with all of it.
+  const std::vector<uint32_t> &table() const { return mTable; }
+  std::vector<VirtualTableRegion> takeTableChanges();
+
+  unsigned int slotsPerSide() const { return mSlotsPerSide; }
+  VirtualTextureStats stats() const;
+
+  unsigned int maxPendingTiles = 32;
+
+private:
+  VirtualTextureCache(VirtualTextureCache const &) = delete;
+  VirtualTextureCache &operator=(VirtualTextureCache const &) = delete;
+
+  struct Slot {
+    int tile = -1;
+    unsigned int lastUsed = 0;
+    bool pinned = false;
+  };
+
+  // Inclusive range of tiles on one level
+  struct TileRange {
+    unsigned int x0, y0, x1, y1;
+    bool empty = true;
+  };
+
+  struct LoadedTile {
+    unsigned int tile;
+    std::vector<unsigned char> texels;
+  };
+
+  enum TileState : unsigned char { Missing, Pending, Resident };
+
+  void load(unsigned int tile);
+  int freeSlot(bool evictVisible);
+  uint32_t tableEntry(unsigned int level, unsigned int x,
+                      unsigned int y) const;
+  void updateTable(unsigned int tile);
+
+  const VirtualTextureFile &mFile;
+  const VirtualTextureLayout &mLayout;
+  unsigned int mSlotsPerSide;
+  unsigned int mFrame = 0;
+
+  std::vector<Slot> mSlots;
+  std::vector<TileState> mTileStates;
+  std::vector<int> mTileSlots;
+  std::vector<bool> mPinnedTiles;
+  std::vector<uint32_t> mTable;
+  // Per level, the entries changed since takeTableChanges()
+  std::vector<TileRange> mTableChanges;
+  VirtualTextureStats mStats;
+
+  std::vector<LoadedTile> mLoaded;
+  std::mutex mMutex;
+  // Last, so that the workers are stopped before the members they use go
+  ThreadPool mPool;
+};
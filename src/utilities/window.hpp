@@ -13,4 +13,40 @@ const std::string windowTitle = "TDT4230 Final Project";
 const GLint windowResizable = GL_FALSE;
 const int windowSamples = 4;
 
-struct CommandLineOptions {};
+// Evenly spaced values from min to max, both included
+struct SweepRange {
+  float min = 0.0f;
+  float max = 0.0f;
+  // 0 keeps the constant at its default instead of sweeping it
+  unsigned int count = 0;
+
+  float value(unsigned int i) const {
+    return count > 1 ? min + (max - min) * i / (count - 1) : min;
+  }
+};
+
+struct CommandLineOptions {
+  // When set, a single frame is rendered on the CPU to this file instead of
+  // opening a window
+  std::string renderFile;
+  unsigned int renderWidth = windowWidth;
+  unsigned int renderHeight = windowHeight;
+
+  // When set, frameCount frames of the sun orbiting the planet are rendered
+  // on the CPU to files named by this prefix and the frame number
+  std::string sequencePrefix;
+  unsigned int frameCount = 120;
+  // Seconds of sunOrbitEarth time between two frames
+  float timestep = 1.0f / 30.0f;
+
+  // When set, every combination of the ranges below is rendered on the CPU to
+  // files starting with this prefix, together with a contact sheet
+  std::string sweepPrefix;
+  SweepRange Kr, Km, ESun, scaleDepth;
+
+  // Threads used for CPU rendering, 0 uses every hardware thread
+  unsigned int threadCount = 0;
+
+  // Moons around the planet when the window opens
+  unsigned int moonCount = 0;
+};